@@ -20,13 +20,20 @@
 
 #include <config.h>
 
+#include <string.h>
+
 #include "viraccessdriverpolkit.h"
 #include "viralloc.h"
+#include "virbuffer.h"
 #include "vircommand.h"
+#include "virdbus.h"
+#include "virhash.h"
 #include "virlog.h"
 #include "virprocess.h"
 #include "virerror.h"
 #include "virstring.h"
+#include "virthread.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_ACCESS
 
@@ -38,17 +45,168 @@ VIR_LOG_INIT("access.accessdriverpolkit");
 
 #define VIR_ACCESS_DRIVER_POLKIT_ACTION_PREFIX "org.libvirt.api"
 
+/* How long a decision of polkitd is reused, in milliseconds. Rule
+ * changes flush the cache right away, this only bounds how long
+ * changes polkitd doesn't announce (such as group membership) take
+ * to be noticed */
+#define VIR_ACCESS_DRIVER_POLKIT_CACHE_TTL (5 * 1000)
+
+/* Upper bound on cached decisions, expired ones are purged first */
+#define VIR_ACCESS_DRIVER_POLKIT_CACHE_MAX 4096
+
+/* Log cache statistics every so many checks */
+#define VIR_ACCESS_DRIVER_POLKIT_STATS_INTERVAL 1000
+
+#define VIR_ACCESS_DRIVER_POLKIT_DBUS_NAME "org.freedesktop.PolicyKit1"
+#define VIR_ACCESS_DRIVER_POLKIT_DBUS_PATH "/org/freedesktop/PolicyKit1/Authority"
+#define VIR_ACCESS_DRIVER_POLKIT_DBUS_IFACE "org.freedesktop.PolicyKit1.Authority"
+#define VIR_ACCESS_DRIVER_POLKIT_DBUS_TIMEOUT (30 * 1000)
+
+#define VIR_ACCESS_DRIVER_POLKIT_DBUS_RULE_CHANGED              \
+    "type='signal'"                                             \
+    ",sender='" VIR_ACCESS_DRIVER_POLKIT_DBUS_NAME "'"          \
+    ",interface='" VIR_ACCESS_DRIVER_POLKIT_DBUS_IFACE "'"      \
+    ",member='Changed'"
+
 typedef struct _virAccessDriverPolkitPrivate virAccessDriverPolkitPrivate;
 typedef virAccessDriverPolkitPrivate *virAccessDriverPolkitPrivatePtr;
 
 struct _virAccessDriverPolkitPrivate {
     bool ignore;
+
+    /* Set when polkitd is asked over DBus, otherwise pkcheck is run */
+    DBusConnection *sysbus;
+
+    virMutex lock;
+    virHashTablePtr cache;      /* decision key -> decision */
+    size_t hits;
+    size_t misses;
+    size_t flushes;             /* times polkitd reported a change */
+};
+
+typedef struct _virAccessDriverPolkitDecision virAccessDriverPolkitDecision;
+typedef virAccessDriverPolkitDecision *virAccessDriverPolkitDecisionPtr;
+
+struct _virAccessDriverPolkitDecision {
+    bool allowed;
+    unsigned long long expires;
 };
 
 
-static void virAccessDriverPolkitCleanup(virAccessManagerPtr manager ATTRIBUTE_UNUSED)
+#ifdef WITH_DBUS
+static DBusHandlerResult
+virAccessDriverPolkitDBusFilter(DBusConnection *connection ATTRIBUTE_UNUSED,
+                                DBusMessage *message,
+                                void *opaque)
+{
+    virAccessDriverPolkitPrivatePtr priv = opaque;
+
+    if (dbus_message_is_signal(message, VIR_ACCESS_DRIVER_POLKIT_DBUS_IFACE,
+                               "Changed")) {
+        virMutexLock(&priv->lock);
+        VIR_DEBUG("Policy kit configuration changed, dropping %zd "
+                  "cached decisions", virHashSize(priv->cache));
+        virHashRemoveAll(priv->cache);
+        priv->flushes++;
+        virMutexUnlock(&priv->lock);
+    }
+
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+
+static void
+virAccessDriverPolkitDBusSetup(virAccessDriverPolkitPrivatePtr priv)
+{
+    DBusConnection *sysbus;
+
+    if (!virDBusHasSystemBus() ||
+        !(sysbus = virDBusGetSystemBus())) {
+        VIR_DEBUG("No DBus system bus, using %s", PKCHECK_PATH);
+        virResetLastError();
+        return;
+    }
+
+    dbus_bus_add_match(sysbus, VIR_ACCESS_DRIVER_POLKIT_DBUS_RULE_CHANGED,
+                       NULL);
+    if (!dbus_connection_add_filter(sysbus, virAccessDriverPolkitDBusFilter,
+                                    priv, NULL)) {
+        VIR_WARN("Adding a filter to the DBus connection failed, "
+                 "using %s", PKCHECK_PATH);
+        dbus_bus_remove_match(sysbus,
+                              VIR_ACCESS_DRIVER_POLKIT_DBUS_RULE_CHANGED,
+                              NULL);
+        return;
+    }
+
+    priv->sysbus = sysbus;
+}
+
+
+static void
+virAccessDriverPolkitDBusCleanup(virAccessDriverPolkitPrivatePtr priv)
+{
+    if (!priv->sysbus)
+        return;
+
+    dbus_connection_remove_filter(priv->sysbus,
+                                  virAccessDriverPolkitDBusFilter, priv);
+    dbus_bus_remove_match(priv->sysbus,
+                          VIR_ACCESS_DRIVER_POLKIT_DBUS_RULE_CHANGED,
+                          NULL);
+    priv->sysbus = NULL;
+}
+#else /* ! WITH_DBUS */
+static void
+virAccessDriverPolkitDBusSetup(virAccessDriverPolkitPrivatePtr priv ATTRIBUTE_UNUSED)
+{
+}
+
+
+static void
+virAccessDriverPolkitDBusCleanup(virAccessDriverPolkitPrivatePtr priv ATTRIBUTE_UNUSED)
 {
 }
+#endif /* ! WITH_DBUS */
+
+
+static int virAccessDriverPolkitSetup(virAccessManagerPtr manager)
+{
+    virAccessDriverPolkitPrivatePtr priv = virAccessManagerGetPrivateData(manager);
+
+    if (!(priv->cache = virHashCreate(64, virHashValueFree)))
+        return -1;
+
+    /* The cache is only kept once the lock is usable, which tells
+     * virAccessDriverPolkitCleanup whether there is anything to undo */
+    if (virMutexInit(&priv->lock) < 0) {
+        virReportSystemError(errno, "%s", _("cannot initialize mutex"));
+        virHashFree(priv->cache);
+        priv->cache = NULL;
+        return -1;
+    }
+
+    virAccessDriverPolkitDBusSetup(priv);
+
+    return 0;
+}
+
+
+static void virAccessDriverPolkitCleanup(virAccessManagerPtr manager)
+{
+    virAccessDriverPolkitPrivatePtr priv = virAccessManagerGetPrivateData(manager);
+
+    if (!priv->cache)
+        return;
+
+    virAccessDriverPolkitDBusCleanup(priv);
+
+    VIR_INFO("Policy kit decision cache: %zu hits, %zu misses, %zu flushes",
+             priv->hits, priv->misses, priv->flushes);
+
+    virHashFree(priv->cache);
+    virMutexDestroy(&priv->lock);
+}
 
 
 static char *
@@ -71,6 +229,7 @@ virAccessDriverPolkitFormatAction(const char *typename,
 }
 
 
+/* Returns "pid,start-time,uid" of the caller */
 static char *
 virAccessDriverPolkitFormatProcess(const char *actionid)
 {
@@ -79,9 +238,6 @@ virAccessDriverPolkitFormatProcess(const char *actionid)
     const char *callerTime = NULL;
     const char *callerUid = NULL;
     char *ret = NULL;
-#ifndef PKCHECK_SUPPORTS_UID
-    static bool polkitInsecureWarned;
-#endif
 
     if (!identity) {
         virAccessError(VIR_ERR_ACCESS_DENIED,
@@ -112,18 +268,8 @@ virAccessDriverPolkitFormatProcess(const char *actionid)
         goto cleanup;
     }
 
-#ifdef PKCHECK_SUPPORTS_UID
     if (virAsprintf(&ret, "%s,%s,%s", callerPid, callerTime, callerUid) < 0)
         goto cleanup;
-#else
-    if (!polkitInsecureWarned) {
-        VIR_WARN("No support for caller UID with pkcheck. "
-                 "This deployment is known to be insecure.");
-        polkitInsecureWarned = true;
-    }
-    if (virAsprintf(&ret, "%s,%s", callerPid, callerTime) < 0)
-        goto cleanup;
-#endif
 
  cleanup:
     virObjectUnref(identity);
@@ -131,29 +277,304 @@ virAccessDriverPolkitFormatProcess(const char *actionid)
 }
 
 
+/* The key has to tell apart any two checks polkitd could answer
+ * differently, hence every string is prefixed with its length */
+static char *
+virAccessDriverPolkitFormatKey(const char *actionid,
+                               const char *process,
+                               const char **attrs)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+
+    virBufferAsprintf(&buf, "%zu:%s%zu:%s",
+                      strlen(actionid), actionid, strlen(process), process);
+    while (attrs && attrs[0] && attrs[1]) {
+        virBufferAsprintf(&buf, "%zu:%s%zu:%s",
+                          strlen(attrs[0]), attrs[0],
+                          strlen(attrs[1]), attrs[1]);
+        attrs += 2;
+    }
+
+    if (virBufferCheckError(&buf) < 0)
+        return NULL;
+
+    return virBufferContentAndReset(&buf);
+}
+
+
 static int
-virAccessDriverPolkitCheck(virAccessManagerPtr manager ATTRIBUTE_UNUSED,
-                           const char *typename,
-                           const char *permname,
-                           const char **attrs)
+virAccessDriverPolkitCacheExpired(const void *payload,
+                                  const void *name ATTRIBUTE_UNUSED,
+                                  const void *opaque)
 {
-    char *actionid = NULL;
-    char *process = NULL;
-    virCommandPtr cmd = NULL;
-    int status;
+    const virAccessDriverPolkitDecision *decision = payload;
+    const unsigned long long *now = opaque;
+
+    return decision->expires <= *now;
+}
+
+
+/* Returns 1 if allowed, 0 if denied, -1 if there is no usable decision.
+ * @flushes is set to the flush count to pass to
+ * virAccessDriverPolkitCacheStore once a decision is made. */
+static int
+virAccessDriverPolkitCacheLookup(virAccessDriverPolkitPrivatePtr priv,
+                                 const char *key,
+                                 size_t *flushes)
+{
+    virAccessDriverPolkitDecisionPtr decision;
+    unsigned long long now;
     int ret = -1;
 
-    if (!(actionid = virAccessDriverPolkitFormatAction(typename, permname)))
+    virMutexLock(&priv->lock);
+
+    *flushes = priv->flushes;
+
+    if (virTimeMillisNowRaw(&now) < 0) {
+        virMutexUnlock(&priv->lock);
+        return -1;
+    }
+
+    if ((decision = virHashLookup(priv->cache, key)) &&
+        decision->expires > now) {
+        ret = decision->allowed ? 1 : 0;
+        priv->hits++;
+    } else {
+        priv->misses++;
+    }
+
+    if ((priv->hits + priv->misses) %
+        VIR_ACCESS_DRIVER_POLKIT_STATS_INTERVAL == 0)
+        VIR_DEBUG("Policy kit decision cache: %zu hits, %zu misses, "
+                  "%zu flushes, %zd entries", priv->hits, priv->misses,
+                  priv->flushes, virHashSize(priv->cache));
+
+    virMutexUnlock(&priv->lock);
+    return ret;
+}
+
+
+/* The decision is dropped if polkitd reported a change since @flushes
+ * was obtained, as it may have been made under the old rules */
+static void
+virAccessDriverPolkitCacheStore(virAccessDriverPolkitPrivatePtr priv,
+                                const char *key,
+                                size_t flushes,
+                                bool allowed)
+{
+    virAccessDriverPolkitDecisionPtr decision;
+    unsigned long long now;
+
+    if (virTimeMillisNowRaw(&now) < 0 ||
+        VIR_ALLOC(decision) < 0) {
+        virResetLastError();
+        return;
+    }
+
+    decision->allowed = allowed;
+    decision->expires = now + VIR_ACCESS_DRIVER_POLKIT_CACHE_TTL;
+
+    virMutexLock(&priv->lock);
+
+    if (priv->flushes != flushes) {
+        VIR_FREE(decision);
         goto cleanup;
+    }
 
-    if (!(process = virAccessDriverPolkitFormatProcess(actionid)))
+    if (virHashSize(priv->cache) >= VIR_ACCESS_DRIVER_POLKIT_CACHE_MAX) {
+        virHashRemoveSet(priv->cache, virAccessDriverPolkitCacheExpired, &now);
+        if (virHashSize(priv->cache) >= VIR_ACCESS_DRIVER_POLKIT_CACHE_MAX)
+            virHashRemoveAll(priv->cache);
+    }
+
+    if (virHashUpdateEntry(priv->cache, key, decision) < 0) {
+        VIR_FREE(decision);
+        virResetLastError();
+    }
+
+ cleanup:
+    virMutexUnlock(&priv->lock);
+}
+
+
+#ifdef WITH_DBUS
+/* Append the a{ss} details argument of CheckAuthorization, which
+ * virDBusMessageEncode can't build from a list of unknown length */
+static int
+virAccessDriverPolkitAppendDetails(DBusMessage *call,
+                                   const char **attrs)
+{
+    DBusMessageIter iter;
+    DBusMessageIter details;
+    DBusMessageIter entry;
+
+    dbus_message_iter_init_append(call, &iter);
+    if (!dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{ss}",
+                                          &details))
+        goto error;
+
+    while (attrs && attrs[0] && attrs[1]) {
+        if (!dbus_message_iter_open_container(&details, DBUS_TYPE_DICT_ENTRY,
+                                              NULL, &entry) ||
+            !dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING,
+                                            &attrs[0]) ||
+            !dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING,
+                                            &attrs[1]) ||
+            !dbus_message_iter_close_container(&details, &entry))
+            goto error;
+        attrs += 2;
+    }
+
+    if (!dbus_message_iter_close_container(&iter, &details))
+        goto error;
+
+    return 0;
+
+ error:
+    virReportOOMError();
+    return -1;
+}
+
+
+/**
+ * virAccessDriverPolkitCheckDBus:
+ *
+ * Ask polkitd directly rather than forking pkcheck for every check.
+ *
+ * Returns 1 if allowed, 0 if denied, -1 on error. @final is set to
+ * false if the caller could still obtain the authorization, in which
+ * case the decision must not be cached.
+ */
+static int
+virAccessDriverPolkitCheckDBus(DBusConnection *sysbus,
+                               const char *actionid,
+                               const char *process,
+                               const char **attrs,
+                               bool *final)
+{
+    DBusMessage *call = NULL;
+    DBusMessage *reply = NULL;
+    DBusMessageIter iter;
+    DBusMessageIter result;
+    DBusError error;
+    unsigned int pid;
+    unsigned long long startTime;
+    int uid;
+    char *tmp;
+    dbus_bool_t authorized;
+    dbus_bool_t challenge;
+    dbus_uint32_t flags = 0;
+    const char *cancellation = "";
+    int ret = -1;
+
+    dbus_error_init(&error);
+
+    if (virStrToLong_ui(process, &tmp, 10, &pid) < 0 || *tmp != ',' ||
+        virStrToLong_ull(tmp + 1, &tmp, 10, &startTime) < 0 || *tmp != ',' ||
+        virStrToLong_i(tmp + 1, NULL, 10, &uid) < 0) {
+        virAccessError(VIR_ERR_INTERNAL_ERROR,
+                       _("Malformed caller process '%s'"), process);
         goto cleanup;
+    }
 
-    VIR_DEBUG("Check action '%s' for process '%s'", actionid, process);
+    if (virDBusCreateMethod(&call,
+                            VIR_ACCESS_DRIVER_POLKIT_DBUS_NAME,
+                            VIR_ACCESS_DRIVER_POLKIT_DBUS_PATH,
+                            VIR_ACCESS_DRIVER_POLKIT_DBUS_IFACE,
+                            "CheckAuthorization",
+                            "(sa{sv})s",
+                            "unix-process",
+                            3,
+                            "pid", "u", pid,
+                            "start-time", "t", startTime,
+                            "uid", "i", uid,
+                            actionid) < 0)
+        goto cleanup;
+
+    if (virAccessDriverPolkitAppendDetails(call, attrs) < 0)
+        goto cleanup;
+
+    /* No user interaction, no cancellation id, like pkcheck does */
+    if (!dbus_message_append_args(call,
+                                  DBUS_TYPE_UINT32, &flags,
+                                  DBUS_TYPE_STRING, &cancellation,
+                                  DBUS_TYPE_INVALID)) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if (!(reply = dbus_connection_send_with_reply_and_block(sysbus, call,
+                                                            VIR_ACCESS_DRIVER_POLKIT_DBUS_TIMEOUT,
+                                                            &error))) {
+        virAccessError(VIR_ERR_ACCESS_DENIED,
+                       _("Policy kit denied action %s from %s: %s"),
+                       actionid, process,
+                       error.message ? error.message : _("unknown error"));
+        goto cleanup;
+    }
+
+    /* The reply is a (bba{ss}) struct of which the two flags
+     * 'is_authorized' and 'is_challenge' are of interest */
+    if (!dbus_message_iter_init(reply, &iter) ||
+        dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_STRUCT)
+        goto malformed;
+    dbus_message_iter_recurse(&iter, &result);
+    if (dbus_message_iter_get_arg_type(&result) != DBUS_TYPE_BOOLEAN)
+        goto malformed;
+    dbus_message_iter_get_basic(&result, &authorized);
+    if (!dbus_message_iter_next(&result) ||
+        dbus_message_iter_get_arg_type(&result) != DBUS_TYPE_BOOLEAN)
+        goto malformed;
+    dbus_message_iter_get_basic(&result, &challenge);
+
+    *final = !challenge;
+    ret = authorized ? 1 : 0;
+
+ cleanup:
+    dbus_error_free(&error);
+    if (call)
+        dbus_message_unref(call);
+    if (reply)
+        dbus_message_unref(reply);
+    return ret;
+
+ malformed:
+    virAccessError(VIR_ERR_INTERNAL_ERROR, "%s",
+                   _("Malformed reply from policy kit"));
+    goto cleanup;
+}
+#endif /* WITH_DBUS */
+
+
+static int
+virAccessDriverPolkitCheckCommand(const char *actionid,
+                                  const char *process,
+                                  const char **attrs,
+                                  bool *final)
+{
+    virCommandPtr cmd = NULL;
+    char *subject = NULL;
+    int status;
+    int ret = -1;
+#ifndef PKCHECK_SUPPORTS_UID
+    static bool polkitInsecureWarned;
+#endif
+
+    if (VIR_STRDUP(subject, process) < 0)
+        return -1;
+
+#ifndef PKCHECK_SUPPORTS_UID
+    if (!polkitInsecureWarned) {
+        VIR_WARN("No support for caller UID with pkcheck. "
+                 "This deployment is known to be insecure.");
+        polkitInsecureWarned = true;
+    }
+    *strrchr(subject, ',') = '\0';
+#endif
 
     cmd = virCommandNewArgList(PKCHECK_PATH,
                                "--action-id", actionid,
-                               "--process", process,
+                               "--process", subject,
                                NULL);
 
     while (attrs && attrs[0] && attrs[1]) {
@@ -171,20 +592,72 @@ virAccessDriverPolkitCheck(virAccessManagerPtr manager ATTRIBUTE_UNUSED,
             status == 2 ||
             status == 3) {
             ret = 0; /* Denied */
+            /* 2 means an authentication agent could grant it */
+            *final = status != 2;
         } else {
             ret = -1; /* Error */
             virAccessError(VIR_ERR_ACCESS_DENIED,
                            _("Policy kit denied action %s from %s: "
                              "exit status %d"),
-                           actionid, process, status);
+                           actionid, subject, status);
         }
         goto cleanup;
     }
 
  cleanup:
     virCommandFree(cmd);
+    VIR_FREE(subject);
+    return ret;
+}
+
+
+static int
+virAccessDriverPolkitCheck(virAccessManagerPtr manager,
+                           const char *typename,
+                           const char *permname,
+                           const char **attrs)
+{
+    virAccessDriverPolkitPrivatePtr priv = virAccessManagerGetPrivateData(manager);
+    char *actionid = NULL;
+    char *process = NULL;
+    char *key = NULL;
+    size_t flushes;
+    bool final = true;
+    int ret = -1;
+
+    if (!(actionid = virAccessDriverPolkitFormatAction(typename, permname)))
+        goto cleanup;
+
+    if (!(process = virAccessDriverPolkitFormatProcess(actionid)))
+        goto cleanup;
+
+    if (!(key = virAccessDriverPolkitFormatKey(actionid, process, attrs)))
+        goto cleanup;
+
+    if ((ret = virAccessDriverPolkitCacheLookup(priv, key, &flushes)) >= 0) {
+        VIR_DEBUG("Cached decision %d for action '%s' for process '%s'",
+                  ret, actionid, process);
+        goto cleanup;
+    }
+
+    VIR_DEBUG("Check action '%s' for process '%s'", actionid, process);
+
+#ifdef WITH_DBUS
+    if (priv->sysbus)
+        ret = virAccessDriverPolkitCheckDBus(priv->sysbus, actionid,
+                                             process, attrs, &final);
+    else
+#endif
+        ret = virAccessDriverPolkitCheckCommand(actionid, process,
+                                                attrs, &final);
+
+    if (ret >= 0 && final)
+        virAccessDriverPolkitCacheStore(priv, key, flushes, ret == 1);
+
+ cleanup:
     VIR_FREE(actionid);
     VIR_FREE(process);
+    VIR_FREE(key);
     return ret;
 }
 
@@ -418,6 +891,7 @@ virAccessDriverPolkitCheckStorageVol(virAccessManagerPtr manager,
 virAccessDriver accessDriverPolkit = {
     .privateDataLen = sizeof(virAccessDriverPolkitPrivate),
     .name = "polkit",
+    .setup = virAccessDriverPolkitSetup,
     .cleanup = virAccessDriverPolkitCleanup,
     .checkConnect = virAccessDriverPolkitCheckConnect,
     .checkDomain = virAccessDriverPolkitCheckDomain,
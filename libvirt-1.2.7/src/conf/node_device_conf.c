@@ -84,38 +84,38 @@ int virNodeDeviceHasCap(const virNodeDeviceObj *dev, const char *cap)
 }
 
 
+/*
+ * The indexes are keyed on the name and sysfs path of each device's
+ * current def. They are only modified with the list's owner holding
+ * the lock that also serializes lookups, so the looked up object
+ * cannot go away before it is locked.
+ */
 virNodeDeviceObjPtr
 virNodeDeviceFindBySysfsPath(virNodeDeviceObjListPtr devs,
                              const char *sysfs_path)
 {
-    size_t i;
+    virNodeDeviceObjPtr dev;
 
-    for (i = 0; i < devs->count; i++) {
-        virNodeDeviceObjLock(devs->objs[i]);
-        if ((devs->objs[i]->def->sysfs_path != NULL) &&
-            (STREQ(devs->objs[i]->def->sysfs_path, sysfs_path))) {
-            return devs->objs[i];
-        }
-        virNodeDeviceObjUnlock(devs->objs[i]);
-    }
+    if (!devs->bySysfsPath ||
+        !(dev = virHashLookup(devs->bySysfsPath, sysfs_path)))
+        return NULL;
 
-    return NULL;
+    virNodeDeviceObjLock(dev);
+    return dev;
 }
 
 
 virNodeDeviceObjPtr virNodeDeviceFindByName(virNodeDeviceObjListPtr devs,
                                             const char *name)
 {
-    size_t i;
+    virNodeDeviceObjPtr dev;
 
-    for (i = 0; i < devs->count; i++) {
-        virNodeDeviceObjLock(devs->objs[i]);
-        if (STREQ(devs->objs[i]->def->name, name))
-            return devs->objs[i];
-        virNodeDeviceObjUnlock(devs->objs[i]);
-    }
+    if (!devs->byName ||
+        !(dev = virHashLookup(devs->byName, name)))
+        return NULL;
 
-    return NULL;
+    virNodeDeviceObjLock(dev);
+    return dev;
 }
 
 
@@ -163,6 +163,38 @@ void virNodeDeviceObjListFree(virNodeDeviceObjListPtr devs)
         virNodeDeviceObjFree(devs->objs[i]);
     VIR_FREE(devs->objs);
     devs->count = 0;
+    virHashFree(devs->byName);
+    devs->byName = NULL;
+    virHashFree(devs->bySysfsPath);
+    devs->bySysfsPath = NULL;
+}
+
+static void
+virNodeDeviceObjListUnindex(virNodeDeviceObjListPtr devs,
+                            virNodeDeviceObjPtr device)
+{
+    if (device->def->sysfs_path &&
+        virHashLookup(devs->bySysfsPath, device->def->sysfs_path) == device)
+        ignore_value(virHashRemoveEntry(devs->bySysfsPath,
+                                        device->def->sysfs_path));
+    ignore_value(virHashRemoveEntry(devs->byName, device->def->name));
+}
+
+static int
+virNodeDeviceObjListIndex(virNodeDeviceObjListPtr devs,
+                          virNodeDeviceObjPtr device)
+{
+    if (virHashAddEntry(devs->byName, device->def->name, device) < 0)
+        return -1;
+
+    if (device->def->sysfs_path &&
+        virHashUpdateEntry(devs->bySysfsPath,
+                           device->def->sysfs_path, device) < 0) {
+        ignore_value(virHashRemoveEntry(devs->byName, device->def->name));
+        return -1;
+    }
+
+    return 0;
 }
 
 virNodeDeviceObjPtr virNodeDeviceAssignDef(virNodeDeviceObjListPtr devs,
@@ -170,9 +202,25 @@ virNodeDeviceObjPtr virNodeDeviceAssignDef(virNodeDeviceObjListPtr devs,
 {
     virNodeDeviceObjPtr device;
 
+    if (!devs->byName &&
+        !(devs->byName = virHashCreate(256, NULL)))
+        return NULL;
+    if (!devs->bySysfsPath &&
+        !(devs->bySysfsPath = virHashCreate(256, NULL)))
+        return NULL;
+
     if ((device = virNodeDeviceFindByName(devs, def->name))) {
-        virNodeDeviceDefFree(device->def);
+        virNodeDeviceDefPtr olddef = device->def;
+
+        virNodeDeviceObjListUnindex(devs, device);
         device->def = def;
+        if (virNodeDeviceObjListIndex(devs, device) < 0) {
+            device->def = olddef;
+            ignore_value(virNodeDeviceObjListIndex(devs, device));
+            virNodeDeviceObjUnlock(device);
+            return NULL;
+        }
+        virNodeDeviceDefFree(olddef);
         return device;
     }
 
@@ -186,13 +234,22 @@ virNodeDeviceObjPtr virNodeDeviceAssignDef(virNodeDeviceObjListPtr devs,
         return NULL;
     }
     virNodeDeviceObjLock(device);
+    device->def = def;
+
+    if (virNodeDeviceObjListIndex(devs, device) < 0) {
+        device->def = NULL;
+        virNodeDeviceObjUnlock(device);
+        virNodeDeviceObjFree(device);
+        return NULL;
+    }
 
     if (VIR_APPEND_ELEMENT_COPY(devs->objs, devs->count, device) < 0){
+        virNodeDeviceObjListUnindex(devs, device);
+        device->def = NULL;
         virNodeDeviceObjUnlock(device);
         virNodeDeviceObjFree(device);
         return NULL;
     }
-    device->def = def;
 
     return device;
 
@@ -203,18 +260,16 @@ void virNodeDeviceObjRemove(virNodeDeviceObjListPtr devs,
 {
     size_t i;
 
+    virNodeDeviceObjListUnindex(devs, dev);
     virNodeDeviceObjUnlock(dev);
 
     for (i = 0; i < devs->count; i++) {
-        virNodeDeviceObjLock(dev);
         if (devs->objs[i] == dev) {
-            virNodeDeviceObjUnlock(dev);
             virNodeDeviceObjFree(devs->objs[i]);
 
             VIR_DELETE_ELEMENT(devs->objs, i, devs->count);
             break;
         }
-        virNodeDeviceObjUnlock(dev);
     }
 }
 
@@ -28,6 +28,7 @@
 # include "internal.h"
 # include "virutil.h"
 # include "virthread.h"
+# include "virhash.h"
 # include "virpci.h"
 # include "device_conf.h"
 
@@ -212,6 +213,10 @@ typedef virNodeDeviceObjList *virNodeDeviceObjListPtr;
 struct _virNodeDeviceObjList {
     size_t count;
     virNodeDeviceObjPtr *objs;
+
+    /* Indexes into @objs, created with the first device */
+    virHashTablePtr byName;
+    virHashTablePtr bySysfsPath;
 };
 
 typedef struct _virNodeDeviceDriverState virNodeDeviceDriverState;
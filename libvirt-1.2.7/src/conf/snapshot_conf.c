@@ -1005,11 +1005,13 @@ virDomainSnapshotForEachDescendant(virDomainSnapshotObjPtr snapshot,
  * inspects the pre-existing snapshot->def->parent field, and adjusts
  * the snapshot->parent field as well as the parent's child fields to
  * wire up the hierarchical relations for the given snapshot.  The error
- * indicator gets set if a parent is missing or a requested parent would
- * cause a circular parent chain.  */
+ * indicator gets set if a parent is missing.  Circular parent chains
+ * are only detected and broken once all relations are in place, see
+ * virDomainSnapshotBreakCycles.  */
 struct snapshot_set_relation {
     virDomainSnapshotObjListPtr snapshots;
     int err;
+    size_t count;
 };
 static void
 virDomainSnapshotSetRelations(void *payload,
@@ -1018,40 +1020,71 @@ virDomainSnapshotSetRelations(void *payload,
 {
     virDomainSnapshotObjPtr obj = payload;
     struct snapshot_set_relation *curr = data;
-    virDomainSnapshotObjPtr tmp;
+    virDomainSnapshotObjPtr parent;
 
-    obj->parent = virDomainSnapshotFindByName(curr->snapshots,
-                                              obj->def->parent);
-    if (!obj->parent) {
+    curr->count++;
+    parent = virDomainSnapshotFindByName(curr->snapshots, obj->def->parent);
+    if (!parent) {
         curr->err = -1;
-        obj->parent = &curr->snapshots->metaroot;
+        parent = &curr->snapshots->metaroot;
         VIR_WARN("snapshot %s lacks parent", obj->def->name);
-    } else {
-        tmp = obj->parent;
-        while (tmp && tmp->def) {
-            if (tmp == obj) {
-                curr->err = -1;
-                obj->parent = &curr->snapshots->metaroot;
-                VIR_WARN("snapshot %s in circular chain", obj->def->name);
-                break;
-            }
-            tmp = tmp->parent;
-        }
+    } else if (parent == obj) {
+        curr->err = -1;
+        parent = &curr->snapshots->metaroot;
+        VIR_WARN("snapshot %s in circular chain", obj->def->name);
+    }
+    virDomainSnapshotSetParent(obj, parent);
+}
+
+/* Any snapshot which does not reach the metaroot within as many steps
+ * as there are snapshots is part of (or hangs off) a circular chain;
+ * turn it into a root to break the cycle.  */
+static void
+virDomainSnapshotBreakCycles(void *payload,
+                             const void *name ATTRIBUTE_UNUSED,
+                             void *data)
+{
+    virDomainSnapshotObjPtr obj = payload;
+    struct snapshot_set_relation *curr = data;
+    virDomainSnapshotObjPtr tmp = obj->parent;
+    size_t steps = 0;
+
+    while (tmp->def && steps++ < curr->count)
+        tmp = tmp->parent;
+
+    if (tmp->def) {
+        curr->err = -1;
+        virDomainSnapshotDropParent(obj);
+        virDomainSnapshotSetParent(obj, &curr->snapshots->metaroot);
+        VIR_WARN("snapshot %s in circular chain", obj->def->name);
     }
-    obj->parent->nchildren++;
-    obj->sibling = obj->parent->first_child;
-    obj->parent->first_child = obj;
+}
+
+static void
+virDomainSnapshotCountDescendant(void *payload ATTRIBUTE_UNUSED,
+                                 const void *name ATTRIBUTE_UNUSED,
+                                 void *data ATTRIBUTE_UNUSED)
+{
 }
 
 /* Populate parent link and child count of all snapshots, with all
  * relations starting as 0/NULL.  Return 0 on success, -1 if a parent
- * is missing or if a circular relationship was requested.  */
+ * is missing or if a circular relationship was requested.  This is
+ * linear in the number of snapshots unless there are cycles to
+ * break.  */
 int
 virDomainSnapshotUpdateRelations(virDomainSnapshotObjListPtr snapshots)
 {
-    struct snapshot_set_relation act = { snapshots, 0 };
+    struct snapshot_set_relation act = { snapshots, 0, 0 };
 
     virHashForEach(snapshots->objs, virDomainSnapshotSetRelations, &act);
+
+    /* With no cycles, every snapshot descends from the metaroot */
+    if (virDomainSnapshotForEachDescendant(&snapshots->metaroot,
+                                           virDomainSnapshotCountDescendant,
+                                           NULL) != act.count)
+        virHashForEach(snapshots->objs, virDomainSnapshotBreakCycles, &act);
+
     return act.err;
 }
 
@@ -1062,25 +1095,63 @@ virDomainSnapshotUpdateRelations(virDomainSnapshotObjListPtr snapshots)
 void
 virDomainSnapshotDropParent(virDomainSnapshotObjPtr snapshot)
 {
-    virDomainSnapshotObjPtr prev = NULL;
-    virDomainSnapshotObjPtr curr = NULL;
+    if (!snapshot->parent) {
+        VIR_WARN("inconsistent snapshot relations");
+        return;
+    }
 
     snapshot->parent->nchildren--;
-    curr = snapshot->parent->first_child;
-    while (curr != snapshot) {
-        if (!curr) {
-            VIR_WARN("inconsistent snapshot relations");
-            return;
-        }
-        prev = curr;
-        curr = curr->sibling;
-    }
-    if (prev)
-        prev->sibling = snapshot->sibling;
+    if (snapshot->prev_sibling)
+        snapshot->prev_sibling->sibling = snapshot->sibling;
     else
         snapshot->parent->first_child = snapshot->sibling;
+    if (snapshot->sibling)
+        snapshot->sibling->prev_sibling = snapshot->prev_sibling;
     snapshot->parent = NULL;
     snapshot->sibling = NULL;
+    snapshot->prev_sibling = NULL;
+}
+
+/* Make snapshot, which must not currently have a parent, the first
+ * child of parent.  */
+void
+virDomainSnapshotSetParent(virDomainSnapshotObjPtr snapshot,
+                           virDomainSnapshotObjPtr parent)
+{
+    snapshot->parent = parent;
+    snapshot->prev_sibling = NULL;
+    snapshot->sibling = parent->first_child;
+    if (parent->first_child)
+        parent->first_child->prev_sibling = snapshot;
+    parent->first_child = snapshot;
+    parent->nchildren++;
+}
+
+/* Move all children of from to the front of the children of to.  Only
+ * the parent links of the moved children need to be visited.  */
+void
+virDomainSnapshotMoveChildren(virDomainSnapshotObjPtr from,
+                              virDomainSnapshotObjPtr to)
+{
+    virDomainSnapshotObjPtr child = from->first_child;
+    virDomainSnapshotObjPtr last = NULL;
+
+    if (!child)
+        return;
+
+    for (; child; child = child->sibling) {
+        child->parent = to;
+        last = child;
+    }
+
+    last->sibling = to->first_child;
+    if (to->first_child)
+        to->first_child->prev_sibling = last;
+    to->first_child = from->first_child;
+    to->nchildren += from->nchildren;
+
+    from->first_child = NULL;
+    from->nchildren = 0;
 }
 
 int
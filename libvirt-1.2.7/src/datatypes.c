@@ -27,6 +27,7 @@
 #include "virlog.h"
 #include "viralloc.h"
 #include "viruuid.h"
+#include "virhashcode.h"
 #include "virstring.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
@@ -119,6 +120,9 @@ virGetConnect(void)
     if (virMutexInit(&ret->lock) < 0)
         goto error;
 
+    if (virMutexInit(&ret->handleLock) < 0)
+        goto error;
+
     return ret;
 
  error:
@@ -169,6 +173,113 @@ virConnectDispose(void *obj)
 
     virMutexUnlock(&conn->lock);
     virMutexDestroy(&conn->lock);
+
+    /* Every handle holds a connection reference, so these are empty */
+    virHashFree(conn->domains);
+    virHashFree(conn->networks);
+    virHashFree(conn->storageVols);
+    virMutexDestroy(&conn->handleLock);
+}
+
+
+static uint32_t
+virConnectHandleUUIDCode(const void *name, uint32_t seed)
+{
+    return virHashCodeGen(name, VIR_UUID_BUFLEN, seed);
+}
+
+static bool
+virConnectHandleUUIDEqual(const void *namea, const void *nameb)
+{
+    return memcmp(namea, nameb, VIR_UUID_BUFLEN) == 0;
+}
+
+static void *
+virConnectHandleUUIDCopy(const void *name)
+{
+    unsigned char *ret;
+
+    if (VIR_ALLOC_N(ret, VIR_UUID_BUFLEN) < 0)
+        return NULL;
+    memcpy(ret, name, VIR_UUID_BUFLEN);
+    return ret;
+}
+
+static void
+virConnectHandleUUIDFree(void *name)
+{
+    VIR_FREE(name);
+}
+
+
+/*
+ * Return a new reference to the handle cached under @key, or NULL
+ * if there is none or it is being disposed of.
+ */
+static void *
+virConnectHandleLookup(virConnectPtr conn,
+                       virHashTablePtr *cache,
+                       const void *key)
+{
+    void *obj = NULL;
+
+    virMutexLock(&conn->handleLock);
+    if (*cache)
+        obj = virObjectRefIfAlive(virHashLookup(*cache, key));
+    virMutexUnlock(&conn->handleLock);
+
+    return obj;
+}
+
+
+/*
+ * Cache @obj under @key, replacing any handle there already. The
+ * cache holds no reference; the dispose callback must call
+ * virConnectHandleRemove.
+ */
+static int
+virConnectHandleAdd(virConnectPtr conn,
+                    virHashTablePtr *cache,
+                    bool uuidKey,
+                    const void *key,
+                    void *obj)
+{
+    int ret = -1;
+
+    virMutexLock(&conn->handleLock);
+
+    if (!*cache) {
+        if (uuidKey)
+            *cache = virHashCreateFull(32, NULL,
+                                       virConnectHandleUUIDCode,
+                                       virConnectHandleUUIDEqual,
+                                       virConnectHandleUUIDCopy,
+                                       virConnectHandleUUIDFree);
+        else
+            *cache = virHashCreate(32, NULL);
+        if (!*cache)
+            goto cleanup;
+    }
+
+    ret = virHashUpdateEntry(*cache, key, obj);
+
+ cleanup:
+    virMutexUnlock(&conn->handleLock);
+    return ret;
+}
+
+
+static void
+virConnectHandleRemove(virConnectPtr conn,
+                       virHashTablePtr *cache,
+                       const void *key,
+                       void *obj)
+{
+    /* A newer handle may have replaced this one already */
+    virMutexLock(&conn->handleLock);
+    if (*cache && virHashLookup(*cache, key) == obj)
+        virHashRemoveEntry(*cache, key);
+    virMutexUnlock(&conn->handleLock);
 }
 
 
@@ -198,8 +309,9 @@ virConnectCloseCallbackDataDispose(void *obj)
  * @name: pointer to the domain name
  * @uuid: pointer to the uuid
  *
- * Allocates a new domain object. When the object is no longer needed,
- * virObjectUnref() must be called in order to not leak data.
+ * Allocates a new domain object, or returns a new reference to the
+ * connection's existing one for @uuid. When the object is no longer
+ * needed, virObjectUnref() must be called in order to not leak data.
  *
  * Returns a pointer to the domain object, or NULL on error.
  */
@@ -215,6 +327,12 @@ virGetDomain(virConnectPtr conn, const char *name, const unsigned char *uuid)
     virCheckNonNullArgGoto(name, error);
     virCheckNonNullArgGoto(uuid, error);
 
+    if ((ret = virConnectHandleLookup(conn, &conn->domains, uuid))) {
+        if (STREQ(ret->name, name))
+            return ret;
+        virObjectUnref(ret);
+    }
+
     if (!(ret = virObjectNew(virDomainClass)))
         goto error;
 
@@ -225,6 +343,9 @@ virGetDomain(virConnectPtr conn, const char *name, const unsigned char *uuid)
     ret->id = -1;
     memcpy(&(ret->uuid[0]), uuid, VIR_UUID_BUFLEN);
 
+    if (virConnectHandleAdd(conn, &conn->domains, true, uuid, ret) < 0)
+        goto error;
+
     return ret;
 
  error:
@@ -251,6 +372,9 @@ virDomainDispose(void *obj)
     virUUIDFormat(domain->uuid, uuidstr);
     VIR_DEBUG("release domain %p %s %s", domain, domain->name, uuidstr);
 
+    if (domain->conn)
+        virConnectHandleRemove(domain->conn, &domain->conn->domains,
+                               domain->uuid, domain);
     VIR_FREE(domain->name);
     virObjectUnref(domain->conn);
 }
@@ -262,8 +386,9 @@ virDomainDispose(void *obj)
  * @name: pointer to the network name
  * @uuid: pointer to the uuid
  *
- * Allocates a new network object. When the object is no longer needed,
- * virObjectUnref() must be called in order to not leak data.
+ * Allocates a new network object, or returns a new reference to the
+ * connection's existing one for @uuid. When the object is no longer
+ * needed, virObjectUnref() must be called in order to not leak data.
  *
  * Returns a pointer to the network object, or NULL on error.
  */
@@ -279,6 +404,12 @@ virGetNetwork(virConnectPtr conn, const char *name, const unsigned char *uuid)
     virCheckNonNullArgGoto(name, error);
     virCheckNonNullArgGoto(uuid, error);
 
+    if ((ret = virConnectHandleLookup(conn, &conn->networks, uuid))) {
+        if (STREQ(ret->name, name))
+            return ret;
+        virObjectUnref(ret);
+    }
+
     if (!(ret = virObjectNew(virNetworkClass)))
         goto error;
 
@@ -288,6 +419,9 @@ virGetNetwork(virConnectPtr conn, const char *name, const unsigned char *uuid)
     ret->conn = virObjectRef(conn);
     memcpy(&(ret->uuid[0]), uuid, VIR_UUID_BUFLEN);
 
+    if (virConnectHandleAdd(conn, &conn->networks, true, uuid, ret) < 0)
+        goto error;
+
     return ret;
 
  error:
@@ -314,6 +448,9 @@ virNetworkDispose(void *obj)
     virUUIDFormat(network->uuid, uuidstr);
     VIR_DEBUG("release network %p %s %s", network, network->name, uuidstr);
 
+    if (network->conn)
+        virConnectHandleRemove(network->conn, &network->conn->networks,
+                               network->uuid, network);
     VIR_FREE(network->name);
     virObjectUnref(network->conn);
 }
@@ -468,7 +605,9 @@ virStoragePoolDispose(void *obj)
  * @privateData: pointer to driver specific private data
  * @freeFunc: private data cleanup function pointer specfic to driver
  *
- * Allocates a new storage volume object. When the object is no longer needed,
+ * Allocates a new storage volume object. Unless driver private data is
+ * given, the connection's existing object for @key may be returned
+ * with a new reference instead. When the object is no longer needed,
  * virObjectUnref() must be called in order to not leak data.
  *
  * Returns a pointer to the storage volume object, or NULL on error.
@@ -478,6 +617,7 @@ virGetStorageVol(virConnectPtr conn, const char *pool, const char *name,
                  const char *key, void *privateData, virFreeCallback freeFunc)
 {
     virStorageVolPtr ret = NULL;
+    bool cache;
 
     if (virDataTypesInitialize() < 0)
         return NULL;
@@ -487,6 +627,16 @@ virGetStorageVol(virConnectPtr conn, const char *pool, const char *name,
     virCheckNonNullArgGoto(name, error);
     virCheckNonNullArgGoto(key, error);
 
+    /* Handles carrying driver data are never shared */
+    cache = !privateData && !freeFunc;
+
+    if (cache &&
+        (ret = virConnectHandleLookup(conn, &conn->storageVols, key))) {
+        if (STREQ(ret->pool, pool) && STREQ(ret->name, name))
+            return ret;
+        virObjectUnref(ret);
+    }
+
     if (!(ret = virObjectNew(virStorageVolClass)))
         goto error;
 
@@ -501,6 +651,10 @@ virGetStorageVol(virConnectPtr conn, const char *pool, const char *name,
     ret->privateData = privateData;
     ret->privateDataFreeFunc = freeFunc;
 
+    if (cache &&
+        virConnectHandleAdd(conn, &conn->storageVols, false, key, ret) < 0)
+        goto error;
+
     return ret;
 
  error:
@@ -525,6 +679,10 @@ virStorageVolDispose(void *obj)
     virStorageVolPtr vol = obj;
     VIR_DEBUG("release vol %p %s", vol, vol->name);
 
+    if (vol->conn && vol->key)
+        virConnectHandleRemove(vol->conn, &vol->conn->storageVols,
+                               vol->key, vol);
+
     if (vol->privateDataFreeFunc) {
         vol->privateDataFreeFunc(vol->privateData);
     }
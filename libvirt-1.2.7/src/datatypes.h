@@ -27,6 +27,7 @@
 # include "driver.h"
 # include "virthread.h"
 # include "virobject.h"
+# include "virhash.h"
 
 extern virClassPtr virConnectClass;
 extern virClassPtr virDomainClass;
@@ -371,6 +372,15 @@ struct _virConnect {
 
     /* Per-connection close callback */
     virConnectCloseCallbackDataPtr closeCallback;
+
+    /* Domain and network handles by UUID, storage volume handles by
+     * key, so that repeated lookups share one object. The tables do
+     * not hold references; handles drop out as they are disposed.
+     * Created on first use and guarded by handleLock. */
+    virMutex handleLock;
+    virHashTablePtr domains;
+    virHashTablePtr networks;
+    virHashTablePtr storageVols;
 };
 
 /**
@@ -581,6 +581,41 @@ virLockDaemonExecRestartHandler(virNetServerPtr srv,
     virNetServerQuit(srv);
 }
 
+static void
+virLockDaemonLogLockSpaceStats(void *payload,
+                               const void *name,
+                               void *opaque ATTRIBUTE_UNUSED)
+{
+    virLockSpacePtr lockspace = payload;
+    virLockSpaceStats stats;
+
+    if (virLockSpaceGetStats(lockspace, &stats) < 0)
+        return;
+
+    VIR_INFO("Lockspace '%s': held=%zu acquired=%llu released=%llu "
+             "wait total=%lluus max=%lluus hold total=%lluus max=%lluus",
+             (const char *)name, stats.nresources,
+             stats.acquired, stats.released,
+             stats.waitTotal, stats.waitMax,
+             stats.holdTotal, stats.holdMax);
+}
+
+static void
+virLockDaemonStatsHandler(virNetServerPtr srv ATTRIBUTE_UNUSED,
+                          siginfo_t *sig ATTRIBUTE_UNUSED,
+                          void *opaque ATTRIBUTE_UNUSED)
+{
+    virMutexLock(&lockDaemon->lock);
+    virHashForEach(lockDaemon->lockspaces,
+                   virLockDaemonLogLockSpaceStats,
+                   NULL);
+    virLockDaemonLogLockSpaceStats(lockDaemon->defaultLockspace, "", NULL);
+    virMutexUnlock(&lockDaemon->lock);
+
+    virObjectLogStats();
+    virLogRecorderDump(STDERR_FILENO);
+}
+
 static int
 virLockDaemonSetupSignals(virNetServerPtr srv)
 {
@@ -592,6 +627,8 @@ virLockDaemonSetupSignals(virNetServerPtr srv)
         return -1;
     if (virNetServerAddSignalHandler(srv, SIGUSR1, virLockDaemonExecRestartHandler, NULL) < 0)
         return -1;
+    if (virNetServerAddSignalHandler(srv, SIGUSR2, virLockDaemonStatsHandler, NULL) < 0)
+        return -1;
     return 0;
 }
 
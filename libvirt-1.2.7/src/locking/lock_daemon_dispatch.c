@@ -96,6 +96,111 @@ virLockSpaceProtocolDispatchAcquireResource(virNetServerPtr server ATTRIBUTE_UNU
 }
 
 
+/*
+ * Acquire a whole set of resources in one round trip. The set is
+ * acquired atomically from the client's point of view: if any
+ * resource cannot be locked, those already taken by this call are
+ * released again before reporting the error.
+ */
+static int
+virLockSpaceProtocolDispatchAcquireResources(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                             virNetServerClientPtr client,
+                                             virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                             virNetMessageErrorPtr rerr,
+                                             virLockSpaceProtocolAcquireResourcesArgs *args)
+{
+    int rv = -1;
+    unsigned int flags = args->flags;
+    virLockDaemonClientPtr priv =
+        virNetServerClientGetPrivateData(client);
+    virLockSpacePtr *lockspaces = NULL;
+    size_t nacquired = 0;
+    size_t i;
+
+    virMutexLock(&priv->lock);
+
+    virCheckFlagsGoto(0, cleanup);
+
+    if (priv->restricted) {
+        virReportError(VIR_ERR_OPERATION_DENIED, "%s",
+                       _("lock manager connection has been restricted"));
+        goto cleanup;
+    }
+
+    if (!priv->ownerPid) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("lock owner details have not been registered"));
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(lockspaces, args->resources.resources_len) < 0)
+        goto cleanup;
+
+    /* Validate the whole request before taking any lock */
+    for (i = 0; i < args->resources.resources_len; i++) {
+        virLockSpaceProtocolResource *res = &args->resources.resources_val[i];
+
+        if (res->flags & ~(VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_SHARED |
+                           VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_AUTOCREATE)) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("unsupported flags (0x%x) for resource %s"),
+                           res->flags, res->name);
+            goto cleanup;
+        }
+
+        if (!(lockspaces[i] = virLockDaemonFindLockSpace(lockDaemon, res->path))) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Lockspace for path %s does not exist"),
+                           res->path);
+            goto cleanup;
+        }
+    }
+
+    for (i = 0; i < args->resources.resources_len; i++) {
+        virLockSpaceProtocolResource *res = &args->resources.resources_val[i];
+        unsigned int newFlags = 0;
+
+        if (res->flags & VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_SHARED)
+            newFlags |= VIR_LOCK_SPACE_ACQUIRE_SHARED;
+        if (res->flags & VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_AUTOCREATE)
+            newFlags |= VIR_LOCK_SPACE_ACQUIRE_AUTOCREATE;
+
+        if (virLockSpaceAcquireResource(lockspaces[i],
+                                        res->name,
+                                        priv->ownerPid,
+                                        newFlags) < 0)
+            goto cleanup;
+        nacquired++;
+    }
+
+    rv = 0;
+
+ cleanup:
+    if (rv < 0) {
+        virErrorPtr orig_err = virSaveLastError();
+
+        while (nacquired-- > 0) {
+            virLockSpaceProtocolResource *res =
+                &args->resources.resources_val[nacquired];
+            if (virLockSpaceReleaseResource(lockspaces[nacquired],
+                                            res->name,
+                                            priv->ownerPid) < 0)
+                VIR_WARN("Unable to release resource %s after failed acquire",
+                         res->name);
+        }
+
+        if (orig_err) {
+            virSetError(orig_err);
+            virFreeError(orig_err);
+        }
+        virNetMessageSaveError(rerr);
+    }
+    VIR_FREE(lockspaces);
+    virMutexUnlock(&priv->lock);
+    return rv;
+}
+
+
 static int
 virLockSpaceProtocolDispatchCreateResource(virNetServerPtr server ATTRIBUTE_UNUSED,
                                            virNetServerClientPtr client,
@@ -347,6 +452,80 @@ virLockSpaceProtocolDispatchReleaseResource(virNetServerPtr server ATTRIBUTE_UNU
 }
 
 
+/*
+ * Release a set of resources in one round trip. Every resource is
+ * attempted even if an earlier one fails, the first error is
+ * reported.
+ */
+static int
+virLockSpaceProtocolDispatchReleaseResources(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                             virNetServerClientPtr client,
+                                             virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                             virNetMessageErrorPtr rerr,
+                                             virLockSpaceProtocolReleaseResourcesArgs *args)
+{
+    int rv = -1;
+    unsigned int flags = args->flags;
+    virLockDaemonClientPtr priv =
+        virNetServerClientGetPrivateData(client);
+    virErrorPtr orig_err = NULL;
+    size_t i;
+
+    virMutexLock(&priv->lock);
+
+    virCheckFlagsGoto(0, cleanup);
+
+    if (priv->restricted) {
+        virReportError(VIR_ERR_OPERATION_DENIED, "%s",
+                       _("lock manager connection has been restricted"));
+        goto cleanup;
+    }
+
+    if (!priv->ownerPid) {
+        virReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                       _("lock owner details have not been registered"));
+        goto cleanup;
+    }
+
+    for (i = 0; i < args->resources.resources_len; i++) {
+        virLockSpaceProtocolResource *res = &args->resources.resources_val[i];
+        virLockSpacePtr lockspace;
+
+        if (res->flags != 0) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("unsupported flags (0x%x) for resource %s"),
+                           res->flags, res->name);
+        } else if (!(lockspace = virLockDaemonFindLockSpace(lockDaemon,
+                                                            res->path))) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Lockspace for path %s does not exist"),
+                           res->path);
+        } else if (virLockSpaceReleaseResource(lockspace,
+                                               res->name,
+                                               priv->ownerPid) == 0) {
+            continue;
+        }
+
+        if (!orig_err)
+            orig_err = virSaveLastError();
+    }
+
+    if (orig_err) {
+        virSetError(orig_err);
+        goto cleanup;
+    }
+
+    rv = 0;
+
+ cleanup:
+    if (rv < 0)
+        virNetMessageSaveError(rerr);
+    virFreeError(orig_err);
+    virMutexUnlock(&priv->lock);
+    return rv;
+}
+
+
 static int
 virLockSpaceProtocolDispatchRestrict(virNetServerPtr server ATTRIBUTE_UNUSED,
                                      virNetServerClientPtr client,
@@ -22,6 +22,27 @@ static int virLockSpaceProtocolDispatchAcquireResourceHelper(
 
 
 
+static int virLockSpaceProtocolDispatchAcquireResources(
+    virNetServerPtr server,
+    virNetServerClientPtr client,
+    virNetMessagePtr msg,
+    virNetMessageErrorPtr rerr,
+    virLockSpaceProtocolAcquireResourcesArgs *args);
+static int virLockSpaceProtocolDispatchAcquireResourcesHelper(
+    virNetServerPtr server,
+    virNetServerClientPtr client,
+    virNetMessagePtr msg,
+    virNetMessageErrorPtr rerr,
+    void *args,
+    void *ret ATTRIBUTE_UNUSED)
+{
+  VIR_DEBUG("server=%p client=%p msg=%p rerr=%p args=%p ret=%p", server, client, msg, rerr, args, ret);
+  return virLockSpaceProtocolDispatchAcquireResources(server, client, msg, rerr, args);
+}
+/* virLockSpaceProtocolDispatchAcquireResources body has to be implemented manually */
+
+
+
 static int virLockSpaceProtocolDispatchCreateLockSpace(
     virNetServerPtr server,
     virNetServerClientPtr client,
@@ -148,6 +169,27 @@ static int virLockSpaceProtocolDispatchReleaseResourceHelper(
 
 
 
+static int virLockSpaceProtocolDispatchReleaseResources(
+    virNetServerPtr server,
+    virNetServerClientPtr client,
+    virNetMessagePtr msg,
+    virNetMessageErrorPtr rerr,
+    virLockSpaceProtocolReleaseResourcesArgs *args);
+static int virLockSpaceProtocolDispatchReleaseResourcesHelper(
+    virNetServerPtr server,
+    virNetServerClientPtr client,
+    virNetMessagePtr msg,
+    virNetMessageErrorPtr rerr,
+    void *args,
+    void *ret ATTRIBUTE_UNUSED)
+{
+  VIR_DEBUG("server=%p client=%p msg=%p rerr=%p args=%p ret=%p", server, client, msg, rerr, args, ret);
+  return virLockSpaceProtocolDispatchReleaseResources(server, client, msg, rerr, args);
+}
+/* virLockSpaceProtocolDispatchReleaseResources body has to be implemented manually */
+
+
+
 static int virLockSpaceProtocolDispatchRestrict(
     virNetServerPtr server,
     virNetServerClientPtr client,
@@ -251,5 +293,23 @@ virNetServerProgramProc virLockSpaceProtocolProcs[] = {
    true,
    0
 },
+{ /* Method AcquireResources => 9 */
+   virLockSpaceProtocolDispatchAcquireResourcesHelper,
+   sizeof(virLockSpaceProtocolAcquireResourcesArgs),
+   (xdrproc_t)xdr_virLockSpaceProtocolAcquireResourcesArgs,
+   0,
+   (xdrproc_t)xdr_void,
+   true,
+   0
+},
+{ /* Method ReleaseResources => 10 */
+   virLockSpaceProtocolDispatchReleaseResourcesHelper,
+   sizeof(virLockSpaceProtocolReleaseResourcesArgs),
+   (xdrproc_t)xdr_virLockSpaceProtocolReleaseResourcesArgs,
+   0,
+   (xdrproc_t)xdr_void,
+   true,
+   0
+},
 };
 size_t virLockSpaceProtocolNProcs = ARRAY_CARDINALITY(virLockSpaceProtocolProcs);
@@ -647,6 +647,156 @@ static int virLockManagerLockDaemonAddResource(virLockManagerPtr lock,
 }
 
 
+static int
+virLockManagerLockDaemonAcquireEach(virLockManagerLockDaemonPrivatePtr priv,
+                                    virNetClientPtr client,
+                                    virNetClientProgramPtr program,
+                                    int *counter)
+{
+    size_t i;
+
+    for (i = 0; i < priv->nresources; i++) {
+        virLockSpaceProtocolAcquireResourceArgs args;
+
+        memset(&args, 0, sizeof(args));
+
+        if (priv->resources[i].lockspace)
+            args.path = priv->resources[i].lockspace;
+        args.name = priv->resources[i].name;
+        args.flags = priv->resources[i].flags;
+
+        if (virNetClientProgramCall(program,
+                                    client,
+                                    (*counter)++,
+                                    VIR_LOCK_SPACE_PROTOCOL_PROC_ACQUIRE_RESOURCE,
+                                    0, NULL, NULL, NULL,
+                                    (xdrproc_t)xdr_virLockSpaceProtocolAcquireResourceArgs, &args,
+                                    (xdrproc_t)xdr_void, NULL) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+virLockManagerLockDaemonReleaseEach(virLockManagerLockDaemonPrivatePtr priv,
+                                    virNetClientPtr client,
+                                    virNetClientProgramPtr program,
+                                    int *counter)
+{
+    size_t i;
+
+    for (i = 0; i < priv->nresources; i++) {
+        virLockSpaceProtocolReleaseResourceArgs args;
+
+        memset(&args, 0, sizeof(args));
+
+        if (priv->resources[i].lockspace)
+            args.path = priv->resources[i].lockspace;
+        args.name = priv->resources[i].name;
+        args.flags = priv->resources[i].flags;
+
+        args.flags &=
+            ~(VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_SHARED |
+              VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_AUTOCREATE);
+
+        if (virNetClientProgramCall(program,
+                                    client,
+                                    (*counter)++,
+                                    VIR_LOCK_SPACE_PROTOCOL_PROC_RELEASE_RESOURCE,
+                                    0, NULL, NULL, NULL,
+                                    (xdrproc_t)xdr_virLockSpaceProtocolReleaseResourceArgs, &args,
+                                    (xdrproc_t)xdr_void, NULL) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Acquire or release all the resources of @priv with a single
+ * RPC call. Returns 0 on success, -1 on error, or 1 if the daemon
+ * does not know the batched procedures (it predates them), in which
+ * case the caller should fall back to one call per resource.
+ */
+static int
+virLockManagerLockDaemonBatchResources(virLockManagerLockDaemonPrivatePtr priv,
+                                       virNetClientPtr client,
+                                       virNetClientProgramPtr program,
+                                       int *counter,
+                                       bool release)
+{
+    virLockSpaceProtocolResource *resources = NULL;
+    virErrorPtr err;
+    size_t i;
+    int rv = -1;
+
+    if (priv->nresources > VIR_LOCK_SPACE_PROTOCOL_RESOURCES_MAX)
+        return 1;
+
+    if (VIR_ALLOC_N(resources, priv->nresources) < 0)
+        return -1;
+
+    for (i = 0; i < priv->nresources; i++) {
+        if (priv->resources[i].lockspace)
+            resources[i].path = priv->resources[i].lockspace;
+        resources[i].name = priv->resources[i].name;
+        resources[i].flags = priv->resources[i].flags;
+
+        if (release)
+            resources[i].flags &=
+                ~(VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_SHARED |
+                  VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_AUTOCREATE);
+    }
+
+    if (release) {
+        virLockSpaceProtocolReleaseResourcesArgs args;
+
+        memset(&args, 0, sizeof(args));
+        args.resources.resources_len = priv->nresources;
+        args.resources.resources_val = resources;
+
+        rv = virNetClientProgramCall(program,
+                                     client,
+                                     (*counter)++,
+                                     VIR_LOCK_SPACE_PROTOCOL_PROC_RELEASE_RESOURCES,
+                                     0, NULL, NULL, NULL,
+                                     (xdrproc_t)xdr_virLockSpaceProtocolReleaseResourcesArgs, &args,
+                                     (xdrproc_t)xdr_void, NULL);
+    } else {
+        virLockSpaceProtocolAcquireResourcesArgs args;
+
+        memset(&args, 0, sizeof(args));
+        args.resources.resources_len = priv->nresources;
+        args.resources.resources_val = resources;
+
+        rv = virNetClientProgramCall(program,
+                                     client,
+                                     (*counter)++,
+                                     VIR_LOCK_SPACE_PROTOCOL_PROC_ACQUIRE_RESOURCES,
+                                     0, NULL, NULL, NULL,
+                                     (xdrproc_t)xdr_virLockSpaceProtocolAcquireResourcesArgs, &args,
+                                     (xdrproc_t)xdr_void, NULL);
+    }
+
+    /* An older virtlockd rejects the unknown procedure without
+     * touching any lock, which the client reports as unsupported */
+    if (rv < 0 &&
+        (err = virGetLastError()) &&
+        err->code == VIR_ERR_NO_SUPPORT) {
+        VIR_DEBUG("Batched resource call failed, falling back: %s",
+                  NULLSTR(err->message));
+        virResetLastError();
+        rv = 1;
+    }
+
+    VIR_FREE(resources);
+    return rv;
+}
+
+
 static int virLockManagerLockDaemonAcquire(virLockManagerPtr lock,
                                            const char *state ATTRIBUTE_UNUSED,
                                            unsigned int flags,
@@ -677,27 +827,18 @@ static int virLockManagerLockDaemonAcquire(virLockManagerPtr lock,
         (*fd = virNetClientDupFD(client, false)) < 0)
         goto cleanup;
 
-    if (!(flags & VIR_LOCK_MANAGER_ACQUIRE_REGISTER_ONLY)) {
-        size_t i;
-        for (i = 0; i < priv->nresources; i++) {
-            virLockSpaceProtocolAcquireResourceArgs args;
-
-            memset(&args, 0, sizeof(args));
-
-            if (priv->resources[i].lockspace)
-                args.path = priv->resources[i].lockspace;
-            args.name = priv->resources[i].name;
-            args.flags = priv->resources[i].flags;
-
-            if (virNetClientProgramCall(program,
-                                        client,
-                                        counter++,
-                                        VIR_LOCK_SPACE_PROTOCOL_PROC_ACQUIRE_RESOURCE,
-                                        0, NULL, NULL, NULL,
-                                        (xdrproc_t)xdr_virLockSpaceProtocolAcquireResourceArgs, &args,
-                                        (xdrproc_t)xdr_void, NULL) < 0)
-                goto cleanup;
-        }
+    if (!(flags & VIR_LOCK_MANAGER_ACQUIRE_REGISTER_ONLY) &&
+        priv->nresources) {
+        int rc;
+
+        if ((rc = virLockManagerLockDaemonBatchResources(priv, client, program,
+                                                         &counter, false)) < 0)
+            goto cleanup;
+
+        if (rc > 0 &&
+            virLockManagerLockDaemonAcquireEach(priv, client, program,
+                                                &counter) < 0)
+            goto cleanup;
     }
 
     if ((flags & VIR_LOCK_MANAGER_ACQUIRE_RESTRICT) &&
@@ -724,7 +865,7 @@ static int virLockManagerLockDaemonRelease(virLockManagerPtr lock,
     virNetClientProgramPtr program = NULL;
     int counter = 0;
     int rv = -1;
-    size_t i;
+    int rc;
     virLockManagerLockDaemonPrivatePtr priv = lock->privateData;
 
     virCheckFlags(0, -1);
@@ -735,27 +876,14 @@ static int virLockManagerLockDaemonRelease(virLockManagerPtr lock,
     if (!(client = virLockManagerLockDaemonConnect(lock, &program, &counter)))
         goto cleanup;
 
-    for (i = 0; i < priv->nresources; i++) {
-        virLockSpaceProtocolReleaseResourceArgs args;
-
-        memset(&args, 0, sizeof(args));
-
-        if (priv->resources[i].lockspace)
-            args.path = priv->resources[i].lockspace;
-        args.name = priv->resources[i].name;
-        args.flags = priv->resources[i].flags;
-
-        args.flags &=
-            ~(VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_SHARED |
-              VIR_LOCK_SPACE_PROTOCOL_ACQUIRE_RESOURCE_AUTOCREATE);
+    if (priv->nresources) {
+        if ((rc = virLockManagerLockDaemonBatchResources(priv, client, program,
+                                                         &counter, true)) < 0)
+            goto cleanup;
 
-        if (virNetClientProgramCall(program,
-                                    client,
-                                    counter++,
-                                    VIR_LOCK_SPACE_PROTOCOL_PROC_RELEASE_RESOURCE,
-                                    0, NULL, NULL, NULL,
-                                    (xdrproc_t)xdr_virLockSpaceProtocolReleaseResourceArgs, &args,
-                                    (xdrproc_t)xdr_void, NULL) < 0)
+        if (rc > 0 &&
+            virLockManagerLockDaemonReleaseEach(priv, client, program,
+                                                &counter) < 0)
             goto cleanup;
     }
 
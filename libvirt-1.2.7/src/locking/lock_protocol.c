@@ -150,6 +150,45 @@ xdr_virLockSpaceProtocolCreateLockSpaceArgs (XDR *xdrs, virLockSpaceProtocolCrea
         return TRUE;
 }
 
+bool_t
+xdr_virLockSpaceProtocolResource (XDR *xdrs, virLockSpaceProtocolResource *objp)
+{
+
+         if (!xdr_virLockSpaceProtocolNonNullString (xdrs, &objp->path))
+                 return FALSE;
+         if (!xdr_virLockSpaceProtocolNonNullString (xdrs, &objp->name))
+                 return FALSE;
+         if (!xdr_u_int (xdrs, &objp->flags))
+                 return FALSE;
+        return TRUE;
+}
+
+bool_t
+xdr_virLockSpaceProtocolAcquireResourcesArgs (XDR *xdrs, virLockSpaceProtocolAcquireResourcesArgs *objp)
+{
+        char **objp_cpp0 = (char **) (void *) &objp->resources.resources_val;
+
+         if (!xdr_array (xdrs, objp_cpp0, (u_int *) &objp->resources.resources_len, VIR_LOCK_SPACE_PROTOCOL_RESOURCES_MAX,
+                sizeof (virLockSpaceProtocolResource), (xdrproc_t) xdr_virLockSpaceProtocolResource))
+                 return FALSE;
+         if (!xdr_u_int (xdrs, &objp->flags))
+                 return FALSE;
+        return TRUE;
+}
+
+bool_t
+xdr_virLockSpaceProtocolReleaseResourcesArgs (XDR *xdrs, virLockSpaceProtocolReleaseResourcesArgs *objp)
+{
+        char **objp_cpp0 = (char **) (void *) &objp->resources.resources_val;
+
+         if (!xdr_array (xdrs, objp_cpp0, (u_int *) &objp->resources.resources_len, VIR_LOCK_SPACE_PROTOCOL_RESOURCES_MAX,
+                sizeof (virLockSpaceProtocolResource), (xdrproc_t) xdr_virLockSpaceProtocolResource))
+                 return FALSE;
+         if (!xdr_u_int (xdrs, &objp->flags))
+                 return FALSE;
+        return TRUE;
+}
+
 bool_t
 xdr_virLockSpaceProtocolProcedure (XDR *xdrs, virLockSpaceProtocolProcedure *objp)
 {
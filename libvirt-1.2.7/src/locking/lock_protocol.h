@@ -85,6 +85,32 @@ struct virLockSpaceProtocolCreateLockSpaceArgs {
         virLockSpaceProtocolNonNullString path;
 };
 typedef struct virLockSpaceProtocolCreateLockSpaceArgs virLockSpaceProtocolCreateLockSpaceArgs;
+#define VIR_LOCK_SPACE_PROTOCOL_RESOURCES_MAX 4096
+
+struct virLockSpaceProtocolResource {
+        virLockSpaceProtocolNonNullString path;
+        virLockSpaceProtocolNonNullString name;
+        u_int flags;
+};
+typedef struct virLockSpaceProtocolResource virLockSpaceProtocolResource;
+
+struct virLockSpaceProtocolAcquireResourcesArgs {
+        struct {
+                u_int resources_len;
+                virLockSpaceProtocolResource *resources_val;
+        } resources;
+        u_int flags;
+};
+typedef struct virLockSpaceProtocolAcquireResourcesArgs virLockSpaceProtocolAcquireResourcesArgs;
+
+struct virLockSpaceProtocolReleaseResourcesArgs {
+        struct {
+                u_int resources_len;
+                virLockSpaceProtocolResource *resources_val;
+        } resources;
+        u_int flags;
+};
+typedef struct virLockSpaceProtocolReleaseResourcesArgs virLockSpaceProtocolReleaseResourcesArgs;
 #define VIR_LOCK_SPACE_PROTOCOL_PROGRAM 0xEA7BEEF
 #define VIR_LOCK_SPACE_PROTOCOL_PROGRAM_VERSION 1
 
@@ -97,6 +123,8 @@ enum virLockSpaceProtocolProcedure {
         VIR_LOCK_SPACE_PROTOCOL_PROC_ACQUIRE_RESOURCE = 6,
         VIR_LOCK_SPACE_PROTOCOL_PROC_RELEASE_RESOURCE = 7,
         VIR_LOCK_SPACE_PROTOCOL_PROC_CREATE_LOCKSPACE = 8,
+        VIR_LOCK_SPACE_PROTOCOL_PROC_ACQUIRE_RESOURCES = 9,
+        VIR_LOCK_SPACE_PROTOCOL_PROC_RELEASE_RESOURCES = 10,
 };
 typedef enum virLockSpaceProtocolProcedure virLockSpaceProtocolProcedure;
 
@@ -116,6 +144,9 @@ extern  bool_t xdr_virLockSpaceProtocolAcquireResourceFlags (XDR *, virLockSpace
 extern  bool_t xdr_virLockSpaceProtocolAcquireResourceArgs (XDR *, virLockSpaceProtocolAcquireResourceArgs*);
 extern  bool_t xdr_virLockSpaceProtocolReleaseResourceArgs (XDR *, virLockSpaceProtocolReleaseResourceArgs*);
 extern  bool_t xdr_virLockSpaceProtocolCreateLockSpaceArgs (XDR *, virLockSpaceProtocolCreateLockSpaceArgs*);
+extern  bool_t xdr_virLockSpaceProtocolResource (XDR *, virLockSpaceProtocolResource*);
+extern  bool_t xdr_virLockSpaceProtocolAcquireResourcesArgs (XDR *, virLockSpaceProtocolAcquireResourcesArgs*);
+extern  bool_t xdr_virLockSpaceProtocolReleaseResourcesArgs (XDR *, virLockSpaceProtocolReleaseResourcesArgs*);
 extern  bool_t xdr_virLockSpaceProtocolProcedure (XDR *, virLockSpaceProtocolProcedure*);
 
 #else /* K&R C */
@@ -132,6 +163,9 @@ extern bool_t xdr_virLockSpaceProtocolAcquireResourceFlags ();
 extern bool_t xdr_virLockSpaceProtocolAcquireResourceArgs ();
 extern bool_t xdr_virLockSpaceProtocolReleaseResourceArgs ();
 extern bool_t xdr_virLockSpaceProtocolCreateLockSpaceArgs ();
+extern bool_t xdr_virLockSpaceProtocolResource ();
+extern bool_t xdr_virLockSpaceProtocolAcquireResourcesArgs ();
+extern bool_t xdr_virLockSpaceProtocolReleaseResourcesArgs ();
 extern bool_t xdr_virLockSpaceProtocolProcedure ();
 
 #endif /* K&R C */
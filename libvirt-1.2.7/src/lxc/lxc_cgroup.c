@@ -261,33 +261,24 @@ static int virLXCCgroupGetMemStat(virCgroupPtr cgroup,
 }
 
 
-int virLXCCgroupGetMeminfo(virLXCMeminfoPtr meminfo)
+int virLXCCgroupGetMeminfo(virCgroupPtr cgroup, virLXCMeminfoPtr meminfo)
 {
-    int ret = -1;
-    virCgroupPtr cgroup;
-
-    if (virCgroupNewSelf(&cgroup) < 0)
-        return -1;
-
     if (virLXCCgroupGetMemStat(cgroup, meminfo) < 0)
-        goto cleanup;
+        return -1;
 
     if (virLXCCgroupGetMemTotal(cgroup, meminfo) < 0)
-        goto cleanup;
+        return -1;
 
     if (virLXCCgroupGetMemUsage(cgroup, meminfo) < 0)
-        goto cleanup;
+        return -1;
 
     if (virLXCCgroupGetMemSwapTotal(cgroup, meminfo) < 0)
-        goto cleanup;
+        return -1;
 
     if (virLXCCgroupGetMemSwapUsage(cgroup, meminfo) < 0)
-        goto cleanup;
+        return -1;
 
-    ret = 0;
- cleanup:
-    virCgroupFree(&cgroup);
-    return ret;
+    return 0;
 }
 
 
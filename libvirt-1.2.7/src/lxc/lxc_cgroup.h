@@ -33,7 +33,7 @@ int virLXCCgroupSetup(virDomainDefPtr def,
                       virCgroupPtr cgroup,
                       virBitmapPtr nodemask);
 
-int virLXCCgroupGetMeminfo(virLXCMeminfoPtr meminfo);
+int virLXCCgroupGetMeminfo(virCgroupPtr cgroup, virLXCMeminfoPtr meminfo);
 
 int
 virLXCSetupHostUSBDeviceCgroup(virUSBDevicePtr dev,
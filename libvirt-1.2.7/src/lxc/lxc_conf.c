@@ -228,6 +228,7 @@ virLXCDriverConfigNew(void)
 
     cfg->securityDefaultConfined = false;
     cfg->securityRequireConfined = false;
+    cfg->autostartWorkers = 4;
 
     /* Set the container configuration directory */
     if (VIR_STRDUP(cfg->configDir, LXC_CONFIG_DIR) < 0)
@@ -288,6 +289,9 @@ virLXCLoadDriverConfig(virLXCDriverConfigPtr cfg,
     CHECK_TYPE("security_require_confined", VIR_CONF_LONG);
     if (p) cfg->securityRequireConfined = p->l;
 
+    p = virConfGetValue(conf, "autostart_workers");
+    CHECK_TYPE("autostart_workers", VIR_CONF_LONG);
+    if (p) cfg->autostartWorkers = p->l > 0 ? p->l : 1;
 
 #undef CHECK_TYPE
 
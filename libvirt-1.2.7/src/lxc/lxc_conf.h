@@ -65,6 +65,8 @@ struct _virLXCDriverConfig {
     char *securityDriverName;
     bool securityDefaultConfined;
     bool securityRequireConfined;
+
+    unsigned int autostartWorkers;
 };
 
 struct _virLXCDriver {
@@ -941,28 +941,42 @@ static int lxcContainerMountBasicFS(bool userns_enabled,
 }
 
 #if WITH_FUSE
+/* The files lxc_fuse.c virtualizes */
+static const char *const lxcContainerProcFuseFiles[] = {
+    "meminfo", "cpuinfo", "stat", "uptime", "diskstats",
+};
+
 static int lxcContainerMountProcFuse(virDomainDefPtr def,
                                      const char *stateDir)
 {
-    int ret;
-    char *meminfo_path = NULL;
+    int ret = 0;
+    size_t i;
+    char *src = NULL;
+    char *dst = NULL;
 
-    VIR_DEBUG("Mount /proc/meminfo stateDir=%s", stateDir);
+    for (i = 0; i < ARRAY_CARDINALITY(lxcContainerProcFuseFiles); i++) {
+        const char *name = lxcContainerProcFuseFiles[i];
 
-    if ((ret = virAsprintf(&meminfo_path,
-                           "/.oldroot/%s/%s.fuse/meminfo",
-                           stateDir,
-                           def->name)) < 0)
-        return ret;
+        VIR_DEBUG("Mount /proc/%s stateDir=%s", name, stateDir);
 
-    if ((ret = mount(meminfo_path, "/proc/meminfo",
-                     NULL, MS_BIND, NULL)) < 0) {
-        virReportSystemError(errno,
-                             _("Failed to mount %s on /proc/meminfo"),
-                             meminfo_path);
+        if ((ret = virAsprintf(&src, "/.oldroot/%s/%s.fuse/%s",
+                               stateDir, def->name, name)) < 0 ||
+            (ret = virAsprintf(&dst, "/proc/%s", name)) < 0)
+            break;
+
+        if ((ret = mount(src, dst, NULL, MS_BIND, NULL)) < 0) {
+            virReportSystemError(errno,
+                                 _("Failed to mount %s on %s"),
+                                 src, dst);
+            break;
+        }
+
+        VIR_FREE(src);
+        VIR_FREE(dst);
     }
 
-    VIR_FREE(meminfo_path);
+    VIR_FREE(src);
+    VIR_FREE(dst);
     return ret;
 }
 #else
@@ -40,6 +40,8 @@
 #include <locale.h>
 #include <grp.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <poll.h>
 #include <time.h>
 
 #if WITH_CAPNG
@@ -52,6 +54,7 @@
 #include "lxc_conf.h"
 #include "lxc_container.h"
 #include "lxc_cgroup.h"
+#include "lxc_domain.h"
 #include "lxc_monitor_protocol.h"
 #include "lxc_fuse.h"
 #include "virnetdev.h"
@@ -72,6 +75,28 @@
 
 VIR_LOG_INIT("lxc.lxc_controller");
 
+/* Data buffered in each direction of a console before reads stop */
+#define VIR_LXC_CONTROLLER_CONSOLE_BUF_SIZE (64 * 1024)
+
+/*
+ * One direction of a console relay. Data is moved with splice()
+ * through @pipe while both ends support it, and copied through the
+ * @data ring otherwise; @len counts the bytes held in either.
+ * Splicing from a tty may use a whole pipe page per read, so the
+ * pipe can fill up long before @len reaches @size; @full records
+ * that until some data has been drained.
+ */
+typedef struct _virLXCControllerConsoleBuf virLXCControllerConsoleBuf;
+typedef virLXCControllerConsoleBuf *virLXCControllerConsoleBufPtr;
+struct _virLXCControllerConsoleBuf {
+    int pipe[2];
+    char *data;
+    size_t head;
+    size_t len;
+    size_t size;
+    bool full;
+};
+
 typedef struct _virLXCControllerConsole virLXCControllerConsole;
 typedef virLXCControllerConsole *virLXCControllerConsolePtr;
 struct _virLXCControllerConsole {
@@ -88,10 +113,10 @@ struct _virLXCControllerConsole {
     int epollWatch;
     int epollFd; /* epoll FD for dealing with EOF */
 
-    size_t fromHostLen;
-    char fromHostBuf[1024];
-    size_t fromContLen;
-    char fromContBuf[1024];
+    bool relay;  /* lock and buffers are set up */
+    virMutex lock;
+    virLXCControllerConsoleBuf fromHost;
+    virLXCControllerConsoleBuf fromCont;
 
     virNetServerPtr server;
 };
@@ -132,6 +157,14 @@ struct _virLXCController {
     virCgroupPtr cgroup;
 
     virLXCFusePtr fuse;
+
+    /* FUSE is mounted in the background while devices are set up */
+    virThread fuseSetupThread;
+    bool fuseSetupActive;
+    int fuseSetupRet;
+    virErrorPtr fuseSetupErr;
+
+    virLXCStartTimer timer;
 };
 
 #include "lxc_controller_dispatch.h"
@@ -165,6 +198,8 @@ static virLXCControllerPtr virLXCControllerNew(const char *name)
     if (VIR_STRDUP(ctrl->name, name) < 0)
         goto error;
 
+    virLXCStartTimerInit(&ctrl->timer, ctrl->name);
+
     if (!(caps = virLXCDriverCapsInit(NULL)))
         goto error;
 
@@ -221,6 +256,16 @@ static void virLXCControllerStopInit(virLXCControllerPtr ctrl)
 }
 
 
+static void virLXCControllerConsoleBufFree(virLXCControllerConsoleBufPtr buf)
+{
+    VIR_FORCE_CLOSE(buf->pipe[0]);
+    VIR_FORCE_CLOSE(buf->pipe[1]);
+    VIR_FREE(buf->data);
+    buf->head = buf->len = 0;
+    buf->full = false;
+}
+
+
 static void virLXCControllerConsoleClose(virLXCControllerConsolePtr console)
 {
     if (console->hostWatch != -1)
@@ -234,6 +279,13 @@ static void virLXCControllerConsoleClose(virLXCControllerConsolePtr console)
     if (console->epollWatch != -1)
         virEventRemoveHandle(console->epollWatch);
     VIR_FORCE_CLOSE(console->epollFd);
+
+    if (console->relay) {
+        virLXCControllerConsoleBufFree(&console->fromHost);
+        virLXCControllerConsoleBufFree(&console->fromCont);
+        virMutexDestroy(&console->lock);
+        console->relay = false;
+    }
 }
 
 
@@ -300,6 +352,11 @@ static int virLXCControllerAddConsole(virLXCControllerPtr ctrl,
 
     ctrl->consoles[ctrl->nconsoles-1].epollFd = -1;
     ctrl->consoles[ctrl->nconsoles-1].epollWatch = -1;
+
+    ctrl->consoles[ctrl->nconsoles-1].fromHost.pipe[0] = -1;
+    ctrl->consoles[ctrl->nconsoles-1].fromHost.pipe[1] = -1;
+    ctrl->consoles[ctrl->nconsoles-1].fromCont.pipe[0] = -1;
+    ctrl->consoles[ctrl->nconsoles-1].fromCont.pipe[1] = -1;
     return 0;
 }
 
@@ -846,6 +903,199 @@ static void virLXCControllerSignalChildIO(virNetServerPtr server,
 }
 
 
+static int virLXCControllerConsoleBufInit(virLXCControllerConsoleBufPtr buf)
+{
+    if (VIR_ALLOC_N(buf->data, VIR_LXC_CONTROLLER_CONSOLE_BUF_SIZE) < 0)
+        return -1;
+    buf->size = VIR_LXC_CONTROLLER_CONSOLE_BUF_SIZE;
+
+#if defined(F_GETPIPE_SZ) && defined(F_SETPIPE_SZ)
+    /* Not being able to splice is not an error, we just copy */
+    if (pipe2(buf->pipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+        VIR_DEBUG("Unable to create console pipe: errno=%d", errno);
+        buf->pipe[0] = buf->pipe[1] = -1;
+    } else {
+        int size;
+
+        ignore_value(fcntl(buf->pipe[1], F_SETPIPE_SZ,
+                           VIR_LXC_CONTROLLER_CONSOLE_BUF_SIZE));
+
+        /* Never hold more in the pipe than fits in the ring, so the
+         * pipe contents can always be moved there if splice fails */
+        if ((size = fcntl(buf->pipe[1], F_GETPIPE_SZ)) > 0 &&
+            size < buf->size)
+            buf->size = size;
+    }
+#endif
+
+    return 0;
+}
+
+
+/*
+ * Some character devices (ptys on many kernels) cannot splice. Move
+ * whatever is already in the pipe to the ring and copy from now on.
+ */
+static int virLXCControllerConsoleBufStopSplice(virLXCControllerConsoleBufPtr buf)
+{
+    VIR_DEBUG("Console does not support splice, copying instead");
+
+    if (buf->len &&
+        saferead(buf->pipe[0], buf->data, buf->len) != buf->len)
+        return -1;
+
+    buf->head = 0;
+    buf->size = VIR_LXC_CONTROLLER_CONSOLE_BUF_SIZE;
+    buf->full = false;
+    VIR_FORCE_CLOSE(buf->pipe[0]);
+    VIR_FORCE_CLOSE(buf->pipe[1]);
+    return 0;
+}
+
+
+/*
+ * Whether the pipe of @buf has no room left for another splice
+ */
+static bool virLXCControllerConsoleBufPipeFull(virLXCControllerConsoleBufPtr buf)
+{
+    struct pollfd pfd = { .fd = buf->pipe[1], .events = POLLOUT };
+
+    if (poll(&pfd, 1, 0) < 0)
+        return false;
+    return !(pfd.revents & POLLOUT);
+}
+
+
+/*
+ * Read from @fd until it would block or @buf is full.
+ * Returns -1 with errno set on error, 0 otherwise.
+ */
+static int virLXCControllerConsoleBufFill(virLXCControllerConsoleBufPtr buf,
+                                          int fd)
+{
+    while (buf->len < buf->size && !buf->full) {
+        ssize_t done;
+
+        if (buf->pipe[0] >= 0) {
+            done = splice(fd, NULL, buf->pipe[1], NULL, buf->size - buf->len,
+                          SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (done < 0 && errno == EINVAL) {
+                if (virLXCControllerConsoleBufStopSplice(buf) < 0)
+                    return -1;
+                continue;
+            }
+        } else {
+            size_t tail = (buf->head + buf->len) % buf->size;
+            size_t room = buf->size - buf->len;
+            struct iovec iov[2];
+            int niov = 1;
+
+            iov[0].iov_base = buf->data + tail;
+            iov[0].iov_len = MIN(room, buf->size - tail);
+            if (iov[0].iov_len < room) {
+                iov[1].iov_base = buf->data;
+                iov[1].iov_len = room - iov[0].iov_len;
+                niov++;
+            }
+            done = readv(fd, iov, niov);
+        }
+
+        if (done < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                /* Either @fd has nothing more, or the pipe is full
+                 * and we must stop watching @fd until it drains */
+                if (buf->pipe[0] >= 0 && buf->len &&
+                    virLXCControllerConsoleBufPipeFull(buf))
+                    buf->full = true;
+                break;
+            }
+            return -1;
+        }
+        if (done == 0) {
+            VIR_DEBUG("Read fd %d done %d errno %d", fd, (int)done, errno);
+            break;
+        }
+        buf->len += done;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Write @buf to @fd until it would block or @buf is empty.
+ * Returns -1 with errno set on error, 0 otherwise.
+ */
+static int virLXCControllerConsoleBufDrain(virLXCControllerConsoleBufPtr buf,
+                                           int fd)
+{
+    while (buf->len) {
+        ssize_t done;
+
+        if (buf->pipe[0] >= 0) {
+            done = splice(buf->pipe[0], NULL, fd, NULL, buf->len,
+                          SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (done < 0 && errno == EINVAL) {
+                if (virLXCControllerConsoleBufStopSplice(buf) < 0)
+                    return -1;
+                continue;
+            }
+        } else {
+            struct iovec iov[2];
+            int niov = 1;
+
+            iov[0].iov_base = buf->data + buf->head;
+            iov[0].iov_len = MIN(buf->len, buf->size - buf->head);
+            if (iov[0].iov_len < buf->len) {
+                iov[1].iov_base = buf->data;
+                iov[1].iov_len = buf->len - iov[0].iov_len;
+                niov++;
+            }
+            done = writev(fd, iov, niov);
+            if (done > 0)
+                buf->head = (buf->head + done) % buf->size;
+        }
+
+        if (done < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+            return -1;
+        }
+        if (done == 0) {
+            VIR_DEBUG("Write fd %d done %d errno %d", fd, (int)done, errno);
+            break;
+        }
+        buf->len -= done;
+        buf->full = false;
+        if (!buf->len)
+            buf->head = 0;
+    }
+
+    return 0;
+}
+
+
+static int virLXCControllerConsoleSetupRelay(virLXCControllerConsolePtr console)
+{
+    if (virMutexInit(&console->lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        return -1;
+    }
+    console->relay = true;
+
+    if (virLXCControllerConsoleBufInit(&console->fromHost) < 0 ||
+        virLXCControllerConsoleBufInit(&console->fromCont) < 0)
+        return -1;
+
+    return 0;
+}
+
+
 static void virLXCControllerConsoleUpdateWatch(virLXCControllerConsolePtr console)
 {
     int hostEvents = 0;
@@ -853,17 +1103,19 @@ static void virLXCControllerConsoleUpdateWatch(virLXCControllerConsolePtr consol
 
     /* If host console is open, then we can look to read/write */
     if (!console->hostClosed) {
-        if (console->fromHostLen < sizeof(console->fromHostBuf))
+        if (console->fromHost.len < console->fromHost.size &&
+            !console->fromHost.full)
             hostEvents |= VIR_EVENT_HANDLE_READABLE;
-        if (console->fromContLen)
+        if (console->fromCont.len)
             hostEvents |= VIR_EVENT_HANDLE_WRITABLE;
     }
 
     /* If cont console is open, then we can look to read/write */
     if (!console->contClosed) {
-        if (console->fromContLen < sizeof(console->fromContBuf))
+        if (console->fromCont.len < console->fromCont.size &&
+            !console->fromCont.full)
             contEvents |= VIR_EVENT_HANDLE_READABLE;
-        if (console->fromHostLen)
+        if (console->fromHost.len)
             contEvents |= VIR_EVENT_HANDLE_WRITABLE;
     }
 
@@ -876,7 +1128,7 @@ static void virLXCControllerConsoleUpdateWatch(virLXCControllerConsolePtr consol
     if (console->hostClosed) {
         /* Must setup an epoll to detect when host becomes accessible again */
         int events = EPOLLIN | EPOLLET;
-        if (console->fromContLen)
+        if (console->fromCont.len)
             events |= EPOLLOUT;
 
         if (events != console->hostEpoll) {
@@ -914,7 +1166,7 @@ static void virLXCControllerConsoleUpdateWatch(virLXCControllerConsolePtr consol
     if (console->contClosed) {
         /* Must setup an epoll to detect when guest becomes accessible again */
         int events = EPOLLIN | EPOLLET;
-        if (console->fromHostLen)
+        if (console->fromHost.len)
             events |= EPOLLOUT;
 
         if (events != console->contEpoll) {
@@ -957,11 +1209,11 @@ static void virLXCControllerConsoleEPoll(int watch, int fd, int events, void *op
 {
     virLXCControllerConsolePtr console = opaque;
 
-    virMutexLock(&lock);
+    virMutexLock(&console->lock);
     VIR_DEBUG("IO event watch=%d fd=%d events=%d fromHost=%zu fromcont=%zu",
               watch, fd, events,
-              console->fromHostLen,
-              console->fromContLen);
+              console->fromHost.len,
+              console->fromCont.len);
 
     while (1) {
         struct epoll_event event;
@@ -997,75 +1249,54 @@ static void virLXCControllerConsoleEPoll(int watch, int fd, int events, void *op
     }
 
  cleanup:
-    virMutexUnlock(&lock);
+    virMutexUnlock(&console->lock);
 }
 
 static void virLXCControllerConsoleIO(int watch, int fd, int events, void *opaque)
 {
     virLXCControllerConsolePtr console = opaque;
+    virLXCControllerConsoleBufPtr in;
+    virLXCControllerConsoleBufPtr out;
+    bool peerClosed;
+    int peerFd;
 
-    virMutexLock(&lock);
+    virMutexLock(&console->lock);
     VIR_DEBUG("IO event watch=%d fd=%d events=%d fromHost=%zu fromcont=%zu",
               watch, fd, events,
-              console->fromHostLen,
-              console->fromContLen);
+              console->fromHost.len,
+              console->fromCont.len);
+    if (watch == console->hostWatch) {
+        in = &console->fromHost;
+        out = &console->fromCont;
+        peerFd = console->contFd;
+        peerClosed = console->contClosed;
+    } else {
+        in = &console->fromCont;
+        out = &console->fromHost;
+        peerFd = console->hostFd;
+        peerClosed = console->hostClosed;
+    }
+
     if (events & VIR_EVENT_HANDLE_READABLE) {
-        char *buf;
-        size_t *len;
-        size_t avail;
-        ssize_t done;
-        if (watch == console->hostWatch) {
-            buf = console->fromHostBuf;
-            len = &console->fromHostLen;
-            avail = sizeof(console->fromHostBuf) - *len;
-        } else {
-            buf = console->fromContBuf;
-            len = &console->fromContLen;
-            avail = sizeof(console->fromContBuf) - *len;
-        }
-    reread:
-        done = read(fd, buf + *len, avail);
-        if (done == -1 && errno == EINTR)
-            goto reread;
-        if (done == -1 && errno != EAGAIN) {
+        if (virLXCControllerConsoleBufFill(in, fd) < 0) {
             virReportSystemError(errno, "%s",
                                  _("Unable to read container pty"));
             goto error;
         }
-        if (done > 0) {
-            *len += done;
-        } else {
-            VIR_DEBUG("Read fd %d done %d errno %d", fd, (int)done, errno);
-        }
+
+        /* Pass the data on straight away instead of waiting for
+         * the peer's writable event on the next loop iteration. Any
+         * error is reported when that event arrives. */
+        if (!peerClosed)
+            ignore_value(virLXCControllerConsoleBufDrain(in, peerFd));
     }
 
     if (events & VIR_EVENT_HANDLE_WRITABLE) {
-        char *buf;
-        size_t *len;
-        ssize_t done;
-        if (watch == console->hostWatch) {
-            buf = console->fromContBuf;
-            len = &console->fromContLen;
-        } else {
-            buf = console->fromHostBuf;
-            len = &console->fromHostLen;
-        }
-
-    rewrite:
-        done = write(fd, buf, *len);
-        if (done == -1 && errno == EINTR)
-            goto rewrite;
-        if (done == -1 && errno != EAGAIN) {
+        if (virLXCControllerConsoleBufDrain(out, fd) < 0) {
             virReportSystemError(errno, "%s",
                                  _("Unable to write to container pty"));
             goto error;
         }
-        if (done > 0) {
-            memmove(buf, buf + done, (*len - done));
-            *len -= done;
-        } else {
-            VIR_DEBUG("Write fd %d done %d errno %d", fd, (int)done, errno);
-        }
     }
 
     if (events & VIR_EVENT_HANDLE_HANGUP) {
@@ -1078,7 +1309,7 @@ static void virLXCControllerConsoleIO(int watch, int fd, int events, void *opaqu
     }
 
     virLXCControllerConsoleUpdateWatch(console);
-    virMutexUnlock(&lock);
+    virMutexUnlock(&console->lock);
     return;
 
  error:
@@ -1086,7 +1317,7 @@ static void virLXCControllerConsoleIO(int watch, int fd, int events, void *opaqu
     virEventRemoveHandle(console->hostWatch);
     console->contWatch = console->hostWatch = -1;
     virNetServerQuit(console->server);
-    virMutexUnlock(&lock);
+    virMutexUnlock(&console->lock);
 }
 
 
@@ -1114,6 +1345,9 @@ static int virLXCControllerMain(virLXCControllerPtr ctrl)
     virResetLastError();
 
     for (i = 0; i < ctrl->nconsoles; i++) {
+        if (virLXCControllerConsoleSetupRelay(&(ctrl->consoles[i])) < 0)
+            goto cleanup;
+
         if ((ctrl->consoles[i].epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
             virReportSystemError(errno, "%s",
                                  _("Unable to create epoll fd"));
@@ -1990,6 +2224,55 @@ virLXCControllerSetupFuse(virLXCControllerPtr ctrl)
     return lxcSetupFuse(&ctrl->fuse, ctrl->def);
 }
 
+static void
+virLXCControllerSetupFuseThread(void *opaque)
+{
+    virLXCControllerPtr ctrl = opaque;
+
+    if ((ctrl->fuseSetupRet = virLXCControllerSetupFuse(ctrl)) < 0)
+        ctrl->fuseSetupErr = virSaveLastError();
+}
+
+/*
+ * Mounting the FUSE filesystem does not depend on any of the device
+ * setup, so overlap the two. If no thread can be created, just do
+ * it synchronously.
+ */
+static int
+virLXCControllerBeginSetupFuse(virLXCControllerPtr ctrl)
+{
+    if (virThreadCreate(&ctrl->fuseSetupThread, true,
+                        virLXCControllerSetupFuseThread, ctrl) < 0) {
+        VIR_DEBUG("Unable to create FUSE setup thread, running inline");
+        virResetLastError();
+        return virLXCControllerSetupFuse(ctrl);
+    }
+
+    ctrl->fuseSetupActive = true;
+    return 0;
+}
+
+static int
+virLXCControllerEndSetupFuse(virLXCControllerPtr ctrl)
+{
+    if (!ctrl->fuseSetupActive)
+        return 0;
+
+    virThreadJoin(&ctrl->fuseSetupThread);
+    ctrl->fuseSetupActive = false;
+
+    if (ctrl->fuseSetupRet < 0) {
+        if (ctrl->fuseSetupErr) {
+            virSetError(ctrl->fuseSetupErr);
+            virFreeError(ctrl->fuseSetupErr);
+            ctrl->fuseSetupErr = NULL;
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
 static int
 virLXCControllerStartFuse(virLXCControllerPtr ctrl)
 {
@@ -2150,33 +2433,45 @@ virLXCControllerRun(virLXCControllerPtr ctrl)
 
     if (virLXCControllerSetupPrivateNS() < 0)
         goto cleanup;
+    virLXCStartTimerPhase(&ctrl->timer, "private-ns");
+
+    if (virLXCControllerBeginSetupFuse(ctrl) < 0)
+        goto cleanup;
 
     if (virLXCControllerSetupLoopDevices(ctrl) < 0)
         goto cleanup;
+    virLXCStartTimerPhase(&ctrl->timer, "loop-devices");
 
     if (virLXCControllerSetupResourceLimits(ctrl) < 0)
         goto cleanup;
+    virLXCStartTimerPhase(&ctrl->timer, "resource-limits");
 
     if (virLXCControllerSetupDevPTS(ctrl) < 0)
         goto cleanup;
+    virLXCStartTimerPhase(&ctrl->timer, "devpts");
 
     if (virLXCControllerPopulateDevices(ctrl) < 0)
         goto cleanup;
+    virLXCStartTimerPhase(&ctrl->timer, "devices");
 
     if (virLXCControllerSetupAllDisks(ctrl) < 0)
         goto cleanup;
+    virLXCStartTimerPhase(&ctrl->timer, "disks");
 
     if (virLXCControllerSetupAllHostdevs(ctrl) < 0)
         goto cleanup;
+    virLXCStartTimerPhase(&ctrl->timer, "hostdevs");
 
-    if (virLXCControllerSetupFuse(ctrl) < 0)
+    if (virLXCControllerEndSetupFuse(ctrl) < 0)
         goto cleanup;
+    virLXCStartTimerPhase(&ctrl->timer, "fuse-wait");
 
     if (virLXCControllerSetupConsoles(ctrl, containerTTYPaths) < 0)
         goto cleanup;
 
     if (lxcSetPersonality(ctrl->def) < 0)
         goto cleanup;
+    virLXCStartTimerPhase(&ctrl->timer, "consoles");
 
     if ((ctrl->initpid = lxcContainerStart(ctrl->def,
                                            ctrl->securityManager,
@@ -2191,15 +2486,18 @@ virLXCControllerRun(virLXCControllerPtr ctrl)
         goto cleanup;
     VIR_FORCE_CLOSE(control[1]);
     VIR_FORCE_CLOSE(containerhandshake[1]);
+    virLXCStartTimerPhase(&ctrl->timer, "clone");
 
     for (i = 0; i < ctrl->npassFDs; i++)
         VIR_FORCE_CLOSE(ctrl->passFDs[i]);
 
     if (virLXCControllerSetupUserns(ctrl) < 0)
         goto cleanup;
+    virLXCStartTimerPhase(&ctrl->timer, "userns");
 
     if (virLXCControllerMoveInterfaces(ctrl) < 0)
         goto cleanup;
+    virLXCStartTimerPhase(&ctrl->timer, "interfaces");
 
     if (virLXCControllerStartFuse(ctrl) < 0)
         goto cleanup;
@@ -2215,6 +2513,7 @@ virLXCControllerRun(virLXCControllerPtr ctrl)
                              _("error receiving signal from container"));
         goto cleanup;
     }
+    virLXCStartTimerPhase(&ctrl->timer, "container-handshake");
 
     /* ...and reduce our privileges */
     if (lxcControllerClearCapabilities() < 0)
@@ -2222,6 +2521,8 @@ virLXCControllerRun(virLXCControllerPtr ctrl)
 
     if (virLXCControllerDaemonHandshake(ctrl) < 0)
         goto cleanup;
+    virLXCStartTimerPhase(&ctrl->timer, "daemon-handshake");
+    virLXCStartTimerReport(&ctrl->timer, "startup");
 
     for (i = 0; i < ctrl->nconsoles; i++)
         if (virLXCControllerConsoleSetNonblocking(&(ctrl->consoles[i])) < 0)
@@ -2247,6 +2548,14 @@ virLXCControllerRun(virLXCControllerPtr ctrl)
         VIR_FREE(containerTTYPaths[i]);
     VIR_FREE(containerTTYPaths);
 
+    /* An earlier step failed, its error is the one to report */
+    if (ctrl->fuseSetupActive) {
+        virThreadJoin(&ctrl->fuseSetupThread);
+        ctrl->fuseSetupActive = false;
+        virFreeError(ctrl->fuseSetupErr);
+        ctrl->fuseSetupErr = NULL;
+    }
+
     virLXCControllerStopInit(ctrl);
 
     return rc;
@@ -2425,11 +2734,15 @@ int main(int argc, char *argv[])
     if (virLXCControllerValidateConsoles(ctrl) < 0)
         goto cleanup;
 
+    virLXCStartTimerPhase(&ctrl->timer, "config");
+
     if (!(ctrl->cgroup = virLXCCgroupCreate(ctrl->def)))
         goto cleanup;
+    virLXCStartTimerPhase(&ctrl->timer, "cgroup");
 
     if (virLXCControllerSetupServer(ctrl) < 0)
         goto cleanup;
+    virLXCStartTimerPhase(&ctrl->timer, "server");
 
     if (bg) {
         if ((pid = fork()) < 0)
@@ -26,6 +26,8 @@
 #include "viralloc.h"
 #include "virlog.h"
 #include "virerror.h"
+#include "virbuffer.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_LXC
 
@@ -117,3 +119,71 @@ virDomainDefParserConfig virLXCDriverDomainDefParserConfig = {
     .domainPostParseCallback = virLXCDomainDefPostParse,
     .devicesPostParseCallback = virLXCDomainDeviceDefPostParse,
 };
+
+
+void
+virLXCStartTimerInit(virLXCStartTimerPtr timer,
+                     const char *domain)
+{
+    memset(timer, 0, sizeof(*timer));
+    timer->domain = domain;
+    ignore_value(virTimeMillisNow(&timer->start));
+    timer->last = timer->start;
+}
+
+
+/**
+ * virLXCStartTimerPhase:
+ * @timer: the timer
+ * @name: static string naming the step that just finished
+ *
+ * Charge the time since the previous phase (or since the timer was
+ * initialized) to @name.
+ */
+void
+virLXCStartTimerPhase(virLXCStartTimerPtr timer,
+                      const char *name)
+{
+    unsigned long long now;
+
+    if (virTimeMillisNow(&now) < 0)
+        return;
+
+    VIR_DEBUG("Container '%s' phase '%s' took %llums",
+              timer->domain, name, now - timer->last);
+
+    if (timer->nphases < VIR_LXC_START_TIMER_MAX_PHASES) {
+        timer->phases[timer->nphases].name = name;
+        timer->phases[timer->nphases].ms = now - timer->last;
+        timer->nphases++;
+    }
+    timer->last = now;
+}
+
+
+/**
+ * virLXCStartTimerReport:
+ * @timer: the timer
+ * @what: what was being timed, eg "startup"
+ *
+ * Log the total time together with the per phase breakdown.
+ */
+void
+virLXCStartTimerReport(virLXCStartTimerPtr timer,
+                       const char *what)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *phases;
+    size_t i;
+
+    for (i = 0; i < timer->nphases; i++)
+        virBufferAsprintf(&buf, " %s=%llums",
+                          timer->phases[i].name, timer->phases[i].ms);
+
+    if (!(phases = virBufferContentAndReset(&buf)))
+        return;
+
+    VIR_INFO("Container '%s' %s took %llums:%s",
+             timer->domain, what, timer->last - timer->start, phases);
+    VIR_FREE(phases);
+}
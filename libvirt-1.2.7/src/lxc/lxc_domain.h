@@ -41,7 +41,34 @@ struct _virLXCDomainObjPrivate {
     virCgroupPtr cgroup;
 };
 
+/* Upper bound on the phases a virLXCStartTimer can record */
+# define VIR_LXC_START_TIMER_MAX_PHASES 32
+
+typedef struct _virLXCStartPhase virLXCStartPhase;
+struct _virLXCStartPhase {
+    const char *name;
+    unsigned long long ms;
+};
+
+/* Wall clock time spent in each step of bringing up a container */
+typedef struct _virLXCStartTimer virLXCStartTimer;
+typedef virLXCStartTimer *virLXCStartTimerPtr;
+struct _virLXCStartTimer {
+    const char *domain;
+    unsigned long long start;
+    unsigned long long last;
+    size_t nphases;
+    virLXCStartPhase phases[VIR_LXC_START_TIMER_MAX_PHASES];
+};
+
 extern virDomainXMLPrivateDataCallbacks virLXCDriverPrivateDataCallbacks;
 extern virDomainDefParserConfig virLXCDriverDomainDefParserConfig;
 
+void virLXCStartTimerInit(virLXCStartTimerPtr timer,
+                          const char *domain);
+void virLXCStartTimerPhase(virLXCStartTimerPtr timer,
+                           const char *name);
+void virLXCStartTimerReport(virLXCStartTimerPtr timer,
+                            const char *what);
+
 #endif /* __LXC_DOMAIN_H__ */
@@ -26,6 +26,7 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/mount.h>
 #include <mntent.h>
 
@@ -33,54 +34,126 @@
 #include "lxc_cgroup.h"
 #include "virerror.h"
 #include "virfile.h"
-#include "virbuffer.h"
+#include "virlog.h"
 #include "virstring.h"
+#include "virtime.h"
+#include "c-ctype.h"
 
 #define VIR_FROM_THIS VIR_FROM_LXC
 
+VIR_LOG_INIT("lxc.lxc_fuse");
+
 #if WITH_FUSE
 
-static const char *fuse_meminfo_path = "/meminfo";
+/* How long a rendered file is served before the cgroup is queried again */
+# define LXC_FUSE_CACHE_TTL 1000 /* milliseconds */
+
+/* Maximum number of block devices tracked for diskstats */
+# define LXC_FUSE_MAX_DISKS 128
+
+typedef struct _virLXCFuseDiskStat virLXCFuseDiskStat;
+struct _virLXCFuseDiskStat {
+    unsigned int major;
+    unsigned int minor;
+    unsigned long long rd_ios;
+    unsigned long long rd_bytes;
+    unsigned long long wr_ios;
+    unsigned long long wr_bytes;
+};
+
+/*
+ * One rendered /proc file. Both buffers are allocated when the
+ * filesystem is set up, so refreshing a snapshot only reads the
+ * host file and the cgroup and formats into @data in place.
+ */
+struct _virLXCFuseCache {
+    virMutex lock;
+    bool valid;
+    unsigned long long expires;
+
+    char *host;         /* NUL terminated copy of the host file */
+    char *data;         /* rendered contents handed to readers */
+    size_t size;        /* of both buffers */
+    size_t len;
+    bool truncated;
+
+    virLXCFuseDiskStat *disks;
+    size_t ndisks;
+};
+
+typedef int (*virLXCFuseRenderFunc)(virLXCFusePtr fuse,
+                                    virLXCFuseCachePtr cache);
+
+typedef struct _virLXCFuseFile virLXCFuseFile;
+struct _virLXCFuseFile {
+    const char *path;
+    const char *hostpath;
+    size_t size;
+    virLXCFuseRenderFunc render;
+};
+
+static int lxcProcRenderMeminfo(virLXCFusePtr fuse, virLXCFuseCachePtr cache);
+static int lxcProcRenderCpuinfo(virLXCFusePtr fuse, virLXCFuseCachePtr cache);
+static int lxcProcRenderStat(virLXCFusePtr fuse, virLXCFuseCachePtr cache);
+static int lxcProcRenderUptime(virLXCFusePtr fuse, virLXCFuseCachePtr cache);
+static int lxcProcRenderDiskstats(virLXCFusePtr fuse, virLXCFuseCachePtr cache);
+
+static const virLXCFuseFile lxcProcFiles[] = {
+    { "/meminfo", "/proc/meminfo", 16 * 1024, lxcProcRenderMeminfo },
+    { "/cpuinfo", "/proc/cpuinfo", 1024 * 1024, lxcProcRenderCpuinfo },
+    { "/stat", "/proc/stat", 256 * 1024, lxcProcRenderStat },
+    { "/uptime", "/proc/uptime", 256, lxcProcRenderUptime },
+    { "/diskstats", "/proc/diskstats", 64 * 1024, lxcProcRenderDiskstats },
+};
+
+verify(ARRAY_CARDINALITY(lxcProcFiles) == LXC_FUSE_NFILES);
+
+static int lxcProcLookup(const char *path)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_CARDINALITY(lxcProcFiles); i++) {
+        if (STREQ(path, lxcProcFiles[i].path))
+            return i;
+    }
+
+    return -1;
+}
 
 static int lxcProcGetattr(const char *path, struct stat *stbuf)
 {
-    int res;
-    char *mempath = NULL;
+    int idx;
     struct stat sb;
     struct fuse_context *context = fuse_get_context();
-    virDomainDefPtr def = (virDomainDefPtr)context->private_data;
+    virLXCFusePtr fuse = context->private_data;
+    virDomainDefPtr def = fuse->def;
 
     memset(stbuf, 0, sizeof(struct stat));
-    if (virAsprintf(&mempath, "/proc/%s", path) < 0)
-        return -errno;
-
-    res = 0;
 
     if (STREQ(path, "/")) {
         stbuf->st_mode = S_IFDIR | 0755;
         stbuf->st_nlink = 2;
-    } else if (STREQ(path, fuse_meminfo_path)) {
-        if (stat(mempath, &sb) < 0) {
-            res = -errno;
-            goto cleanup;
-        }
+        return 0;
+    }
 
-        stbuf->st_uid = def->idmap.uidmap ? def->idmap.uidmap[0].target : 0;
-        stbuf->st_gid = def->idmap.gidmap ? def->idmap.gidmap[0].target : 0;
-        stbuf->st_mode = sb.st_mode;
-        stbuf->st_nlink = 1;
-        stbuf->st_blksize = sb.st_blksize;
-        stbuf->st_blocks = sb.st_blocks;
-        stbuf->st_size = sb.st_size;
-        stbuf->st_atime = sb.st_atime;
-        stbuf->st_ctime = sb.st_ctime;
-        stbuf->st_mtime = sb.st_mtime;
-    } else
-        res = -ENOENT;
+    if ((idx = lxcProcLookup(path)) < 0)
+        return -ENOENT;
 
- cleanup:
-    VIR_FREE(mempath);
-    return res;
+    if (stat(lxcProcFiles[idx].hostpath, &sb) < 0)
+        return -errno;
+
+    stbuf->st_uid = def->idmap.uidmap ? def->idmap.uidmap[0].target : 0;
+    stbuf->st_gid = def->idmap.gidmap ? def->idmap.gidmap[0].target : 0;
+    stbuf->st_mode = sb.st_mode;
+    stbuf->st_nlink = 1;
+    stbuf->st_blksize = sb.st_blksize;
+    stbuf->st_blocks = sb.st_blocks;
+    stbuf->st_size = sb.st_size;
+    stbuf->st_atime = sb.st_atime;
+    stbuf->st_ctime = sb.st_ctime;
+    stbuf->st_mtime = sb.st_mtime;
+
+    return 0;
 }
 
 static int lxcProcReaddir(const char *path, void *buf,
@@ -88,20 +161,23 @@ static int lxcProcReaddir(const char *path, void *buf,
                           off_t offset ATTRIBUTE_UNUSED,
                           struct fuse_file_info *fi ATTRIBUTE_UNUSED)
 {
+    size_t i;
+
     if (!STREQ(path, "/"))
         return -ENOENT;
 
     filler(buf, ".", NULL, 0);
     filler(buf, "..", NULL, 0);
-    filler(buf, fuse_meminfo_path + 1, NULL, 0);
+    for (i = 0; i < ARRAY_CARDINALITY(lxcProcFiles); i++)
+        filler(buf, lxcProcFiles[i].path + 1, NULL, 0);
 
     return 0;
 }
 
-static int lxcProcOpen(const char *path ATTRIBUTE_UNUSED,
-                       struct fuse_file_info *fi ATTRIBUTE_UNUSED)
+static int lxcProcOpen(const char *path,
+                       struct fuse_file_info *fi)
 {
-    if (!STREQ(path, fuse_meminfo_path))
+    if (lxcProcLookup(path) < 0)
         return -ENOENT;
 
     if ((fi->flags & 3) != O_RDONLY)
@@ -110,7 +186,8 @@ static int lxcProcOpen(const char *path ATTRIBUTE_UNUSED,
     return 0;
 }
 
-static int lxcProcHostRead(char *path, char *buf, size_t size, off_t offset)
+static int lxcProcHostRead(const char *path, char *buf, size_t size,
+                           off_t offset)
 {
     int fd;
     int res;
@@ -126,131 +203,588 @@ static int lxcProcHostRead(char *path, char *buf, size_t size, off_t offset)
     return res;
 }
 
-static int lxcProcReadMeminfo(char *hostpath, virDomainDefPtr def,
-                              char *buf, size_t size, off_t offset)
+/*
+ * Read a whole (small) kernel file into @buf and NUL terminate it.
+ * Fails with EFBIG rather than returning a truncated copy.
+ */
+static ssize_t lxcProcReadFile(const char *path, char *buf, size_t size)
 {
-    int copied = 0;
-    int res;
-    FILE *fd = NULL;
-    char *line = NULL;
-    size_t n;
+    int fd;
+    ssize_t got;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+
+    got = saferead(fd, buf, size);
+    VIR_FORCE_CLOSE(fd);
+    if (got < 0)
+        return -1;
+
+    if (got == size) {
+        errno = EFBIG;
+        return -1;
+    }
+
+    buf[got] = '\0';
+    return got;
+}
+
+static void lxcProcAppend(virLXCFuseCachePtr cache, const char *fmt, ...)
+    ATTRIBUTE_FMT_PRINTF(2, 3);
+
+static void lxcProcAppend(virLXCFuseCachePtr cache, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+    size_t room = cache->size - cache->len;
+
+    if (cache->truncated)
+        return;
+
+    va_start(ap, fmt);
+    n = vsnprintf(cache->data + cache->len, room, fmt, ap);
+    va_end(ap);
+
+    if (n < 0 || n >= room) {
+        cache->truncated = true;
+        return;
+    }
+    cache->len += n;
+}
+
+static void lxcProcAppendLine(virLXCFuseCachePtr cache,
+                              const char *line, size_t len)
+{
+    if (cache->truncated)
+        return;
+
+    if (len + 1 >= cache->size - cache->len) {
+        cache->truncated = true;
+        return;
+    }
+    memcpy(cache->data + cache->len, line, len);
+    cache->len += len;
+    cache->data[cache->len++] = '\n';
+}
+
+/* Does @line start with the field @key immediately followed by @sep? */
+static bool lxcProcLineIs(const char *line, const char *key, char sep)
+{
+    size_t n = strlen(key);
+
+    return STREQLEN(line, key, n) && line[n] == sep;
+}
+
+static virCgroupPtr lxcProcGetCgroup(virLXCFusePtr fuse)
+{
+    virCgroupPtr cgroup;
+
+    virMutexLock(&fuse->lock);
+    if (!fuse->cgroup && virCgroupNewSelf(&fuse->cgroup) < 0)
+        fuse->cgroup = NULL;
+    cgroup = fuse->cgroup;
+    virMutexUnlock(&fuse->lock);
+
+    return cgroup;
+}
+
+/* Milliseconds since the container was started */
+static int lxcProcGetUptime(virLXCFusePtr fuse, unsigned long long *uptime)
+{
+    unsigned long long now;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    *uptime = now > fuse->started ? now - fuse->started : 0;
+    return 0;
+}
+
+/*
+ * Fetch the CPUs the container may run on. @cpus is left NULL when
+ * there is no cpuset controller, meaning every host CPU. Returns the
+ * number of usable CPUs, or -1 on error.
+ */
+static int lxcProcGetCpuset(virCgroupPtr cgroup, virBitmapPtr *cpus)
+{
+    char *str = NULL;
+    int ncpus;
+
+    *cpus = NULL;
+    if (!virCgroupHasController(cgroup, VIR_CGROUP_CONTROLLER_CPUSET)) {
+        if ((ncpus = sysconf(_SC_NPROCESSORS_CONF)) <= 0)
+            ncpus = 1;
+        return ncpus;
+    }
+
+    if (virCgroupGetCpusetCpus(cgroup, &str) < 0)
+        return -1;
+
+    if (virBitmapParse(str, 0, cpus, VIR_DOMAIN_CPUMASK_LEN) < 0) {
+        VIR_FREE(str);
+        return -1;
+    }
+    VIR_FREE(str);
+
+    if ((ncpus = virBitmapCountBits(*cpus)) <= 0)
+        ncpus = 1;
+    return ncpus;
+}
+
+static int lxcProcRenderMeminfo(virLXCFusePtr fuse, virLXCFuseCachePtr cache)
+{
+    virDomainDefPtr def = fuse->def;
+    virCgroupPtr cgroup;
     struct virLXCMeminfo meminfo;
-    virBuffer buffer = VIR_BUFFER_INITIALIZER;
-    virBufferPtr new_meminfo = &buffer;
+    char *line;
+    char *eol;
 
-    if (virLXCCgroupGetMeminfo(&meminfo) < 0) {
-        virErrorSetErrnoFromLastError();
-        return -errno;
+    if (!(cgroup = lxcProcGetCgroup(fuse)))
+        return -1;
+
+    memset(&meminfo, 0, sizeof(meminfo));
+    if (virLXCCgroupGetMeminfo(cgroup, &meminfo) < 0)
+        return -1;
+
+    if (lxcProcReadFile("/proc/meminfo", cache->host, cache->size) < 0)
+        return -1;
+
+    for (line = cache->host; *line; line = eol + !!*eol) {
+        eol = strchrnul(line, '\n');
+
+        if (lxcProcLineIs(line, "MemTotal", ':') &&
+            (def->mem.hard_limit || def->mem.max_balloon))
+            lxcProcAppend(cache, "MemTotal:       %8llu kB\n",
+                          meminfo.memtotal);
+        else if (lxcProcLineIs(line, "MemFree", ':') &&
+                 (def->mem.hard_limit || def->mem.max_balloon))
+            lxcProcAppend(cache, "MemFree:        %8llu kB\n",
+                          (meminfo.memtotal - meminfo.memusage));
+        else if (lxcProcLineIs(line, "Buffers", ':'))
+            lxcProcAppend(cache, "Buffers:        %8d kB\n", 0);
+        else if (lxcProcLineIs(line, "Cached", ':'))
+            lxcProcAppend(cache, "Cached:         %8llu kB\n",
+                          meminfo.cached);
+        else if (lxcProcLineIs(line, "Active", ':'))
+            lxcProcAppend(cache, "Active:         %8llu kB\n",
+                          (meminfo.active_anon + meminfo.active_file));
+        else if (lxcProcLineIs(line, "Inactive", ':'))
+            lxcProcAppend(cache, "Inactive:       %8llu kB\n",
+                          (meminfo.inactive_anon + meminfo.inactive_file));
+        else if (lxcProcLineIs(line, "Active(anon)", ':'))
+            lxcProcAppend(cache, "Active(anon):   %8llu kB\n",
+                          meminfo.active_anon);
+        else if (lxcProcLineIs(line, "Inactive(anon)", ':'))
+            lxcProcAppend(cache, "Inactive(anon): %8llu kB\n",
+                          meminfo.inactive_anon);
+        else if (lxcProcLineIs(line, "Active(file)", ':'))
+            lxcProcAppend(cache, "Active(file):   %8llu kB\n",
+                          meminfo.active_file);
+        else if (lxcProcLineIs(line, "Inactive(file)", ':'))
+            lxcProcAppend(cache, "Inactive(file): %8llu kB\n",
+                          meminfo.inactive_file);
+        else if (lxcProcLineIs(line, "Unevictable", ':'))
+            lxcProcAppend(cache, "Unevictable:    %8llu kB\n",
+                          meminfo.unevictable);
+        else if (lxcProcLineIs(line, "SwapTotal", ':') &&
+                 def->mem.swap_hard_limit)
+            lxcProcAppend(cache, "SwapTotal:      %8llu kB\n",
+                          (meminfo.swaptotal - meminfo.memtotal));
+        else if (lxcProcLineIs(line, "SwapFree", ':') &&
+                 def->mem.swap_hard_limit)
+            lxcProcAppend(cache, "SwapFree:       %8llu kB\n",
+                          (meminfo.swaptotal - meminfo.memtotal -
+                           meminfo.swapusage + meminfo.memusage));
+        else
+            lxcProcAppendLine(cache, line, eol - line);
     }
 
-    fd = fopen(hostpath, "r");
-    if (fd == NULL) {
-        virReportSystemError(errno, _("Cannot open %s"), hostpath);
-        res = -errno;
+    return 0;
+}
+
+/*
+ * Only show the processors in the container's cpuset, renumbered
+ * from zero so that tools sizing thread pools from cpuinfo agree
+ * with sched_getaffinity(). Lines outside a "processor" block are
+ * kept as they are.
+ */
+static int lxcProcRenderCpuinfo(virLXCFusePtr fuse, virLXCFuseCachePtr cache)
+{
+    virCgroupPtr cgroup;
+    virBitmapPtr cpus = NULL;
+    char *line;
+    char *eol;
+    bool keep = true;
+    unsigned int next = 0;
+    int ret = -1;
+
+    if (!(cgroup = lxcProcGetCgroup(fuse)))
+        return -1;
+
+    if (lxcProcGetCpuset(cgroup, &cpus) < 0)
+        return -1;
+
+    if (lxcProcReadFile("/proc/cpuinfo", cache->host, cache->size) < 0)
         goto cleanup;
+
+    for (line = cache->host; *line; line = eol + !!*eol) {
+        unsigned int cpu;
+        char *val;
+
+        eol = strchrnul(line, '\n');
+
+        if (STRPREFIX(line, "processor") &&
+            (val = strchr(line, ':')) && val < eol &&
+            virStrToLong_ui(val + 1, NULL, 10, &cpu) == 0) {
+            bool set = true;
+
+            if (cpus && virBitmapGetBit(cpus, cpu, &set) < 0)
+                set = false;
+            if ((keep = set))
+                lxcProcAppend(cache, "%.*s: %u\n",
+                              (int)(val - line), line, next++);
+            continue;
+        }
+
+        if (keep)
+            lxcProcAppendLine(cache, line, eol - line);
+
+        /* a blank line ends the current processor block */
+        if (line == eol)
+            keep = true;
     }
 
-    if (fseek(fd, offset, SEEK_SET) < 0) {
-        virReportSystemError(errno, "%s", _("fseek failed"));
-        res = -errno;
+    ret = 0;
+ cleanup:
+    virBitmapFree(cpus);
+    return ret;
+}
+
+/*
+ * The aggregate "cpu" line comes from cpuacct.stat, one "cpuN" line
+ * is generated per CPU in the cpuset from cpuacct.usage_percpu (its
+ * user/system split follows the aggregate ratio), and idle time is
+ * whatever the container did not use since it started. Everything
+ * else is passed through; btime in particular must stay the host
+ * boot time, as process start times in /proc/<pid>/stat are
+ * relative to it.
+ */
+static int lxcProcRenderStat(virLXCFusePtr fuse, virLXCFuseCachePtr cache)
+{
+    virCgroupPtr cgroup;
+    virBitmapPtr cpus = NULL;
+    char *percpu = NULL;
+    unsigned long long user;
+    unsigned long long sys;
+    unsigned long long uptime;
+    unsigned long long nsPerTick;
+    long ticks;
+    int ncpus;
+    char *line;
+    char *eol;
+    int ret = -1;
+
+    if (!(cgroup = lxcProcGetCgroup(fuse)))
+        return -1;
+
+    if ((ticks = sysconf(_SC_CLK_TCK)) <= 0)
+        ticks = 100;
+    nsPerTick = 1000000000ULL / ticks;
+
+    if ((ncpus = lxcProcGetCpuset(cgroup, &cpus)) < 0)
+        return -1;
+
+    if (virCgroupGetCpuacctStat(cgroup, &user, &sys) < 0 ||
+        virCgroupGetCpuacctPercpuUsage(cgroup, &percpu) < 0 ||
+        lxcProcGetUptime(fuse, &uptime) < 0)
         goto cleanup;
-    }
 
-    res = -1;
-    while (copied < size && getline(&line, &n, fd) > 0) {
-        char *ptr = strchr(line, ':');
-        if (ptr) {
-            *ptr = '\0';
-
-            if (STREQ(line, "MemTotal") &&
-                (def->mem.hard_limit || def->mem.max_balloon))
-                virBufferAsprintf(new_meminfo, "MemTotal:       %8llu kB\n",
-                                  meminfo.memtotal);
-            else if (STREQ(line, "MemFree") &&
-                       (def->mem.hard_limit || def->mem.max_balloon))
-                virBufferAsprintf(new_meminfo, "MemFree:        %8llu kB\n",
-                                  (meminfo.memtotal - meminfo.memusage));
-            else if (STREQ(line, "Buffers"))
-                virBufferAsprintf(new_meminfo, "Buffers:        %8d kB\n", 0);
-            else if (STREQ(line, "Cached"))
-                virBufferAsprintf(new_meminfo, "Cached:         %8llu kB\n",
-                                  meminfo.cached);
-            else if (STREQ(line, "Active"))
-                virBufferAsprintf(new_meminfo, "Active:         %8llu kB\n",
-                                  (meminfo.active_anon + meminfo.active_file));
-            else if (STREQ(line, "Inactive"))
-                virBufferAsprintf(new_meminfo, "Inactive:       %8llu kB\n",
-                                  (meminfo.inactive_anon + meminfo.inactive_file));
-            else if (STREQ(line, "Active(anon)"))
-                virBufferAsprintf(new_meminfo, "Active(anon):   %8llu kB\n",
-                                  meminfo.active_anon);
-            else if (STREQ(line, "Inactive(anon)"))
-                virBufferAsprintf(new_meminfo, "Inactive(anon): %8llu kB\n",
-                                  meminfo.inactive_anon);
-            else if (STREQ(line, "Active(file)"))
-                virBufferAsprintf(new_meminfo, "Active(file):   %8llu kB\n",
-                                  meminfo.active_file);
-            else if (STREQ(line, "Inactive(file)"))
-                virBufferAsprintf(new_meminfo, "Inactive(file): %8llu kB\n",
-                                  meminfo.inactive_file);
-            else if (STREQ(line, "Unevictable"))
-                virBufferAsprintf(new_meminfo, "Unevictable:    %8llu kB\n",
-                                  meminfo.unevictable);
-            else if (STREQ(line, "SwapTotal") && def->mem.swap_hard_limit)
-                virBufferAsprintf(new_meminfo, "SwapTotal:      %8llu kB\n",
-                                  (meminfo.swaptotal - meminfo.memtotal));
-            else if (STREQ(line, "SwapFree") && def->mem.swap_hard_limit)
-                virBufferAsprintf(new_meminfo, "SwapFree:       %8llu kB\n",
-                                  (meminfo.swaptotal - meminfo.memtotal -
-                                   meminfo.swapusage + meminfo.memusage));
-            else {
-                *ptr = ':';
-                virBufferAdd(new_meminfo, line, -1);
-            }
+    if (lxcProcReadFile("/proc/stat", cache->host, cache->size) < 0)
+        goto cleanup;
 
-            if (virBufferCheckError(new_meminfo) < 0) {
-                res = -errno;
-                goto cleanup;
+    uptime = uptime * ticks / 1000;
+    user /= nsPerTick;
+    sys /= nsPerTick;
+
+    for (line = cache->host; *line; line = eol + !!*eol) {
+        eol = strchrnul(line, '\n');
+
+        if (lxcProcLineIs(line, "cpu", ' ')) {
+            unsigned long long total = uptime * ncpus;
+            unsigned long long used = user + sys;
+            unsigned int cpu = 0;
+            unsigned int next = 0;
+            char *p = percpu;
+
+            lxcProcAppend(cache, "cpu  %llu 0 %llu %llu 0 0 0 0 0 0\n",
+                          user, sys, total > used ? total - used : 0);
+
+            while (p && *p && *p != '\n') {
+                unsigned long long usage;
+                unsigned long long cpuUser;
+                bool set = true;
+
+                if (virStrToLong_ull(p, &p, 10, &usage) < 0)
+                    break;
+
+                if (cpus && virBitmapGetBit(cpus, cpu, &set) < 0)
+                    set = false;
+                cpu++;
+                if (!set)
+                    continue;
+
+                usage /= nsPerTick;
+                cpuUser = used ? usage * user / used : usage;
+                lxcProcAppend(cache, "cpu%u %llu 0 %llu %llu 0 0 0 0 0 0\n",
+                              next++, cpuUser, usage - cpuUser,
+                              uptime > usage ? uptime - usage : 0);
             }
+        } else if (STRPREFIX(line, "cpu") && c_isdigit(line[3])) {
+            /* replaced by the per-cpu lines emitted above */
+        } else {
+            lxcProcAppendLine(cache, line, eol - line);
+        }
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(percpu);
+    virBitmapFree(cpus);
+    return ret;
+}
+
+static int lxcProcRenderUptime(virLXCFusePtr fuse, virLXCFuseCachePtr cache)
+{
+    virCgroupPtr cgroup;
+    virBitmapPtr cpus = NULL;
+    unsigned long long uptime;
+    unsigned long long used;
+    unsigned long long idle;
+    int ncpus;
+
+    if (!(cgroup = lxcProcGetCgroup(fuse)))
+        return -1;
+
+    if ((ncpus = lxcProcGetCpuset(cgroup, &cpus)) < 0)
+        return -1;
+    virBitmapFree(cpus);
+
+    if (virCgroupGetCpuacctUsage(cgroup, &used) < 0 ||
+        lxcProcGetUptime(fuse, &uptime) < 0)
+        return -1;
 
-            copied += strlen(line);
-            if (copied > size)
-                copied = size;
+    used /= 1000000;
+    idle = uptime * ncpus > used ? uptime * ncpus - used : 0;
+
+    lxcProcAppend(cache, "%llu.%02llu %llu.%02llu\n",
+                  uptime / 1000, (uptime % 1000) / 10,
+                  idle / 1000, (idle % 1000) / 10);
+    return 0;
+}
+
+static virLXCFuseDiskStat *
+lxcProcFindDisk(virLXCFuseCachePtr cache,
+                unsigned int major,
+                unsigned int minor,
+                bool add)
+{
+    size_t i;
+
+    for (i = 0; i < cache->ndisks; i++) {
+        if (cache->disks[i].major == major &&
+            cache->disks[i].minor == minor)
+            return &cache->disks[i];
+    }
+
+    if (!add || cache->ndisks == LXC_FUSE_MAX_DISKS)
+        return NULL;
+
+    memset(&cache->disks[cache->ndisks], 0, sizeof(cache->disks[0]));
+    cache->disks[cache->ndisks].major = major;
+    cache->disks[cache->ndisks].minor = minor;
+    return &cache->disks[cache->ndisks++];
+}
+
+/*
+ * Accumulate one of the blkio.throttle.io_service* files, whose
+ * lines look like "8:0 Read 4096", into the per-device table.
+ */
+static int lxcProcLoadBlkio(virCgroupPtr cgroup,
+                            virLXCFuseCachePtr cache,
+                            const char *name,
+                            bool bytes)
+{
+    char *path = NULL;
+    char *line;
+    char *eol;
+    int ret = -1;
+
+    if (virCgroupPathOfController(cgroup, VIR_CGROUP_CONTROLLER_BLKIO,
+                                  name, &path) < 0)
+        return -1;
+
+    if (lxcProcReadFile(path, cache->host, cache->size) < 0)
+        goto cleanup;
+
+    for (line = cache->host; *line; line = eol + !!*eol) {
+        unsigned int major;
+        unsigned int minor;
+        unsigned long long value;
+        virLXCFuseDiskStat *disk;
+        char *p;
+
+        eol = strchrnul(line, '\n');
+
+        if (virStrToLong_ui(line, &p, 10, &major) < 0 || *p != ':' ||
+            virStrToLong_ui(p + 1, &p, 10, &minor) < 0 || *p != ' ')
+            continue;
+        p++;
+
+        if (!(disk = lxcProcFindDisk(cache, major, minor, true)))
+            continue;
+
+        if (STRPREFIX(p, "Read ")) {
+            if (virStrToLong_ull(p + 5, NULL, 10, &value) < 0)
+                continue;
+            if (bytes)
+                disk->rd_bytes = value;
+            else
+                disk->rd_ios = value;
+        } else if (STRPREFIX(p, "Write ")) {
+            if (virStrToLong_ull(p + 6, NULL, 10, &value) < 0)
+                continue;
+            if (bytes)
+                disk->wr_bytes = value;
+            else
+                disk->wr_ios = value;
         }
     }
-    res = copied;
-    memcpy(buf, virBufferCurrentContent(new_meminfo), copied);
 
+    ret = 0;
  cleanup:
-    VIR_FREE(line);
-    virBufferFreeAndReset(new_meminfo);
-    VIR_FORCE_FCLOSE(fd);
-    return res;
+    VIR_FREE(path);
+    return ret;
+}
+
+/*
+ * Only list the devices the container has done I/O to, with the
+ * counters the blkio controller keeps. Timing and merge columns are
+ * not tracked per cgroup and are reported as zero.
+ */
+static int lxcProcRenderDiskstats(virLXCFusePtr fuse, virLXCFuseCachePtr cache)
+{
+    virCgroupPtr cgroup;
+    char *line;
+    char *eol;
+
+    if (!(cgroup = lxcProcGetCgroup(fuse)))
+        return -1;
+
+    cache->ndisks = 0;
+    if (lxcProcLoadBlkio(cgroup, cache,
+                         "blkio.throttle.io_serviced", false) < 0 ||
+        lxcProcLoadBlkio(cgroup, cache,
+                         "blkio.throttle.io_service_bytes", true) < 0)
+        return -1;
+
+    if (lxcProcReadFile("/proc/diskstats", cache->host, cache->size) < 0)
+        return -1;
+
+    for (line = cache->host; *line; line = eol + !!*eol) {
+        unsigned int major;
+        unsigned int minor;
+        virLXCFuseDiskStat *disk;
+        char *name;
+        char *p;
+
+        eol = strchrnul(line, '\n');
+
+        if (virStrToLong_ui(line, &p, 10, &major) < 0 ||
+            virStrToLong_ui(p, &p, 10, &minor) < 0)
+            continue;
+
+        if (!(disk = lxcProcFindDisk(cache, major, minor, false)))
+            continue;
+
+        name = p + strspn(p, " ");
+        p = name + strcspn(name, " \n");
+
+        lxcProcAppend(cache,
+                      "%4u %7u %.*s %llu 0 %llu 0 %llu 0 %llu 0 0 0 0\n",
+                      major, minor, (int)(p - name), name,
+                      disk->rd_ios, disk->rd_bytes / 512,
+                      disk->wr_ios, disk->wr_bytes / 512);
+    }
+
+    return 0;
 }
 
-static int lxcProcRead(const char *path ATTRIBUTE_UNUSED,
-                       char *buf ATTRIBUTE_UNUSED,
-                       size_t size ATTRIBUTE_UNUSED,
-                       off_t offset ATTRIBUTE_UNUSED,
+/*
+ * Render the file again if its snapshot expired. A read at a non-zero
+ * offset continues the current snapshot rather than starting a new
+ * one, so a single reader going through the file sees one version
+ * unless another reader's refresh lands in between.
+ */
+static int lxcProcRefresh(virLXCFusePtr fuse, int idx, off_t offset)
+{
+    virLXCFuseCachePtr cache = &fuse->cache[idx];
+    unsigned long long now;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    if (cache->valid && (offset > 0 || now < cache->expires))
+        return 0;
+
+    cache->valid = false;
+    cache->len = 0;
+    cache->truncated = false;
+
+    if (lxcProcFiles[idx].render(fuse, cache) < 0)
+        return -1;
+
+    if (cache->truncated) {
+        VIR_WARN("Rendered %s does not fit in %zu bytes",
+                 lxcProcFiles[idx].path, cache->size);
+        return -1;
+    }
+
+    cache->valid = true;
+    cache->expires = now + LXC_FUSE_CACHE_TTL;
+    return 0;
+}
+
+static int lxcProcRead(const char *path,
+                       char *buf,
+                       size_t size,
+                       off_t offset,
                        struct fuse_file_info *fi ATTRIBUTE_UNUSED)
 {
-    int res = -ENOENT;
-    char *hostpath = NULL;
-    struct fuse_context *context = NULL;
-    virDomainDefPtr def = NULL;
+    int res;
+    int idx;
+    struct fuse_context *context = fuse_get_context();
+    virLXCFusePtr fuse = context->private_data;
+    virLXCFuseCachePtr cache;
 
-    if (virAsprintf(&hostpath, "/proc/%s", path) < 0)
-        return -errno;
+    if ((idx = lxcProcLookup(path)) < 0)
+        return -ENOENT;
+    cache = &fuse->cache[idx];
 
-    context = fuse_get_context();
-    def = (virDomainDefPtr)context->private_data;
+    virMutexLock(&cache->lock);
+    if (lxcProcRefresh(fuse, idx, offset) < 0) {
+        virMutexUnlock(&cache->lock);
+        virResetLastError();
+        return lxcProcHostRead(lxcProcFiles[idx].hostpath, buf, size, offset);
+    }
 
-    if (STREQ(path, fuse_meminfo_path)) {
-        if ((res = lxcProcReadMeminfo(hostpath, def, buf, size, offset)) < 0)
-            res = lxcProcHostRead(hostpath, buf, size, offset);
+    if (offset >= cache->len) {
+        res = 0;
+    } else {
+        res = MIN(size, cache->len - offset);
+        memcpy(buf, cache->data + offset, res);
     }
+    virMutexUnlock(&cache->lock);
 
-    VIR_FREE(hostpath);
     return res;
 }
 
@@ -261,6 +795,52 @@ static struct fuse_operations lxcProcOper = {
     .read    = lxcProcRead,
 };
 
+static void lxcFuseFreeCache(virLXCFusePtr fuse, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        virMutexDestroy(&fuse->cache[i].lock);
+        VIR_FREE(fuse->cache[i].host);
+        VIR_FREE(fuse->cache[i].data);
+        VIR_FREE(fuse->cache[i].disks);
+    }
+    VIR_FREE(fuse->cache);
+}
+
+static int lxcFuseAllocCache(virLXCFusePtr fuse)
+{
+    size_t i;
+
+    if (VIR_ALLOC_N(fuse->cache, ARRAY_CARDINALITY(lxcProcFiles)) < 0)
+        return -1;
+
+    for (i = 0; i < ARRAY_CARDINALITY(lxcProcFiles); i++) {
+        virLXCFuseCachePtr cache = &fuse->cache[i];
+
+        if (virMutexInit(&cache->lock) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to initialize mutex"));
+            goto error;
+        }
+
+        cache->size = lxcProcFiles[i].size;
+        if (VIR_ALLOC_N(cache->host, cache->size) < 0 ||
+            VIR_ALLOC_N(cache->data, cache->size) < 0 ||
+            (lxcProcFiles[i].render == lxcProcRenderDiskstats &&
+             VIR_ALLOC_N(cache->disks, LXC_FUSE_MAX_DISKS) < 0)) {
+            i++;
+            goto error;
+        }
+    }
+
+    return 0;
+
+ error:
+    lxcFuseFreeCache(fuse, i);
+    return -1;
+}
+
 static void lxcFuseDestroy(virLXCFusePtr fuse)
 {
     virMutexLock(&fuse->lock);
@@ -274,9 +854,11 @@ static void lxcFuseRun(void *opaque)
 {
     virLXCFusePtr fuse = opaque;
 
-    if (fuse_loop(fuse->fuse) < 0)
+    /* Agents in the container poll these files concurrently, and a
+     * refresh of one file must not hold up reads of another. */
+    if (fuse_loop_mt(fuse->fuse) < 0)
         virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("fuse_loop failed"));
+                       _("fuse_loop_mt failed"));
 
     lxcFuseDestroy(fuse);
 }
@@ -295,6 +877,12 @@ int lxcSetupFuse(virLXCFusePtr *f, virDomainDefPtr def)
     if (virMutexInit(&fuse->lock) < 0)
         goto cleanup2;
 
+    if (virTimeMillisNow(&fuse->started) < 0)
+        goto cleanup1;
+
+    if (lxcFuseAllocCache(fuse) < 0)
+        goto cleanup1;
+
     if (virAsprintf(&fuse->mountpoint, "%s/%s.fuse/", LXC_STATE_DIR,
                     def->name) < 0)
         goto cleanup1;
@@ -317,7 +905,7 @@ int lxcSetupFuse(virLXCFusePtr *f, virDomainDefPtr def)
         goto cleanup1;
 
     fuse->fuse = fuse_new(fuse->ch, &args, &lxcProcOper,
-                          sizeof(lxcProcOper), fuse->def);
+                          sizeof(lxcProcOper), fuse);
     if (fuse->fuse == NULL) {
         fuse_unmount(fuse->mountpoint, fuse->ch);
         goto cleanup1;
@@ -330,6 +918,8 @@ int lxcSetupFuse(virLXCFusePtr *f, virDomainDefPtr def)
     return ret;
  cleanup1:
     VIR_FREE(fuse->mountpoint);
+    if (fuse->cache)
+        lxcFuseFreeCache(fuse, LXC_FUSE_NFILES);
     virMutexDestroy(&fuse->lock);
  cleanup2:
     VIR_FREE(fuse);
@@ -338,11 +928,12 @@ int lxcSetupFuse(virLXCFusePtr *f, virDomainDefPtr def)
 
 int lxcStartFuse(virLXCFusePtr fuse)
 {
-    if (virThreadCreate(&fuse->thread, false, lxcFuseRun,
+    if (virThreadCreate(&fuse->thread, true, lxcFuseRun,
                         (void *)fuse) < 0) {
         lxcFuseDestroy(fuse);
         return -1;
     }
+    fuse->running = true;
 
     return 0;
 }
@@ -354,11 +945,29 @@ void lxcFreeFuse(virLXCFusePtr *f)
     if (fuse) {
         /* exit fuse_loop, lxcFuseRun thread may try to destroy
          * fuse->fuse at the same time,so add a lock here. */
+        bool wake = false;
+        int fd;
+
         virMutexLock(&fuse->lock);
-        if (fuse->fuse)
+        if (fuse->fuse) {
             fuse_exit(fuse->fuse);
+            wake = true;
+        }
         virMutexUnlock(&fuse->lock);
 
+        /* The workers only notice fuse_exit once they got a request,
+         * opening the mount point sends one. The caches must outlive
+         * every worker, so wait for fuse_loop_mt to return. */
+        if (wake &&
+            (fd = open(fuse->mountpoint, O_RDONLY | O_DIRECTORY)) >= 0)
+            VIR_FORCE_CLOSE(fd);
+        if (fuse->running) {
+            virThreadJoin(&fuse->thread);
+            fuse->running = false;
+        }
+
+        virCgroupFree(&fuse->cgroup);
+        lxcFuseFreeCache(fuse, LXC_FUSE_NFILES);
         VIR_FREE(fuse->mountpoint);
         VIR_FREE(*f);
     }
@@ -47,13 +47,23 @@ struct virLXCMeminfo {
 };
 typedef struct virLXCMeminfo *virLXCMeminfoPtr;
 
+/* Number of files served under the fuse mount point */
+# define LXC_FUSE_NFILES 5
+
+typedef struct _virLXCFuseCache virLXCFuseCache;
+typedef virLXCFuseCache *virLXCFuseCachePtr;
+
 struct virLXCFuse {
     virDomainDefPtr def;
     virThread thread;
+    bool running;               /* @thread is to be joined */
     char *mountpoint;
     struct fuse *fuse;
     struct fuse_chan *ch;
     virMutex lock;
+    virCgroupPtr cgroup;        /* opened on first use, protected by lock */
+    unsigned long long started; /* container start, ms since the epoch */
+    virLXCFuseCachePtr cache;   /* one per served file */
 };
 typedef struct virLXCFuse *virLXCFusePtr;
 
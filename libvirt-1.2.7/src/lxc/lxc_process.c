@@ -1032,6 +1032,9 @@ int virLXCProcessStart(virConnectPtr conn,
     virLXCDriverConfigPtr cfg = virLXCDriverGetConfig(driver);
     virCgroupPtr selfcgroup;
     int status;
+    virLXCStartTimer timer;
+
+    virLXCStartTimerInit(&timer, vm->def->name);
 
     if (virCgroupNewSelf(&selfcgroup) < 0)
         return -1;
@@ -1114,11 +1117,13 @@ int virLXCProcessStart(virConnectPtr conn,
 
     if (virLXCProcessEnsureRootFS(vm) < 0)
         goto cleanup;
+    virLXCStartTimerPhase(&timer, "prepare");
 
     /* Must be run before security labelling */
     VIR_DEBUG("Preparing host devices");
     if (virLXCPrepareHostDevices(driver, vm->def) < 0)
         goto cleanup;
+    virLXCStartTimerPhase(&timer, "hostdevs");
 
     /* Here we open all the PTYs we need on the host OS side.
      * The LXC controller will open the guest OS side PTYs
@@ -1147,6 +1152,7 @@ int virLXCProcessStart(virConnectPtr conn,
     if (virSecurityManagerSetAllLabel(driver->securityManager,
                                       vm->def, NULL) < 0)
         goto cleanup;
+    virLXCStartTimerPhase(&timer, "security");
 
     for (i = 0; i < vm->def->nconsoles; i++) {
         char *ttyPath;
@@ -1170,8 +1176,11 @@ int virLXCProcessStart(virConnectPtr conn,
             goto cleanup;
     }
 
+    virLXCStartTimerPhase(&timer, "consoles");
+
     if (virLXCProcessSetupInterfaces(conn, vm->def, &nveths, &veths) < 0)
         goto cleanup;
+    virLXCStartTimerPhase(&timer, "interfaces");
 
     /* Save the configuration for the controller */
     if (virDomainSaveConfig(cfg->stateDir, vm->def) < 0)
@@ -1234,9 +1243,12 @@ int virLXCProcessStart(virConnectPtr conn,
         VIR_WARN("Unable to seek to end of logfile: %s",
                  virStrerror(errno, ebuf, sizeof(ebuf)));
 
+    virLXCStartTimerPhase(&timer, "controller-setup");
+
     virCommandRawStatus(cmd);
     if (virCommandRun(cmd, &status) < 0)
         goto cleanup;
+    virLXCStartTimerPhase(&timer, "controller-spawn");
 
     if (status != 0) {
         if (virLXCProcessReadLogOutput(vm, logfile, pos, ebuf,
@@ -1284,6 +1296,7 @@ int virLXCProcessStart(virConnectPtr conn,
                                  cfg->stateDir, vm->def->name);
         goto cleanup;
     }
+    virLXCStartTimerPhase(&timer, "monitor");
 
     if (virCgroupNewDetectMachine(vm->def->name, "lxc", vm->pid,
                                   vm->def->resource ?
@@ -1318,6 +1331,7 @@ int virLXCProcessStart(virConnectPtr conn,
 
         goto error;
     }
+    virLXCStartTimerPhase(&timer, "container-handshake");
 
     if (autoDestroy &&
         virCloseCallbacksSet(driver->closeCallbacks, vm,
@@ -1356,6 +1370,8 @@ int virLXCProcessStart(virConnectPtr conn,
         if (hookret < 0)
             goto error;
     }
+    virLXCStartTimerPhase(&timer, "finish");
+    virLXCStartTimerReport(&timer, "startup");
 
     rc = 0;
 
@@ -1419,6 +1435,11 @@ int virLXCProcessStart(virConnectPtr conn,
 struct virLXCProcessAutostartData {
     virLXCDriverPtr driver;
     virConnectPtr conn;
+
+    /* Domains to start, each holding a reference */
+    virDomainObjPtr *vms;
+    size_t nvms;
+    int next; /* index of the next domain to pick, atomic */
 };
 
 static int
@@ -1454,6 +1475,37 @@ virLXCProcessAutostartDomain(virDomainObjPtr vm,
 }
 
 
+static int
+virLXCProcessAutostartCollect(virDomainObjPtr vm,
+                              void *opaque)
+{
+    struct virLXCProcessAutostartData *data = opaque;
+    int ret = 0;
+
+    virObjectLock(vm);
+    if (vm->autostart &&
+        !virDomainObjIsActive(vm)) {
+        if (VIR_APPEND_ELEMENT(data->vms, data->nvms, vm) < 0)
+            ret = -1;
+        else
+            virObjectRef(vm);
+    }
+    virObjectUnlock(vm);
+    return ret;
+}
+
+
+static void
+virLXCProcessAutostartWorker(void *opaque)
+{
+    struct virLXCProcessAutostartData *data = opaque;
+    size_t i;
+
+    while ((i = virAtomicIntInc(&data->next)) <= data->nvms)
+        ignore_value(virLXCProcessAutostartDomain(data->vms[i - 1], data));
+}
+
+
 void
 virLXCProcessAutostartAll(virLXCDriverPtr driver)
 {
@@ -1465,12 +1517,43 @@ virLXCProcessAutostartAll(virLXCDriverPtr driver)
     virConnectPtr conn = virConnectOpen("lxc:///");
     /* Ignoring NULL conn which is mostly harmless here */
 
-    struct virLXCProcessAutostartData data = { driver, conn };
+    struct virLXCProcessAutostartData data = { driver, conn, NULL, 0, 0 };
+    virLXCDriverConfigPtr cfg = virLXCDriverGetConfig(driver);
+    virThreadPtr workers = NULL;
+    size_t nworkers;
+    size_t i;
 
     virDomainObjListForEach(driver->domains,
-                            virLXCProcessAutostartDomain,
+                            virLXCProcessAutostartCollect,
                             &data);
 
+    /* Containers are independent of each other, so bring them up
+     * concurrently; the calling thread always takes part too */
+    nworkers = MIN(cfg->autostartWorkers, data.nvms);
+    if (nworkers > 1 && VIR_ALLOC_N(workers, nworkers - 1) < 0)
+        nworkers = 1;
+
+    for (i = 0; i + 1 < nworkers; i++) {
+        if (virThreadCreate(&workers[i], true,
+                            virLXCProcessAutostartWorker, &data) < 0) {
+            VIR_WARN("Unable to create autostart worker thread");
+            break;
+        }
+    }
+    nworkers = i;
+
+    VIR_DEBUG("Autostarting %zu domains with %zu extra workers",
+              data.nvms, nworkers);
+    virLXCProcessAutostartWorker(&data);
+
+    for (i = 0; i < nworkers; i++)
+        virThreadJoin(&workers[i]);
+
+    for (i = 0; i < data.nvms; i++)
+        virObjectUnref(data.vms[i]);
+    VIR_FREE(data.vms);
+    VIR_FREE(workers);
+    virObjectUnref(cfg);
     virObjectUnref(conn);
 }
 
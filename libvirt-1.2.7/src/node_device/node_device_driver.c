@@ -243,52 +243,85 @@ nodeDeviceLookupByName(virConnectPtr conn, const char *name)
 }
 
 
-virNodeDevicePtr
-nodeDeviceLookupSCSIHostByWWN(virConnectPtr conn,
-                              const char *wwnn,
-                              const char *wwpn,
-                              unsigned int flags)
+/* Look for the fc_host with the given WWNs. Reading the fc_host
+ * attributes from sysfs is what makes the lookup slow with many HBAs,
+ * so unless @refreshAll is set only hosts whose cached WWNs are missing
+ * or match are refreshed.
+ *
+ * Returns 1 and sets @dev if found, 0 if not, -1 on error. */
+static int
+nodeDeviceFindSCSIHostByWWN(virConnectPtr conn,
+                            virNodeDeviceObjListPtr devs,
+                            const char *wwnn,
+                            const char *wwpn,
+                            bool refreshAll,
+                            virNodeDevicePtr *dev)
 {
     size_t i;
-    virNodeDeviceDriverStatePtr driver = conn->nodeDevicePrivateData;
-    virNodeDeviceObjListPtr devs = &driver->devs;
     virNodeDevCapsDefPtr cap = NULL;
     virNodeDeviceObjPtr obj = NULL;
-    virNodeDevicePtr dev = NULL;
-
-    virCheckFlags(0, NULL);
-
-    nodeDeviceLock(driver);
+    int ret = 0;
 
-    for (i = 0; i < devs->count; i++) {
+    for (i = 0; i < devs->count && ret == 0; i++) {
         obj = devs->objs[i];
         virNodeDeviceObjLock(obj);
-        cap = obj->def->caps;
 
-        while (cap) {
-            if (cap->type == VIR_NODE_DEV_CAP_SCSI_HOST) {
+        for (cap = obj->def->caps; cap; cap = cap->next) {
+            if (cap->type != VIR_NODE_DEV_CAP_SCSI_HOST)
+                continue;
+
+            if (refreshAll ||
+                !cap->data.scsi_host.wwnn ||
+                !cap->data.scsi_host.wwpn ||
+                (STREQ(cap->data.scsi_host.wwnn, wwnn) &&
+                 STREQ(cap->data.scsi_host.wwpn, wwpn)))
                 detect_scsi_host_caps(&cap->data);
-                if (cap->data.scsi_host.flags &
-                    VIR_NODE_DEV_CAP_FLAG_HBA_FC_HOST) {
-                    if (STREQ(cap->data.scsi_host.wwnn, wwnn) &&
-                        STREQ(cap->data.scsi_host.wwpn, wwpn)) {
-
-                        if (virNodeDeviceLookupSCSIHostByWWNEnsureACL(conn, obj->def) < 0)
-                            goto out;
-
-                        dev = virGetNodeDevice(conn, obj->def->name);
-                        virNodeDeviceObjUnlock(obj);
-                        goto out;
-                    }
-                }
+
+            if ((cap->data.scsi_host.flags &
+                 VIR_NODE_DEV_CAP_FLAG_HBA_FC_HOST) &&
+                cap->data.scsi_host.wwnn &&
+                cap->data.scsi_host.wwpn &&
+                STREQ(cap->data.scsi_host.wwnn, wwnn) &&
+                STREQ(cap->data.scsi_host.wwpn, wwpn)) {
+                if (virNodeDeviceLookupSCSIHostByWWNEnsureACL(conn,
+                                                              obj->def) < 0 ||
+                    !(*dev = virGetNodeDevice(conn, obj->def->name)))
+                    ret = -1;
+                else
+                    ret = 1;
+                break;
             }
-            cap = cap->next;
         }
 
         virNodeDeviceObjUnlock(obj);
     }
 
- out:
+    return ret;
+}
+
+
+virNodeDevicePtr
+nodeDeviceLookupSCSIHostByWWN(virConnectPtr conn,
+                              const char *wwnn,
+                              const char *wwpn,
+                              unsigned int flags)
+{
+    virNodeDeviceDriverStatePtr driver = conn->nodeDevicePrivateData;
+    virNodeDevicePtr dev = NULL;
+    int rc;
+
+    virCheckFlags(0, NULL);
+
+    nodeDeviceLock(driver);
+
+    /* The WWNs of a host skipped by the first pass may have changed
+     * since they were cached, refresh all of them before giving up */
+    rc = nodeDeviceFindSCSIHostByWWN(conn, &driver->devs, wwnn, wwpn,
+                                     false, &dev);
+    if (rc == 0)
+        ignore_value(nodeDeviceFindSCSIHostByWWN(conn, &driver->devs,
+                                                 wwnn, wwpn, true, &dev));
+
     nodeDeviceUnlock(driver);
     return dev;
 }
@@ -505,20 +505,19 @@ dev_create(const char *udi)
     if (def->caps == NULL)
         goto cleanup;
 
-    /* Some devices don't have a path in sysfs, so ignore failure */
+    /* Some devices don't have a path in sysfs, so ignore failure.
+     * Set it before the def is added so that it gets indexed. */
     (void)get_str_prop(ctx, udi, "linux.sysfs_path", &devicePath);
+    def->sysfs_path = devicePath;
 
     dev = virNodeDeviceAssignDef(&driverState->devs,
                                  def);
 
-    if (!dev) {
-        VIR_FREE(devicePath);
+    if (!dev)
         goto failure;
-    }
 
     dev->privateData = privData;
     dev->privateFree = free_udi;
-    dev->def->sysfs_path = devicePath;
 
     virNodeDeviceObjUnlock(dev);
 
@@ -1431,6 +1431,20 @@ static int udevAddOneDevice(struct udev_device *device)
         goto out;
     }
 
+    /* A change event can alter the generated name, e.g. when a net
+     * interface is renamed. Drop the entry under the old name rather
+     * than leaving a stale duplicate for the same sysfs path. */
+    if ((dev = virNodeDeviceFindBySysfsPath(&driverState->devs,
+                                            def->sysfs_path))) {
+        if (STRNEQ(dev->def->name, def->name)) {
+            VIR_DEBUG("Device '%s' renamed to '%s'",
+                      dev->def->name, def->name);
+            virNodeDeviceObjRemove(&driverState->devs, dev);
+        } else {
+            virNodeDeviceObjUnlock(dev);
+        }
+    }
+
     /* If this is a device change, the old definition will be freed
      * and the current definition will take its place. */
     dev = virNodeDeviceAssignDef(&driverState->devs, def);
@@ -1580,6 +1594,11 @@ static void udevEventHandleCallback(int watch ATTRIBUTE_UNUSED,
     action = udev_device_get_action(device);
     VIR_DEBUG("udev action: '%s'", action);
 
+    /* Bus numbers and bridges may have changed as well */
+    if ((STREQ(action, "add") || STREQ(action, "remove")) &&
+        STREQ_NULLABLE(udev_device_get_subsystem(device), "pci"))
+        virPCITopologyInvalidate();
+
     if (STREQ(action, "add") || STREQ(action, "change")) {
         udevAddOneDevice(device);
         goto out;
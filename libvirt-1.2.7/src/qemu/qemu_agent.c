@@ -80,6 +80,12 @@ struct _qemuAgentMessage {
      * fatal error occurred on the monitor channel
      */
     bool finished;
+
+    /* Non-zero for guest-sync, whose reply must return this ID;
+     * replies received before it are stale ones */
+    unsigned long long syncID;
+
+    qemuAgentMessagePtr next;
 };
 
 
@@ -97,10 +103,15 @@ struct _qemuAgent {
 
     qemuAgentCallbacksPtr cb;
 
-    /* If there's a command being processed this will be
-     * non-NULL */
+    /* Messages being sent or waiting for their reply, in the
+     * order they are written to the channel, which is also the
+     * order the agent replies in */
     qemuAgentMessagePtr msg;
 
+    /* True once guest-sync succeeded and no command failed or
+     * timed out since, so that no stale reply can be pending */
+    bool inSync;
+
     /* Buffer incoming data ready for Agent monitor
      * code to process & find message boundaries */
     size_t bufferOffset;
@@ -155,6 +166,45 @@ qemuAgentEscapeNonPrintable(const char *text)
 #endif
 
 
+/* The message the next reply belongs to: the oldest one still
+ * waiting for a reply, provided it was completely written */
+static qemuAgentMessagePtr
+qemuAgentPendingMessage(qemuAgentPtr mon)
+{
+    qemuAgentMessagePtr msg = mon->msg;
+
+    while (msg && msg->finished)
+        msg = msg->next;
+
+    if (msg && msg->txOffset == msg->txLength)
+        return msg;
+    return NULL;
+}
+
+/* The oldest message not yet completely written */
+static qemuAgentMessagePtr
+qemuAgentTransmitMessage(qemuAgentPtr mon)
+{
+    qemuAgentMessagePtr msg;
+
+    for (msg = mon->msg; msg; msg = msg->next) {
+        if (msg->txOffset < msg->txLength)
+            return msg;
+    }
+    return NULL;
+}
+
+/* Wake up everybody waiting for a reply which will never come */
+static void
+qemuAgentFinishMessages(qemuAgentPtr mon)
+{
+    qemuAgentMessagePtr msg;
+
+    for (msg = mon->msg; msg; msg = msg->next)
+        msg->finished = 1;
+    virCondBroadcast(&mon->notify);
+}
+
 static void qemuAgentDispose(void *obj)
 {
     qemuAgentPtr mon = obj;
@@ -300,10 +350,10 @@ qemuAgentIOProcessEvent(qemuAgentPtr mon,
 
 static int
 qemuAgentIOProcessLine(qemuAgentPtr mon,
-                       const char *line,
-                       qemuAgentMessagePtr msg)
+                       const char *line)
 {
     virJSONValuePtr obj = NULL;
+    qemuAgentMessagePtr msg;
     int ret = -1;
     unsigned long long id;
 
@@ -324,26 +374,36 @@ qemuAgentIOProcessLine(qemuAgentPtr mon,
         ret = qemuAgentIOProcessEvent(mon, obj);
     } else if (virJSONValueObjectHasKey(obj, "error") == 1 ||
                virJSONValueObjectHasKey(obj, "return") == 1) {
-        if (msg) {
+        msg = qemuAgentPendingMessage(mon);
+        if (msg && msg->syncID &&
+            virJSONValueObjectHasKey(obj, "return") == 1 &&
+            (virJSONValueObjectGetNumberUlong(obj, "return", &id) < 0 ||
+             id != msg->syncID)) {
+            /* Late reply to a command we stopped waiting for, the
+             * one to our guest-sync is still to come */
+            VIR_DEBUG("Ignoring stale reply while waiting for guest-sync "
+                      "%llu: %s", msg->syncID, line);
+            ret = 0;
+        } else if (msg) {
             msg->rxObject = obj;
             msg->finished = 1;
             obj = NULL;
             ret = 0;
-        } else {
+        } else if (!mon->inSync ||
+                   virJSONValueObjectGetNumberUlong(obj, "return", &id) == 0) {
             /* If we've received something like:
              *  {"return": 1234}
              * it is likely that somebody started GA
              * which is now processing our previous
-             * guest-sync commands. Check if this is
-             * the case and don't report an error but
-             * return silently.
+             * guest-sync commands. Similarly, a command
+             * we gave up waiting for may reply late.
+             * Either way the channel gets synchronized
+             * again before the next command, so don't
+             * report an error but return silently.
              */
-            if (virJSONValueObjectGetNumberUlong(obj, "return", &id) == 0) {
-                VIR_DEBUG("Ignoring delayed reply to guest-sync: %llu", id);
-                ret = 0;
-                goto cleanup;
-            }
-
+            VIR_DEBUG("Ignoring delayed reply: %s", line);
+            ret = 0;
+        } else {
             virReportError(VIR_ERR_INTERNAL_ERROR,
                            _("Unexpected JSON reply '%s'"), line);
         }
@@ -359,8 +419,7 @@ qemuAgentIOProcessLine(qemuAgentPtr mon,
 
 static int qemuAgentIOProcessData(qemuAgentPtr mon,
                                   char *data,
-                                  size_t len,
-                                  qemuAgentMessagePtr msg)
+                                  size_t len)
 {
     int used = 0;
     size_t i = 0;
@@ -381,7 +440,7 @@ static int qemuAgentIOProcessData(qemuAgentPtr mon,
             int got = nl - (data + used);
             for (i = 0; i < strlen(LINE_ENDING); i++)
                 data[used + got + i] = '\0';
-            if (qemuAgentIOProcessLine(mon, data + used, msg) < 0) {
+            if (qemuAgentIOProcessLine(mon, data + used) < 0) {
                 return -1;
             }
             used += got + strlen(LINE_ENDING);
@@ -402,15 +461,12 @@ static int
 qemuAgentIOProcess(qemuAgentPtr mon)
 {
     int len;
-    qemuAgentMessagePtr msg = NULL;
 
+#if DEBUG_IO
     /* See if there's a message ready for reply; that is,
      * one that has completed writing all its data.
      */
-    if (mon->msg && mon->msg->txOffset == mon->msg->txLength)
-        msg = mon->msg;
-
-#if DEBUG_IO
+    qemuAgentMessagePtr msg = qemuAgentPendingMessage(mon);
 # if DEBUG_RAW_IO
     char *str1 = qemuAgentEscapeNonPrintable(msg ? msg->txBuffer : "");
     char *str2 = qemuAgentEscapeNonPrintable(mon->buffer);
@@ -424,8 +480,7 @@ qemuAgentIOProcess(qemuAgentPtr mon)
 #endif
 
     len = qemuAgentIOProcessData(mon,
-                                 mon->buffer, mon->bufferOffset,
-                                 msg);
+                                 mon->buffer, mon->bufferOffset);
 
     if (len < 0)
         return -1;
@@ -440,7 +495,8 @@ qemuAgentIOProcess(qemuAgentPtr mon)
 #if DEBUG_IO
     VIR_DEBUG("Process done %zu used %d", mon->bufferOffset, len);
 #endif
-    if (msg && msg->finished)
+    /* Replies to any number of queued messages may have arrived */
+    if (mon->msg)
         virCondBroadcast(&mon->notify);
     return len;
 }
@@ -482,15 +538,16 @@ qemuAgentIOConnect(qemuAgentPtr mon)
 static int
 qemuAgentIOWrite(qemuAgentPtr mon)
 {
+    qemuAgentMessagePtr msg = qemuAgentTransmitMessage(mon);
     int done;
 
     /* If no active message, or fully transmitted, then no-op */
-    if (!mon->msg || mon->msg->txOffset == mon->msg->txLength)
+    if (!msg)
         return 0;
 
     done = safewrite(mon->fd,
-                     mon->msg->txBuffer + mon->msg->txOffset,
-                     mon->msg->txLength - mon->msg->txOffset);
+                     msg->txBuffer + msg->txOffset,
+                     msg->txLength - msg->txOffset);
 
     if (done < 0) {
         if (errno == EAGAIN)
@@ -500,7 +557,7 @@ qemuAgentIOWrite(qemuAgentPtr mon)
                              _("Unable to write to monitor"));
         return -1;
     }
-    mon->msg->txOffset += done;
+    msg->txOffset += done;
     return done;
 }
 
@@ -565,7 +622,7 @@ static void qemuAgentUpdateWatch(qemuAgentPtr mon)
     if (mon->lastError.code == VIR_ERR_OK) {
         events |= VIR_EVENT_HANDLE_READABLE;
 
-        if (mon->msg && mon->msg->txOffset < mon->msg->txLength)
+        if (qemuAgentTransmitMessage(mon))
             events |= VIR_EVENT_HANDLE_WRITABLE;
     }
 
@@ -665,12 +722,10 @@ qemuAgentIO(int watch, int fd, int events, void *opaque)
         }
 
         VIR_DEBUG("Error on monitor %s", NULLSTR(mon->lastError.message));
-        /* If IO process resulted in an error & we have a message,
-         * then wakeup that waiter */
-        if (mon->msg && !mon->msg->finished) {
-            mon->msg->finished = 1;
-            virCondSignal(&mon->notify);
-        }
+        /* If IO process resulted in an error & we have messages,
+         * then wakeup their waiters */
+        if (mon->msg)
+            qemuAgentFinishMessages(mon);
     }
 
     qemuAgentUpdateWatch(mon);
@@ -806,10 +861,8 @@ void qemuAgentClose(qemuAgentPtr mon)
 
     /* If there is somebody waiting for a message
      * wake him up. No message will arrive anyway. */
-    if (mon->msg && !mon->msg->finished) {
-        mon->msg->finished = 1;
-        virCondSignal(&mon->notify);
-    }
+    if (mon->msg)
+        qemuAgentFinishMessages(mon);
     virObjectUnlock(mon);
 
     virObjectUnref(mon);
@@ -817,14 +870,29 @@ void qemuAgentClose(qemuAgentPtr mon)
 
 #define QEMU_AGENT_WAIT_TIME 5
 
+/* Whether all messages from @first to @last got their reply */
+static bool
+qemuAgentMessagesFinished(qemuAgentMessagePtr first,
+                          qemuAgentMessagePtr last)
+{
+    for (; first; first = first->next) {
+        if (!first->finished)
+            return false;
+        if (first == last)
+            break;
+    }
+    return true;
+}
+
 /**
  * qemuAgentSend:
  * @mon: Monitor
- * @msg: Message
+ * @msg: Message, or first of a list of messages linked by ->next
  * @seconds: number of seconds to wait for the result, it can be either
  *           -2, -1, 0 or positive.
  *
- * Send @msg to agent @mon. If @seconds is equal to
+ * Send @msg and any messages following it to agent @mon all at once,
+ * and wait for all their replies. If @seconds is equal to
  * VIR_DOMAIN_QEMU_AGENT_COMMAND_BLOCK(-2), this function will block forever
  * waiting for the result. The value of
  * VIR_DOMAIN_QEMU_AGENT_COMMAND_DEFAULT(-1) means use default timeout value
@@ -842,6 +910,8 @@ static int qemuAgentSend(qemuAgentPtr mon,
 {
     int ret = -1;
     unsigned long long then = 0;
+    qemuAgentMessagePtr last;
+    qemuAgentMessagePtr *tail;
 
     /* Check whether qemu quit unexpectedly */
     if (mon->lastError.code != VIR_ERR_OK) {
@@ -860,10 +930,17 @@ static int qemuAgentSend(qemuAgentPtr mon,
         then = now + seconds * 1000ull;
     }
 
-    mon->msg = msg;
+    for (last = msg; last->next; last = last->next)
+        ;
+
+    /* Queue behind any messages still in flight */
+    tail = &mon->msg;
+    while (*tail)
+        tail = &(*tail)->next;
+    *tail = msg;
     qemuAgentUpdateWatch(mon);
 
-    while (!mon->msg->finished) {
+    while (!qemuAgentMessagesFinished(msg, last)) {
         if ((then && virCondWaitUntil(&mon->notify, &mon->parent.lock, then) < 0) ||
             (!then && virCondWait(&mon->notify, &mon->parent.lock) < 0)) {
             if (errno == ETIMEDOUT) {
@@ -889,7 +966,17 @@ static int qemuAgentSend(qemuAgentPtr mon,
     ret = 0;
 
  cleanup:
-    mon->msg = NULL;
+    /* Any reply still to come for these messages would be taken
+     * for the reply to the next command */
+    if (ret < 0)
+        mon->inSync = false;
+
+    /* Dequeue our messages, keeping those queued after them */
+    tail = &mon->msg;
+    while (*tail != msg)
+        tail = &(*tail)->next;
+    *tail = last->next;
+    last->next = NULL;
     qemuAgentUpdateWatch(mon);
 
     return ret;
@@ -926,6 +1013,7 @@ qemuAgentGuestSync(qemuAgentPtr mon)
         return -1;
 
     sync_msg.txLength = strlen(sync_msg.txBuffer);
+    sync_msg.syncID = id;
 
     VIR_DEBUG("Sending guest-sync command with ID: %llu", id);
 
@@ -1076,42 +1164,76 @@ qemuAgentCheckError(virJSONValuePtr cmd,
     return 0;
 }
 
+/**
+ * qemuAgentCommands:
+ * @mon: Agent
+ * @cmds: array of @ncmds commands
+ * @replies: array of @ncmds replies, to be freed by the caller
+ * @ncmds: number of commands
+ * @needReply: whether a reply is required even if an event is awaited
+ * @seconds: how long to wait for the replies, see qemuAgentSend
+ *
+ * Write all @cmds to the channel at once and wait for their replies,
+ * which the agent sends in order. A guest-sync round trip is only
+ * done first if no command was sent since the agent was opened or the
+ * last one failed, since only then stale replies may be pending.
+ *
+ * Returns: 0 on success,
+ *          -2 on timeout,
+ *          -1 otherwise, including if any command failed
+ */
 static int
-qemuAgentCommand(qemuAgentPtr mon,
-                 virJSONValuePtr cmd,
-                 virJSONValuePtr *reply,
-                 bool needReply,
-                 int seconds)
+qemuAgentCommands(qemuAgentPtr mon,
+                  virJSONValuePtr *cmds,
+                  virJSONValuePtr *replies,
+                  size_t ncmds,
+                  bool needReply,
+                  int seconds)
 {
     int ret = -1;
-    qemuAgentMessage msg;
+    qemuAgentMessagePtr msgs = NULL;
     char *cmdstr = NULL;
     int await_event = mon->await_event;
+    size_t i;
 
-    *reply = NULL;
+    memset(replies, 0, sizeof(*replies) * ncmds);
 
-    if (qemuAgentGuestSync(mon) < 0)
+    if (!mon->inSync) {
+        if (qemuAgentGuestSync(mon) < 0)
+            return -1;
+        mon->inSync = true;
+    }
+
+    if (VIR_ALLOC_N(msgs, ncmds) < 0)
         return -1;
 
-    memset(&msg, 0, sizeof(msg));
+    for (i = 0; i < ncmds; i++) {
+        if (!(cmdstr = virJSONValueToString(cmds[i], false)))
+            goto cleanup;
+        if (virAsprintf(&msgs[i].txBuffer, "%s" LINE_ENDING, cmdstr) < 0)
+            goto cleanup;
+        msgs[i].txLength = strlen(msgs[i].txBuffer);
+        if (i > 0)
+            msgs[i - 1].next = &msgs[i];
 
-    if (!(cmdstr = virJSONValueToString(cmd, false)))
-        goto cleanup;
-    if (virAsprintf(&msg.txBuffer, "%s" LINE_ENDING, cmdstr) < 0)
-        goto cleanup;
-    msg.txLength = strlen(msg.txBuffer);
+        VIR_DEBUG("Send command '%s' for write, seconds = %d",
+                  cmdstr, seconds);
+        VIR_FREE(cmdstr);
+    }
 
-    VIR_DEBUG("Send command '%s' for write, seconds = %d", cmdstr, seconds);
+    ret = qemuAgentSend(mon, msgs, seconds);
 
-    ret = qemuAgentSend(mon, &msg, seconds);
+    VIR_DEBUG("Receive command replies ret=%d", ret);
 
-    VIR_DEBUG("Receive command reply ret=%d rxObject=%p",
-              ret, msg.rxObject);
+    /* Commands which are answered by an event may still reply
+     * once the event was seen, so don't trust the channel */
+    if (await_event)
+        mon->inSync = false;
 
-    if (ret == 0) {
+    for (i = 0; ret == 0 && i < ncmds; i++) {
         /* If we haven't obtained any reply but we wait for an
          * event, then don't report this as error */
-        if (!msg.rxObject) {
+        if (!msgs[i].rxObject) {
             if (await_event && !needReply) {
                 VIR_DEBUG("Woken up by event %d", await_event);
             } else {
@@ -1120,18 +1242,33 @@ qemuAgentCommand(qemuAgentPtr mon,
                 ret = -1;
             }
         } else {
-            *reply = msg.rxObject;
-            ret = qemuAgentCheckError(cmd, *reply);
+            replies[i] = msgs[i].rxObject;
+            msgs[i].rxObject = NULL;
+            ret = qemuAgentCheckError(cmds[i], replies[i]);
         }
     }
 
  cleanup:
+    for (i = 0; i < ncmds; i++) {
+        VIR_FREE(msgs[i].txBuffer);
+        virJSONValueFree(msgs[i].rxObject);
+    }
+    VIR_FREE(msgs);
     VIR_FREE(cmdstr);
-    VIR_FREE(msg.txBuffer);
 
     return ret;
 }
 
+static int
+qemuAgentCommand(qemuAgentPtr mon,
+                 virJSONValuePtr cmd,
+                 virJSONValuePtr *reply,
+                 bool needReply,
+                 int seconds)
+{
+    return qemuAgentCommands(mon, &cmd, reply, 1, needReply, seconds);
+}
+
 static virJSONValuePtr ATTRIBUTE_SENTINEL
 qemuAgentMakeCommand(const char *cmdname,
                      ...)
@@ -1264,14 +1401,18 @@ qemuAgentMakeStringsArray(const char **strings, unsigned int len)
 void qemuAgentNotifyEvent(qemuAgentPtr mon,
                           qemuAgentEvent event)
 {
+    qemuAgentMessagePtr msg = mon->msg;
+
     VIR_DEBUG("mon=%p event=%d", mon, event);
     if (mon->await_event == event) {
         VIR_DEBUG("Waking up a tragedian");
         mon->await_event = QEMU_AGENT_EVENT_NONE;
         /* somebody waiting for this event, wake him up. */
-        if (mon->msg && !mon->msg->finished) {
-            mon->msg->finished = 1;
-            virCondSignal(&mon->notify);
+        while (msg && msg->finished)
+            msg = msg->next;
+        if (msg) {
+            msg->finished = 1;
+            virCondBroadcast(&mon->notify);
         }
     } else {
         /* shouldn't happen but one never knows */
@@ -1462,6 +1603,118 @@ qemuAgentArbitraryCommand(qemuAgentPtr mon,
     return ret;
 }
 
+/* Commands the agent doesn't reply to, which would leave the replies
+ * to the commands after them matched with the wrong command */
+static const char *qemuAgentNoReplyCommands[] = {
+    "guest-shutdown",
+    "guest-suspend-disk",
+    "guest-suspend-ram",
+    "guest-suspend-hybrid",
+};
+
+/**
+ * qemuAgentArbitraryCommands:
+ * @mon: Agent
+ * @cmd_str: JSON array of commands
+ * @result: JSON array of their replies, in the same order
+ * @timeout: how long to wait for all the replies, see qemuAgentSend
+ *
+ * Like qemuAgentArbitraryCommand, but send all commands in @cmd_str
+ * to the agent at once instead of waiting for each reply before
+ * sending the next command. Commands the agent does not reply to
+ * can't be part of such a batch.
+ *
+ * Returns: 0 on success,
+ *          -2 on timeout,
+ *          -1 otherwise, including if any command failed
+ */
+int
+qemuAgentArbitraryCommands(qemuAgentPtr mon,
+                           const char *cmd_str,
+                           char **result,
+                           int timeout)
+{
+    int ret = -1;
+    virJSONValuePtr cmd = NULL;
+    virJSONValuePtr reply = NULL;
+    virJSONValuePtr *cmds = NULL;
+    virJSONValuePtr *replies = NULL;
+    int ncmds = 0;
+    size_t i;
+    size_t j;
+
+    *result = NULL;
+    if (timeout < VIR_DOMAIN_QEMU_AGENT_COMMAND_MIN) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("guest agent timeout '%d' is "
+                         "less than the minimum '%d'"),
+                       timeout, VIR_DOMAIN_QEMU_AGENT_COMMAND_MIN);
+        goto cleanup;
+    }
+
+    if (!(cmd = virJSONValueFromString(cmd_str)))
+        goto cleanup;
+
+    if (cmd->type != VIR_JSON_TYPE_ARRAY ||
+        (ncmds = virJSONValueArraySize(cmd)) <= 0) {
+        virReportError(VIR_ERR_INVALID_ARG, "%s",
+                       _("guest agent commands must be a non-empty array"));
+        ncmds = 0;
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(cmds, ncmds) < 0 ||
+        VIR_ALLOC_N(replies, ncmds) < 0 ||
+        !(reply = virJSONValueNewArray()))
+        goto cleanup;
+
+    for (i = 0; i < ncmds; i++) {
+        const char *name;
+
+        cmds[i] = virJSONValueArrayGet(cmd, i);
+        if (!(name = virJSONValueObjectGetString(cmds[i], "execute"))) {
+            virReportError(VIR_ERR_INVALID_ARG,
+                           _("guest agent command %zu has no 'execute'"), i);
+            goto cleanup;
+        }
+
+        for (j = 0; j < ARRAY_CARDINALITY(qemuAgentNoReplyCommands); j++) {
+            if (STREQ(name, qemuAgentNoReplyCommands[j])) {
+                virReportError(VIR_ERR_INVALID_ARG,
+                               _("guest agent command '%s' can't be sent "
+                                 "with other commands"), name);
+                goto cleanup;
+            }
+        }
+    }
+
+    if ((ret = qemuAgentCommands(mon, cmds, replies, ncmds,
+                                 true, timeout)) < 0)
+        goto cleanup;
+
+    for (i = 0; i < ncmds; i++) {
+        if (virJSONValueArrayAppend(reply, replies[i]) < 0) {
+            ret = -1;
+            goto cleanup;
+        }
+        replies[i] = NULL;
+    }
+
+    if (!(*result = virJSONValueToString(reply, false)))
+        ret = -1;
+
+ cleanup:
+    if (replies) {
+        for (i = 0; i < ncmds; i++)
+            virJSONValueFree(replies[i]);
+    }
+    VIR_FREE(replies);
+    VIR_FREE(cmds);
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
 int
 qemuAgentFSTrim(qemuAgentPtr mon,
                 unsigned long long minimum)
@@ -81,6 +81,10 @@ int qemuAgentArbitraryCommand(qemuAgentPtr mon,
                               const char *cmd,
                               char **result,
                               int timeout);
+int qemuAgentArbitraryCommands(qemuAgentPtr mon,
+                               const char *cmds,
+                               char **result,
+                               int timeout);
 int qemuAgentFSTrim(qemuAgentPtr mon,
                     unsigned long long minimum);
 
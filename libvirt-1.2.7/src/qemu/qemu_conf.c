@@ -58,6 +58,11 @@
 
 VIR_LOG_INIT("qemu.qemu_conf");
 
+VIR_ENUM_IMPL(qemuMigrationQueueOrder, QEMU_MIGRATION_QUEUE_LAST,
+              "fifo",
+              "smallest",
+              "largest");
+
 static virClassPtr virQEMUDriverConfigClass;
 static void virQEMUDriverConfigDispose(void *obj);
 
@@ -229,6 +234,8 @@ virQEMUDriverConfigPtr virQEMUDriverConfigNew(bool privileged)
 
     cfg->migrationPortMin = QEMU_MIGRATION_PORT_MIN;
     cfg->migrationPortMax = QEMU_MIGRATION_PORT_MAX;
+    cfg->migrationStatsInterval = 1000;
+    cfg->migrationQueueOrder = QEMU_MIGRATION_QUEUE_FIFO;
 
     /* For privileged driver, try and find hugetlbfs mounts automatically.
      * Non-privileged driver requires admin to create a dir for the
@@ -508,6 +515,35 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
         goto cleanup;
     }
 
+    /* Checked before storing it, a negative value would wrap around */
+    p = virConfGetValue(conf, "migration_stats_interval");
+    CHECK_TYPE("migration_stats_interval", VIR_CONF_LONG);
+    if (p) {
+        if (p->l < 50) {
+            virReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("%s: migration_stats_interval: interval must be "
+                             "at least 50 ms"),
+                           filename);
+            goto cleanup;
+        }
+        cfg->migrationStatsInterval = p->l;
+    }
+
+    GET_VALUE_LONG("max_concurrent_migrations", cfg->maxConcurrentMigrations);
+    GET_VALUE_LONG("migration_bandwidth_budget",
+                   cfg->migrationBandwidthBudget);
+
+    p = virConfGetValue(conf, "migration_queue_order");
+    CHECK_TYPE("migration_queue_order", VIR_CONF_STRING);
+    if (p && p->str &&
+        (cfg->migrationQueueOrder =
+         qemuMigrationQueueOrderTypeFromString(p->str)) < 0) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("%s: migration_queue_order: unknown order '%s'"),
+                       filename, p->str);
+        goto cleanup;
+    }
+
     p = virConfGetValue(conf, "user");
     CHECK_TYPE("user", VIR_CONF_STRING);
     if (p && p->str &&
@@ -576,6 +612,8 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
     GET_VALUE_BOOL("auto_dump_bypass_cache", cfg->autoDumpBypassCache);
     GET_VALUE_BOOL("auto_start_bypass_cache", cfg->autoStartBypassCache);
 
+    GET_VALUE_BOOL("snapshot_single_metadata_store", cfg->snapshotSingleStore);
+
     /* Some crazy backcompat. Back in the old days, this was just a pure
      * string. We must continue supporting it. These days however, this may be
      * an array of strings. */
@@ -639,6 +677,7 @@ int virQEMUDriverConfigLoadFile(virQEMUDriverConfigPtr cfg,
     GET_VALUE_BOOL("set_process_name", cfg->setProcessName);
     GET_VALUE_LONG("max_processes", cfg->maxProcesses);
     GET_VALUE_LONG("max_files", cfg->maxFiles);
+    GET_VALUE_LONG("max_concurrent_restores", cfg->maxConcurrentRestores);
 
     GET_VALUE_STR("lock_manager", cfg->lockManagerName);
 
@@ -63,6 +63,16 @@ typedef virQEMUDriver *virQEMUDriverPtr;
 typedef struct _virQEMUDriverConfig virQEMUDriverConfig;
 typedef virQEMUDriverConfig *virQEMUDriverConfigPtr;
 
+/* Which waiting outgoing migration gets the next free slot */
+typedef enum {
+    QEMU_MIGRATION_QUEUE_FIFO,
+    QEMU_MIGRATION_QUEUE_SMALLEST,
+    QEMU_MIGRATION_QUEUE_LARGEST,
+
+    QEMU_MIGRATION_QUEUE_LAST
+} qemuMigrationQueueOrder;
+VIR_ENUM_DECL(qemuMigrationQueueOrder)
+
 /* Main driver config. The data in these object
  * instances is immutable, so can be accessed
  * without locking. Threads must, however, hold
@@ -144,6 +154,8 @@ struct _virQEMUDriverConfig {
     int maxProcesses;
     int maxFiles;
 
+    unsigned int maxConcurrentRestores;
+
     int maxQueuedJobs;
 
     char **securityDriverNames;
@@ -158,6 +170,8 @@ struct _virQEMUDriverConfig {
     bool autoDumpBypassCache;
     bool autoStartBypassCache;
 
+    bool snapshotSingleStore;
+
     char *lockManagerName;
 
     int keepAliveInterval;
@@ -170,10 +184,38 @@ struct _virQEMUDriverConfig {
     char *migrationAddress;
     int migrationPortMin;
     int migrationPortMax;
+    /* Upper bound on how often migration statistics are refreshed
+     * from QEMU while waiting for the job to finish, in ms */
+    unsigned int migrationStatsInterval;
+    /* Outgoing migrations running at the same time, 0 means no limit */
+    unsigned int maxConcurrentMigrations;
+    /* Bandwidth shared by all outgoing migrations in MiB/s, 0 means
+     * each migration gets its own limit */
+    unsigned long migrationBandwidthBudget;
+    int migrationQueueOrder; /* qemuMigrationQueueOrder */
 
     bool logTimestamp;
 };
 
+typedef struct _qemuRestoreWaiter qemuRestoreWaiter;
+typedef qemuRestoreWaiter *qemuRestoreWaiterPtr;
+struct _qemuRestoreWaiter {
+    virCond cond;
+    bool ready;
+    qemuRestoreWaiterPtr next;
+};
+
+typedef struct _qemuMigrationWaiter qemuMigrationWaiter;
+typedef qemuMigrationWaiter *qemuMigrationWaiterPtr;
+struct _qemuMigrationWaiter {
+    virCond cond;
+    bool ready;
+    bool cancelled;
+    virDomainObjPtr vm;
+    unsigned long long memory; /* in KiB, for migration_queue_order */
+    qemuMigrationWaiterPtr next;
+};
+
 /* Main driver state */
 struct _virQEMUDriver {
     virMutex lock;
@@ -243,6 +285,19 @@ struct _virQEMUDriver {
 
     /* Immutable pointer, self-clocking APIs */
     virCloseCallbacksPtr closeCallbacks;
+
+    /* Restores limited by max_concurrent_restores, protected by
+     * restoreLock. Waiting restores start in the order they came. */
+    virMutex restoreLock;
+    unsigned int restoreRunning;
+    qemuRestoreWaiterPtr restoreQueue;
+
+    /* Outgoing migrations limited by max_concurrent_migrations and
+     * sharing migration_bandwidth_budget, protected by migrationLock.
+     * Waiting migrations start in migration_queue_order. */
+    virMutex migrationLock;
+    unsigned int migrationRunning;
+    qemuMigrationWaiterPtr migrationQueue;
 };
 
 typedef struct _qemuDomainCmdlineDef qemuDomainCmdlineDef;
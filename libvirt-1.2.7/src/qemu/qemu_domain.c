@@ -43,7 +43,9 @@
 #include "storage/storage_driver.h"
 
 #include <sys/time.h>
+#include <sys/stat.h>
 #include <fcntl.h>
+#include <limits.h>
 
 #include <libxml/xpathInternals.h>
 
@@ -142,6 +144,12 @@ qemuDomainObjInitJob(qemuDomainObjPrivatePtr priv)
         return -1;
     }
 
+    if (virCondInit(&priv->job.progressCond) < 0) {
+        virCondDestroy(&priv->job.cond);
+        virCondDestroy(&priv->job.asyncCond);
+        return -1;
+    }
+
     return 0;
 }
 
@@ -154,6 +162,17 @@ qemuDomainObjResetJob(qemuDomainObjPrivatePtr priv)
     job->owner = 0;
 }
 
+static void
+qemuDomainMirrorJobFree(qemuDomainMirrorJobPtr mirror)
+{
+    if (!mirror)
+        return;
+
+    VIR_FREE(mirror->alias);
+    VIR_FREE(mirror->target);
+    VIR_FREE(mirror);
+}
+
 static void
 qemuDomainObjResetAsyncJob(qemuDomainObjPrivatePtr priv)
 {
@@ -168,6 +187,15 @@ qemuDomainObjResetAsyncJob(qemuDomainObjPrivatePtr priv)
     job->asyncAbort = false;
     memset(&job->status, 0, sizeof(job->status));
     memset(&job->info, 0, sizeof(job->info));
+    memset(&job->progress, 0, sizeof(job->progress));
+    memset(&job->tunnel, 0, sizeof(job->tunnel));
+    job->wrapperFd = NULL;
+    job->dumpStream = NULL;
+    job->migrationEvents = false;
+    job->spiceMigrated = false;
+    while (job->nmirrors)
+        qemuDomainMirrorJobFree(job->mirrors[--job->nmirrors]);
+    VIR_FREE(job->mirrors);
 }
 
 void
@@ -202,6 +230,7 @@ qemuDomainObjFreeJob(qemuDomainObjPrivatePtr priv)
 {
     virCondDestroy(&priv->job.cond);
     virCondDestroy(&priv->job.asyncCond);
+    virCondDestroy(&priv->job.progressCond);
 }
 
 static bool
@@ -232,6 +261,7 @@ qemuDomainObjPrivateAlloc(void)
         goto error;
 
     priv->migMaxBandwidth = QEMU_DOMAIN_MIG_BANDWIDTH_MAX;
+    priv->snapshotStoreCompactAt = QEMU_SNAPSHOT_STORE_SLACK;
 
     return priv;
 
@@ -255,6 +285,7 @@ qemuDomainObjPrivateFree(void *data)
     VIR_FREE(priv->vcpupids);
     VIR_FREE(priv->lockState);
     VIR_FREE(priv->origname);
+    VIR_FREE(priv->memPeekPath);
 
     virCondDestroy(&priv->unplugFinished);
     virChrdevFree(priv->devs);
@@ -1130,6 +1161,7 @@ qemuDomainObjBeginJobInternal(virQEMUDriverPtr driver,
         priv->job.asyncJob = asyncJob;
         priv->job.asyncOwner = virThreadSelfID();
         priv->job.start = now;
+        virProgressInit(&priv->job.progress, 0);
     }
 
     if (qemuDomainTrackJob(job))
@@ -1281,6 +1313,185 @@ qemuDomainObjAbortAsyncJob(virDomainObjPtr obj)
               obj, obj->def->name);
 
     priv->job.asyncAbort = true;
+    qemuDomainObjSignalJobProgress(obj);
+}
+
+/*
+ * obj must be locked before calling
+ *
+ * Wake up the thread waiting in qemuDomainObjWaitJobProgress, if any,
+ * because QEMU reported a change which may affect the async job.
+ */
+void
+qemuDomainObjSignalJobProgress(virDomainObjPtr obj)
+{
+    qemuDomainObjPrivatePtr priv = obj->privateData;
+
+    priv->job.progressSeq++;
+    virCondBroadcast(&priv->job.progressCond);
+}
+
+/*
+ * obj must be locked before calling
+ *
+ * Returns the current progress sequence number to be passed to
+ * qemuDomainObjWaitJobProgress. Take it before querying QEMU so that
+ * a signal arriving while the domain is unlocked is not lost.
+ */
+unsigned long long
+qemuDomainObjGetJobProgress(virDomainObjPtr obj)
+{
+    qemuDomainObjPrivatePtr priv = obj->privateData;
+
+    return priv->job.progressSeq;
+}
+
+/*
+ * obj must be locked before calling
+ *
+ * Wait up to @timeout milliseconds for qemuDomainObjSignalJobProgress
+ * to be called. Returns immediately if it was already called since
+ * @seq was obtained from qemuDomainObjGetJobProgress. The domain
+ * object is unlocked while waiting.
+ *
+ * Returns 0 when signalled, 1 on timeout, -1 on error.
+ */
+int
+qemuDomainObjWaitJobProgress(virDomainObjPtr obj,
+                             unsigned long long seq,
+                             unsigned long long timeout)
+{
+    qemuDomainObjPrivatePtr priv = obj->privateData;
+    unsigned long long now;
+
+    if (priv->job.progressSeq != seq)
+        return 0;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    if (virCondWaitUntil(&priv->job.progressCond,
+                         &obj->parent.lock, now + timeout) < 0) {
+        if (errno == ETIMEDOUT)
+            return 1;
+
+        virReportSystemError(errno, "%s",
+                             _("Unable to wait on async job progress "
+                               "condition"));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * obj must be locked before calling
+ *
+ * Start tracking a drive-mirror run by the current async job on the
+ * drive @alias of disk @target. The mirror is forgotten when the async
+ * job ends.
+ *
+ * Returns the new mirror or NULL on error.
+ */
+qemuDomainMirrorJobPtr
+qemuDomainObjAddMirrorJob(virDomainObjPtr obj,
+                          const char *alias,
+                          const char *target)
+{
+    qemuDomainObjPrivatePtr priv = obj->privateData;
+    qemuDomainMirrorJobPtr mirror;
+
+    if (VIR_ALLOC(mirror) < 0)
+        return NULL;
+
+    if (VIR_STRDUP(mirror->alias, alias) < 0 ||
+        VIR_STRDUP(mirror->target, target) < 0)
+        goto error;
+
+    virProgressInit(&mirror->progress, 0);
+
+    if (VIR_APPEND_ELEMENT_COPY(priv->job.mirrors, priv->job.nmirrors,
+                                mirror) < 0)
+        goto error;
+
+    return mirror;
+
+ error:
+    qemuDomainMirrorJobFree(mirror);
+    return NULL;
+}
+
+/*
+ * obj must be locked before calling
+ */
+qemuDomainMirrorJobPtr
+qemuDomainObjFindMirrorJob(virDomainObjPtr obj,
+                           const char *alias)
+{
+    qemuDomainObjPrivatePtr priv = obj->privateData;
+    size_t i;
+
+    for (i = 0; i < priv->job.nmirrors; i++) {
+        if (STREQ(priv->job.mirrors[i]->alias, alias))
+            return priv->job.mirrors[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * obj must be locked before calling
+ *
+ * Append the state, size, progress and throughput of each drive-mirror
+ * of the current async job to @params.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuDomainObjAddMirrorJobParams(virDomainObjPtr obj,
+                                virTypedParamListPtr params)
+{
+    qemuDomainObjPrivatePtr priv = obj->privateData;
+    char field[VIR_TYPED_PARAM_FIELD_LENGTH];
+    size_t i;
+
+    if (!priv->job.nmirrors)
+        return 0;
+
+    /* The count plus five fields per mirror */
+    if (virTypedParamListReserve(params, 1 + 5 * priv->job.nmirrors) < 0 ||
+        virTypedParamListAdd(params, QEMU_DOMAIN_JOB_MIRROR_COUNT,
+                             VIR_TYPED_PARAM_UINT,
+                             (unsigned int) priv->job.nmirrors) < 0)
+        return -1;
+
+#define ADD_FIELD(TYPE, SUFFIX, VALUE)                                  \
+    do {                                                                \
+        snprintf(field, sizeof(field),                                  \
+                 QEMU_DOMAIN_JOB_MIRROR_PREFIX "%s", i, SUFFIX);        \
+        if (virTypedParamListAdd(params, field,                         \
+                                 VIR_TYPED_PARAM_ ## TYPE, VALUE) < 0)  \
+            return -1;                                                  \
+    } while (0)
+
+    for (i = 0; i < priv->job.nmirrors; i++) {
+        qemuDomainMirrorJobPtr mirror = priv->job.mirrors[i];
+
+        ADD_FIELD(STRING, QEMU_DOMAIN_JOB_MIRROR_SUFFIX_NAME,
+                  mirror->target);
+        ADD_FIELD(BOOLEAN, QEMU_DOMAIN_JOB_MIRROR_SUFFIX_READY,
+                  mirror->ready);
+        ADD_FIELD(ULLONG, QEMU_DOMAIN_JOB_MIRROR_SUFFIX_TOTAL,
+                  mirror->progress.total);
+        ADD_FIELD(ULLONG, QEMU_DOMAIN_JOB_MIRROR_SUFFIX_PROCESSED,
+                  mirror->progress.processed);
+        ADD_FIELD(ULLONG, QEMU_DOMAIN_JOB_MIRROR_SUFFIX_BPS,
+                  virProgressGetRate(&mirror->progress));
+    }
+
+#undef ADD_FIELD
+
+    return 0;
 }
 
 /*
@@ -1908,11 +2119,389 @@ qemuFindQemuImgBinary(virQEMUDriverPtr driver)
     return driver->qemuImgBinary;
 }
 
+/* The single snapshot metadata store of a domain is a journal of
+ * records, each made of a "<type> <name length> <data length>" header
+ * line followed by the snapshot name and the data, both terminated by
+ * a newline.  A '+' record holds the XML of a new or updated snapshot,
+ * a '-' record (with no data) the removal of one; later records for
+ * the same name supersede earlier ones.  */
+#define QEMU_SNAPSHOT_STORE_MAX_LEN (256 * 1024 * 1024)
+
+static char *
+qemuDomainSnapshotStorePath(virDomainObjPtr vm,
+                            const char *snapshotDir)
+{
+    char *path;
+
+    ignore_value(virAsprintf(&path, "%s/%s/%s", snapshotDir, vm->def->name,
+                             QEMU_SNAPSHOT_STORE_FILE));
+    return path;
+}
+
+static int
+qemuDomainSnapshotStoreWriteRecord(int fd,
+                                   char type,
+                                   const char *name,
+                                   const char *data)
+{
+    size_t namelen = strlen(name);
+    size_t datalen = data ? strlen(data) : 0;
+    char *header = NULL;
+    int ret = -1;
+
+    if (virAsprintf(&header, "%c %zu %zu\n", type, namelen, datalen) < 0)
+        return -1;
+
+    if (safewrite(fd, header, strlen(header)) < 0 ||
+        safewrite(fd, name, namelen) < 0 ||
+        safewrite(fd, "\n", 1) < 0 ||
+        safewrite(fd, data ? data : "", datalen) < 0 ||
+        safewrite(fd, "\n", 1) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(header);
+    return ret;
+}
+
+static int
+qemuDomainSnapshotStoreAppend(virDomainObjPtr vm,
+                              virQEMUDriverConfigPtr cfg,
+                              char type,
+                              const char *name,
+                              const char *data)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    char *path = NULL;
+    off_t start;
+    int fd = -1;
+    int ret = -1;
+
+    if (!(path = qemuDomainSnapshotStorePath(vm, cfg->snapshotDir)))
+        goto cleanup;
+
+    if ((fd = open(path, O_WRONLY | O_APPEND | O_CREAT,
+                   S_IRUSR | S_IWUSR)) < 0) {
+        virReportSystemError(errno,
+                             _("cannot open snapshot metadata store '%s'"),
+                             path);
+        goto cleanup;
+    }
+
+    if ((start = lseek(fd, 0, SEEK_END)) < 0) {
+        virReportSystemError(errno,
+                             _("cannot seek in snapshot metadata store '%s'"),
+                             path);
+        goto cleanup;
+    }
+
+    /* Removals usually come in bunches, their callers sync them
+     * all at once with qemuDomainSnapshotStoreSync */
+    if (qemuDomainSnapshotStoreWriteRecord(fd, type, name, data) < 0 ||
+        (type != '-' && fsync(fd) < 0)) {
+        virReportSystemError(errno,
+                             _("cannot write snapshot metadata store '%s'"),
+                             path);
+        /* Don't leave a torn record behind for the next one to follow */
+        ignore_value(ftruncate(fd, start));
+        goto cleanup;
+    }
+
+    if (VIR_CLOSE(fd) < 0) {
+        virReportSystemError(errno,
+                             _("cannot save snapshot metadata store '%s'"),
+                             path);
+        goto cleanup;
+    }
+
+    priv->snapshotStoreRecords++;
+    priv->snapshotStoreUnsynced = type == '-';
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    VIR_FREE(path);
+    return ret;
+}
+
+struct qemuDomainSnapshotStoreData {
+    virDomainObjPtr vm;
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    int fd;
+    size_t count;
+    int err;
+};
+
+static void
+qemuDomainSnapshotStoreWriteOne(void *payload,
+                                const void *name ATTRIBUTE_UNUSED,
+                                void *opaque)
+{
+    virDomainSnapshotObjPtr snap = payload;
+    struct qemuDomainSnapshotStoreData *data = opaque;
+    char *xml;
+
+    if (data->err < 0)
+        return;
+
+    if (!(xml = virDomainSnapshotDefFormat(data->uuidstr, snap->def,
+                                           QEMU_DOMAIN_FORMAT_LIVE_FLAGS, 1)) ||
+        qemuDomainSnapshotStoreWriteRecord(data->fd, '+', snap->def->name,
+                                           xml) < 0)
+        data->err = -1;
+    else
+        data->count++;
+
+    VIR_FREE(xml);
+}
+
+static int
+qemuDomainSnapshotStoreRewrite(int fd, void *opaque)
+{
+    struct qemuDomainSnapshotStoreData *data = opaque;
+
+    data->fd = fd;
+    virDomainSnapshotForEach(data->vm->snapshots,
+                             qemuDomainSnapshotStoreWriteOne, data);
+    return data->err;
+}
+
+/**
+ * qemuDomainSnapshotStoreCompact:
+ * @vm: domain object
+ * @cfg: driver configuration
+ *
+ * Atomically replace the snapshot metadata store of @vm with one
+ * holding a single record for each of its current snapshots.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuDomainSnapshotStoreCompact(virDomainObjPtr vm,
+                               virQEMUDriverConfigPtr cfg)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    struct qemuDomainSnapshotStoreData data;
+    char *snapDir = NULL;
+    char *path = NULL;
+    int ret = -1;
+
+    memset(&data, 0, sizeof(data));
+    data.vm = vm;
+    virUUIDFormat(vm->def->uuid, data.uuidstr);
+
+    if (virAsprintf(&snapDir, "%s/%s", cfg->snapshotDir, vm->def->name) < 0)
+        goto cleanup;
+    if (virFileMakePath(snapDir) < 0) {
+        virReportSystemError(errno, _("cannot create snapshot directory '%s'"),
+                             snapDir);
+        goto cleanup;
+    }
+
+    if (!(path = qemuDomainSnapshotStorePath(vm, cfg->snapshotDir)))
+        goto cleanup;
+
+    if (virFileRewrite(path, S_IRUSR | S_IWUSR,
+                       qemuDomainSnapshotStoreRewrite, &data) < 0)
+        goto cleanup;
+
+    VIR_DEBUG("compacted snapshot metadata of domain %s from %zu to %zu "
+              "records", vm->def->name, priv->snapshotStoreRecords,
+              data.count);
+    priv->snapshotStoreRecords = data.count;
+    priv->snapshotStoreCompactAt = 2 * data.count + QEMU_SNAPSHOT_STORE_SLACK;
+    priv->snapshotStoreUnsynced = false;
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(path);
+    VIR_FREE(snapDir);
+    return ret;
+}
+
+/**
+ * qemuDomainSnapshotStoreRead:
+ * @vm: domain object
+ * @snapshotDir: base directory for snapshot metadata
+ *
+ * Replay the snapshot metadata store of @vm, if there is one. A
+ * truncated or malformed record ends the replay, keeping whatever
+ * was read before it. The store is cut off at that record, records
+ * appended later would never be replayed otherwise.
+ *
+ * Returns a hash table mapping the names of the snapshots in the
+ * store to their XML, or NULL on error.
+ */
+virHashTablePtr
+qemuDomainSnapshotStoreRead(virDomainObjPtr vm,
+                            const char *snapshotDir)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virHashTablePtr defs = NULL;
+    char *path = NULL;
+    char *buf = NULL;
+    char *cur;
+    char *end;
+    size_t records = 0;
+    int len;
+
+    if (!(defs = virHashCreate(32, virHashValueFree)) ||
+        !(path = qemuDomainSnapshotStorePath(vm, snapshotDir)))
+        goto error;
+
+    if (!virFileExists(path))
+        goto done;
+
+    if ((len = virFileReadAll(path, QEMU_SNAPSHOT_STORE_MAX_LEN, &buf)) < 0)
+        goto error;
+
+    cur = buf;
+    end = buf + len;
+    while (cur < end) {
+        char type = *cur;
+        unsigned long long namelen;
+        unsigned long long datalen;
+        char *name;
+        char *data;
+        char *xml = NULL;
+
+        /* '\n' name '\n' data '\n' must fit in the buffer; compare
+         * the lengths one at a time so a corrupt one can't overflow */
+        if ((type != '+' && type != '-') ||
+            virStrToLong_ull(cur + 1, &name, 10, &namelen) < 0 ||
+            virStrToLong_ull(name, &name, 10, &datalen) < 0 ||
+            end - name < 3 || *name != '\n' ||
+            namelen > (size_t) (end - name) - 3 ||
+            datalen > (size_t) (end - name) - 3 - namelen ||
+            name[namelen + 1] != '\n' ||
+            name[namelen + datalen + 2] != '\n') {
+            VIR_WARN("dropping %zu bytes of malformed snapshot metadata "
+                     "at offset %zu of %s",
+                     (size_t) (end - cur), (size_t) (cur - buf), path);
+            if (truncate(path, cur - buf) < 0) {
+                virReportSystemError(errno,
+                                     _("cannot truncate snapshot metadata "
+                                       "store '%s'"), path);
+                goto error;
+            }
+            break;
+        }
+
+        name++;
+        name[namelen] = '\0';
+        data = name + namelen + 1;
+        data[datalen] = '\0';
+        cur = data + datalen + 1;
+        records++;
+
+        if (type == '-') {
+            ignore_value(virHashRemoveEntry(defs, name));
+            continue;
+        }
+
+        if (VIR_STRDUP(xml, data) < 0 ||
+            virHashUpdateEntry(defs, name, xml) < 0) {
+            VIR_FREE(xml);
+            goto error;
+        }
+    }
+
+ done:
+    priv->snapshotStoreRecords = records;
+    priv->snapshotStoreCompactAt = 2 * virHashSize(defs) +
+        QEMU_SNAPSHOT_STORE_SLACK;
+    VIR_FREE(buf);
+    VIR_FREE(path);
+    return defs;
+
+ error:
+    virHashFree(defs);
+    VIR_FREE(buf);
+    VIR_FREE(path);
+    return NULL;
+}
+
+/**
+ * qemuDomainSnapshotStoreRemove:
+ * @vm: domain object
+ * @snapshotDir: base directory for snapshot metadata
+ *
+ * Delete the snapshot metadata store of @vm, if any.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuDomainSnapshotStoreRemove(virDomainObjPtr vm,
+                              const char *snapshotDir)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    char *path;
+    int ret = 0;
+
+    if (!(path = qemuDomainSnapshotStorePath(vm, snapshotDir)))
+        return -1;
+
+    if (unlink(path) < 0 && errno != ENOENT) {
+        virReportSystemError(errno,
+                             _("cannot remove snapshot metadata store '%s'"),
+                             path);
+        ret = -1;
+    } else {
+        priv->snapshotStoreRecords = 0;
+        priv->snapshotStoreCompactAt = QEMU_SNAPSHOT_STORE_SLACK;
+        priv->snapshotStoreUnsynced = false;
+    }
+
+    VIR_FREE(path);
+    return ret;
+}
+
+/**
+ * qemuDomainSnapshotStoreSync:
+ * @vm: domain object
+ * @cfg: driver configuration
+ *
+ * Flush the removal records appended to the snapshot metadata store
+ * of @vm since it was last synced. A failure is only logged, the
+ * records are written and merely not known to be on disk yet.
+ */
+void
+qemuDomainSnapshotStoreSync(virDomainObjPtr vm,
+                            virQEMUDriverConfigPtr cfg)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    char ebuf[1024];
+    char *path;
+    int fd;
+
+    if (!priv->snapshotStoreUnsynced)
+        return;
+
+    if (!(path = qemuDomainSnapshotStorePath(vm, cfg->snapshotDir))) {
+        virResetLastError();
+        return;
+    }
+
+    if ((fd = open(path, O_WRONLY)) < 0 ||
+        fsync(fd) < 0) {
+        VIR_WARN("cannot sync snapshot metadata store '%s': %s",
+                 path, virStrerror(errno, ebuf, sizeof(ebuf)));
+    } else {
+        priv->snapshotStoreUnsynced = false;
+    }
+
+    VIR_FORCE_CLOSE(fd);
+    VIR_FREE(path);
+}
+
 int
 qemuDomainSnapshotWriteMetadata(virDomainObjPtr vm,
                                 virDomainSnapshotObjPtr snapshot,
-                                char *snapshotDir)
+                                virQEMUDriverConfigPtr cfg)
 {
+    qemuDomainObjPrivatePtr priv = vm->privateData;
     char *newxml = NULL;
     int ret = -1;
     char *snapDir = NULL;
@@ -1925,7 +2514,7 @@ qemuDomainSnapshotWriteMetadata(virDomainObjPtr vm,
     if (newxml == NULL)
         return -1;
 
-    if (virAsprintf(&snapDir, "%s/%s", snapshotDir, vm->def->name) < 0)
+    if (virAsprintf(&snapDir, "%s/%s", cfg->snapshotDir, vm->def->name) < 0)
         goto cleanup;
     if (virFileMakePath(snapDir) < 0) {
         virReportSystemError(errno, _("cannot create snapshot directory '%s'"),
@@ -1933,6 +2522,24 @@ qemuDomainSnapshotWriteMetadata(virDomainObjPtr vm,
         goto cleanup;
     }
 
+    if (cfg->snapshotSingleStore) {
+        if (qemuDomainSnapshotStoreAppend(vm, cfg, '+', snapshot->def->name,
+                                          newxml) < 0)
+            goto cleanup;
+
+        /* The record is safely stored, failing to drop the stale
+         * ones only costs space and load time */
+        if (priv->snapshotStoreRecords >= priv->snapshotStoreCompactAt &&
+            qemuDomainSnapshotStoreCompact(vm, cfg) < 0) {
+            VIR_WARN("failed to compact snapshot metadata of domain %s",
+                     vm->def->name);
+            virResetLastError();
+        }
+
+        ret = 0;
+        goto cleanup;
+    }
+
     if (virAsprintf(&snapFile, "%s/%s.xml", snapDir, snapshot->def->name) < 0)
         goto cleanup;
 
@@ -2046,6 +2653,7 @@ qemuDomainSnapshotDiscard(virQEMUDriverPtr driver,
                           bool metadata_only)
 {
     char *snapFile = NULL;
+    char *name = NULL;
     int ret = -1;
     qemuDomainObjPrivatePtr priv;
     virDomainSnapshotObjPtr parentsnap = NULL;
@@ -2066,9 +2674,13 @@ qemuDomainSnapshotDiscard(virQEMUDriverPtr driver,
         }
     }
 
-    if (virAsprintf(&snapFile, "%s/%s/%s.xml", cfg->snapshotDir,
-                    vm->def->name, snap->def->name) < 0)
+    if (cfg->snapshotSingleStore) {
+        if (VIR_STRDUP(name, snap->def->name) < 0)
+            goto cleanup;
+    } else if (virAsprintf(&snapFile, "%s/%s/%s.xml", cfg->snapshotDir,
+                           vm->def->name, snap->def->name) < 0) {
         goto cleanup;
+    }
 
     if (snap == vm->current_snapshot) {
         if (update_current && snap->def->parent) {
@@ -2079,8 +2691,7 @@ qemuDomainSnapshotDiscard(virQEMUDriverPtr driver,
                          snap->def->parent);
             } else {
                 parentsnap->def->current = true;
-                if (qemuDomainSnapshotWriteMetadata(vm, parentsnap,
-                                                    cfg->snapshotDir) < 0) {
+                if (qemuDomainSnapshotWriteMetadata(vm, parentsnap, cfg) < 0) {
                     VIR_WARN("failed to set parent snapshot '%s' as current",
                              snap->def->parent);
                     parentsnap->def->current = false;
@@ -2091,13 +2702,20 @@ qemuDomainSnapshotDiscard(virQEMUDriverPtr driver,
         vm->current_snapshot = parentsnap;
     }
 
-    if (unlink(snapFile) < 0)
+    if (snapFile && unlink(snapFile) < 0)
         VIR_WARN("Failed to unlink %s", snapFile);
     virDomainSnapshotObjListRemove(vm->snapshots, snap);
 
+    if (name &&
+        qemuDomainSnapshotStoreAppend(vm, cfg, '-', name, NULL) < 0) {
+        VIR_WARN("Failed to record removal of snapshot %s", name);
+        virResetLastError();
+    }
+
     ret = 0;
 
  cleanup:
+    VIR_FREE(name);
     VIR_FREE(snapFile);
     virObjectUnref(cfg);
     return ret;
@@ -2124,6 +2742,7 @@ int
 qemuDomainSnapshotDiscardAllMetadata(virQEMUDriverPtr driver,
                                      virDomainObjPtr vm)
 {
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     virQEMUSnapRemove rem;
 
     rem.driver = driver;
@@ -2132,7 +2751,9 @@ qemuDomainSnapshotDiscardAllMetadata(virQEMUDriverPtr driver,
     rem.err = 0;
     virDomainSnapshotForEach(vm->snapshots, qemuDomainSnapshotDiscardAll,
                              &rem);
+    qemuDomainSnapshotStoreSync(vm, cfg);
 
+    virObjectUnref(cfg);
     return rem.err;
 }
 
@@ -2148,7 +2769,8 @@ qemuDomainRemoveInactive(virQEMUDriverPtr driver,
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
 
     /* Remove any snapshot metadata prior to removing the domain */
-    if (qemuDomainSnapshotDiscardAllMetadata(driver, vm) < 0) {
+    if (qemuDomainSnapshotDiscardAllMetadata(driver, vm) < 0 ||
+        qemuDomainSnapshotStoreRemove(vm, cfg->snapshotDir) < 0) {
         VIR_WARN("unable to remove all snapshots for domain %s",
                  vm->def->name);
     }
@@ -2560,3 +3182,280 @@ qemuDomainAgentAvailable(qemuDomainObjPrivatePtr priv,
     }
     return true;
 }
+
+
+/* Guest memory is peeked through a FIFO created once per domain, as
+ * long as the range fits into the pipe buffer. QEMU has to finish
+ * writing before the monitor command returns, so larger ranges would
+ * block it forever and go through a temporary file instead. */
+#define QEMU_MEMORY_PEEK_PIPE_SIZE (1024 * 1024)
+
+static void
+qemuDomainMemoryPeekCleanup(virQEMUDriverPtr driver ATTRIBUTE_UNUSED,
+                            virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+
+    if (priv->memPeekPath) {
+        unlink(priv->memPeekPath);
+        VIR_FREE(priv->memPeekPath);
+    }
+}
+
+/* Open the reading end of the peek FIFO of @vm, creating the FIFO
+ * first if needed. Returns the fd or -1 if the FIFO can't be used, in
+ * which case no error is reported. */
+static int
+qemuDomainMemoryPeekOpenPipe(virQEMUDriverPtr driver,
+                             virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg = NULL;
+    char *path = NULL;
+    int fd = -1;
+
+    if (!priv->memPeekPath) {
+        cfg = virQEMUDriverGetConfig(driver);
+
+        if (virAsprintf(&path, "%s/%s.mempeek",
+                        cfg->cacheDir, vm->def->name) < 0)
+            goto error;
+
+        if ((unlink(path) < 0 && errno != ENOENT) ||
+            mkfifo(path, S_IRUSR | S_IWUSR) < 0) {
+            VIR_DEBUG("Unable to create memory peek FIFO %s: errno=%d",
+                      path, errno);
+            goto error;
+        }
+
+        if (virSecurityManagerSetSavedStateLabel(driver->securityManager,
+                                                 vm->def, path) < 0 ||
+            qemuDomainCleanupAdd(vm, qemuDomainMemoryPeekCleanup) < 0) {
+            unlink(path);
+            goto error;
+        }
+
+        priv->memPeekPath = path;
+        path = NULL;
+        virObjectUnref(cfg);
+        cfg = NULL;
+    }
+
+    /* Non-blocking, so that opening does not wait for QEMU and reading
+     * stops once QEMU closed its end */
+    if ((fd = open(priv->memPeekPath,
+                   O_RDONLY | O_NONBLOCK | O_CLOEXEC)) < 0) {
+        VIR_DEBUG("Unable to open memory peek FIFO %s: errno=%d",
+                  priv->memPeekPath, errno);
+        return -1;
+    }
+
+    return fd;
+
+ error:
+    virResetLastError();
+    VIR_FREE(path);
+    virObjectUnref(cfg);
+    return -1;
+}
+
+/* Returns how many bytes the pipe @fd can hold without blocking the
+ * writer, growing it up to @want if possible. */
+static size_t
+qemuDomainMemoryPeekPipeSize(int fd ATTRIBUTE_UNUSED,
+                             size_t want ATTRIBUTE_UNUSED)
+{
+#if defined(F_GETPIPE_SZ) && defined(F_SETPIPE_SZ)
+    int size;
+
+    if ((size = fcntl(fd, F_GETPIPE_SZ)) < 0)
+        return 0;
+
+    if (want > (size_t) size && want <= QEMU_MEMORY_PEEK_PIPE_SIZE) {
+        int newsize = fcntl(fd, F_SETPIPE_SZ, (int) want);
+        if (newsize > 0)
+            size = newsize;
+    }
+
+    return size;
+#else
+    /* POSIX only guarantees atomic writes of PIPE_BUF bytes, which is
+     * also a safe lower bound of the pipe capacity */
+    return PIPE_BUF;
+#endif
+}
+
+static int
+qemuDomainMemoryPeekSave(virQEMUDriverPtr driver,
+                         virDomainObjPtr vm,
+                         qemuDomainMemoryRangePtr range,
+                         const char *path,
+                         unsigned int flags)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    int ret;
+
+    qemuDomainObjEnterMonitor(driver, vm);
+    if (flags == VIR_MEMORY_VIRTUAL)
+        ret = qemuMonitorSaveVirtualMemory(priv->mon, range->offset,
+                                           range->size, path);
+    else
+        ret = qemuMonitorSavePhysicalMemory(priv->mon, range->offset,
+                                            range->size, path);
+    qemuDomainObjExitMonitor(driver, vm);
+
+    return ret;
+}
+
+static int
+qemuDomainMemoryPeekPipe(virQEMUDriverPtr driver,
+                         virDomainObjPtr vm,
+                         qemuDomainMemoryRangePtr range,
+                         int fd,
+                         unsigned int flags)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    char junk[1024];
+    size_t done = 0;
+    ssize_t got;
+
+    /* Discard whatever a previously failed peek left behind */
+    do {
+        got = read(fd, junk, sizeof(junk));
+    } while (got > 0 || (got < 0 && errno == EINTR));
+
+    if (qemuDomainMemoryPeekSave(driver, vm, range,
+                                 priv->memPeekPath, flags) < 0)
+        return -1;
+
+    /* QEMU closed the FIFO before the command returned, so everything
+     * it wrote is already waiting in the pipe */
+    while (done < range->size) {
+        got = read(fd, (char *) range->buffer + done, range->size - done);
+
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0) {
+            virReportSystemError(errno,
+                                 _("failed to read memory from %s"),
+                                 priv->memPeekPath);
+            return -1;
+        }
+        if (got == 0)
+            break;
+        done += got;
+    }
+
+    if (done != range->size) {
+        virReportError(VIR_ERR_OPERATION_FAILED,
+                       _("QEMU wrote %zu bytes of memory instead of %zu"),
+                       done, range->size);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+qemuDomainMemoryPeekTempFile(virQEMUDriverPtr driver,
+                             virDomainObjPtr vm,
+                             qemuDomainMemoryRangePtr range,
+                             unsigned int flags)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    char *tmp = NULL;
+    int fd = -1;
+    int ret = -1;
+
+    if (virAsprintf(&tmp, "%s/qemu.mem.XXXXXX", cfg->cacheDir) < 0)
+        goto cleanup;
+
+    /* Create a temporary filename. */
+    if ((fd = mkostemp(tmp, O_CLOEXEC)) == -1) {
+        virReportSystemError(errno,
+                             _("mkostemp(\"%s\") failed"), tmp);
+        goto cleanup;
+    }
+
+    virSecurityManagerSetSavedStateLabel(driver->securityManager,
+                                         vm->def, tmp);
+
+    if (qemuDomainMemoryPeekSave(driver, vm, range, tmp, flags) < 0)
+        goto cleanup;
+
+    /* Read the memory file into buffer. */
+    if (saferead(fd, range->buffer, range->size) == (ssize_t) -1) {
+        virReportSystemError(errno,
+                             _("failed to read temporary file "
+                               "created with template %s"), tmp);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    if (tmp)
+        unlink(tmp);
+    VIR_FREE(tmp);
+    virObjectUnref(cfg);
+    return ret;
+}
+
+/**
+ * qemuDomainMemoryPeekRanges:
+ * @driver: qemu driver
+ * @vm: domain object, locked, with a job
+ * @ranges: ranges of guest memory to read
+ * @nranges: number of items in @ranges
+ * @flags: VIR_MEMORY_VIRTUAL or VIR_MEMORY_PHYSICAL
+ *
+ * Read each range of guest memory into its buffer. Ranges which fit
+ * into a pipe are streamed through a FIFO reused by all peeks of the
+ * domain, the rest is read from a temporary file.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuDomainMemoryPeekRanges(virQEMUDriverPtr driver,
+                           virDomainObjPtr vm,
+                           qemuDomainMemoryRangePtr ranges,
+                           size_t nranges,
+                           unsigned int flags)
+{
+    size_t maxsize = 0;
+    size_t pipesize = 0;
+    int fd = -1;
+    size_t i;
+    int ret = -1;
+
+    for (i = 0; i < nranges; i++)
+        maxsize = MAX(maxsize, ranges[i].size);
+
+    if ((fd = qemuDomainMemoryPeekOpenPipe(driver, vm)) >= 0)
+        pipesize = qemuDomainMemoryPeekPipeSize(fd, maxsize);
+
+    for (i = 0; i < nranges; i++) {
+        if (!virDomainObjIsActive(vm)) {
+            virReportError(VIR_ERR_OPERATION_INVALID,
+                           "%s", _("domain is not running"));
+            goto cleanup;
+        }
+
+        if (fd >= 0 && ranges[i].size <= pipesize) {
+            if (qemuDomainMemoryPeekPipe(driver, vm, &ranges[i],
+                                         fd, flags) < 0)
+                goto cleanup;
+        } else {
+            if (qemuDomainMemoryPeekTempFile(driver, vm, &ranges[i],
+                                             flags) < 0)
+                goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FORCE_CLOSE(fd);
+    return ret;
+}
@@ -33,7 +33,10 @@
 # include "qemu_agent.h"
 # include "qemu_conf.h"
 # include "qemu_capabilities.h"
+# include "qemu_dump.h"
 # include "virchrdev.h"
+# include "virfile.h"
+# include "virtypedparam.h"
 
 # define QEMU_EXPECTED_VIRT_TYPES      \
     ((1 << VIR_DOMAIN_VIRT_QEMU) |     \
@@ -45,6 +48,14 @@
     (VIR_DOMAIN_XML_SECURE |                \
      VIR_DOMAIN_XML_UPDATE_CPU)
 
+/* Typed parameter reported by virDomainGetJobStats during tunnelled
+ * migration, in bytes per second */
+# define QEMU_DOMAIN_JOB_TUNNEL_BPS "tunnel_bps"
+
+/* Typed parameter reported by virDomainGetJobStats during memory-only
+ * dumps, bytes of zeros which were not written to the file */
+# define QEMU_DOMAIN_JOB_DUMP_ZERO_BYTES "dump_zero_bytes"
+
 # if ULONG_MAX == 4294967295
 /* Qemu has a 64-bit limit, but we are limited by our historical choice of
  * representing bandwidth in a long instead of a 64-bit int.  */
@@ -100,6 +111,26 @@ typedef enum {
 } qemuDomainAsyncJob;
 VIR_ENUM_DECL(qemuDomainAsyncJob)
 
+/* Typed parameters reported by virDomainGetJobStats for each disk
+ * copied by drive-mirror during migration, %zu is the mirror index */
+# define QEMU_DOMAIN_JOB_MIRROR_COUNT      "mirror.count"
+# define QEMU_DOMAIN_JOB_MIRROR_PREFIX     "mirror.%zu."
+# define QEMU_DOMAIN_JOB_MIRROR_SUFFIX_NAME       "name"
+# define QEMU_DOMAIN_JOB_MIRROR_SUFFIX_READY      "ready"
+# define QEMU_DOMAIN_JOB_MIRROR_SUFFIX_TOTAL      "total"
+# define QEMU_DOMAIN_JOB_MIRROR_SUFFIX_PROCESSED  "processed"
+# define QEMU_DOMAIN_JOB_MIRROR_SUFFIX_BPS        "bps"
+
+typedef struct _qemuDomainMirrorJob qemuDomainMirrorJob;
+typedef qemuDomainMirrorJob *qemuDomainMirrorJobPtr;
+struct _qemuDomainMirrorJob {
+    char *alias;                        /* drive the mirror runs on */
+    char *target;                       /* disk target, e.g. vda */
+    bool ready;                         /* mirror caught up with the disk */
+    bool failed;                        /* mirror failed or was cancelled */
+    virProgress progress;               /* data copied so far */
+};
+
 struct qemuDomainJobObj {
     virCond cond;                       /* Use to coordinate jobs */
     qemuDomainJob active;               /* Currently running job */
@@ -114,7 +145,19 @@ struct qemuDomainJobObj {
     bool dump_memory_only;              /* use dump-guest-memory to do dump */
     qemuMonitorMigrationStatus status;  /* Raw async job progress data */
     virDomainJobInfo info;              /* Processed async job progress data */
+    virProgress progress;               /* Throughput of async job */
+    virProgress tunnel;                 /* Throughput of migration tunnel */
+    virFileWrapperFdPtr wrapperFd;      /* iohelper used by the async job */
+    qemuDumpStreamPtr dumpStream;       /* writer of memory-only dump */
     bool asyncAbort;                    /* abort of async job requested */
+    virCond progressCond;               /* Signalled when QEMU reports
+                                           async job progress */
+    unsigned long long progressSeq;     /* Bumped with each progressCond
+                                           signal */
+    bool migrationEvents;               /* QEMU emits MIGRATION events */
+    bool spiceMigrated;                 /* SPICE_MIGRATE_COMPLETED seen */
+    qemuDomainMirrorJobPtr *mirrors;    /* NBD drive-mirrors of migration */
+    size_t nmirrors;
 };
 
 typedef void (*qemuDomainCleanupCallback)(virQEMUDriverPtr driver,
@@ -174,6 +217,14 @@ struct _qemuDomainObjPrivate {
     bool hookRun;  /* true if there was a hook run over this domain */
 
     bool quiesced; /* true if filesystems are quiesced */
+
+    /* Records in the single snapshot metadata store, and the count
+     * at which it is next compacted */
+    size_t snapshotStoreRecords;
+    size_t snapshotStoreCompactAt;
+    bool snapshotStoreUnsynced; /* removals appended without fsync */
+
+    char *memPeekPath; /* FIFO QEMU writes peeked memory into */
 };
 
 typedef enum {
@@ -217,6 +268,22 @@ bool qemuDomainObjEndAsyncJob(virQEMUDriverPtr driver,
                               virDomainObjPtr obj)
     ATTRIBUTE_RETURN_CHECK;
 void qemuDomainObjAbortAsyncJob(virDomainObjPtr obj);
+void qemuDomainObjSignalJobProgress(virDomainObjPtr obj);
+unsigned long long qemuDomainObjGetJobProgress(virDomainObjPtr obj);
+int qemuDomainObjWaitJobProgress(virDomainObjPtr obj,
+                                 unsigned long long seq,
+                                 unsigned long long timeout)
+    ATTRIBUTE_RETURN_CHECK;
+
+qemuDomainMirrorJobPtr qemuDomainObjAddMirrorJob(virDomainObjPtr obj,
+                                                 const char *alias,
+                                                 const char *target)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+qemuDomainMirrorJobPtr qemuDomainObjFindMirrorJob(virDomainObjPtr obj,
+                                                  const char *alias)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+int qemuDomainObjAddMirrorJobParams(virDomainObjPtr obj,
+                                    virTypedParamListPtr params);
 void qemuDomainObjSetJobPhase(virQEMUDriverPtr driver,
                               virDomainObjPtr obj,
                               int phase);
@@ -301,9 +368,25 @@ int qemuDomainAppendLog(virQEMUDriverPtr driver,
 
 const char *qemuFindQemuImgBinary(virQEMUDriverPtr driver);
 
+/* Name of the single snapshot metadata store within the snapshot
+ * directory of a domain, see snapshot_single_metadata_store */
+# define QEMU_SNAPSHOT_STORE_FILE "snapshots.journal"
+/* Stale records the store may hold beyond one per snapshot before
+ * it gets compacted */
+# define QEMU_SNAPSHOT_STORE_SLACK 64
+
 int qemuDomainSnapshotWriteMetadata(virDomainObjPtr vm,
                                     virDomainSnapshotObjPtr snapshot,
-                                    char *snapshotDir);
+                                    virQEMUDriverConfigPtr cfg);
+
+virHashTablePtr qemuDomainSnapshotStoreRead(virDomainObjPtr vm,
+                                            const char *snapshotDir);
+int qemuDomainSnapshotStoreCompact(virDomainObjPtr vm,
+                                   virQEMUDriverConfigPtr cfg);
+int qemuDomainSnapshotStoreRemove(virDomainObjPtr vm,
+                                  const char *snapshotDir);
+void qemuDomainSnapshotStoreSync(virDomainObjPtr vm,
+                                 virQEMUDriverConfigPtr cfg);
 
 int qemuDomainSnapshotForEachQcow2(virQEMUDriverPtr driver,
                                    virDomainObjPtr vm,
@@ -378,4 +461,19 @@ bool qemuDomainDefCheckABIStability(virQEMUDriverPtr driver,
 bool qemuDomainAgentAvailable(qemuDomainObjPrivatePtr priv,
                               bool reportError);
 
+typedef struct _qemuDomainMemoryRange qemuDomainMemoryRange;
+typedef qemuDomainMemoryRange *qemuDomainMemoryRangePtr;
+struct _qemuDomainMemoryRange {
+    unsigned long long offset;
+    size_t size;
+    void *buffer;       /* at least @size bytes */
+};
+
+int qemuDomainMemoryPeekRanges(virQEMUDriverPtr driver,
+                               virDomainObjPtr vm,
+                               qemuDomainMemoryRangePtr ranges,
+                               size_t nranges,
+                               unsigned int flags)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+
 #endif /* __QEMU_DOMAIN_H__ */
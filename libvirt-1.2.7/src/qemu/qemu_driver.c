@@ -109,6 +109,10 @@ VIR_LOG_INIT("qemu.qemu_driver");
 
 #define QEMU_NB_PER_CPU_STAT_PARAM 2
 
+/* How long to wait for a cancelled block job to go away before
+ * checking again, in milliseconds */
+#define QEMU_BLOCK_JOB_ABORT_WAIT 1000
+
 #define QEMU_SCHED_MIN_PERIOD              1000LL
 #define QEMU_SCHED_MAX_PERIOD           1000000LL
 #define QEMU_SCHED_MIN_QUOTA               1000LL
@@ -449,6 +453,73 @@ qemuSecurityInit(virQEMUDriverPtr driver)
 }
 
 
+struct qemuDomainSnapshotLoadData {
+    virDomainObjPtr vm;
+    virCapsPtr caps;
+    virDomainSnapshotObjPtr current;
+};
+
+/* Parse one snapshot and add it to the domain, @source naming where
+ * the XML came from for error messages */
+static virDomainSnapshotObjPtr
+qemuDomainSnapshotLoadOne(struct qemuDomainSnapshotLoadData *data,
+                          const char *xmlStr,
+                          const char *source)
+{
+    virDomainSnapshotDefPtr def = NULL;
+    virDomainSnapshotObjPtr snap = NULL;
+    unsigned int flags = (VIR_DOMAIN_SNAPSHOT_PARSE_REDEFINE |
+                          VIR_DOMAIN_SNAPSHOT_PARSE_DISKS |
+                          VIR_DOMAIN_SNAPSHOT_PARSE_INTERNAL);
+
+    def = virDomainSnapshotDefParseString(xmlStr, data->caps,
+                                          qemu_driver->xmlopt,
+                                          QEMU_EXPECTED_VIRT_TYPES,
+                                          flags);
+    if (def == NULL) {
+        /* Nothing we can do here, skip this one */
+        VIR_ERROR(_("Failed to parse snapshot XML from '%s'"), source);
+        return NULL;
+    }
+
+    snap = virDomainSnapshotAssignDef(data->vm->snapshots, def);
+    if (snap == NULL) {
+        virDomainSnapshotDefFree(def);
+    } else if (snap->def->current) {
+        data->current = snap;
+        if (!data->vm->current_snapshot)
+            data->vm->current_snapshot = snap;
+    }
+
+    return snap;
+}
+
+static void
+qemuDomainSnapshotLoadStoreEntry(void *payload,
+                                 const void *name,
+                                 void *opaque)
+{
+    VIR_INFO("Loading snapshot '%s' from metadata store", (const char *)name);
+    ignore_value(qemuDomainSnapshotLoadOne(opaque, payload, name));
+}
+
+struct qemuDomainSnapshotConvertData {
+    virDomainObjPtr vm;
+    virQEMUDriverConfigPtr cfg;
+    int err;
+};
+
+static void
+qemuDomainSnapshotConvertToFile(void *payload,
+                                const void *name ATTRIBUTE_UNUSED,
+                                void *opaque)
+{
+    struct qemuDomainSnapshotConvertData *data = opaque;
+
+    if (qemuDomainSnapshotWriteMetadata(data->vm, payload, data->cfg) < 0)
+        data->err = -1;
+}
+
 static int
 qemuDomainSnapshotLoad(virDomainObjPtr vm,
                        void *data)
@@ -459,15 +530,17 @@ qemuDomainSnapshotLoad(virDomainObjPtr vm,
     struct dirent *entry;
     char *xmlStr;
     char *fullpath;
-    virDomainSnapshotDefPtr def = NULL;
-    virDomainSnapshotObjPtr snap = NULL;
-    virDomainSnapshotObjPtr current = NULL;
+    char **legacy = NULL;
+    size_t nlegacy = 0;
+    virHashTablePtr store = NULL;
+    ssize_t nstore = 0;
+    struct qemuDomainSnapshotLoadData load;
     char ebuf[1024];
-    unsigned int flags = (VIR_DOMAIN_SNAPSHOT_PARSE_REDEFINE |
-                          VIR_DOMAIN_SNAPSHOT_PARSE_DISKS |
-                          VIR_DOMAIN_SNAPSHOT_PARSE_INTERNAL);
     int ret = -1;
     virCapsPtr caps = NULL;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(qemu_driver);
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    size_t i;
     int direrr;
 
     virObjectLock(vm);
@@ -491,8 +564,23 @@ qemuDomainSnapshotLoad(virDomainObjPtr vm,
         goto cleanup;
     }
 
+    load.vm = vm;
+    load.caps = caps;
+    load.current = NULL;
+
+    /* Snapshots in the single metadata store take precedence over
+     * any left in individual files */
+    if (!(store = qemuDomainSnapshotStoreRead(vm, baseDir))) {
+        VIR_ERROR(_("Failed to read snapshot metadata store for domain %s"),
+                  vm->def->name);
+    } else {
+        nstore = virHashSize(store);
+        virHashForEach(store, qemuDomainSnapshotLoadStoreEntry, &load);
+    }
+
     while ((direrr = virDirRead(dir, &entry, NULL)) > 0) {
-        if (entry->d_name[0] == '.')
+        if (entry->d_name[0] == '.' ||
+            STRPREFIX(entry->d_name, QEMU_SNAPSHOT_STORE_FILE))
             continue;
 
         /* NB: ignoring errors, so one malformed config doesn't
@@ -512,27 +600,11 @@ qemuDomainSnapshotLoad(virDomainObjPtr vm,
             continue;
         }
 
-        def = virDomainSnapshotDefParseString(xmlStr, caps,
-                                              qemu_driver->xmlopt,
-                                              QEMU_EXPECTED_VIRT_TYPES,
-                                              flags);
-        if (def == NULL) {
-            /* Nothing we can do here, skip this one */
-            VIR_ERROR(_("Failed to parse snapshot XML from file '%s'"),
-                      fullpath);
-            VIR_FREE(fullpath);
-            VIR_FREE(xmlStr);
-            continue;
-        }
-
-        snap = virDomainSnapshotAssignDef(vm->snapshots, def);
-        if (snap == NULL) {
-            virDomainSnapshotDefFree(def);
-        } else if (snap->def->current) {
-            current = snap;
-            if (!vm->current_snapshot)
-                vm->current_snapshot = snap;
-        }
+        /* Files are removed once converted to the metadata store */
+        if (qemuDomainSnapshotLoadOne(&load, xmlStr, fullpath) &&
+            cfg->snapshotSingleStore &&
+            VIR_APPEND_ELEMENT(legacy, nlegacy, fullpath) < 0)
+            VIR_ERROR(_("Failed to allocate memory for path"));
 
         VIR_FREE(fullpath);
         VIR_FREE(xmlStr);
@@ -540,7 +612,7 @@ qemuDomainSnapshotLoad(virDomainObjPtr vm,
     if (direrr < 0)
         VIR_ERROR(_("Failed to fully read directory %s"), snapDir);
 
-    if (vm->current_snapshot != current) {
+    if (vm->current_snapshot != load.current) {
         VIR_ERROR(_("Too many snapshots claiming to be current for domain %s"),
                   vm->def->name);
         vm->current_snapshot = NULL;
@@ -550,6 +622,30 @@ qemuDomainSnapshotLoad(virDomainObjPtr vm,
         VIR_ERROR(_("Snapshots have inconsistent relations for domain %s"),
                   vm->def->name);
 
+    if (cfg->snapshotSingleStore) {
+        if (nlegacy ||
+            priv->snapshotStoreRecords >= priv->snapshotStoreCompactAt) {
+            if (qemuDomainSnapshotStoreCompact(vm, cfg) < 0) {
+                VIR_ERROR(_("Failed to compact snapshot metadata for "
+                            "domain %s"), vm->def->name);
+            } else {
+                for (i = 0; i < nlegacy; i++) {
+                    if (unlink(legacy[i]) < 0)
+                        VIR_WARN("Failed to unlink %s", legacy[i]);
+                }
+            }
+        }
+    } else if (nstore) {
+        struct qemuDomainSnapshotConvertData convert = { vm, cfg, 0 };
+
+        virDomainSnapshotForEach(vm->snapshots,
+                                 qemuDomainSnapshotConvertToFile, &convert);
+        if (convert.err < 0 ||
+            qemuDomainSnapshotStoreRemove(vm, baseDir) < 0)
+            VIR_ERROR(_("Failed to convert snapshot metadata store for "
+                        "domain %s"), vm->def->name);
+    }
+
     /* FIXME: qemu keeps internal track of snapshots.  We can get access
      * to this info via the "info snapshots" monitor command for running
      * domains, or via "qemu-img snapshot -l" for shutoff domains.  It would
@@ -565,8 +661,13 @@ qemuDomainSnapshotLoad(virDomainObjPtr vm,
  cleanup:
     if (dir)
         closedir(dir);
+    for (i = 0; i < nlegacy; i++)
+        VIR_FREE(legacy[i]);
+    VIR_FREE(legacy);
+    virHashFree(store);
     VIR_FREE(snapDir);
     virObjectUnref(caps);
+    virObjectUnref(cfg);
     virObjectUnlock(vm);
     return ret;
 }
@@ -642,6 +743,16 @@ qemuStateInitialize(bool privileged,
         return -1;
     }
 
+    if (virMutexInit(&qemu_driver->restoreLock) < 0) {
+        VIR_ERROR(_("cannot initialize mutex"));
+        goto error;
+    }
+
+    if (virMutexInit(&qemu_driver->migrationLock) < 0) {
+        VIR_ERROR(_("cannot initialize mutex"));
+        goto error;
+    }
+
     qemu_driver->inhibitCallback = callback;
     qemu_driver->inhibitOpaque = opaque;
 
@@ -1054,6 +1165,8 @@ qemuStateCleanup(void)
 
     virLockManagerPluginUnref(qemu_driver->lockManager);
 
+    virMutexDestroy(&qemu_driver->migrationLock);
+    virMutexDestroy(&qemu_driver->restoreLock);
     virMutexDestroy(&qemu_driver->lock);
     virThreadPoolFree(qemu_driver->workerPool);
     VIR_FREE(qemu_driver);
@@ -2680,6 +2793,10 @@ qemuDomainGetControlInfo(virDomainPtr dom,
 
 verify(sizeof(QEMU_SAVE_MAGIC) == sizeof(QEMU_SAVE_PARTIAL));
 
+/* How much of the saved memory state the kernel is asked to start
+ * reading while the domain XML is parsed and QEMU is being started */
+#define QEMU_SAVE_READAHEAD (64 * 1024 * 1024)
+
 typedef enum {
     QEMU_SAVE_FORMAT_RAW = 0,
     QEMU_SAVE_FORMAT_GZIP = 1,
@@ -2961,6 +3078,7 @@ qemuDomainSaveMemory(virQEMUDriverPtr driver,
     int directFlag = 0;
     virFileWrapperFdPtr wrapperFd = NULL;
     unsigned int wrapperFlags = VIR_FILE_WRAPPER_NON_BLOCKING;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
     unsigned long long pad;
     unsigned long long offset;
     size_t len;
@@ -3015,6 +3133,7 @@ qemuDomainSaveMemory(virQEMUDriverPtr driver,
 
     if (!(wrapperFd = virFileWrapperFdNew(&fd, path, wrapperFlags)))
         goto cleanup;
+    priv->job.wrapperFd = wrapperFd;
 
     /* Write header to file, followed by XML */
     if (qemuDomainSaveHeader(fd, path, xml, &header) < 0)
@@ -3060,6 +3179,7 @@ qemuDomainSaveMemory(virQEMUDriverPtr driver,
 
  cleanup:
     VIR_FORCE_CLOSE(fd);
+    priv->job.wrapperFd = NULL;
     virFileWrapperFdFree(wrapperFd);
     VIR_FREE(xml);
 
@@ -3484,6 +3604,7 @@ doCoreDump(virQEMUDriverPtr driver,
     int directFlag = 0;
     unsigned int flags = VIR_FILE_WRAPPER_NON_BLOCKING;
     const char *memory_dump_format = NULL;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
 
     /* Create an empty file with appropriate ownership.  */
     if (dump_flags & VIR_DUMP_BYPASS_CACHE) {
@@ -3504,10 +3625,9 @@ doCoreDump(virQEMUDriverPtr driver,
                            NULL, NULL)) < 0)
         goto cleanup;
 
-    if (!(wrapperFd = virFileWrapperFdNew(&fd, path, flags)))
-        goto cleanup;
-
     if (dump_flags & VIR_DUMP_MEMORY_ONLY) {
+        int writefd = -1;
+
         if (!(memory_dump_format = qemuDumpFormatTypeToString(dumpformat))) {
             virReportError(VIR_ERR_INVALID_ARG,
                            _("unknown dumpformat '%d'"), dumpformat);
@@ -3518,8 +3638,22 @@ doCoreDump(virQEMUDriverPtr driver,
         if (STREQ(memory_dump_format, "elf"))
             memory_dump_format = NULL;
 
-        ret = qemuDumpToFd(driver, vm, fd, QEMU_ASYNC_JOB_DUMP,
+        /* QEMU writes into a pipe drained by our own threads, which
+         * leave zero pages out of regular files and track progress */
+        if (!(priv->job.dumpStream =
+              qemuDumpStreamNew(fd, path, directFlag != 0,
+                                vm->def->mem.max_balloon * 1024ULL,
+                                &writefd)))
+            goto cleanup;
+
+        ret = qemuDumpToFd(driver, vm, writefd, QEMU_ASYNC_JOB_DUMP,
                            memory_dump_format);
+        VIR_FORCE_CLOSE(writefd);
+
+        if (ret < 0)
+            ignore_value(qemuDumpStreamFinish(priv->job.dumpStream));
+        else
+            ret = qemuDumpStreamFinish(priv->job.dumpStream);
     } else {
         if (dumpformat != VIR_DOMAIN_CORE_DUMP_FORMAT_RAW) {
             virReportError(VIR_ERR_OPERATION_UNSUPPORTED, "%s",
@@ -3531,6 +3665,10 @@ doCoreDump(virQEMUDriverPtr driver,
         if (!qemuMigrationIsAllowed(driver, vm, vm->def, false, false))
             goto cleanup;
 
+        if (!(wrapperFd = virFileWrapperFdNew(&fd, path, flags)))
+            goto cleanup;
+        priv->job.wrapperFd = wrapperFd;
+
         ret = qemuMigrationToFile(driver, vm, fd, 0, path,
                                   qemuCompressProgramName(compress), false,
                                   QEMU_ASYNC_JOB_DUMP);
@@ -3545,7 +3683,7 @@ doCoreDump(virQEMUDriverPtr driver,
                              path);
         goto cleanup;
     }
-    if (virFileWrapperFdClose(wrapperFd) < 0)
+    if (wrapperFd && virFileWrapperFdClose(wrapperFd) < 0)
         goto cleanup;
 
     ret = 0;
@@ -3554,7 +3692,10 @@ doCoreDump(virQEMUDriverPtr driver,
     VIR_FORCE_CLOSE(fd);
     if (ret != 0)
         unlink(path);
+    priv->job.wrapperFd = NULL;
     virFileWrapperFdFree(wrapperFd);
+    qemuDumpStreamFree(priv->job.dumpStream);
+    priv->job.dumpStream = NULL;
     return ret;
 }
 
@@ -5381,6 +5522,13 @@ qemuDomainSaveImageOpen(virQEMUDriverPtr driver,
         goto error;
     }
 
+    /* Callers which are going to restore the domain pass @wrapperFd.
+     * Unless the image is read through iohelper, let the kernel fetch
+     * the memory state in the background while we get QEMU ready. */
+    if (wrapperFd && !bypass_cache)
+        virFileReadAhead(fd, sizeof(header) + header.xml_len,
+                         QEMU_SAVE_READAHEAD);
+
     if (edit && STREQ(xml, xmlin) &&
         (state < 0 || state == header.was_running)) {
         VIR_FREE(xml);
@@ -5457,6 +5605,104 @@ qemuDomainSaveImageOpen(virQEMUDriverPtr driver,
     return -1;
 }
 
+/* Wait until a restore may start without exceeding the
+ * max_concurrent_restores limit, in the order restores were requested.
+ * The domain @vm, if not NULL, is unlocked while waiting; the caller's
+ * job keeps it from changing in the meantime.
+ *
+ * Returns 0 on success, in which case qemuDomainRestoreEnd must be
+ * called once the restore finishes, or -1 on error. */
+static int
+qemuDomainRestoreBegin(virQEMUDriverPtr driver,
+                       virDomainObjPtr vm)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    qemuRestoreWaiter waiter = { .ready = false, .next = NULL };
+    qemuRestoreWaiterPtr *tail;
+    int ret = -1;
+
+    virMutexLock(&driver->restoreLock);
+
+    if (!driver->restoreQueue &&
+        (!cfg->maxConcurrentRestores ||
+         driver->restoreRunning < cfg->maxConcurrentRestores)) {
+        driver->restoreRunning++;
+        virMutexUnlock(&driver->restoreLock);
+        virObjectUnref(cfg);
+        return 0;
+    }
+
+    if (virCondInit(&waiter.cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize restore condition"));
+        virMutexUnlock(&driver->restoreLock);
+        virObjectUnref(cfg);
+        return -1;
+    }
+
+    tail = &driver->restoreQueue;
+    while (*tail)
+        tail = &(*tail)->next;
+    *tail = &waiter;
+
+    VIR_DEBUG("Waiting for one of %u running restores to finish",
+              driver->restoreRunning);
+
+    if (vm)
+        virObjectUnlock(vm);
+
+    while (!waiter.ready) {
+        if (virCondWait(&waiter.cond, &driver->restoreLock) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("failed to wait for a restore slot"));
+            break;
+        }
+    }
+
+    if (waiter.ready) {
+        ret = 0;
+    } else {
+        tail = &driver->restoreQueue;
+        while (*tail != &waiter)
+            tail = &(*tail)->next;
+        *tail = waiter.next;
+    }
+
+    virMutexUnlock(&driver->restoreLock);
+    virCondDestroy(&waiter.cond);
+
+    if (vm)
+        virObjectLock(vm);
+
+    virObjectUnref(cfg);
+    return ret;
+}
+
+/* Release the slot taken by qemuDomainRestoreBegin and let the
+ * longest waiting restore start. */
+static void
+qemuDomainRestoreEnd(virQEMUDriverPtr driver)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    qemuRestoreWaiterPtr waiter;
+
+    virMutexLock(&driver->restoreLock);
+
+    driver->restoreRunning--;
+
+    if ((waiter = driver->restoreQueue) &&
+        (!cfg->maxConcurrentRestores ||
+         driver->restoreRunning < cfg->maxConcurrentRestores)) {
+        driver->restoreQueue = waiter->next;
+        driver->restoreRunning++;
+        waiter->ready = true;
+        virCondSignal(&waiter->cond);
+    }
+
+    virMutexUnlock(&driver->restoreLock);
+    virObjectUnref(cfg);
+}
+
 static int ATTRIBUTE_NONNULL(4) ATTRIBUTE_NONNULL(5) ATTRIBUTE_NONNULL(6)
 qemuDomainSaveImageStartVM(virConnectPtr conn,
                            virQEMUDriverPtr driver,
@@ -5583,6 +5829,7 @@ qemuDomainRestoreFlags(virConnectPtr conn,
     virQEMUSaveHeader header;
     virFileWrapperFdPtr wrapperFd = NULL;
     int state = -1;
+    bool restoring = false;
 
     virCheckFlags(VIR_DOMAIN_SAVE_BYPASS_CACHE |
                   VIR_DOMAIN_SAVE_RUNNING |
@@ -5594,6 +5841,10 @@ qemuDomainRestoreFlags(virConnectPtr conn,
     else if (flags & VIR_DOMAIN_SAVE_PAUSED)
         state = 0;
 
+    if (qemuDomainRestoreBegin(driver, NULL) < 0)
+        goto cleanup;
+    restoring = true;
+
     fd = qemuDomainSaveImageOpen(driver, path, &def, &header,
                                  (flags & VIR_DOMAIN_SAVE_BYPASS_CACHE) != 0,
                                  &wrapperFd, dxml, state, false, false);
@@ -5632,6 +5883,8 @@ qemuDomainRestoreFlags(virConnectPtr conn,
     virFileWrapperFdFree(wrapperFd);
     if (vm)
         virObjectUnlock(vm);
+    if (restoring)
+        qemuDomainRestoreEnd(driver);
     return ret;
 }
 
@@ -5758,6 +6011,9 @@ qemuDomainObjRestore(virConnectPtr conn,
     virQEMUSaveHeader header;
     virFileWrapperFdPtr wrapperFd = NULL;
 
+    if (qemuDomainRestoreBegin(driver, vm) < 0)
+        return -1;
+
     fd = qemuDomainSaveImageOpen(driver, path, &def, &header,
                                  bypass_cache, &wrapperFd, NULL, -1, false,
                                  true);
@@ -5793,6 +6049,7 @@ qemuDomainObjRestore(virConnectPtr conn,
     virDomainDefFree(def);
     VIR_FORCE_CLOSE(fd);
     virFileWrapperFdFree(wrapperFd);
+    qemuDomainRestoreEnd(driver);
     return ret;
 }
 
@@ -10248,18 +10505,14 @@ qemuDomainMemoryPeek(virDomainPtr dom,
 {
     virQEMUDriverPtr driver = dom->conn->privateData;
     virDomainObjPtr vm;
-    char *tmp = NULL;
-    int fd = -1, ret = -1;
-    qemuDomainObjPrivatePtr priv;
-    virQEMUDriverConfigPtr cfg = NULL;
+    qemuDomainMemoryRange range = { offset, size, buffer };
+    int ret = -1;
 
     virCheckFlags(VIR_MEMORY_VIRTUAL | VIR_MEMORY_PHYSICAL, -1);
 
     if (!(vm = qemuDomObjFromDomain(dom)))
         goto cleanup;
 
-    cfg = virQEMUDriverGetConfig(driver);
-
     if (virDomainMemoryPeekEnsureACL(dom->conn, vm->def) < 0)
         goto cleanup;
 
@@ -10278,55 +10531,15 @@ qemuDomainMemoryPeek(virDomainPtr dom,
         goto endjob;
     }
 
-    if (virAsprintf(&tmp, "%s/qemu.mem.XXXXXX", cfg->cacheDir) < 0)
-        goto endjob;
-
-    /* Create a temporary filename. */
-    if ((fd = mkostemp(tmp, O_CLOEXEC)) == -1) {
-        virReportSystemError(errno,
-                             _("mkostemp(\"%s\") failed"), tmp);
-        goto endjob;
-    }
-
-    virSecurityManagerSetSavedStateLabel(qemu_driver->securityManager, vm->def, tmp);
-
-    priv = vm->privateData;
-    qemuDomainObjEnterMonitor(driver, vm);
-    if (flags == VIR_MEMORY_VIRTUAL) {
-        if (qemuMonitorSaveVirtualMemory(priv->mon, offset, size, tmp) < 0) {
-            qemuDomainObjExitMonitor(driver, vm);
-            goto endjob;
-        }
-    } else {
-        if (qemuMonitorSavePhysicalMemory(priv->mon, offset, size, tmp) < 0) {
-            qemuDomainObjExitMonitor(driver, vm);
-            goto endjob;
-        }
-    }
-    qemuDomainObjExitMonitor(driver, vm);
-
-    /* Read the memory file into buffer. */
-    if (saferead(fd, buffer, size) == (ssize_t) -1) {
-        virReportSystemError(errno,
-                             _("failed to read temporary file "
-                               "created with template %s"), tmp);
-        goto endjob;
-    }
-
-    ret = 0;
+    ret = qemuDomainMemoryPeekRanges(driver, vm, &range, 1, flags);
 
  endjob:
     if (!qemuDomainObjEndJob(driver, vm))
         vm = NULL;
 
  cleanup:
-    VIR_FORCE_CLOSE(fd);
-    if (tmp)
-        unlink(tmp);
-    VIR_FREE(tmp);
     if (vm)
         virObjectUnlock(vm);
-    virObjectUnref(cfg);
     return ret;
 }
 
@@ -11587,6 +11800,28 @@ qemuConnectBaselineCPU(virConnectPtr conn ATTRIBUTE_UNUSED,
 }
 
 
+/* Copy the progress of a memory-only dump into the job, whose status
+ * is otherwise only updated by migration */
+static void
+qemuDomainJobUpdateDumpProgress(qemuDomainObjPrivatePtr priv,
+                                unsigned long long *zeroBytes)
+{
+    virDomainJobInfoPtr info = &priv->job.info;
+    virProgressPtr progress = &priv->job.progress;
+
+    qemuDumpStreamGetProgress(priv->job.dumpStream, progress, zeroBytes);
+
+    info->type = VIR_DOMAIN_JOB_UNBOUNDED;
+    info->dataTotal = info->memTotal = progress->total;
+    info->dataProcessed = info->memProcessed = progress->processed;
+    if (progress->total > progress->processed)
+        info->dataRemaining = progress->total - progress->processed;
+    else
+        info->dataRemaining = 0;
+    info->memRemaining = info->dataRemaining;
+}
+
+
 static int qemuDomainGetJobInfo(virDomainPtr dom,
                                 virDomainJobInfoPtr info)
 {
@@ -11603,7 +11838,13 @@ static int qemuDomainGetJobInfo(virDomainPtr dom,
         goto cleanup;
 
     if (virDomainObjIsActive(vm)) {
-        if (priv->job.asyncJob && !priv->job.dump_memory_only) {
+        if (priv->job.asyncJob &&
+            (!priv->job.dump_memory_only || priv->job.dumpStream)) {
+            unsigned long long zeroBytes;
+
+            if (priv->job.dumpStream)
+                qemuDomainJobUpdateDumpProgress(priv, &zeroBytes);
+
             memcpy(info, &priv->job.info, sizeof(*info));
 
             /* Refresh elapsed time again just to ensure it
@@ -11642,11 +11883,13 @@ qemuDomainGetJobStats(virDomainPtr dom,
 {
     virDomainObjPtr vm;
     qemuDomainObjPrivatePtr priv;
-    virTypedParameterPtr par = NULL;
-    int maxpar = 0;
-    int npar = 0;
+    virTypedParamList list;
+    virProgress progress;
+    unsigned long long zeroBytes = 0;
     int ret = -1;
 
+    memset(&list, 0, sizeof(list));
+
     virCheckFlags(0, -1);
 
     if (!(vm = qemuDomObjFromDomain(dom)))
@@ -11663,7 +11906,8 @@ qemuDomainGetJobStats(virDomainPtr dom,
         goto cleanup;
     }
 
-    if (!priv->job.asyncJob || priv->job.dump_memory_only) {
+    if (!priv->job.asyncJob ||
+        (priv->job.dump_memory_only && !priv->job.dumpStream)) {
         *type = VIR_DOMAIN_JOB_NONE;
         *params = NULL;
         *nparams = 0;
@@ -11680,98 +11924,133 @@ qemuDomainGetJobStats(virDomainPtr dom,
         goto cleanup;
     priv->job.info.timeElapsed -= priv->job.start;
 
-    if (virTypedParamsAddULLong(&par, &npar, &maxpar,
+    if (priv->job.dumpStream)
+        qemuDomainJobUpdateDumpProgress(priv, &zeroBytes);
+
+    if (virTypedParamsAddULLong(&list.par, &list.npar, &list.maxpar,
                                 VIR_DOMAIN_JOB_TIME_ELAPSED,
                                 priv->job.info.timeElapsed) < 0)
         goto cleanup;
 
     if (priv->job.info.type == VIR_DOMAIN_JOB_BOUNDED &&
-        virTypedParamsAddULLong(&par, &npar, &maxpar,
+        virTypedParamsAddULLong(&list.par, &list.npar, &list.maxpar,
                                 VIR_DOMAIN_JOB_TIME_REMAINING,
                                 priv->job.info.timeRemaining) < 0)
         goto cleanup;
 
     if (priv->job.status.downtime_set &&
-        virTypedParamsAddULLong(&par, &npar, &maxpar,
+        virTypedParamsAddULLong(&list.par, &list.npar, &list.maxpar,
                                 VIR_DOMAIN_JOB_DOWNTIME,
                                 priv->job.status.downtime) < 0)
         goto cleanup;
 
-    if (virTypedParamsAddULLong(&par, &npar, &maxpar,
+    if (virTypedParamsAddULLong(&list.par, &list.npar, &list.maxpar,
                                 VIR_DOMAIN_JOB_DATA_TOTAL,
                                 priv->job.info.dataTotal) < 0 ||
-        virTypedParamsAddULLong(&par, &npar, &maxpar,
+        virTypedParamsAddULLong(&list.par, &list.npar, &list.maxpar,
                                 VIR_DOMAIN_JOB_DATA_PROCESSED,
                                 priv->job.info.dataProcessed) < 0 ||
-        virTypedParamsAddULLong(&par, &npar, &maxpar,
+        virTypedParamsAddULLong(&list.par, &list.npar, &list.maxpar,
                                 VIR_DOMAIN_JOB_DATA_REMAINING,
                                 priv->job.info.dataRemaining) < 0)
         goto cleanup;
 
-    if (virTypedParamsAddULLong(&par, &npar, &maxpar,
+    if (virTypedParamsAddULLong(&list.par, &list.npar, &list.maxpar,
                                 VIR_DOMAIN_JOB_MEMORY_TOTAL,
                                 priv->job.info.memTotal) < 0 ||
-        virTypedParamsAddULLong(&par, &npar, &maxpar,
+        virTypedParamsAddULLong(&list.par, &list.npar, &list.maxpar,
                                 VIR_DOMAIN_JOB_MEMORY_PROCESSED,
                                 priv->job.info.memProcessed) < 0 ||
-        virTypedParamsAddULLong(&par, &npar, &maxpar,
+        virTypedParamsAddULLong(&list.par, &list.npar, &list.maxpar,
                                 VIR_DOMAIN_JOB_MEMORY_REMAINING,
                                 priv->job.info.memRemaining) < 0)
         goto cleanup;
 
     if (priv->job.status.ram_duplicate_set) {
-        if (virTypedParamsAddULLong(&par, &npar, &maxpar,
+        if (virTypedParamsAddULLong(&list.par, &list.npar, &list.maxpar,
                                     VIR_DOMAIN_JOB_MEMORY_CONSTANT,
                                     priv->job.status.ram_duplicate) < 0 ||
-            virTypedParamsAddULLong(&par, &npar, &maxpar,
+            virTypedParamsAddULLong(&list.par, &list.npar, &list.maxpar,
                                     VIR_DOMAIN_JOB_MEMORY_NORMAL,
                                     priv->job.status.ram_normal) < 0 ||
-            virTypedParamsAddULLong(&par, &npar, &maxpar,
+            virTypedParamsAddULLong(&list.par, &list.npar, &list.maxpar,
                                     VIR_DOMAIN_JOB_MEMORY_NORMAL_BYTES,
                                     priv->job.status.ram_normal_bytes) < 0)
             goto cleanup;
     }
 
-    if (virTypedParamsAddULLong(&par, &npar, &maxpar,
+    if (virTypedParamsAddULLong(&list.par, &list.npar, &list.maxpar,
                                 VIR_DOMAIN_JOB_DISK_TOTAL,
                                 priv->job.info.fileTotal) < 0 ||
-        virTypedParamsAddULLong(&par, &npar, &maxpar,
+        virTypedParamsAddULLong(&list.par, &list.npar, &list.maxpar,
                                 VIR_DOMAIN_JOB_DISK_PROCESSED,
                                 priv->job.info.fileProcessed) < 0 ||
-        virTypedParamsAddULLong(&par, &npar, &maxpar,
+        virTypedParamsAddULLong(&list.par, &list.npar, &list.maxpar,
                                 VIR_DOMAIN_JOB_DISK_REMAINING,
                                 priv->job.info.fileRemaining) < 0)
         goto cleanup;
 
     if (priv->job.status.xbzrle_set) {
-        if (virTypedParamsAddULLong(&par, &npar, &maxpar,
+        if (virTypedParamsAddULLong(&list.par, &list.npar, &list.maxpar,
                                     VIR_DOMAIN_JOB_COMPRESSION_CACHE,
                                     priv->job.status.xbzrle_cache_size) < 0 ||
-            virTypedParamsAddULLong(&par, &npar, &maxpar,
+            virTypedParamsAddULLong(&list.par, &list.npar, &list.maxpar,
                                     VIR_DOMAIN_JOB_COMPRESSION_BYTES,
                                     priv->job.status.xbzrle_bytes) < 0 ||
-            virTypedParamsAddULLong(&par, &npar, &maxpar,
+            virTypedParamsAddULLong(&list.par, &list.npar, &list.maxpar,
                                     VIR_DOMAIN_JOB_COMPRESSION_PAGES,
                                     priv->job.status.xbzrle_pages) < 0 ||
-            virTypedParamsAddULLong(&par, &npar, &maxpar,
+            virTypedParamsAddULLong(&list.par, &list.npar, &list.maxpar,
                                     VIR_DOMAIN_JOB_COMPRESSION_CACHE_MISSES,
                                     priv->job.status.xbzrle_cache_miss) < 0 ||
-            virTypedParamsAddULLong(&par, &npar, &maxpar,
+            virTypedParamsAddULLong(&list.par, &list.npar, &list.maxpar,
                                     VIR_DOMAIN_JOB_COMPRESSION_OVERFLOW,
                                     priv->job.status.xbzrle_overflow) < 0)
             goto cleanup;
     }
 
+    /* Jobs writing through iohelper also know how long it waited for
+     * QEMU and for the disk, telling which side is the bottleneck */
+    progress = priv->job.progress;
+    if (priv->job.wrapperFd) {
+        virProgress io;
+
+        virFileWrapperFdGetProgress(priv->job.wrapperFd, &io);
+        progress.blockedIn = io.blockedIn;
+        progress.blockedOut = io.blockedOut;
+    }
+
+    /* Likewise tunnelled migration knows how fast the data actually
+     * reaches the destination and whether QEMU or the peer lags */
+    if (priv->job.tunnel.start) {
+        progress.blockedIn = priv->job.tunnel.blockedIn;
+        progress.blockedOut = priv->job.tunnel.blockedOut;
+
+        if (virTypedParamsAddULLong(&list.par, &list.npar, &list.maxpar,
+                                    QEMU_DOMAIN_JOB_TUNNEL_BPS,
+                                    virProgressGetRate(&priv->job.tunnel)) < 0)
+            goto cleanup;
+    }
+
+    if (priv->job.dumpStream &&
+        virTypedParamsAddULLong(&list.par, &list.npar, &list.maxpar,
+                                QEMU_DOMAIN_JOB_DUMP_ZERO_BYTES,
+                                zeroBytes) < 0)
+        goto cleanup;
+
+    if (virProgressAddParams(&progress, &list.par,
+                             &list.npar, &list.maxpar) < 0 ||
+        qemuDomainObjAddMirrorJobParams(vm, &list) < 0)
+        goto cleanup;
+
     *type = priv->job.info.type;
-    *params = par;
-    *nparams = npar;
+    virTypedParamListSteal(&list, params, nparams);
     ret = 0;
 
  cleanup:
     if (vm)
         virObjectUnlock(vm);
-    if (ret < 0)
-        virTypedParamsFree(par, npar);
+    virTypedParamListClear(&list);
     return ret;
 }
 
@@ -11800,10 +12079,19 @@ static int qemuDomainAbortJob(virDomainPtr dom)
 
     priv = vm->privateData;
 
-    if (!priv->job.asyncJob || priv->job.dump_memory_only) {
+    if (!priv->job.asyncJob ||
+        (priv->job.dump_memory_only && !priv->job.dumpStream)) {
         virReportError(VIR_ERR_OPERATION_INVALID,
                        "%s", _("no job is active on the domain"));
         goto endjob;
+    } else if (priv->job.dumpStream) {
+        /* dump-guest-memory can't be cancelled, but it fails as soon
+         * as nobody reads what it writes */
+        VIR_DEBUG("Cancelling memory-only dump at client request");
+        qemuDomainObjAbortAsyncJob(vm);
+        qemuDumpStreamAbort(priv->job.dumpStream);
+        ret = 0;
+        goto endjob;
     } else if (priv->job.asyncJob == QEMU_ASYNC_JOB_MIGRATION_IN) {
         virReportError(VIR_ERR_OPERATION_INVALID, "%s",
                        _("cannot abort incoming migration;"
@@ -11813,6 +12101,8 @@ static int qemuDomainAbortJob(virDomainPtr dom)
 
     VIR_DEBUG("Cancelling job at client request");
     qemuDomainObjAbortAsyncJob(vm);
+    if (priv->job.asyncJob == QEMU_ASYNC_JOB_MIGRATION_OUT)
+        qemuMigrationCancelQueued(driver, vm);
     qemuDomainObjEnterMonitor(driver, vm);
     ret = qemuMonitorMigrateCancel(priv->mon);
     qemuDomainObjExitMonitor(driver, vm);
@@ -13516,7 +13806,7 @@ qemuDomainSnapshotCreateXML(virDomainPtr domain,
         if (update_current) {
             vm->current_snapshot->def->current = false;
             if (qemuDomainSnapshotWriteMetadata(vm, vm->current_snapshot,
-                                                cfg->snapshotDir) < 0)
+                                                cfg) < 0)
                 goto cleanup;
             vm->current_snapshot = NULL;
         }
@@ -13565,8 +13855,7 @@ qemuDomainSnapshotCreateXML(virDomainPtr domain,
  cleanup:
     if (vm) {
         if (snapshot && !(flags & VIR_DOMAIN_SNAPSHOT_CREATE_NO_METADATA)) {
-            if (qemuDomainSnapshotWriteMetadata(vm, snap,
-                                                cfg->snapshotDir) < 0) {
+            if (qemuDomainSnapshotWriteMetadata(vm, snap, cfg) < 0) {
                 /* if writing of metadata fails, error out rather than trying
                  * to silently carry on  without completing the snapshot */
                 virDomainSnapshotFree(snapshot);
@@ -13580,10 +13869,7 @@ qemuDomainSnapshotCreateXML(virDomainPtr domain,
                     vm->current_snapshot = snap;
                 other = virDomainSnapshotFindByName(vm->snapshots,
                                                     snap->def->parent);
-                snap->parent = other;
-                other->nchildren++;
-                snap->sibling = other->first_child;
-                other->first_child = snap;
+                virDomainSnapshotSetParent(snap, other);
             }
         } else if (snap) {
             virDomainSnapshotObjListRemove(vm->snapshots, snap);
@@ -14062,8 +14348,7 @@ static int qemuDomainRevertToSnapshot(virDomainSnapshotPtr snapshot,
 
     if (vm->current_snapshot) {
         vm->current_snapshot->def->current = false;
-        if (qemuDomainSnapshotWriteMetadata(vm, vm->current_snapshot,
-                                            cfg->snapshotDir) < 0)
+        if (qemuDomainSnapshotWriteMetadata(vm, vm->current_snapshot, cfg) < 0)
             goto cleanup;
         vm->current_snapshot = NULL;
         /* XXX Should we restore vm->current_snapshot after this point
@@ -14308,8 +14593,7 @@ static int qemuDomainRevertToSnapshot(virDomainSnapshotPtr snapshot,
 
  cleanup:
     if (vm && ret == 0) {
-        if (qemuDomainSnapshotWriteMetadata(vm, snap,
-                                            cfg->snapshotDir) < 0)
+        if (qemuDomainSnapshotWriteMetadata(vm, snap, cfg) < 0)
             ret = -1;
         else
             vm->current_snapshot = snap;
@@ -14337,7 +14621,6 @@ struct _virQEMUSnapReparent {
     virDomainSnapshotObjPtr parent;
     virDomainObjPtr vm;
     int err;
-    virDomainSnapshotObjPtr last;
 };
 
 static void
@@ -14353,7 +14636,6 @@ qemuDomainSnapshotReparentChildren(void *payload,
     }
 
     VIR_FREE(snap->def->parent);
-    snap->parent = rep->parent;
 
     if (rep->parent->def &&
         VIR_STRDUP(snap->def->parent, rep->parent->def->name) < 0) {
@@ -14361,11 +14643,7 @@ qemuDomainSnapshotReparentChildren(void *payload,
         return;
     }
 
-    if (!snap->sibling)
-        rep->last = snap;
-
-    rep->err = qemuDomainSnapshotWriteMetadata(rep->vm, snap,
-                                               rep->cfg->snapshotDir);
+    rep->err = qemuDomainSnapshotWriteMetadata(rep->vm, snap, rep->cfg);
 }
 
 
@@ -14431,8 +14709,7 @@ static int qemuDomainSnapshotDelete(virDomainSnapshotPtr snapshot,
         if (rem.current) {
             if (flags & VIR_DOMAIN_SNAPSHOT_DELETE_CHILDREN_ONLY) {
                 snap->def->current = true;
-                if (qemuDomainSnapshotWriteMetadata(vm, snap,
-                                                    cfg->snapshotDir) < 0) {
+                if (qemuDomainSnapshotWriteMetadata(vm, snap, cfg) < 0) {
                     virReportError(VIR_ERR_INTERNAL_ERROR,
                                    _("failed to set snapshot '%s' as current"),
                                    snap->def->name);
@@ -14447,16 +14724,13 @@ static int qemuDomainSnapshotDelete(virDomainSnapshotPtr snapshot,
         rep.parent = snap->parent;
         rep.vm = vm;
         rep.err = 0;
-        rep.last = NULL;
         virDomainSnapshotForEachChild(snap,
                                       qemuDomainSnapshotReparentChildren,
                                       &rep);
         if (rep.err < 0)
             goto endjob;
         /* Can't modify siblings during ForEachChild, so do it now.  */
-        snap->parent->nchildren += snap->nchildren;
-        rep.last->sibling = snap->parent->first_child;
-        snap->parent->first_child = snap->first_child;
+        virDomainSnapshotMoveChildren(snap, snap->parent);
     }
 
     if (flags & VIR_DOMAIN_SNAPSHOT_DELETE_CHILDREN_ONLY) {
@@ -14469,6 +14743,7 @@ static int qemuDomainSnapshotDelete(virDomainSnapshotPtr snapshot,
     }
 
  endjob:
+    qemuDomainSnapshotStoreSync(vm, cfg);
     if (!qemuDomainObjEndJob(driver, vm))
         vm = NULL;
 
@@ -15149,10 +15424,8 @@ qemuDomainBlockJobImpl(virDomainObjPtr vm,
             /* XXX If the event reports failure, we should reflect
              * that back into the return status of this API call.  */
             while (1) {
-                /* Poll every 50ms */
-                static struct timespec ts = { .tv_sec = 0,
-                                              .tv_nsec = 50 * 1000 * 1000ull };
                 virDomainBlockJobInfo dummy;
+                unsigned long long seq = qemuDomainObjGetJobProgress(vm);
 
                 qemuDomainObjEnterMonitor(driver, vm);
                 ret = qemuMonitorBlockJob(priv->mon, device, NULL, NULL, 0,
@@ -15162,11 +15435,14 @@ qemuDomainBlockJobImpl(virDomainObjPtr vm,
                 if (ret <= 0)
                     break;
 
-                virObjectUnlock(vm);
-
-                nanosleep(&ts, NULL);
-
-                virObjectLock(vm);
+                /* The BLOCK_JOB_CANCELLED event wakes us up as soon as
+                 * the job is gone, even if it arrived while we were
+                 * talking to the monitor */
+                if (qemuDomainObjWaitJobProgress(vm, seq,
+                                                 QEMU_BLOCK_JOB_ABORT_WAIT) < 0) {
+                    ret = -1;
+                    break;
+                }
 
                 if (!virDomainObjIsActive(vm)) {
                     virReportError(VIR_ERR_OPERATION_INVALID, "%s",
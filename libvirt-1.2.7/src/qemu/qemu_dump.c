@@ -0,0 +1,574 @@
+/*
+ * qemu_dump.c: write memory-only dumps produced by QEMU
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "qemu_dump.h"
+#include "viralloc.h"
+#include "virerror.h"
+#include "virfile.h"
+#include "virlog.h"
+#include "virstring.h"
+#include "virthread.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_QEMU
+
+VIR_LOG_INIT("qemu.qemu_dump");
+
+/* QEMU writes the dump into a pipe. One thread reads it in chunks of
+ * QEMU_DUMP_CHUNK_SIZE bytes and several workers write the chunks to
+ * the file. Every chunk lands at the same offset it had in the stream,
+ * so the workers need no ordering, and blocks consisting of zeros only
+ * (free guest pages, mostly) are skipped, leaving holes in the file
+ * which read back as zeros. This works for any format QEMU produces,
+ * and the data is stored as QEMU produced it: kdump compression is
+ * only available through QEMU's own dump formats.
+ *
+ * Only regular files get holes, a block device would keep whatever
+ * the skipped blocks held before. Targets which can't seek, like
+ * pipes, are written in order by a single worker. */
+#define QEMU_DUMP_CHUNK_SIZE (1024 * 1024)
+#define QEMU_DUMP_BLOCK_SIZE 4096
+#define QEMU_DUMP_BUFFERS 8
+#define QEMU_DUMP_WORKERS 4
+#define QEMU_DUMP_PIPE_SIZE (1024 * 1024)
+
+verify(QEMU_DUMP_CHUNK_SIZE % QEMU_DUMP_BLOCK_SIZE == 0);
+
+typedef enum {
+    QEMU_DUMP_BUFFER_FREE,
+    QEMU_DUMP_BUFFER_BUSY,              /* being read into or written */
+    QEMU_DUMP_BUFFER_FULL,              /* waiting for a worker */
+} qemuDumpBufferState;
+
+typedef struct _qemuDumpBuffer qemuDumpBuffer;
+typedef qemuDumpBuffer *qemuDumpBufferPtr;
+struct _qemuDumpBuffer {
+    void *base;                         /* Location to be freed */
+    char *data;                         /* Aligned location within base */
+    size_t len;
+    off_t offset;                       /* position in the dump */
+    qemuDumpBufferState state;
+};
+
+struct _qemuDumpStream {
+    int outfd;
+    char *path;
+    bool direct;                        /* @outfd uses O_DIRECT */
+    bool sparse;                        /* @outfd is a regular file */
+    bool seekable;                      /* @outfd supports pwrite */
+    int readfd;                         /* our end of QEMU's pipe */
+
+    virThread reader;
+    bool readerRunning;
+    virThread workers[QEMU_DUMP_WORKERS];
+    size_t nworkers;
+
+    /* The rest is shared by all threads and protected by @lock */
+    virMutex lock;
+    virCond cond;
+    qemuDumpBuffer buffers[QEMU_DUMP_BUFFERS];
+    off_t end;                          /* bytes read from QEMU so far */
+    bool eof;                           /* QEMU finished writing */
+    bool aborted;
+    bool failed;                        /* see @err */
+    virError err;
+    virProgress progress;
+    unsigned long long zeroBytes;       /* bytes left as holes */
+};
+
+
+static unsigned long long
+qemuDumpNow(void)
+{
+    unsigned long long now;
+
+    if (virTimeMonotonicMicrosNowRaw(&now) < 0)
+        return 0;
+    return now;
+}
+
+
+/* @lock must be held. Record the first error and stop all threads. */
+static void
+qemuDumpStreamFail(qemuDumpStreamPtr st)
+{
+    if (!st->failed) {
+        st->failed = true;
+        virCopyLastError(&st->err);
+    }
+    virResetLastError();
+    st->aborted = true;
+    virCondBroadcast(&st->cond);
+}
+
+
+static bool
+qemuDumpIsZero(const char *data,
+               size_t len)
+{
+    return data[0] == 0 && memcmp(data, data + 1, len - 1) == 0;
+}
+
+
+static int
+qemuDumpStreamPwrite(qemuDumpStreamPtr st,
+                     const char *data,
+                     size_t len,
+                     off_t offset)
+{
+    while (len) {
+        ssize_t done = st->seekable ? pwrite(st->outfd, data, len, offset) :
+                                      write(st->outfd, data, len);
+
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0) {
+            virReportSystemError(done < 0 ? errno : ENOSPC,
+                                 _("unable to write dump to %s"), st->path);
+            return -1;
+        }
+        data += done;
+        len -= done;
+        offset += done;
+    }
+
+    return 0;
+}
+
+
+/* Write the non-zero blocks of @buf, coalescing adjacent ones into a
+ * single write, or all of it unless the target is a regular file.
+ * Stores the number of bytes skipped in @zero. */
+static int
+qemuDumpStreamWriteBuffer(qemuDumpStreamPtr st,
+                          qemuDumpBufferPtr buf,
+                          unsigned long long *zero)
+{
+    size_t len = buf->len;
+    size_t runStart = 0;
+    size_t pos;
+
+    *zero = 0;
+
+    /* O_DIRECT can only write whole blocks, the file is truncated to
+     * its real size once the dump finishes */
+    if (st->direct && len % QEMU_DUMP_BLOCK_SIZE) {
+        size_t padded = VIR_ROUND_UP(len, QEMU_DUMP_BLOCK_SIZE);
+
+        memset(buf->data + len, 0, padded - len);
+        len = padded;
+    }
+
+    if (!st->sparse)
+        return qemuDumpStreamPwrite(st, buf->data, len, buf->offset);
+
+    for (pos = 0; pos < len; pos += QEMU_DUMP_BLOCK_SIZE) {
+        size_t block = MIN(QEMU_DUMP_BLOCK_SIZE, len - pos);
+
+        if (!qemuDumpIsZero(buf->data + pos, block))
+            continue;
+
+        if (pos > runStart &&
+            qemuDumpStreamPwrite(st, buf->data + runStart, pos - runStart,
+                                 buf->offset + runStart) < 0)
+            return -1;
+
+        *zero += block;
+        runStart = pos + block;
+    }
+
+    if (len > runStart &&
+        qemuDumpStreamPwrite(st, buf->data + runStart, len - runStart,
+                             buf->offset + runStart) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static void
+qemuDumpStreamReader(void *opaque)
+{
+    qemuDumpStreamPtr st = opaque;
+    qemuDumpBufferPtr buf = NULL;
+    unsigned long long start;
+    ssize_t got;
+    size_t i;
+
+    virMutexLock(&st->lock);
+
+    while (!st->aborted) {
+        start = qemuDumpNow();
+        buf = NULL;
+        while (!st->aborted) {
+            for (i = 0; i < QEMU_DUMP_BUFFERS; i++) {
+                if (st->buffers[i].state == QEMU_DUMP_BUFFER_FREE) {
+                    buf = &st->buffers[i];
+                    break;
+                }
+            }
+            if (buf)
+                break;
+
+            if (virCondWait(&st->cond, &st->lock) < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("failed to wait for dump buffer"));
+                qemuDumpStreamFail(st);
+                break;
+            }
+        }
+        virProgressAddBlocked(&st->progress, false, qemuDumpNow() - start);
+
+        if (!buf)
+            break;
+
+        buf->state = QEMU_DUMP_BUFFER_BUSY;
+        virMutexUnlock(&st->lock);
+
+        start = qemuDumpNow();
+        got = saferead(st->readfd, buf->data, QEMU_DUMP_CHUNK_SIZE);
+        if (got < 0)
+            virReportSystemError(errno, "%s",
+                                 _("unable to read dump from QEMU"));
+
+        virMutexLock(&st->lock);
+        virProgressAddBlocked(&st->progress, true, qemuDumpNow() - start);
+
+        if (got <= 0) {
+            buf->state = QEMU_DUMP_BUFFER_FREE;
+            if (got < 0)
+                qemuDumpStreamFail(st);
+            break;
+        }
+
+        buf->len = got;
+        buf->offset = st->end;
+        buf->state = QEMU_DUMP_BUFFER_FULL;
+        st->end += got;
+        virProgressUpdate(&st->progress, st->end);
+        virCondBroadcast(&st->cond);
+
+        if (got < QEMU_DUMP_CHUNK_SIZE)
+            break;
+    }
+
+    st->eof = true;
+    virCondBroadcast(&st->cond);
+    virMutexUnlock(&st->lock);
+
+    /* When aborting, this makes QEMU fail with EPIPE */
+    VIR_FORCE_CLOSE(st->readfd);
+}
+
+
+static void
+qemuDumpStreamWorker(void *opaque)
+{
+    qemuDumpStreamPtr st = opaque;
+    qemuDumpBufferPtr buf;
+    unsigned long long zero;
+    size_t i;
+    int rc;
+
+    virMutexLock(&st->lock);
+
+    while (!st->aborted) {
+        /* The oldest chunk first, which keeps a single worker
+         * writing them in order */
+        buf = NULL;
+        for (i = 0; i < QEMU_DUMP_BUFFERS; i++) {
+            if (st->buffers[i].state == QEMU_DUMP_BUFFER_FULL &&
+                (!buf || st->buffers[i].offset < buf->offset))
+                buf = &st->buffers[i];
+        }
+
+        if (!buf) {
+            if (st->eof)
+                break;
+            if (virCondWait(&st->cond, &st->lock) < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("failed to wait for dump data"));
+                qemuDumpStreamFail(st);
+            }
+            continue;
+        }
+
+        buf->state = QEMU_DUMP_BUFFER_BUSY;
+        virMutexUnlock(&st->lock);
+
+        rc = qemuDumpStreamWriteBuffer(st, buf, &zero);
+
+        virMutexLock(&st->lock);
+        buf->state = QEMU_DUMP_BUFFER_FREE;
+        st->zeroBytes += zero;
+        if (rc < 0)
+            qemuDumpStreamFail(st);
+        virCondBroadcast(&st->cond);
+    }
+
+    virMutexUnlock(&st->lock);
+}
+
+
+/**
+ * qemuDumpStreamNew:
+ * @outfd: file to write the dump to, opened for writing and empty
+ * @path: name of @outfd, for diagnostics
+ * @direct: whether @outfd was opened with O_DIRECT
+ * @expected: expected size of the dump in bytes, or 0 if unknown
+ * @writefd: where to store the descriptor QEMU should write to
+ *
+ * Start the threads writing a dump to @outfd. The caller must hand
+ * @writefd to QEMU, close it once QEMU is done and then call
+ * qemuDumpStreamFinish. @outfd is not closed.
+ *
+ * Returns the stream or NULL on error.
+ */
+qemuDumpStreamPtr
+qemuDumpStreamNew(int outfd,
+                  const char *path,
+                  bool direct,
+                  unsigned long long expected,
+                  int *writefd)
+{
+    qemuDumpStreamPtr st;
+    int pipefd[2] = { -1, -1 };
+    struct stat sb;
+    size_t nworkers;
+    size_t i;
+
+    if (VIR_ALLOC(st) < 0)
+        return NULL;
+
+    st->outfd = outfd;
+    st->direct = direct;
+    st->readfd = -1;
+    virProgressInit(&st->progress, expected);
+
+    if (VIR_STRDUP(st->path, path) < 0)
+        goto error;
+
+    if (fstat(outfd, &sb) < 0) {
+        virReportSystemError(errno, _("unable to stat %s"), path);
+        goto error;
+    }
+    st->sparse = S_ISREG(sb.st_mode);
+    st->seekable = st->sparse || S_ISBLK(sb.st_mode);
+    nworkers = st->seekable ? QEMU_DUMP_WORKERS : 1;
+
+    if (virMutexInit(&st->lock) < 0) {
+        virReportSystemError(errno, "%s", _("cannot initialize mutex"));
+        goto error;
+    }
+    if (virCondInit(&st->cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize condition variable"));
+        virMutexDestroy(&st->lock);
+        goto error;
+    }
+
+    for (i = 0; i < QEMU_DUMP_BUFFERS; i++) {
+        qemuDumpBufferPtr buf = &st->buffers[i];
+
+#if HAVE_POSIX_MEMALIGN
+        if (posix_memalign(&buf->base, QEMU_DUMP_BLOCK_SIZE,
+                           QEMU_DUMP_CHUNK_SIZE)) {
+            virReportOOMError();
+            goto error;
+        }
+        buf->data = buf->base;
+#else
+        if (VIR_ALLOC_N(buf->data,
+                        QEMU_DUMP_CHUNK_SIZE + QEMU_DUMP_BLOCK_SIZE - 1) < 0)
+            goto error;
+        buf->base = buf->data;
+        buf->data = (char *) VIR_ROUND_UP((intptr_t) buf->base,
+                                          QEMU_DUMP_BLOCK_SIZE);
+#endif
+    }
+
+    if (pipe2(pipefd, O_CLOEXEC) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to create pipe for dump"));
+        goto error;
+    }
+    st->readfd = pipefd[0];
+
+#ifdef F_SETPIPE_SZ
+    /* Not fatal, a smaller pipe only costs more wakeups */
+    if (fcntl(st->readfd, F_SETPIPE_SZ, QEMU_DUMP_PIPE_SIZE) < 0)
+        VIR_DEBUG("Unable to resize dump pipe: errno=%d", errno);
+#endif
+
+    if (virThreadCreate(&st->reader, true, qemuDumpStreamReader, st) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to create dump reader thread"));
+        goto error;
+    }
+    st->readerRunning = true;
+
+    for (i = 0; i < nworkers; i++) {
+        if (virThreadCreate(&st->workers[i], true,
+                            qemuDumpStreamWorker, st) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("unable to create dump writer thread"));
+            if (!st->nworkers)
+                goto error;
+            break;
+        }
+        st->nworkers++;
+    }
+
+    VIR_DEBUG("Writing dump to %s with %zu threads, expected size %llu",
+              path, st->nworkers, expected);
+
+    *writefd = pipefd[1];
+    return st;
+
+ error:
+    VIR_FORCE_CLOSE(pipefd[1]);
+    if (st->readerRunning) {
+        virErrorPtr orig_err = virSaveLastError();
+
+        qemuDumpStreamAbort(st);
+        ignore_value(qemuDumpStreamFinish(st));
+        if (orig_err) {
+            virSetError(orig_err);
+            virFreeError(orig_err);
+        }
+    }
+    qemuDumpStreamFree(st);
+    return NULL;
+}
+
+
+/**
+ * qemuDumpStreamFinish:
+ * @st: the stream
+ *
+ * Wait until everything QEMU wrote is in the file. The write end of
+ * the pipe must be closed by then, otherwise this never returns.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+qemuDumpStreamFinish(qemuDumpStreamPtr st)
+{
+    size_t i;
+    int ret = -1;
+
+    if (st->readerRunning) {
+        virThreadJoin(&st->reader);
+        st->readerRunning = false;
+    }
+    for (i = 0; i < st->nworkers; i++)
+        virThreadJoin(&st->workers[i]);
+    st->nworkers = 0;
+
+    virMutexLock(&st->lock);
+
+    if (st->failed) {
+        virSetError(&st->err);
+        goto cleanup;
+    }
+
+    if (st->aborted) {
+        virReportError(VIR_ERR_OPERATION_ABORTED, "%s",
+                       _("dump was aborted"));
+        goto cleanup;
+    }
+
+    /* Trailing holes don't extend the file and O_DIRECT may have
+     * padded the last block */
+    if (st->sparse && ftruncate(st->outfd, st->end) < 0) {
+        virReportSystemError(errno, _("unable to truncate %s"), st->path);
+        goto cleanup;
+    }
+
+    VIR_DEBUG("Dump to %s finished: %llu bytes, %llu left as holes",
+              st->path, (unsigned long long) st->end, st->zeroBytes);
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&st->lock);
+    return ret;
+}
+
+
+/**
+ * qemuDumpStreamAbort:
+ * @st: the stream
+ *
+ * Stop reading the dump, which makes QEMU fail writing the rest.
+ */
+void
+qemuDumpStreamAbort(qemuDumpStreamPtr st)
+{
+    virMutexLock(&st->lock);
+    st->aborted = true;
+    virCondBroadcast(&st->cond);
+    virMutexUnlock(&st->lock);
+}
+
+
+/**
+ * qemuDumpStreamGetProgress:
+ * @st: the stream
+ * @progress: filled in with the amount of data read from QEMU
+ * @zeroBytes: filled in with the amount of zeros skipped
+ */
+void
+qemuDumpStreamGetProgress(qemuDumpStreamPtr st,
+                          virProgressPtr progress,
+                          unsigned long long *zeroBytes)
+{
+    virMutexLock(&st->lock);
+    *progress = st->progress;
+    *zeroBytes = st->zeroBytes;
+    virMutexUnlock(&st->lock);
+}
+
+
+void
+qemuDumpStreamFree(qemuDumpStreamPtr st)
+{
+    size_t i;
+
+    if (!st)
+        return;
+
+    for (i = 0; i < QEMU_DUMP_BUFFERS; i++)
+        VIR_FREE(st->buffers[i].base);
+    VIR_FORCE_CLOSE(st->readfd);
+    virResetError(&st->err);
+    virCondDestroy(&st->cond);
+    virMutexDestroy(&st->lock);
+    VIR_FREE(st->path);
+    VIR_FREE(st);
+}
@@ -0,0 +1,48 @@
+/*
+ * qemu_dump.h: write memory-only dumps produced by QEMU
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __QEMU_DUMP_H__
+# define __QEMU_DUMP_H__
+
+# include "internal.h"
+# include "virprogress.h"
+
+typedef struct _qemuDumpStream qemuDumpStream;
+typedef qemuDumpStream *qemuDumpStreamPtr;
+
+qemuDumpStreamPtr qemuDumpStreamNew(int outfd,
+                                    const char *path,
+                                    bool direct,
+                                    unsigned long long expected,
+                                    int *writefd)
+    ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(5);
+
+int qemuDumpStreamFinish(qemuDumpStreamPtr st);
+
+void qemuDumpStreamAbort(qemuDumpStreamPtr st);
+
+void qemuDumpStreamGetProgress(qemuDumpStreamPtr st,
+                               virProgressPtr progress,
+                               unsigned long long *zeroBytes);
+
+void qemuDumpStreamFree(qemuDumpStreamPtr st);
+
+#endif /* __QEMU_DUMP_H__ */
@@ -51,6 +51,7 @@
 #include "virtime.h"
 #include "locking/domain_lock.h"
 #include "rpc/virnetsocket.h"
+#include "rpc/virnetprotocol.h"
 #include "virstoragefile.h"
 #include "viruri.h"
 #include "virhook.h"
@@ -59,6 +60,10 @@
 
 #define VIR_FROM_THIS VIR_FROM_QEMU
 
+/* Shortest interval (in ms) between two queries of the progress of
+ * a job QEMU does not report completion of through events */
+#define QEMU_MIGRATION_POLL_MIN 50
+
 VIR_LOG_INIT("qemu.qemu_migration");
 
 VIR_ENUM_IMPL(qemuMigrationJobPhase, QEMU_MIGRATION_PHASE_LAST,
@@ -1152,6 +1157,12 @@ qemuMigrationStartNBDServer(virQEMUDriverPtr driver,
     char *diskAlias = NULL;
     size_t i;
 
+    /* Export all the disks in one go rather than giving the monitor
+     * (and the domain lock) up between them */
+    if (qemuDomainObjEnterMonitorAsync(driver, vm,
+                                       QEMU_ASYNC_JOB_MIGRATION_IN) < 0)
+        goto cleanup;
+
     for (i = 0; i < vm->def->ndisks; i++) {
         virDomainDiskDefPtr disk = vm->def->disks[i];
 
@@ -1163,29 +1174,22 @@ qemuMigrationStartNBDServer(virQEMUDriverPtr driver,
         VIR_FREE(diskAlias);
         if (virAsprintf(&diskAlias, "%s%s",
                         QEMU_DRIVE_HOST_PREFIX, disk->info.alias) < 0)
-            goto cleanup;
-
-        if (qemuDomainObjEnterMonitorAsync(driver, vm,
-                                           QEMU_ASYNC_JOB_MIGRATION_IN) < 0)
-            goto cleanup;
+            goto exit_monitor;
 
         if (!port &&
             ((virPortAllocatorAcquire(driver->migrationPorts, &port) < 0) ||
-             (qemuMonitorNBDServerStart(priv->mon, listenAddr, port) < 0))) {
-            qemuDomainObjExitMonitor(driver, vm);
-            goto cleanup;
-        }
+             (qemuMonitorNBDServerStart(priv->mon, listenAddr, port) < 0)))
+            goto exit_monitor;
 
-        if (qemuMonitorNBDServerAdd(priv->mon, diskAlias, true) < 0) {
-            qemuDomainObjExitMonitor(driver, vm);
-            goto cleanup;
-        }
-        qemuDomainObjExitMonitor(driver, vm);
+        if (qemuMonitorNBDServerAdd(priv->mon, diskAlias, true) < 0)
+            goto exit_monitor;
     }
 
     priv->nbdPort = port;
     ret = 0;
 
+ exit_monitor:
+    qemuDomainObjExitMonitor(driver, vm);
  cleanup:
     VIR_FREE(diskAlias);
     if (ret < 0)
@@ -1204,10 +1208,11 @@ qemuMigrationStartNBDServer(virQEMUDriverPtr driver,
  *
  * Run drive-mirror to feed NBD server running on dst and wait
  * till the process switches into another phase where writes go
- * simultaneously to both source and destination. And this switch
- * is what we are waiting for before proceeding with the next
- * disk. On success, update @migrate_flags so we don't tell
- * 'migrate' command to do the very same operation.
+ * simultaneously to both source and destination. Mirrors of all
+ * disks are started at once and copy the disks in parallel, we
+ * wait until every one of them reaches that phase. On success,
+ * update @migrate_flags so we don't tell 'migrate' command to do
+ * the very same operation.
  *
  * Returns 0 on success (@migrate_flags updated),
  *        -1 otherwise.
@@ -1221,26 +1226,33 @@ qemuMigrationDriveMirror(virQEMUDriverPtr driver,
                          unsigned int *migrate_flags)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     int ret = -1;
     int mon_ret;
     int port;
-    size_t i, lastGood = 0;
+    size_t i;
+    size_t nstarted = 0;
     char *diskAlias = NULL;
     char *nbd_dest = NULL;
     char *hoststr = NULL;
     unsigned int mirror_flags = VIR_DOMAIN_BLOCK_REBASE_REUSE_EXT;
+    virDomainBlockJobInfoPtr infos = NULL;
+    int *found = NULL;
     virErrorPtr err = NULL;
 
     if (!(*migrate_flags & (QEMU_MONITOR_MIGRATE_NON_SHARED_DISK |
-                            QEMU_MONITOR_MIGRATE_NON_SHARED_INC)))
-        return 0;
+                            QEMU_MONITOR_MIGRATE_NON_SHARED_INC))) {
+        ret = 0;
+        goto cleanup;
+    }
 
     if (!mig->nbd) {
         /* Destination doesn't support NBD server.
          * Fall back to previous implementation. */
         VIR_DEBUG("Destination doesn't support NBD server "
                   "Falling back to previous implementation.");
-        return 0;
+        ret = 0;
+        goto cleanup;
     }
 
     /* steal NBD port and thus prevent its propagation back to destination */
@@ -1260,7 +1272,6 @@ qemuMigrationDriveMirror(virQEMUDriverPtr driver,
 
     for (i = 0; i < vm->def->ndisks; i++) {
         virDomainDiskDefPtr disk = vm->def->disks[i];
-        virDomainBlockJobInfo info;
 
         /* skip shared, RO and source-less disks */
         if (disk->src->shared || disk->src->readonly ||
@@ -1268,67 +1279,108 @@ qemuMigrationDriveMirror(virQEMUDriverPtr driver,
             continue;
 
         VIR_FREE(diskAlias);
-        VIR_FREE(nbd_dest);
-        if ((virAsprintf(&diskAlias, "%s%s",
-                         QEMU_DRIVE_HOST_PREFIX, disk->info.alias) < 0) ||
-            (virAsprintf(&nbd_dest, "nbd:%s:%d:exportname=%s",
-                         hoststr, port, diskAlias) < 0))
+        if (virAsprintf(&diskAlias, "%s%s",
+                        QEMU_DRIVE_HOST_PREFIX, disk->info.alias) < 0)
             goto error;
 
-        if (qemuDomainObjEnterMonitorAsync(driver, vm,
-                                           QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
+        if (!qemuDomainObjAddMirrorJob(vm, diskAlias, disk->dst))
             goto error;
-        mon_ret = qemuMonitorDriveMirror(priv->mon, diskAlias, nbd_dest,
-                                         NULL, speed, mirror_flags);
-        qemuDomainObjExitMonitor(driver, vm);
+    }
 
-        if (mon_ret < 0)
-            goto error;
+    if (VIR_ALLOC_N(infos, priv->job.nmirrors) < 0 ||
+        VIR_ALLOC_N(found, priv->job.nmirrors) < 0)
+        goto error;
 
-        lastGood = i;
+    if (qemuDomainObjEnterMonitorAsync(driver, vm,
+                                       QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
+        goto error;
 
-        /* wait for completion */
-        while (true) {
-            /* Poll every 500ms for progress & to allow cancellation */
-            struct timespec ts = { .tv_sec = 0, .tv_nsec = 500 * 1000 * 1000ull };
+    for (nstarted = 0; nstarted < priv->job.nmirrors; nstarted++) {
+        const char *alias = priv->job.mirrors[nstarted]->alias;
 
-            memset(&info, 0, sizeof(info));
+        VIR_FREE(nbd_dest);
+        if (virAsprintf(&nbd_dest, "nbd:%s:%d:exportname=%s",
+                        hoststr, port, alias) < 0 ||
+            qemuMonitorDriveMirror(priv->mon, alias, nbd_dest,
+                                   NULL, speed, mirror_flags) < 0) {
+            qemuDomainObjExitMonitor(driver, vm);
+            goto error;
+        }
+    }
+    qemuDomainObjExitMonitor(driver, vm);
 
-            if (qemuDomainObjEnterMonitorAsync(driver, vm,
-                                               QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
-                goto error;
-            if (priv->job.asyncAbort) {
-                /* explicitly do this *after* we entered the monitor,
-                 * as this is a critical section so we are guaranteed
-                 * priv->job.asyncAbort will not change */
-                qemuDomainObjExitMonitor(driver, vm);
-                virReportError(VIR_ERR_OPERATION_ABORTED, _("%s: %s"),
-                               qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
-                               _("canceled by client"));
+    /* wait for completion */
+    while (true) {
+        bool ready = true;
+        unsigned long long seq = qemuDomainObjGetJobProgress(vm);
+
+        for (i = 0; i < priv->job.nmirrors; i++) {
+            if (priv->job.mirrors[i]->failed) {
+                virReportError(VIR_ERR_OPERATION_FAILED,
+                               _("migration of disk %s failed"),
+                               priv->job.mirrors[i]->target);
                 goto error;
             }
-            mon_ret = qemuMonitorBlockJob(priv->mon, diskAlias, NULL, NULL, 0,
-                                          &info, BLOCK_JOB_INFO, true);
+        }
+
+        if (qemuDomainObjEnterMonitorAsync(driver, vm,
+                                           QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
+            goto error;
+        if (priv->job.asyncAbort) {
+            /* explicitly do this *after* we entered the monitor,
+             * as this is a critical section so we are guaranteed
+             * priv->job.asyncAbort will not change */
             qemuDomainObjExitMonitor(driver, vm);
+            virReportError(VIR_ERR_OPERATION_ABORTED, _("%s: %s"),
+                           qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
+                           _("canceled by client"));
+            goto error;
+        }
+        for (i = 0, mon_ret = 0; i < priv->job.nmirrors && mon_ret >= 0; i++) {
+            const char *alias = priv->job.mirrors[i]->alias;
 
-            if (mon_ret < 0)
-                goto error;
+            memset(&infos[i], 0, sizeof(infos[i]));
+            mon_ret = found[i] = qemuMonitorBlockJob(priv->mon, alias,
+                                                     NULL, NULL, 0, &infos[i],
+                                                     BLOCK_JOB_INFO, true);
+        }
+        qemuDomainObjExitMonitor(driver, vm);
 
-            if (info.cur == info.end) {
-                VIR_DEBUG("Drive mirroring of '%s' completed", diskAlias);
-                break;
+        if (mon_ret < 0)
+            goto error;
+
+        for (i = 0; i < priv->job.nmirrors; i++) {
+            qemuDomainMirrorJobPtr mirror = priv->job.mirrors[i];
+
+            if (!found[i]) {
+                virReportError(VIR_ERR_OPERATION_FAILED,
+                               _("mirroring of disk %s stopped unexpectedly"),
+                               mirror->target);
+                goto error;
             }
 
-            /* XXX Frankly speaking, we should listen to the events,
-             * instead of doing this. But this works for now and we
-             * are doing something similar in migration itself anyway */
+            mirror->progress.total = infos[i].end;
+            virProgressUpdate(&mirror->progress, infos[i].cur);
 
-            virObjectUnlock(vm);
+            /* BLOCK_JOB_READY usually tells us first */
+            if (infos[i].cur == infos[i].end)
+                mirror->ready = true;
 
-            nanosleep(&ts, NULL);
+            if (!mirror->ready)
+                ready = false;
+        }
 
-            virObjectLock(vm);
+        if (ready) {
+            VIR_DEBUG("Drive mirroring of %zu disks completed",
+                      priv->job.nmirrors);
+            break;
         }
+
+        /* BLOCK_JOB_READY or a request to abort the job wakes us
+         * up earlier, the timeout only refreshes the progress */
+        if (qemuDomainObjWaitJobProgress(vm, seq,
+                                         cfg->migrationStatsInterval) < 0)
+            goto error;
     }
 
     /* Okay, copied. Modify migrate_flags */
@@ -1337,32 +1389,28 @@ qemuMigrationDriveMirror(virQEMUDriverPtr driver,
     ret = 0;
 
  cleanup:
+    VIR_FREE(infos);
+    VIR_FREE(found);
     VIR_FREE(diskAlias);
     VIR_FREE(nbd_dest);
     VIR_FREE(hoststr);
+    virObjectUnref(cfg);
     return ret;
 
  error:
     /* don't overwrite any errors */
     err = virSaveLastError();
     /* cancel any outstanding jobs */
-    while (lastGood) {
-        virDomainDiskDefPtr disk = vm->def->disks[--lastGood];
-
-        /* skip shared, RO disks */
-        if (disk->src->shared || disk->src->readonly ||
-            !virDomainDiskGetSource(disk))
-            continue;
-
-        VIR_FREE(diskAlias);
-        if (virAsprintf(&diskAlias, "%s%s",
-                        QEMU_DRIVE_HOST_PREFIX, disk->info.alias) < 0)
-            continue;
+    if (nstarted) {
         if (qemuDomainObjEnterMonitorAsync(driver, vm,
                                            QEMU_ASYNC_JOB_MIGRATION_OUT) == 0) {
-            if (qemuMonitorBlockJob(priv->mon, diskAlias, NULL, NULL, 0,
-                                    NULL, BLOCK_JOB_ABORT, true) < 0) {
-                VIR_WARN("Unable to cancel block-job on '%s'", diskAlias);
+            while (nstarted) {
+                const char *alias = priv->job.mirrors[--nstarted]->alias;
+
+                if (qemuMonitorBlockJob(priv->mon, alias, NULL, NULL, 0,
+                                        NULL, BLOCK_JOB_ABORT, true) < 0) {
+                    VIR_WARN("Unable to cancel block-job on '%s'", alias);
+                }
             }
             qemuDomainObjExitMonitor(driver, vm);
         } else {
@@ -1375,7 +1423,6 @@ qemuMigrationDriveMirror(virQEMUDriverPtr driver,
     goto cleanup;
 }
 
-
 static void
 qemuMigrationStopNBDServer(virQEMUDriverPtr driver,
                            virDomainObjPtr vm,
@@ -1410,6 +1457,10 @@ qemuMigrationCancelDriveMirror(qemuMigrationCookiePtr mig,
 
     VIR_DEBUG("mig=%p nbdPort=%d", mig->nbd, priv->nbdPort);
 
+    if (qemuDomainObjEnterMonitorAsync(driver, vm,
+                                       QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
+        return;
+
     for (i = 0; i < vm->def->ndisks; i++) {
         virDomainDiskDefPtr disk = vm->def->disks[i];
 
@@ -1421,21 +1472,15 @@ qemuMigrationCancelDriveMirror(qemuMigrationCookiePtr mig,
         VIR_FREE(diskAlias);
         if (virAsprintf(&diskAlias, "%s%s",
                         QEMU_DRIVE_HOST_PREFIX, disk->info.alias) < 0)
-            goto cleanup;
-
-        if (qemuDomainObjEnterMonitorAsync(driver, vm,
-                                           QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
-            goto cleanup;
+            break;
 
         if (qemuMonitorBlockJob(priv->mon, diskAlias, NULL, NULL, 0,
                                 NULL, BLOCK_JOB_ABORT, true) < 0)
             VIR_WARN("Unable to stop block job on %s", diskAlias);
-        qemuDomainObjExitMonitor(driver, vm);
     }
+    qemuDomainObjExitMonitor(driver, vm);
 
- cleanup:
     VIR_FREE(diskAlias);
-    return;
 }
 
 /* Validate whether the domain is safe to migrate.  If vm is NULL,
@@ -1673,13 +1718,53 @@ qemuMigrationSetAutoConverge(virQEMUDriverPtr driver,
 }
 
 
+/* Ask QEMU to report migration state changes through MIGRATION events,
+ * which lets qemuMigrationWaitForCompletion sleep until something
+ * happens rather than polling. Failure is not fatal, the job is
+ * polled as before. */
+static void
+qemuMigrationSetEvents(virQEMUDriverPtr driver,
+                       virDomainObjPtr vm,
+                       qemuDomainAsyncJob job)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    int rc;
+
+    priv->job.migrationEvents = false;
+
+    if (qemuDomainObjEnterMonitorAsync(driver, vm, job) < 0)
+        return;
+
+    rc = qemuMonitorGetMigrationCapability(
+                priv->mon,
+                QEMU_MONITOR_MIGRATION_CAPS_EVENTS);
+
+    if (rc > 0 &&
+        qemuMonitorSetMigrationCapability(
+                priv->mon,
+                QEMU_MONITOR_MIGRATION_CAPS_EVENTS) == 0)
+        priv->job.migrationEvents = true;
+
+    qemuDomainObjExitMonitor(driver, vm);
+
+    if (!priv->job.migrationEvents) {
+        VIR_DEBUG("QEMU does not support migration events, "
+                  "falling back to polling");
+        virResetLastError();
+    }
+}
+
+
 static int
 qemuMigrationWaitForSpice(virQEMUDriverPtr driver,
                           virDomainObjPtr vm)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg;
+    unsigned long long interval = QEMU_MIGRATION_POLL_MIN;
     bool wait_for_spice = false;
     bool spice_migrated = false;
+    int ret = -1;
     size_t i = 0;
 
     if (virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_SEAMLESS_MIGRATION)) {
@@ -1694,26 +1779,37 @@ qemuMigrationWaitForSpice(virQEMUDriverPtr driver,
     if (!wait_for_spice)
         return 0;
 
-    while (!spice_migrated) {
-        /* Poll every 50ms for progress & to allow cancellation */
-        struct timespec ts = { .tv_sec = 0, .tv_nsec = 50 * 1000 * 1000ull };
+    cfg = virQEMUDriverGetConfig(driver);
+
+    /* SPICE_MIGRATE_COMPLETED wakes us up as soon as the client is done,
+     * polling with an increasing interval covers a missed event */
+    while (!spice_migrated && !priv->job.spiceMigrated) {
+        unsigned long long seq = qemuDomainObjGetJobProgress(vm);
 
         if (qemuDomainObjEnterMonitorAsync(driver, vm,
                                            QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
-            return -1;
+            goto cleanup;
 
         if (qemuMonitorGetSpiceMigrationStatus(priv->mon,
                                                &spice_migrated) < 0) {
             qemuDomainObjExitMonitor(driver, vm);
-            return -1;
+            goto cleanup;
         }
         qemuDomainObjExitMonitor(driver, vm);
-        virObjectUnlock(vm);
-        nanosleep(&ts, NULL);
-        virObjectLock(vm);
+
+        if (spice_migrated)
+            break;
+
+        if (qemuDomainObjWaitJobProgress(vm, seq, interval) < 0)
+            goto cleanup;
+        interval = MIN(interval * 2, cfg->migrationStatsInterval);
     }
 
-    return 0;
+    ret = 0;
+
+ cleanup:
+    virObjectUnref(cfg);
+    return ret;
 }
 
 static int
@@ -1774,6 +1870,9 @@ qemuMigrationUpdateJobStatus(virQEMUDriverPtr driver,
             priv->job.status.ram_transferred +
             priv->job.status.disk_transferred;
 
+        priv->job.progress.total = priv->job.info.dataTotal;
+        virProgressUpdate(&priv->job.progress, priv->job.info.dataProcessed);
+
         ret = 0;
         break;
 
@@ -1799,17 +1898,220 @@ qemuMigrationUpdateJobStatus(virQEMUDriverPtr driver,
 }
 
 
+/* Pick the waiting migration which gets the next free slot according
+ * to migration_queue_order. Returns the link pointing to it, or NULL
+ * if nothing is waiting. Must be called with migrationLock held. */
+static qemuMigrationWaiterPtr *
+qemuMigrationQueueNext(virQEMUDriverPtr driver,
+                       int order)
+{
+    qemuMigrationWaiterPtr *next = &driver->migrationQueue;
+    qemuMigrationWaiterPtr *tmp;
+
+    if (!*next)
+        return NULL;
+
+    for (tmp = &(*next)->next; *tmp; tmp = &(*tmp)->next) {
+        if ((order == QEMU_MIGRATION_QUEUE_SMALLEST &&
+             (*tmp)->memory < (*next)->memory) ||
+            (order == QEMU_MIGRATION_QUEUE_LARGEST &&
+             (*tmp)->memory > (*next)->memory))
+            next = tmp;
+    }
+
+    return next;
+}
+
+/* Wait until an outgoing migration of @vm may start without exceeding
+ * the max_concurrent_migrations limit. The domain is unlocked while
+ * waiting; the caller's async job keeps it from changing in the
+ * meantime and qemuMigrationCancelQueued stops the wait when the job
+ * is aborted.
+ *
+ * Returns 0 on success, in which case qemuMigrationSlotRelease must be
+ * called once the migration finishes, or -1 on error. */
+static int
+qemuMigrationSlotAcquire(virQEMUDriverPtr driver,
+                         virDomainObjPtr vm)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuMigrationWaiter waiter = { .ready = false, .cancelled = false };
+    qemuMigrationWaiterPtr *tail;
+    int ret = -1;
+
+    virMutexLock(&driver->migrationLock);
+
+    if (!driver->migrationQueue &&
+        (!cfg->maxConcurrentMigrations ||
+         driver->migrationRunning < cfg->maxConcurrentMigrations)) {
+        driver->migrationRunning++;
+        virMutexUnlock(&driver->migrationLock);
+        virObjectUnref(cfg);
+        return 0;
+    }
+
+    if (priv->job.asyncAbort) {
+        virReportError(VIR_ERR_OPERATION_ABORTED, _("%s: %s"),
+                       qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
+                       _("canceled by client"));
+        virMutexUnlock(&driver->migrationLock);
+        virObjectUnref(cfg);
+        return -1;
+    }
+
+    if (virCondInit(&waiter.cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize migration condition"));
+        virMutexUnlock(&driver->migrationLock);
+        virObjectUnref(cfg);
+        return -1;
+    }
+
+    waiter.vm = vm;
+    waiter.memory = vm->def->mem.cur_balloon;
+
+    tail = &driver->migrationQueue;
+    while (*tail)
+        tail = &(*tail)->next;
+    *tail = &waiter;
+
+    VIR_DEBUG("Waiting for one of %u running migrations to finish",
+              driver->migrationRunning);
+
+    virObjectUnlock(vm);
+
+    while (!waiter.ready && !waiter.cancelled) {
+        if (virCondWait(&waiter.cond, &driver->migrationLock) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("failed to wait for a migration slot"));
+            break;
+        }
+    }
+
+    if (waiter.ready) {
+        ret = 0;
+    } else {
+        tail = &driver->migrationQueue;
+        while (*tail != &waiter)
+            tail = &(*tail)->next;
+        *tail = waiter.next;
+
+        if (waiter.cancelled)
+            virReportError(VIR_ERR_OPERATION_ABORTED, _("%s: %s"),
+                           qemuDomainAsyncJobTypeToString(priv->job.asyncJob),
+                           _("canceled by client"));
+    }
+
+    virMutexUnlock(&driver->migrationLock);
+    virCondDestroy(&waiter.cond);
+
+    virObjectLock(vm);
+
+    virObjectUnref(cfg);
+    return ret;
+}
+
+/* Release the slot taken by qemuMigrationSlotAcquire and let the next
+ * waiting migration start. */
+static void
+qemuMigrationSlotRelease(virQEMUDriverPtr driver)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    qemuMigrationWaiterPtr *next;
+    qemuMigrationWaiterPtr waiter;
+
+    virMutexLock(&driver->migrationLock);
+
+    driver->migrationRunning--;
+
+    if ((!cfg->maxConcurrentMigrations ||
+         driver->migrationRunning < cfg->maxConcurrentMigrations) &&
+        (next = qemuMigrationQueueNext(driver, cfg->migrationQueueOrder))) {
+        waiter = *next;
+        *next = waiter->next;
+        driver->migrationRunning++;
+        waiter->ready = true;
+        virCondSignal(&waiter->cond);
+    }
+
+    virMutexUnlock(&driver->migrationLock);
+    virObjectUnref(cfg);
+}
+
+/* Stop waiting for a migration slot for @vm, if its migration is
+ * queued. Called with @vm locked after its async job was aborted. */
+void
+qemuMigrationCancelQueued(virQEMUDriverPtr driver,
+                          virDomainObjPtr vm)
+{
+    qemuMigrationWaiterPtr waiter;
+
+    virMutexLock(&driver->migrationLock);
+
+    for (waiter = driver->migrationQueue; waiter; waiter = waiter->next) {
+        if (waiter->vm == vm) {
+            waiter->cancelled = true;
+            virCondSignal(&waiter->cond);
+            break;
+        }
+    }
+
+    virMutexUnlock(&driver->migrationLock);
+}
+
+/* Returns the migration speed (in MiB/s) a migration asking for @speed
+ * may use, given its share of migration_bandwidth_budget. */
+static unsigned long
+qemuMigrationBandwidthShare(virQEMUDriverPtr driver,
+                            unsigned long speed)
+{
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    unsigned long share;
+
+    if (!cfg->migrationBandwidthBudget) {
+        virObjectUnref(cfg);
+        return speed;
+    }
+
+    virMutexLock(&driver->migrationLock);
+    share = cfg->migrationBandwidthBudget / MAX(driver->migrationRunning, 1);
+    virMutexUnlock(&driver->migrationLock);
+
+    virObjectUnref(cfg);
+    return MAX(MIN(share, speed), 1);
+}
+
+
+typedef struct _qemuMigrationIOThread qemuMigrationIOThread;
+typedef qemuMigrationIOThread *qemuMigrationIOThreadPtr;
+
+static void qemuMigrationTunnelGetProgress(qemuMigrationIOThreadPtr io,
+                                           virProgressPtr progress);
+
 /* Returns 0 on success, -2 when migration needs to be cancelled, or -1 when
  * QEMU reports failed migration.
+ *
+ * A non-zero @speed is the migration speed the job asked for. QEMU is
+ * kept at the job's current share of migration_bandwidth_budget, which
+ * changes as other migrations start and finish.
  */
 static int
 qemuMigrationWaitForCompletion(virQEMUDriverPtr driver, virDomainObjPtr vm,
                                qemuDomainAsyncJob asyncJob,
-                               virConnectPtr dconn, bool abort_on_error)
+                               virConnectPtr dconn, bool abort_on_error,
+                               qemuMigrationIOThreadPtr iothread,
+                               unsigned long speed)
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
+    unsigned long applied = 0;
+    unsigned long share;
+    unsigned long long seq;
+    unsigned long long timeout;
     const char *job;
     int pauseReason;
+    int ret;
 
     switch (priv->job.asyncJob) {
     case QEMU_ASYNC_JOB_MIGRATION_OUT:
@@ -1827,13 +2129,21 @@ qemuMigrationWaitForCompletion(virQEMUDriverPtr driver, virDomainObjPtr vm,
 
     priv->job.info.type = VIR_DOMAIN_JOB_UNBOUNDED;
 
+    if (iothread)
+        virProgressInit(&priv->job.tunnel, 0);
+
     while (priv->job.info.type == VIR_DOMAIN_JOB_UNBOUNDED) {
-        /* Poll every 50ms for progress & to allow cancellation */
-        struct timespec ts = { .tv_sec = 0, .tv_nsec = 50 * 1000 * 1000ull };
+        /* A MIGRATION event handled while query-migrate is in flight
+         * may be overwritten by its stale answer, sampling the progress
+         * sequence first makes us query again instead of sleeping */
+        seq = qemuDomainObjGetJobProgress(vm);
 
         if (qemuMigrationUpdateJobStatus(driver, vm, job, asyncJob) == -1)
             break;
 
+        if (iothread)
+            qemuMigrationTunnelGetProgress(iothread, &priv->job.tunnel);
+
         /* cancel migration if disk I/O error is emitted while migrating */
         if (abort_on_error &&
             virDomainObjGetState(vm, &pauseReason) == VIR_DOMAIN_PAUSED &&
@@ -1849,24 +2159,47 @@ qemuMigrationWaitForCompletion(virQEMUDriverPtr driver, virDomainObjPtr vm,
             break;
         }
 
-        virObjectUnlock(vm);
+        /* Other migrations started or finished since the last round */
+        if (speed &&
+            (share = qemuMigrationBandwidthShare(driver, speed)) != applied) {
+            VIR_DEBUG("Changing migration speed from %lu to %lu MiB/s",
+                      applied, share);
+            if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
+                break;
+            if (qemuMonitorSetMigrationSpeed(priv->mon, share) < 0)
+                VIR_WARN("Unable to change migration speed of domain %s",
+                         vm->def->name);
+            else
+                applied = share;
+            qemuDomainObjExitMonitor(driver, vm);
+        }
 
-        nanosleep(&ts, NULL);
+        /* QEMU wakes us up when the job finishes or fails, we only
+         * need to refresh the statistics from time to time. Without
+         * events keep polling as often as we always did. */
+        if (priv->job.migrationEvents)
+            timeout = cfg->migrationStatsInterval;
+        else
+            timeout = QEMU_MIGRATION_POLL_MIN;
 
-        virObjectLock(vm);
+        if (qemuDomainObjWaitJobProgress(vm, seq, timeout) < 0)
+            break;
     }
 
     if (priv->job.info.type == VIR_DOMAIN_JOB_COMPLETED) {
-        return 0;
+        ret = 0;
     } else if (priv->job.info.type == VIR_DOMAIN_JOB_UNBOUNDED) {
         /* The migration was aborted by us rather than QEMU itself so let's
          * update the job type and notify the caller to send migrate_cancel.
          */
         priv->job.info.type = VIR_DOMAIN_JOB_FAILED;
-        return -2;
+        ret = -2;
     } else {
-        return -1;
+        ret = -1;
     }
+
+    virObjectUnref(cfg);
+    return ret;
 }
 
 
@@ -2262,6 +2595,21 @@ qemuMigrationPrepareCleanup(virQEMUDriverPtr driver,
     qemuDomainObjDiscardAsyncJob(driver, vm);
 }
 
+/* Size requested for the pipes between QEMU and a migration tunnel, so
+ * that QEMU can keep writing while a whole chunk is in flight */
+#define TUNNEL_PIPE_SIZE (1024 * 1024)
+
+static void
+qemuMigrationTunnelSetPipeSize(int fd ATTRIBUTE_UNUSED)
+{
+#ifdef F_SETPIPE_SZ
+    /* Not fatal, the default pipe size just costs more wakeups */
+    if (fcntl(fd, F_SETPIPE_SZ, TUNNEL_PIPE_SIZE) < 0)
+        VIR_DEBUG("Unable to resize tunnel pipe to %d bytes: errno=%d",
+                  TUNNEL_PIPE_SIZE, errno);
+#endif
+}
+
 static int
 qemuMigrationPrepareAny(virQEMUDriverPtr driver,
                         virConnectPtr dconn,
@@ -2477,6 +2825,9 @@ qemuMigrationPrepareAny(virQEMUDriverPtr driver,
         goto endjob;
     }
 
+    if (tunnel)
+        qemuMigrationTunnelSetPipeSize(dataFD[0]);
+
     /* Start the QEMU daemon, with the same command-line arguments plus
      * -incoming $migrateFrom
      */
@@ -2987,23 +3338,179 @@ struct _qemuMigrationSpec {
     } fwd;
 };
 
-#define TUNNEL_SEND_BUF_SIZE 65536
+/* Tunnelled migration data is sent in chunks as large as any libvirtd
+ * accepts in a single stream packet.  The next chunk is read from QEMU
+ * while the previous one is being sent to the destination, so neither
+ * side waits for the other. */
+#define TUNNEL_SEND_BUF_SIZE VIR_NET_MESSAGE_LEGACY_PAYLOAD_MAX
+#define TUNNEL_SEND_BUF_COUNT 2
+
+typedef struct _qemuMigrationIOBuffer qemuMigrationIOBuffer;
+typedef qemuMigrationIOBuffer *qemuMigrationIOBufferPtr;
+struct _qemuMigrationIOBuffer {
+    char *data;
+    size_t len;
+};
 
-typedef struct _qemuMigrationIOThread qemuMigrationIOThread;
-typedef qemuMigrationIOThread *qemuMigrationIOThreadPtr;
 struct _qemuMigrationIOThread {
     virThread thread;
+    virThread sendThread;
+    bool sendRunning;
     virStreamPtr st;
     int sock;
     virError err;
     int wakeupRecvFD;
     int wakeupSendFD;
+
+    /* The rest is shared by the read and send threads and
+     * protected by @lock */
+    virMutex lock;
+    virCond cond;
+    qemuMigrationIOBuffer buffers[TUNNEL_SEND_BUF_COUNT];
+    size_t head;                    /* first buffer waiting to be sent */
+    size_t count;                   /* number of buffers waiting to be sent */
+    bool eof;                       /* no more buffers will be queued */
+    bool abort;                     /* stop sending immediately */
+    bool failed;                    /* sending failed, see @err */
+    unsigned long long sent;        /* bytes sent to the destination */
+    unsigned long long blockedIn;   /* us spent waiting for QEMU */
+    unsigned long long blockedOut;  /* us spent waiting for the destination */
 };
 
+static unsigned long long qemuMigrationIONow(void)
+{
+    unsigned long long now;
+
+    if (virTimeMonotonicMicrosNowRaw(&now) < 0)
+        return 0;
+    return now;
+}
+
+static void qemuMigrationIOSendFunc(void *arg)
+{
+    qemuMigrationIOThreadPtr data = arg;
+    qemuMigrationIOBufferPtr buf;
+    unsigned long long start;
+    unsigned long long now;
+    int rc;
+
+    virMutexLock(&data->lock);
+
+    for (;;) {
+        start = qemuMigrationIONow();
+        while (!data->count && !data->eof && !data->abort) {
+            if (virCondWait(&data->cond, &data->lock) < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("failed to wait for migration data"));
+                goto error;
+            }
+        }
+        now = qemuMigrationIONow();
+        if (start && now > start)
+            data->blockedIn += now - start;
+
+        if (data->abort || !data->count)
+            break;
+
+        buf = &data->buffers[data->head];
+        virMutexUnlock(&data->lock);
+
+        rc = virStreamSend(data->st, buf->data, buf->len);
+
+        virMutexLock(&data->lock);
+        if (rc < 0)
+            goto error;
+
+        data->sent += buf->len;
+        data->head = (data->head + 1) % TUNNEL_SEND_BUF_COUNT;
+        data->count--;
+        virCondBroadcast(&data->cond);
+    }
+
+    virMutexUnlock(&data->lock);
+    return;
+
+ error:
+    data->failed = true;
+    virCopyLastError(&data->err);
+    virResetLastError();
+    virCondBroadcast(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+/* Returns a buffer to read the next chunk into, waiting for the send
+ * thread to release one if necessary, or NULL if sending failed. */
+static qemuMigrationIOBufferPtr
+qemuMigrationIOGetBuffer(qemuMigrationIOThreadPtr data)
+{
+    qemuMigrationIOBufferPtr buf = NULL;
+    unsigned long long start;
+    unsigned long long now;
+
+    virMutexLock(&data->lock);
+
+    start = qemuMigrationIONow();
+    while (data->count == TUNNEL_SEND_BUF_COUNT && !data->failed) {
+        if (virCondWait(&data->cond, &data->lock) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("failed to wait for migration tunnel"));
+            goto cleanup;
+        }
+    }
+    now = qemuMigrationIONow();
+    if (start && now > start)
+        data->blockedOut += now - start;
+
+    if (!data->failed)
+        buf = &data->buffers[(data->head + data->count) %
+                             TUNNEL_SEND_BUF_COUNT];
+
+ cleanup:
+    virMutexUnlock(&data->lock);
+    return buf;
+}
+
+static void
+qemuMigrationIOQueueBuffer(qemuMigrationIOThreadPtr data,
+                           qemuMigrationIOBufferPtr buf,
+                           size_t len)
+{
+    virMutexLock(&data->lock);
+    buf->len = len;
+    data->count++;
+    virCondBroadcast(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+/* Tell the send thread to flush the queued data (or drop it when
+ * @abort is true) and wait for it to finish.
+ *
+ * Returns 0 on success, -1 if sending failed. */
+static int
+qemuMigrationIOStopSend(qemuMigrationIOThreadPtr data,
+                        bool abort)
+{
+    if (!data->sendRunning)
+        return 0;
+
+    virMutexLock(&data->lock);
+    if (abort)
+        data->abort = true;
+    else
+        data->eof = true;
+    virCondBroadcast(&data->cond);
+    virMutexUnlock(&data->lock);
+
+    virThreadJoin(&data->sendThread);
+    data->sendRunning = false;
+
+    return data->failed ? -1 : 0;
+}
+
 static void qemuMigrationIOFunc(void *arg)
 {
     qemuMigrationIOThreadPtr data = arg;
-    char *buffer = NULL;
+    qemuMigrationIOBufferPtr buf;
     struct pollfd fds[2];
     int timeout = -1;
     virErrorPtr err = NULL;
@@ -3011,8 +3518,13 @@ static void qemuMigrationIOFunc(void *arg)
     VIR_DEBUG("Running migration tunnel; stream=%p, sock=%d",
               data->st, data->sock);
 
-    if (VIR_ALLOC_N(buffer, TUNNEL_SEND_BUF_SIZE) < 0)
+    if (virThreadCreate(&data->sendThread, true,
+                        qemuMigrationIOSendFunc, data) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create migration send thread"));
         goto abrt;
+    }
+    data->sendRunning = true;
 
     fds[0].fd = data->sock;
     fds[1].fd = data->wakeupRecvFD;
@@ -3063,10 +3575,13 @@ static void qemuMigrationIOFunc(void *arg)
         if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
             int nbytes;
 
-            nbytes = saferead(data->sock, buffer, TUNNEL_SEND_BUF_SIZE);
+            /* NULL means sending failed and the error is in data->err */
+            if (!(buf = qemuMigrationIOGetBuffer(data)))
+                goto abrt;
+
+            nbytes = saferead(data->sock, buf->data, TUNNEL_SEND_BUF_SIZE);
             if (nbytes > 0) {
-                if (virStreamSend(data->st, buffer, nbytes) < 0)
-                    goto error;
+                qemuMigrationIOQueueBuffer(data, buf, nbytes);
             } else if (nbytes < 0) {
                 virReportSystemError(errno, "%s",
                         _("tunnelled migration failed to read from qemu"));
@@ -3078,11 +3593,12 @@ static void qemuMigrationIOFunc(void *arg)
         }
     }
 
+    if (qemuMigrationIOStopSend(data, false) < 0)
+        goto abrt;
+
     if (virStreamFinish(data->st) < 0)
         goto error;
 
-    VIR_FREE(buffer);
-
     return;
 
  abrt:
@@ -3091,6 +3607,7 @@ static void qemuMigrationIOFunc(void *arg)
         virFreeError(err);
         err = NULL;
     }
+    qemuMigrationIOStopSend(data, true);
     virStreamAbort(data->st);
     if (err) {
         virSetError(err);
@@ -3098,9 +3615,10 @@ static void qemuMigrationIOFunc(void *arg)
     }
 
  error:
-    virCopyLastError(&data->err);
+    /* the send thread may have already recorded why it failed */
+    if (data->err.code == VIR_ERR_OK)
+        virCopyLastError(&data->err);
     virResetLastError();
-    VIR_FREE(buffer);
 }
 
 
@@ -3110,6 +3628,7 @@ qemuMigrationStartTunnel(virStreamPtr st,
 {
     qemuMigrationIOThreadPtr io = NULL;
     int wakeupFD[2] = { -1, -1 };
+    size_t i;
 
     if (pipe2(wakeupFD, O_CLOEXEC) < 0) {
         virReportSystemError(errno, "%s",
@@ -3120,6 +3639,24 @@ qemuMigrationStartTunnel(virStreamPtr st,
     if (VIR_ALLOC(io) < 0)
         goto error;
 
+    for (i = 0; i < TUNNEL_SEND_BUF_COUNT; i++) {
+        if (VIR_ALLOC_N(io->buffers[i].data, TUNNEL_SEND_BUF_SIZE) < 0)
+            goto error;
+    }
+
+    if (virMutexInit(&io->lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        goto error;
+    }
+
+    if (virCondInit(&io->cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize condition"));
+        virMutexDestroy(&io->lock);
+        goto error;
+    }
+
     io->st = st;
     io->sock = sock;
     io->wakeupRecvFD = wakeupFD[0];
@@ -3130,6 +3667,8 @@ qemuMigrationStartTunnel(virStreamPtr st,
                         io) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to create migration thread"));
+        virCondDestroy(&io->cond);
+        virMutexDestroy(&io->lock);
         goto error;
     }
 
@@ -3138,6 +3677,10 @@ qemuMigrationStartTunnel(virStreamPtr st,
  error:
     VIR_FORCE_CLOSE(wakeupFD[0]);
     VIR_FORCE_CLOSE(wakeupFD[1]);
+    if (io) {
+        for (i = 0; i < TUNNEL_SEND_BUF_COUNT; i++)
+            VIR_FREE(io->buffers[i].data);
+    }
     VIR_FREE(io);
     return NULL;
 }
@@ -3147,6 +3690,7 @@ qemuMigrationStopTunnel(qemuMigrationIOThreadPtr io, bool error)
 {
     int rv = -1;
     char stop = error ? 1 : 0;
+    size_t i;
 
     /* make sure the thread finishes its job and is joinable */
     if (safewrite(io->wakeupSendFD, &stop, 1) != 1) {
@@ -3157,6 +3701,10 @@ qemuMigrationStopTunnel(qemuMigrationIOThreadPtr io, bool error)
 
     virThreadJoin(&io->thread);
 
+    VIR_DEBUG("Migration tunnel sent %llu bytes, waited %llu ms for QEMU "
+              "and %llu ms for the destination",
+              io->sent, io->blockedIn / 1000, io->blockedOut / 1000);
+
     /* Forward error from the IO thread, to this thread */
     if (io->err.code != VIR_ERR_OK) {
         if (error)
@@ -3172,10 +3720,27 @@ qemuMigrationStopTunnel(qemuMigrationIOThreadPtr io, bool error)
  cleanup:
     VIR_FORCE_CLOSE(io->wakeupSendFD);
     VIR_FORCE_CLOSE(io->wakeupRecvFD);
+    virCondDestroy(&io->cond);
+    virMutexDestroy(&io->lock);
+    for (i = 0; i < TUNNEL_SEND_BUF_COUNT; i++)
+        VIR_FREE(io->buffers[i].data);
     VIR_FREE(io);
     return rv;
 }
 
+/* Copy the amount of data the tunnel sent so far and the time it spent
+ * waiting on either side into @progress, which tracks the throughput */
+static void
+qemuMigrationTunnelGetProgress(qemuMigrationIOThreadPtr io,
+                               virProgressPtr progress)
+{
+    virMutexLock(&io->lock);
+    virProgressUpdate(progress, io->sent);
+    progress->blockedIn = io->blockedIn;
+    progress->blockedOut = io->blockedOut;
+    virMutexUnlock(&io->lock);
+}
+
 static int
 qemuMigrationConnect(virQEMUDriverPtr driver,
                      virDomainObjPtr vm,
@@ -3235,13 +3800,16 @@ qemuMigrationRun(virQEMUDriverPtr driver,
     int ret = -1;
     unsigned int migrate_flags = QEMU_MONITOR_MIGRATE_BACKGROUND;
     qemuDomainObjPrivatePtr priv = vm->privateData;
+    virQEMUDriverConfigPtr cfg = NULL;
     qemuMigrationCookiePtr mig = NULL;
     qemuMigrationIOThreadPtr iothread = NULL;
     int fd = -1;
     unsigned long migrate_speed = resource ? resource : priv->migMaxBandwidth;
+    unsigned long shared_speed = 0;
     virErrorPtr orig_err = NULL;
     unsigned int cookieFlags = 0;
     bool abort_on_error = !!(flags & VIR_MIGRATE_ABORT_ON_ERROR);
+    bool slot = false;
     int rc;
 
     VIR_DEBUG("driver=%p, vm=%p, cookiein=%s, cookieinlen=%d, "
@@ -3271,6 +3839,23 @@ qemuMigrationRun(virQEMUDriverPtr driver,
         return -1;
     }
 
+    cfg = virQEMUDriverGetConfig(driver);
+
+    if (qemuMigrationSlotAcquire(driver, vm) < 0)
+        goto cleanup;
+    slot = true;
+
+    if (!virDomainObjIsActive(vm)) {
+        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                       _("guest unexpectedly quit"));
+        goto cleanup;
+    }
+
+    if (cfg->migrationBandwidthBudget) {
+        shared_speed = migrate_speed;
+        migrate_speed = qemuMigrationBandwidthShare(driver, shared_speed);
+    }
+
     mig = qemuMigrationEatCookie(driver, vm, cookiein, cookieinlen,
                                  cookieFlags | QEMU_MIGRATION_COOKIE_GRAPHICS);
     if (!mig)
@@ -3303,6 +3888,8 @@ qemuMigrationRun(virQEMUDriverPtr driver,
                                      QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
         goto cleanup;
 
+    qemuMigrationSetEvents(driver, vm, QEMU_ASYNC_JOB_MIGRATION_OUT);
+
     if (qemuDomainObjEnterMonitorAsync(driver, vm,
                                        QEMU_ASYNC_JOB_MIGRATION_OUT) < 0)
         goto cleanup;
@@ -3401,7 +3988,8 @@ qemuMigrationRun(virQEMUDriverPtr driver,
 
     rc = qemuMigrationWaitForCompletion(driver, vm,
                                         QEMU_ASYNC_JOB_MIGRATION_OUT,
-                                        dconn, abort_on_error);
+                                        dconn, abort_on_error, iothread,
+                                        shared_speed);
     if (rc == -2)
         goto cancel;
     else if (rc == -1)
@@ -3427,7 +4015,11 @@ qemuMigrationRun(virQEMUDriverPtr driver,
         orig_err = virSaveLastError();
 
     /* cancel any outstanding NBD jobs */
-    qemuMigrationCancelDriveMirror(mig, driver, vm);
+    if (mig)
+        qemuMigrationCancelDriveMirror(mig, driver, vm);
+
+    if (slot)
+        qemuMigrationSlotRelease(driver);
 
     if (spec->fwdType != MIGRATION_FWD_DIRECT) {
         if (iothread && qemuMigrationStopTunnel(iothread, ret < 0) < 0)
@@ -3445,6 +4037,7 @@ qemuMigrationRun(virQEMUDriverPtr driver,
     }
 
     qemuMigrationCookieFree(mig);
+    virObjectUnref(cfg);
 
     if (orig_err) {
         virSetError(orig_err);
@@ -3574,6 +4167,7 @@ static int doTunnelMigrate(virQEMUDriverPtr driver,
         if (pipe2(fds, O_CLOEXEC) == 0) {
             spec.dest.fd.qemu = fds[1];
             spec.dest.fd.local = fds[0];
+            qemuMigrationTunnelSetPipeSize(fds[0]);
         }
         if (spec.dest.fd.qemu == -1 ||
             virSecurityManagerSetImageFDLabel(driver->securityManager, vm->def,
@@ -4731,6 +5325,8 @@ qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
         qemuDomainObjExitMonitor(driver, vm);
     }
 
+    qemuMigrationSetEvents(driver, vm, asyncJob);
+
     if (virQEMUCapsGet(priv->qemuCaps, QEMU_CAPS_MIGRATE_QEMU_FD) &&
         (!compressor || pipe(pipeFD) == 0)) {
         /* All right! We can use fd migration, which means that qemu
@@ -4821,7 +5417,8 @@ qemuMigrationToFile(virQEMUDriverPtr driver, virDomainObjPtr vm,
     if (rc < 0)
         goto cleanup;
 
-    rc = qemuMigrationWaitForCompletion(driver, vm, asyncJob, NULL, false);
+    rc = qemuMigrationWaitForCompletion(driver, vm, asyncJob,
+                                        NULL, false, NULL, 0);
 
     if (rc < 0) {
         if (rc == -2) {
@@ -164,6 +164,9 @@ int qemuMigrationConfirm(virConnectPtr conn,
                          unsigned int flags,
                          int cancelled);
 
+void qemuMigrationCancelQueued(virQEMUDriverPtr driver,
+                               virDomainObjPtr vm);
+
 bool qemuMigrationIsAllowed(virQEMUDriverPtr driver, virDomainObjPtr vm,
                             virDomainDefPtr def, bool remote,
                             bool abort_on_error);
@@ -767,6 +767,10 @@ qemuProcessHandleStop(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
             VIR_WARN("Unable to save status on vm %s after state change",
                      vm->def->name);
         }
+
+        /* a migration about to complete or an I/O error pausing the
+         * guest may both be interesting to a waiting async job */
+        qemuDomainObjSignalJobProgress(vm);
     }
 
  unlock:
@@ -1018,11 +1022,23 @@ qemuProcessHandleBlockJob(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virDomainDiskDefPtr disk;
     virQEMUDriverConfigPtr cfg = virQEMUDriverGetConfig(driver);
     virDomainDiskDefPtr persistDisk = NULL;
+    qemuDomainMirrorJobPtr mirror;
     bool save = false;
 
     virObjectLock(vm);
     disk = qemuProcessFindDomainDiskByAlias(vm, diskAlias);
 
+    /* drive-mirror started by migration rather than by the user */
+    if ((mirror = qemuDomainObjFindMirrorJob(vm, diskAlias))) {
+        if (status == VIR_DOMAIN_BLOCK_JOB_READY) {
+            mirror->ready = true;
+        } else if (status == VIR_DOMAIN_BLOCK_JOB_FAILED ||
+                   (status == VIR_DOMAIN_BLOCK_JOB_CANCELED &&
+                    !mirror->ready)) {
+            mirror->failed = true;
+        }
+    }
+
     if (disk) {
         /* Have to generate two variants of the event for old vs. new
          * client callbacks */
@@ -1110,6 +1126,10 @@ qemuProcessHandleBlockJob(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
             VIR_WARN("Unable to update persistent definition on vm %s "
                      "after block job", vm->def->name);
     }
+
+    /* drive-mirror during migration waits for the mirror to catch up */
+    qemuDomainObjSignalJobProgress(vm);
+
     virObjectUnlock(vm);
     virObjectUnref(cfg);
 
@@ -1482,6 +1502,62 @@ qemuProcessHandleDeviceDeleted(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
 }
 
 
+static int
+qemuProcessHandleMigrationStatus(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
+                                 virDomainObjPtr vm,
+                                 int status,
+                                 void *opaque ATTRIBUTE_UNUSED)
+{
+    qemuDomainObjPrivatePtr priv;
+
+    virObjectLock(vm);
+
+    VIR_DEBUG("Migration of domain %p %s changed state to %s",
+              vm, vm->def->name,
+              qemuMonitorMigrationStatusTypeToString(status));
+
+    priv = vm->privateData;
+    if (priv->job.asyncJob == QEMU_ASYNC_JOB_NONE) {
+        VIR_DEBUG("got MIGRATION event without a migration job");
+        goto cleanup;
+    }
+
+    priv->job.status.status = status;
+    qemuDomainObjSignalJobProgress(vm);
+
+ cleanup:
+    virObjectUnlock(vm);
+    return 0;
+}
+
+
+static int
+qemuProcessHandleSpiceMigrated(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
+                               virDomainObjPtr vm,
+                               void *opaque ATTRIBUTE_UNUSED)
+{
+    qemuDomainObjPrivatePtr priv;
+
+    virObjectLock(vm);
+
+    VIR_DEBUG("Spice migration completed for domain %p %s",
+              vm, vm->def->name);
+
+    priv = vm->privateData;
+    if (priv->job.asyncJob != QEMU_ASYNC_JOB_MIGRATION_OUT) {
+        VIR_DEBUG("got SPICE_MIGRATE_COMPLETED event without a migration job");
+        goto cleanup;
+    }
+
+    priv->job.spiceMigrated = true;
+    qemuDomainObjSignalJobProgress(vm);
+
+ cleanup:
+    virObjectUnlock(vm);
+    return 0;
+}
+
+
 static qemuMonitorCallbacks monitorCallbacks = {
     .eofNotify = qemuProcessHandleMonitorEOF,
     .errorNotify = qemuProcessHandleMonitorError,
@@ -1503,6 +1579,8 @@ static qemuMonitorCallbacks monitorCallbacks = {
     .domainPMSuspendDisk = qemuProcessHandlePMSuspendDisk,
     .domainGuestPanic = qemuProcessHandleGuestPanic,
     .domainDeviceDeleted = qemuProcessHandleDeviceDeleted,
+    .domainMigrationStatus = qemuProcessHandleMigrationStatus,
+    .domainSpiceMigrated = qemuProcessHandleSpiceMigrated,
 };
 
 static int
@@ -4438,6 +4516,9 @@ void qemuProcessStop(virQEMUDriverPtr driver,
      */
     vm->def->id = -1;
 
+    /* don't let an async job sleep until its next poll */
+    qemuDomainObjSignalJobProgress(vm);
+
     if (virAtomicIntDecAndTest(&driver->nactive) && driver->inhibitCallback)
         driver->inhibitCallback(false, driver->inhibitOpaque);
 
@@ -1662,26 +1662,17 @@ remoteConnectListAllDomains(virConnectPtr conn,
     return rv;
 }
 
-/* Helper to free typed parameters. */
+/* Helper to free typed parameters serialized by
+ * remoteSerializeTypedParameters. */
 static void
 remoteFreeTypedParameters(remote_typed_param *args_params_val,
-                          u_int args_params_len)
+                          u_int args_params_len ATTRIBUTE_UNUSED)
 {
-    size_t i;
-
-    if (args_params_val == NULL)
-        return;
-
-    for (i = 0; i < args_params_len; i++) {
-        VIR_FREE(args_params_val[i].field);
-        if (args_params_val[i].value.type == VIR_TYPED_PARAM_STRING)
-            VIR_FREE(args_params_val[i].value.remote_typed_param_value_u.s);
-    }
-
     VIR_FREE(args_params_val);
 }
 
-/* Helper to serialize typed parameters. */
+/* Helper to serialize typed parameters. Names and string values are
+ * not copied, @params must outlive the serialized array. */
 static int
 remoteSerializeTypedParameters(virTypedParameterPtr params,
                                int nparams,
@@ -1697,9 +1688,7 @@ remoteSerializeTypedParameters(virTypedParameterPtr params,
         goto cleanup;
 
     for (i = 0; i < nparams; ++i) {
-        /* call() will free this: */
-        if (VIR_STRDUP(val[i].field, params[i].field) < 0)
-            goto cleanup;
+        val[i].field = params[i].field;
         val[i].value.type = params[i].type;
         switch (params[i].type) {
         case VIR_TYPED_PARAM_INT:
@@ -1721,9 +1710,7 @@ remoteSerializeTypedParameters(virTypedParameterPtr params,
             val[i].value.remote_typed_param_value_u.b = params[i].value.b;
             break;
         case VIR_TYPED_PARAM_STRING:
-            if (VIR_STRDUP(val[i].value.remote_typed_param_value_u.s,
-                           params[i].value.s) < 0)
-                goto cleanup;
+            val[i].value.remote_typed_param_value_u.s = params[i].value.s;
             break;
         default:
             virReportError(VIR_ERR_RPC, _("unknown parameter type: %d"),
@@ -1806,9 +1793,9 @@ remoteDeserializeTypedParameters(remote_typed_param *ret_params_val,
                 ret_param->value.remote_typed_param_value_u.b;
             break;
         case VIR_TYPED_PARAM_STRING:
-            if (VIR_STRDUP(param->value.s,
-                           ret_param->value.remote_typed_param_value_u.s) < 0)
-                goto cleanup;
+            /* Taken over from the reply, which xdr_free() then skips */
+            param->value.s = ret_param->value.remote_typed_param_value_u.s;
+            ret_param->value.remote_typed_param_value_u.s = NULL;
             break;
         default:
             virReportError(VIR_ERR_RPC, _("unknown parameter type: %d"),
@@ -60,6 +60,8 @@
 #include "virstring.h"
 #include "virxml.h"
 #include "fdstream.h"
+#include "virprogress.h"
+#include "virtime.h"
 
 #if WITH_STORAGE_LVM
 # include "storage_backend_logical.h"
@@ -150,6 +152,30 @@ enum {
 #define READ_BLOCK_SIZE_DEFAULT  (1024 * 1024)
 #define WRITE_BLOCK_SIZE_DEFAULT (4 * 1024)
 
+static unsigned long long
+virStorageBackendTimeNow(void)
+{
+    unsigned long long now;
+
+    if (virTimeMonotonicMicrosNowRaw(&now) < 0)
+        return 0;
+    return now;
+}
+
+static void
+virStorageBackendLogProgress(const char *what,
+                             const char *path,
+                             virProgressPtr progress)
+{
+    VIR_DEBUG("%s '%s': %llu bytes in %llu ms (%llu bytes/s), "
+              "blocked on input %llu ms, on output %llu ms",
+              what, path, progress->processed,
+              virProgressGetTimeElapsed(progress),
+              virProgressGetRate(progress),
+              progress->blockedIn / 1000,
+              progress->blockedOut / 1000);
+}
+
 static int ATTRIBUTE_NONNULL(2)
 virStorageBackendCopyToFD(virStorageVolDefPtr vol,
                           virStorageVolDefPtr inputvol,
@@ -166,6 +192,10 @@ virStorageBackendCopyToFD(virStorageVolDefPtr vol,
     char *zerobuf = NULL;
     char *buf = NULL;
     struct stat st;
+    virProgress progress;
+    unsigned long long then;
+
+    virProgressInit(&progress, *total);
 
     if ((inputfd = open(inputvol->target.path, O_RDONLY)) < 0) {
         ret = -errno;
@@ -201,6 +231,7 @@ virStorageBackendCopyToFD(virStorageVolDefPtr vol,
         if (*total < rbytes)
             rbytes = *total;
 
+        then = virStorageBackendTimeNow();
         if ((amtread = saferead(inputfd, buf, rbytes)) < 0) {
             ret = -errno;
             virReportSystemError(errno,
@@ -208,11 +239,14 @@ virStorageBackendCopyToFD(virStorageVolDefPtr vol,
                                  inputvol->target.path);
             goto cleanup;
         }
+        virProgressAddBlocked(&progress, true,
+                              virStorageBackendTimeNow() - then);
         *total -= amtread;
 
         /* Loop over amt read in 512 byte increments, looking for sparse
          * blocks */
         amtleft = amtread;
+        then = virStorageBackendTimeNow();
         do {
             interval = ((wbytes > amtleft) ? amtleft : wbytes);
             int offset = amtread - amtleft;
@@ -234,6 +268,9 @@ virStorageBackendCopyToFD(virStorageVolDefPtr vol,
 
             }
         } while ((amtleft -= interval) > 0);
+        virProgressAddBlocked(&progress, false,
+                              virStorageBackendTimeNow() - then);
+        virProgressAdd(&progress, amtread);
     }
 
     if (fdatasync(fd) < 0) {
@@ -253,6 +290,8 @@ virStorageBackendCopyToFD(virStorageVolDefPtr vol,
     }
     inputfd = -1;
 
+    virStorageBackendLogProgress("Copied", vol->target.path, &progress);
+
  cleanup:
     VIR_FORCE_CLOSE(inputfd);
 
@@ -1779,11 +1818,12 @@ virStorageBackendWipeExtentLocal(virStorageVolDefPtr vol,
                                  off_t extent_length,
                                  char *writebuf,
                                  size_t writebuf_length,
-                                 size_t *bytes_wiped)
+                                 virProgressPtr progress)
 {
     int ret = -1, written = 0;
     off_t remaining = 0;
     size_t write_size = 0;
+    unsigned long long then;
 
     VIR_DEBUG("extent logical start: %ju len: %ju",
               (uintmax_t)extent_start, (uintmax_t)extent_length);
@@ -1800,6 +1840,7 @@ virStorageBackendWipeExtentLocal(virStorageVolDefPtr vol,
     while (remaining > 0) {
 
         write_size = (writebuf_length < remaining) ? writebuf_length : remaining;
+        then = virStorageBackendTimeNow();
         written = safewrite(fd, writebuf, write_size);
         if (written < 0) {
             virReportSystemError(errno,
@@ -1809,11 +1850,14 @@ virStorageBackendWipeExtentLocal(virStorageVolDefPtr vol,
 
             goto cleanup;
         }
+        virProgressAddBlocked(progress, false,
+                              virStorageBackendTimeNow() - then);
 
-        *bytes_wiped += written;
+        virProgressAdd(progress, written);
         remaining -= written;
     }
 
+    then = virStorageBackendTimeNow();
     if (fdatasync(fd) < 0) {
         ret = -errno;
         virReportSystemError(errno,
@@ -1822,8 +1866,10 @@ virStorageBackendWipeExtentLocal(virStorageVolDefPtr vol,
         goto cleanup;
     }
 
-    VIR_DEBUG("Wrote %zu bytes to volume with path '%s'",
-              *bytes_wiped, vol->target.path);
+    virProgressAddBlocked(progress, false,
+                          virStorageBackendTimeNow() - then);
+
+    virStorageBackendLogProgress("Wiped", vol->target.path, progress);
 
     ret = 0;
 
@@ -1842,7 +1888,7 @@ virStorageBackendVolWipeLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
     int ret = -1, fd = -1;
     struct stat st;
     char *writebuf = NULL;
-    size_t bytes_wiped = 0;
+    virProgress progress;
     virCommandPtr cmd = NULL;
 
     virCheckFlags(0, -1);
@@ -1914,13 +1960,14 @@ virStorageBackendVolWipeLocal(virConnectPtr conn ATTRIBUTE_UNUSED,
             if (VIR_ALLOC_N(writebuf, st.st_blksize) < 0)
                 goto cleanup;
 
+            virProgressInit(&progress, vol->target.allocation);
             ret = virStorageBackendWipeExtentLocal(vol,
                                                    fd,
                                                    0,
                                                    vol->target.allocation,
                                                    writebuf,
                                                    st.st_blksize,
-                                                   &bytes_wiped);
+                                                   &progress);
         }
     }
 
@@ -32,6 +32,7 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <signal.h>
 
 #include "virutil.h"
 #include "virthread.h"
@@ -41,9 +42,42 @@
 #include "configmake.h"
 #include "virrandom.h"
 #include "virstring.h"
+#include "virprogress.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
+/* How often progress is reported, in microseconds */
+#define IOHELPER_PROGRESS_INTERVAL (500 * 1000)
+
+static unsigned long long
+now(void)
+{
+    unsigned long long ret;
+
+    if (virTimeMonotonicMicrosNowRaw(&ret) < 0)
+        return 0;
+    return ret;
+}
+
+/* Send the current progress to libvirtd, if it asked for it. The
+ * descriptor is non-blocking, a report which does not fit into the
+ * pipe is simply dropped since a newer one will follow. */
+static void
+reportProgress(int progressfd, virProgressPtr progress)
+{
+    char *line;
+
+    if (progressfd < 0)
+        return;
+
+    if (!(line = virProgressFormat(progress)))
+        return;
+
+    ignore_value(write(progressfd, line, strlen(line)));
+    VIR_FREE(line);
+}
+
 static int
 prepare(const char *path, int oflags, int mode,
         unsigned long long offset)
@@ -73,38 +107,217 @@ prepare(const char *path, int oflags, int mode,
     return fd;
 }
 
+/* When reading a file, a separate thread keeps this many buffers
+ * filled ahead of the writer, so that the disk is kept busy while the
+ * previous chunk is being written to the pipe */
+#define IOHELPER_BUFFERS 4
+#define IOHELPER_BUFFER_SIZE (1024 * 1024)
+#define IOHELPER_ALIGN_MASK (64 * 1024 - 1)
+
+typedef struct _ioBuffer ioBuffer;
+typedef ioBuffer *ioBufferPtr;
+struct _ioBuffer {
+    void *base;         /* Location to be freed */
+    char *data;         /* Aligned location within base */
+    size_t want;        /* bytes requested from the input */
+    size_t len;         /* bytes actually read */
+};
+
+typedef struct _ioReader ioReader;
+typedef ioReader *ioReaderPtr;
+struct _ioReader {
+    int fd;
+    const char *name;
+    unsigned long long length;  /* bytes to read, 0 until EOF */
+    unsigned long long total;   /* bytes read so far */
+    bool threaded;              /* reading in a separate thread */
+    virThread thread;
+
+    /* The rest is shared with the reader thread and protected by
+     * @lock when @threaded is true */
+    virMutex lock;
+    virCond cond;
+    ioBuffer buffers[IOHELPER_BUFFERS];
+    size_t head;                /* first buffer filled with data */
+    size_t count;               /* number of buffers filled with data */
+    bool eof;                   /* no more buffers will be filled */
+    bool failed;                /* reading failed, see @err */
+    bool abort;                 /* writer gave up, stop reading */
+    virError err;
+};
+
 static int
-runIO(const char *path, int fd, int oflags, unsigned long long length)
+allocBuffer(ioBufferPtr buf)
 {
-    void *base = NULL; /* Location to be freed */
-    char *buf = NULL; /* Aligned location within base */
-    size_t buflen = 1024*1024;
-    intptr_t alignMask = 64*1024 - 1;
-    int ret = -1;
-    int fdin, fdout;
-    const char *fdinname, *fdoutname;
-    unsigned long long total = 0;
-    bool direct = O_DIRECT && ((oflags & O_DIRECT) != 0);
-    bool shortRead = false; /* true if we hit a short read */
-    off_t end = 0;
-
 #if HAVE_POSIX_MEMALIGN
-    if (posix_memalign(&base, alignMask + 1, buflen)) {
+    if (posix_memalign(&buf->base, IOHELPER_ALIGN_MASK + 1,
+                       IOHELPER_BUFFER_SIZE)) {
         virReportOOMError();
-        goto cleanup;
+        return -1;
     }
-    buf = base;
+    buf->data = buf->base;
 #else
-    if (VIR_ALLOC_N(buf, buflen + alignMask) < 0)
-        goto cleanup;
-    base = buf;
-    buf = (char *) (((intptr_t) base + alignMask) & ~alignMask);
+    if (VIR_ALLOC_N(buf->data, IOHELPER_BUFFER_SIZE + IOHELPER_ALIGN_MASK) < 0)
+        return -1;
+    buf->base = buf->data;
+    buf->data = (char *) (((intptr_t) buf->base + IOHELPER_ALIGN_MASK) &
+                          ~IOHELPER_ALIGN_MASK);
 #endif
+    return 0;
+}
+
+/* Fill @buf with the next chunk of input. Returns the number of bytes
+ * read, 0 at the end of the requested data, or -1 on error. */
+static ssize_t
+readChunk(ioReaderPtr rd, ioBufferPtr buf)
+{
+    ssize_t got;
+
+    buf->want = IOHELPER_BUFFER_SIZE;
+    if (rd->length && (rd->length - rd->total) < buf->want)
+        buf->want = rd->length - rd->total;
+
+    if (buf->want == 0)
+        return 0; /* End of requested data from client */
+
+    if ((got = saferead(rd->fd, buf->data, buf->want)) < 0) {
+        virReportSystemError(errno, _("Unable to read %s"), rd->name);
+        return -1;
+    }
+
+    buf->len = got;
+    rd->total += got;
+    return got;
+}
+
+static void
+readerThread(void *opaque)
+{
+    ioReaderPtr rd = opaque;
+    ioBufferPtr buf;
+    ssize_t got;
+
+    virMutexLock(&rd->lock);
+
+    while (!rd->abort) {
+        while (rd->count == IOHELPER_BUFFERS && !rd->abort) {
+            if (virCondWait(&rd->cond, &rd->lock) < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("failed to wait for a free buffer"));
+                goto error;
+            }
+        }
+        if (rd->abort)
+            break;
+
+        buf = &rd->buffers[(rd->head + rd->count) % IOHELPER_BUFFERS];
+        virMutexUnlock(&rd->lock);
+
+        got = readChunk(rd, buf);
+
+        virMutexLock(&rd->lock);
+        if (got < 0)
+            goto error;
+        if (got == 0)
+            break;
+
+        rd->count++;
+        virCondBroadcast(&rd->cond);
+    }
+
+    rd->eof = true;
+    virCondBroadcast(&rd->cond);
+    virMutexUnlock(&rd->lock);
+    return;
+
+ error:
+    rd->failed = true;
+    rd->eof = true;
+    virCopyLastError(&rd->err);
+    virResetLastError();
+    virCondBroadcast(&rd->cond);
+    virMutexUnlock(&rd->lock);
+}
+
+/* Get the next buffer filled with input into @buf. Returns the number
+ * of bytes in it, 0 at the end of the input, or -1 on error. */
+static ssize_t
+getChunk(ioReaderPtr rd, ioBufferPtr *buf)
+{
+    ssize_t ret = -1;
+
+    if (!rd->threaded) {
+        *buf = &rd->buffers[0];
+        return readChunk(rd, *buf);
+    }
+
+    virMutexLock(&rd->lock);
+
+    while (!rd->count && !rd->eof) {
+        if (virCondWait(&rd->cond, &rd->lock) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("failed to wait for input data"));
+            goto cleanup;
+        }
+    }
+
+    if (rd->count) {
+        *buf = &rd->buffers[rd->head];
+        ret = (*buf)->len;
+    } else if (rd->failed) {
+        virSetError(&rd->err);
+    } else {
+        ret = 0;
+    }
+
+ cleanup:
+    virMutexUnlock(&rd->lock);
+    return ret;
+}
+
+/* Hand the buffer returned by getChunk back to the reader thread */
+static void
+putChunk(ioReaderPtr rd)
+{
+    if (!rd->threaded)
+        return;
+
+    virMutexLock(&rd->lock);
+    rd->head = (rd->head + 1) % IOHELPER_BUFFERS;
+    rd->count--;
+    virCondBroadcast(&rd->cond);
+    virMutexUnlock(&rd->lock);
+}
+
+static int
+runIO(const char *path, int fd, int oflags, unsigned long long length,
+      int progressfd)
+{
+    ioReader rd;
+    ioBufferPtr buf;
+    int ret = -1;
+    int fdout;
+    const char *fdoutname;
+    bool direct = O_DIRECT && ((oflags & O_DIRECT) != 0);
+    bool shortRead = false; /* true if we hit a short read */
+    off_t end = 0;
+    unsigned long long total = 0;
+    size_t nbuffers = 1;
+    size_t i;
+    virProgress progress;
+    unsigned long long lastReport;
+    unsigned long long then;
+
+    memset(&rd, 0, sizeof(rd));
+    rd.length = length;
+
+    virProgressInit(&progress, length);
+    lastReport = progress.start;
 
     switch (oflags & O_ACCMODE) {
     case O_RDONLY:
-        fdin = fd;
-        fdinname = path;
+        rd.fd = fd;
+        rd.name = path;
         fdout = STDOUT_FILENO;
         fdoutname = "stdout";
         /* To make the implementation simpler, we give up on any
@@ -114,10 +327,14 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
                                  _("O_DIRECT read needs entire seekable file"));
             goto cleanup;
         }
+        /* A regular file read always completes, so the reader thread
+         * can be joined even if writing fails */
+        nbuffers = IOHELPER_BUFFERS;
+        virFileReadAhead(fd, lseek(fd, 0, SEEK_CUR), 0);
         break;
     case O_WRONLY:
-        fdin = STDIN_FILENO;
-        fdinname = "stdin";
+        rd.fd = STDIN_FILENO;
+        rd.name = "stdin";
         fdout = fd;
         fdoutname = path;
         /* To make the implementation simpler, we give up on any
@@ -137,23 +354,36 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
         goto cleanup;
     }
 
-    while (1) {
-        ssize_t got;
+    for (i = 0; i < nbuffers; i++) {
+        if (allocBuffer(&rd.buffers[i]) < 0)
+            goto cleanup;
+    }
 
-        if (length &&
-            (length - total) < buflen)
-            buflen = length - total;
+    if (nbuffers > 1) {
+        if (virMutexInit(&rd.lock) < 0 ||
+            virCondInit(&rd.cond) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to initialize reader"));
+            goto cleanup;
+        }
+        if (virThreadCreate(&rd.thread, true, readerThread, &rd) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to create reader thread"));
+            goto cleanup;
+        }
+        rd.threaded = true;
+    }
 
-        if (buflen == 0)
-            break; /* End of requested data from client */
+    while (1) {
+        ssize_t got;
 
-        if ((got = saferead(fdin, buf, buflen)) < 0) {
-            virReportSystemError(errno, _("Unable to read %s"), fdinname);
+        then = now();
+        if ((got = getChunk(&rd, &buf)) < 0)
             goto cleanup;
-        }
+        virProgressAddBlocked(&progress, true, now() - then);
         if (got == 0)
             break; /* End of file before end of requested data */
-        if (got < buflen || (buflen & alignMask)) {
+        if (got < buf->want || (buf->want & IOHELPER_ALIGN_MASK)) {
             /* O_DIRECT can handle at most one short read, at end of file */
             if (direct && shortRead) {
                 virReportSystemError(EINVAL, "%s",
@@ -165,17 +395,26 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
         total += got;
         if (fdout == fd && direct && shortRead) {
             end = total;
-            memset(buf + got, 0, buflen - got);
-            got = (got + alignMask) & ~alignMask;
+            memset(buf->data + got, 0, buf->want - got);
+            got = (got + IOHELPER_ALIGN_MASK) & ~IOHELPER_ALIGN_MASK;
         }
-        if (safewrite(fdout, buf, got) < 0) {
+        then = now();
+        if (safewrite(fdout, buf->data, got) < 0) {
             virReportSystemError(errno, _("Unable to write %s"), fdoutname);
             goto cleanup;
         }
+        virProgressAddBlocked(&progress, false, now() - then);
+        putChunk(&rd);
         if (end && ftruncate(fd, end) < 0) {
             virReportSystemError(errno, _("Unable to truncate %s"), fdoutname);
             goto cleanup;
         }
+
+        virProgressUpdate(&progress, total);
+        if (then - lastReport >= IOHELPER_PROGRESS_INTERVAL) {
+            reportProgress(progressfd, &progress);
+            lastReport = then;
+        }
     }
 
     /* Ensure all data is written */
@@ -187,16 +426,29 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
         }
     }
 
+    reportProgress(progressfd, &progress);
     ret = 0;
 
  cleanup:
+    if (rd.threaded) {
+        virMutexLock(&rd.lock);
+        rd.abort = true;
+        virCondBroadcast(&rd.cond);
+        virMutexUnlock(&rd.lock);
+        virThreadJoin(&rd.thread);
+        virResetError(&rd.err);
+        virCondDestroy(&rd.cond);
+        virMutexDestroy(&rd.lock);
+    }
+
     if (VIR_CLOSE(fd) < 0 &&
         ret == 0) {
         virReportSystemError(errno, _("Unable to close %s"), path);
         ret = -1;
     }
 
-    VIR_FREE(base);
+    for (i = 0; i < nbuffers; i++)
+        VIR_FREE(rd.buffers[i].base);
     return ret;
 }
 
@@ -227,6 +479,8 @@ main(int argc, char **argv)
     unsigned int delete = 0;
     int fd = -1;
     int lengthIndex = 0;
+    int progressfd = -1;
+    const char *progressenv;
 
     program_name = argv[0];
 
@@ -301,7 +555,19 @@ main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    if (fd < 0 || runIO(path, fd, oflags, length) < 0)
+    /* libvirtd may pass a pipe to receive progress reports on */
+    if ((progressenv = virGetEnvAllowSUID("LIBVIRT_IOHELPER_PROGRESS_FD"))) {
+        if (virStrToLong_i(progressenv, NULL, 10, &progressfd) < 0 ||
+            progressfd < 0 ||
+            virSetNonBlock(progressfd) < 0) {
+            fprintf(stderr, _("%s: malformed progress fd %s"),
+                    program_name, progressenv);
+            exit(EXIT_FAILURE);
+        }
+        signal(SIGPIPE, SIG_IGN);
+    }
+
+    if (fd < 0 || runIO(path, fd, oflags, length, progressfd) < 0)
         goto error;
 
     if (delete)
@@ -158,11 +158,49 @@ virFileDirectFdFlag(void)
     return O_DIRECT ? O_DIRECT : -1;
 }
 
+
+/**
+ * virFileReadAhead:
+ * @fd: file about to be read
+ * @offset: where the reading continues
+ * @len: how many bytes to start fetching right away, or 0 for none
+ *
+ * Tell the kernel that @fd is going to be read sequentially from
+ * @offset to the end, so that it reads ahead more aggressively, and
+ * start fetching the first @len bytes in the background. This is only
+ * a hint, failures are ignored and it does nothing on O_DIRECT files
+ * or on systems without posix_fadvise.
+ */
+void
+virFileReadAhead(int fd ATTRIBUTE_UNUSED,
+                 off_t offset ATTRIBUTE_UNUSED,
+                 off_t len ATTRIBUTE_UNUSED)
+{
+#if defined(POSIX_FADV_SEQUENTIAL) && defined(POSIX_FADV_WILLNEED)
+    int rc;
+
+    if ((rc = posix_fadvise(fd, offset, 0, POSIX_FADV_SEQUENTIAL)) != 0) {
+        VIR_DEBUG("Unable to advise sequential read of fd %d: errno=%d",
+                  fd, rc);
+        return;
+    }
+
+    if (len &&
+        (rc = posix_fadvise(fd, offset, len, POSIX_FADV_WILLNEED)) != 0)
+        VIR_DEBUG("Unable to start read ahead on fd %d: errno=%d", fd, rc);
+#endif
+}
+
 /* Opaque type for managing a wrapper around a fd.  For now,
  * read-write is not supported, just a single direction.  */
 struct _virFileWrapperFd {
     virCommandPtr cmd; /* Child iohelper process to do the I/O.  */
     char *err_msg; /* stderr of @cmd */
+
+    int progressfd; /* Progress reports from @cmd */
+    char progressLine[128]; /* Incomplete report read so far */
+    size_t progressLen;
+    virProgress progress; /* Last complete report */
 };
 
 #ifndef WIN32
@@ -199,6 +237,7 @@ virFileWrapperFdNew(int *fd, const char *name, unsigned int flags)
     virFileWrapperFdPtr ret = NULL;
     bool output = false;
     int pipefd[2] = { -1, -1 };
+    int progressfd[2] = { -1, -1 };
     int mode = -1;
     char *iohelper_path = NULL;
 
@@ -223,6 +262,8 @@ virFileWrapperFdNew(int *fd, const char *name, unsigned int flags)
 
     if (VIR_ALLOC(ret) < 0)
         return NULL;
+    ret->progressfd = -1;
+    virProgressInit(&ret->progress, 0);
 
     mode = fcntl(*fd, F_GETFL);
 
@@ -238,12 +279,20 @@ virFileWrapperFdNew(int *fd, const char *name, unsigned int flags)
         goto error;
     }
 
-    if (pipe2(pipefd, O_CLOEXEC) < 0) {
+    if (pipe2(pipefd, O_CLOEXEC) < 0 ||
+        pipe2(progressfd, O_CLOEXEC) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("unable to create pipe for %s"), name);
         goto error;
     }
 
+    if (virSetNonBlock(progressfd[0]) < 0) {
+        virReportSystemError(errno,
+                             _("unable to set progress pipe of %s non-blocking"),
+                             name);
+        goto error;
+    }
+
     if (!(iohelper_path = virFileFindResource("libvirt_iohelper",
                                               "src",
                                               LIBEXECDIR)))
@@ -268,6 +317,17 @@ virFileWrapperFdNew(int *fd, const char *name, unsigned int flags)
      */
     virCommandAddEnvPair(ret->cmd, "LIBVIRT_LOG_OUTPUTS", "1:stderr");
     virCommandSetErrorBuffer(ret->cmd, &ret->err_msg);
+
+    /* Let iohelper report how much it has transferred and how long
+     * it waited for each side, see virFileWrapperFdGetProgress */
+    virCommandPassFD(ret->cmd, progressfd[1],
+                     VIR_COMMAND_PASS_FD_CLOSE_PARENT);
+    virCommandAddEnvFormat(ret->cmd, "LIBVIRT_IOHELPER_PROGRESS_FD=%d",
+                           progressfd[1]);
+    progressfd[1] = -1;
+    ret->progressfd = progressfd[0];
+    progressfd[0] = -1;
+
     virCommandDoAsyncIO(ret->cmd);
 
     if (virCommandRunAsync(ret->cmd, NULL) < 0)
@@ -286,6 +346,8 @@ virFileWrapperFdNew(int *fd, const char *name, unsigned int flags)
     VIR_FREE(iohelper_path);
     VIR_FORCE_CLOSE(pipefd[0]);
     VIR_FORCE_CLOSE(pipefd[1]);
+    VIR_FORCE_CLOSE(progressfd[0]);
+    VIR_FORCE_CLOSE(progressfd[1]);
     virFileWrapperFdFree(ret);
     return NULL;
 }
@@ -325,9 +387,57 @@ virFileWrapperFdClose(virFileWrapperFdPtr wfd)
     if (wfd->err_msg)
         VIR_WARN("iohelper reports: %s", wfd->err_msg);
 
+    virFileWrapperFdGetProgress(wfd, &wfd->progress);
+    VIR_DEBUG("iohelper transferred %llu bytes in %llu ms, "
+              "blocked on input %llu ms, on output %llu ms",
+              wfd->progress.processed,
+              virProgressGetTimeElapsed(&wfd->progress),
+              wfd->progress.blockedIn / 1000,
+              wfd->progress.blockedOut / 1000);
+
     return ret;
 }
 
+
+/**
+ * virFileWrapperFdGetProgress:
+ * @wfd: fd wrapper
+ * @progress: filled with the progress of the transfer
+ *
+ * Collect the progress reports sent by the helper process so far
+ * and fill @progress with the most recent one. This never blocks,
+ * so it is safe to call while the transfer is running.
+ */
+void
+virFileWrapperFdGetProgress(virFileWrapperFdPtr wfd,
+                            virProgressPtr progress)
+{
+    char buf[1024];
+    ssize_t got;
+    size_t i;
+
+    while (wfd->progressfd >= 0 &&
+           (got = read(wfd->progressfd, buf, sizeof(buf))) > 0) {
+        for (i = 0; i < got; i++) {
+            if (buf[i] != '\n') {
+                if (wfd->progressLen < sizeof(wfd->progressLine) - 1)
+                    wfd->progressLine[wfd->progressLen++] = buf[i];
+                continue;
+            }
+
+            wfd->progressLine[wfd->progressLen] = '\0';
+            wfd->progressLen = 0;
+            if (virProgressParse(wfd->progressLine, &wfd->progress) < 0) {
+                VIR_WARN("Ignoring malformed iohelper progress report");
+                virResetLastError();
+            }
+        }
+    }
+
+    if (progress != &wfd->progress)
+        *progress = wfd->progress;
+}
+
 /**
  * virFileWrapperFdFree:
  * @wfd: fd wrapper, or NULL
@@ -344,6 +454,7 @@ virFileWrapperFdFree(virFileWrapperFdPtr wfd)
         return;
 
     VIR_FREE(wfd->err_msg);
+    VIR_FORCE_CLOSE(wfd->progressfd);
 
     virCommandFree(wfd->cmd);
     VIR_FREE(wfd);
@@ -31,6 +31,7 @@
 
 # include "internal.h"
 # include "virstoragefile.h"
+# include "virprogress.h"
 
 typedef enum {
     VIR_FILE_CLOSE_PRESERVE_ERRNO = 1 << 0,
@@ -84,6 +85,8 @@ typedef virFileWrapperFd *virFileWrapperFdPtr;
 
 int virFileDirectFdFlag(void);
 
+void virFileReadAhead(int fd, off_t offset, off_t len);
+
 typedef enum {
     VIR_FILE_WRAPPER_BYPASS_CACHE   = (1 << 0),
     VIR_FILE_WRAPPER_NON_BLOCKING   = (1 << 1),
@@ -96,6 +99,10 @@ virFileWrapperFdPtr virFileWrapperFdNew(int *fd,
 
 int virFileWrapperFdClose(virFileWrapperFdPtr dfd);
 
+void virFileWrapperFdGetProgress(virFileWrapperFdPtr dfd,
+                                 virProgressPtr progress)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
 void virFileWrapperFdFree(virFileWrapperFdPtr dfd);
 
 int virFileLock(int fd, bool shared, off_t start, off_t len, bool waitForLock);
@@ -1,5 +1,5 @@
 /*
- * virhash.c: chained hash tables
+ * virhash.c: open addressing hash tables
  *
  * Reference: Your favorite introductory book on algorithms
  *
@@ -36,7 +36,13 @@
 
 VIR_LOG_INIT("util.hash");
 
-#define MAX_HASH_LEN 8
+/* Tables are power-of-two sized arrays of slots probed linearly.
+ * Growing allocates the new array and moves at most
+ * VIR_HASH_MIGRATE_STEP slots of the old one per modification, so
+ * no single insertion has to rehash the whole table. Until the move
+ * is complete, lookups consult both arrays. */
+#define VIR_HASH_MIN_SIZE 8
+#define VIR_HASH_MIGRATE_STEP 64
 
 /* #define DEBUG_GROW */
 
@@ -47,24 +53,42 @@ VIR_LOG_INIT("util.hash");
     } while (0)
 
 /*
- * A single entry in the hash table
+ * A single slot in the hash table. Empty slots have a NULL name,
+ * removed ones keep probe sequences intact by pointing name at
+ * virHashDeletedName.
  */
 typedef struct _virHashEntry virHashEntry;
 typedef virHashEntry *virHashEntryPtr;
 struct _virHashEntry {
-    struct _virHashEntry *next;
     void *name;
     void *payload;
+    uint32_t code;
+};
+
+static char virHashDeletedName;
+
+#define VIR_HASH_ENTRY_LIVE(entry)                                      \
+    ((entry)->name && (entry)->name != &virHashDeletedName)
+
+typedef struct _virHashSlots virHashSlots;
+typedef virHashSlots *virHashSlotsPtr;
+struct _virHashSlots {
+    virHashEntryPtr entries;
+    size_t size;        /* always a power of two */
+    size_t used;        /* live entries */
+    size_t deleted;     /* removed entries still occupying a slot */
 };
 
 /*
  * The entire hash table
  */
 struct _virHashTable {
-    virHashEntryPtr *table;
+    virHashSlots cur;
+    /* Slots being moved into @cur after a resize, and the index of
+     * the next one to move. */
+    virHashSlots old;
+    size_t migrated;
     uint32_t seed;
-    size_t size;
-    size_t nbElems;
     /* True iff we are iterating over hash entries. */
     bool iterating;
     /* Pointer to the current entry during iteration. */
@@ -106,11 +130,166 @@ virHashValueFree(void *value, const void *name ATTRIBUTE_UNUSED)
 }
 
 
-static size_t
-virHashComputeKey(const virHashTable *table, const void *name)
+static int
+virHashSlotsInit(virHashSlotsPtr slots, size_t size)
+{
+    if (VIR_ALLOC_N(slots->entries, size) < 0)
+        return -1;
+    slots->size = size;
+    slots->used = 0;
+    slots->deleted = 0;
+    return 0;
+}
+
+
+static virHashEntryPtr
+virHashSlotsFind(const virHashTable *table,
+                 const virHashSlots *slots,
+                 const void *name,
+                 uint32_t code)
 {
-    uint32_t value = table->keyCode(name, table->seed);
-    return value % table->size;
+    size_t mask = slots->size - 1;
+    size_t i;
+
+    if (!slots->entries || !slots->used)
+        return NULL;
+
+    /* There is always at least one empty slot, see virHashSlotsFull */
+    for (i = code & mask; slots->entries[i].name; i = (i + 1) & mask) {
+        virHashEntryPtr entry = slots->entries + i;
+
+        if (entry->code == code &&
+            entry->name != &virHashDeletedName &&
+            table->keyEqual(entry->name, name))
+            return entry;
+    }
+
+    return NULL;
+}
+
+
+/* Claim the first free slot on the probe sequence of @code. The
+ * caller must have made sure the key is not present already. */
+static virHashEntryPtr
+virHashSlotsClaim(virHashSlotsPtr slots, uint32_t code)
+{
+    size_t mask = slots->size - 1;
+    size_t i;
+
+    for (i = code & mask; VIR_HASH_ENTRY_LIVE(&slots->entries[i]);
+         i = (i + 1) & mask)
+        ;
+
+    if (slots->entries[i].name)
+        slots->deleted--;
+    slots->used++;
+    slots->entries[i].code = code;
+    return slots->entries + i;
+}
+
+
+static void
+virHashSlotsRelease(virHashSlotsPtr slots, virHashEntryPtr entry)
+{
+    size_t next = (entry - slots->entries + 1) & (slots->size - 1);
+
+    /* No probe sequence runs past an empty slot, so a removed entry
+     * directly followed by one need not be kept as a marker. */
+    if (slots->entries[next].name) {
+        entry->name = &virHashDeletedName;
+        slots->deleted++;
+    } else {
+        entry->name = NULL;
+    }
+    entry->payload = NULL;
+    slots->used--;
+}
+
+
+/* Whether adding one more entry would push @slots over 3/4 load */
+static bool
+virHashSlotsFull(const virHashSlots *slots)
+{
+    return (slots->used + slots->deleted + 1) * 4 > slots->size * 3;
+}
+
+
+/**
+ * virHashMigrate:
+ * @table: the hash table
+ * @nslots: how many slots of the old array to process
+ *
+ * Move live entries from the array being retired after a resize
+ * into the current one, freeing the old array once it is drained.
+ */
+static void
+virHashMigrate(virHashTablePtr table, size_t nslots)
+{
+    if (!table->old.entries)
+        return;
+
+    while (nslots-- && table->migrated < table->old.size) {
+        virHashEntryPtr entry = table->old.entries + table->migrated++;
+        virHashEntryPtr dst;
+
+        if (!VIR_HASH_ENTRY_LIVE(entry))
+            continue;
+
+        dst = virHashSlotsClaim(&table->cur, entry->code);
+        dst->name = entry->name;
+        dst->payload = entry->payload;
+
+        /* Later probes in the old array may still pass through here */
+        entry->name = &virHashDeletedName;
+        table->old.used--;
+        table->old.deleted++;
+    }
+
+    if (table->migrated == table->old.size) {
+        VIR_FREE(table->old.entries);
+        memset(&table->old, 0, sizeof(table->old));
+        table->migrated = 0;
+    }
+}
+
+
+/**
+ * virHashGrow:
+ * @table: the hash table
+ *
+ * Start moving the table into a fresh array: twice as large if it is
+ * mostly live entries, the same size if it is mostly removed ones.
+ * Entries are then moved over gradually by virHashMigrate.
+ *
+ * Returns 0 in case of success, -1 in case of failure
+ */
+static int
+virHashGrow(virHashTablePtr table)
+{
+    virHashSlots slots;
+    size_t size = table->cur.size;
+
+    /* Never have two resizes in flight */
+    virHashMigrate(table, SIZE_MAX);
+
+    if (table->cur.used * 2 >= size) {
+        if (size > SIZE_MAX / 2)
+            return -1;
+        size *= 2;
+    }
+
+    if (virHashSlotsInit(&slots, size) < 0)
+        return -1;
+
+#ifdef DEBUG_GROW
+    VIR_DEBUG("virHashGrow : from %zu to %zu, %zu elems, %zu deleted",
+              table->cur.size, size, table->cur.used, table->cur.deleted);
+#endif
+
+    table->old = table->cur;
+    table->cur = slots;
+    table->migrated = 0;
+    return 0;
 }
 
 /**
@@ -134,23 +313,25 @@ virHashTablePtr virHashCreateFull(ssize_t size,
                                   virHashKeyFree keyFree)
 {
     virHashTablePtr table = NULL;
+    size_t slots = VIR_HASH_MIN_SIZE;
 
     if (size <= 0)
         size = 256;
 
+    while (slots < (size_t) size)
+        slots *= 2;
+
     if (VIR_ALLOC(table) < 0)
         return NULL;
 
     table->seed = virRandomBits(32);
-    table->size = size;
-    table->nbElems = 0;
     table->dataFree = dataFree;
     table->keyCode = keyCode;
     table->keyEqual = keyEqual;
     table->keyCopy = keyCopy;
     table->keyFree = keyFree;
 
-    if (VIR_ALLOC_N(table->table, size) < 0) {
+    if (virHashSlotsInit(&table->cur, slots) < 0) {
         VIR_FREE(table);
         return NULL;
     }
@@ -178,67 +359,26 @@ virHashTablePtr virHashCreate(ssize_t size, virHashDataFree dataFree)
                              virHashStrFree);
 }
 
-/**
- * virHashGrow:
- * @table: the hash table
- * @size: the new size of the hash table
- *
- * resize the hash table
- *
- * Returns 0 in case of success, -1 in case of failure
- */
-static int
-virHashGrow(virHashTablePtr table, size_t size)
-{
-    size_t oldsize, i;
-    virHashEntryPtr *oldtable;
-
-#ifdef DEBUG_GROW
-    size_t nbElem = 0;
-#endif
-
-    if (table == NULL)
-        return -1;
-    if (size < 8)
-        return -1;
-    if (size > 8 * 2048)
-        return -1;
-
-    oldsize = table->size;
-    oldtable = table->table;
-    if (oldtable == NULL)
-        return -1;
 
-    if (VIR_ALLOC_N(table->table, size) < 0) {
-        table->table = oldtable;
-        return -1;
-    }
-    table->size = size;
+static void
+virHashSlotsFreeEntries(virHashTablePtr table, virHashSlotsPtr slots)
+{
+    size_t i;
 
-    for (i = 0; i < oldsize; i++) {
-        virHashEntryPtr iter = oldtable[i];
-        while (iter) {
-            virHashEntryPtr next = iter->next;
-            size_t key = virHashComputeKey(table, iter->name);
+    for (i = 0; i < slots->size && slots->used; i++) {
+        virHashEntryPtr entry = slots->entries + i;
 
-            iter->next = table->table[key];
-            table->table[key] = iter;
+        if (!VIR_HASH_ENTRY_LIVE(entry))
+            continue;
 
-#ifdef DEBUG_GROW
-            nbElem++;
-#endif
-            iter = next;
-        }
+        if (table->dataFree)
+            table->dataFree(entry->payload, entry->name);
+        if (table->keyFree)
+            table->keyFree(entry->name);
+        slots->used--;
     }
 
-    VIR_FREE(oldtable);
-
-#ifdef DEBUG_GROW
-    VIR_DEBUG("virHashGrow : from %d to %d, %ld elems\n", oldsize,
-              size, nbElem);
-#endif
-
-    return 0;
+    VIR_FREE(slots->entries);
 }
 
 /**
@@ -251,27 +391,34 @@ virHashGrow(virHashTablePtr table, size_t size)
 void
 virHashFree(virHashTablePtr table)
 {
-    size_t i;
-
     if (table == NULL)
         return;
 
-    for (i = 0; i < table->size; i++) {
-        virHashEntryPtr iter = table->table[i];
-        while (iter) {
-            virHashEntryPtr next = iter->next;
+    virHashSlotsFreeEntries(table, &table->old);
+    virHashSlotsFreeEntries(table, &table->cur);
+    VIR_FREE(table);
+}
 
-            if (table->dataFree)
-                table->dataFree(iter->payload, iter->name);
-            if (table->keyFree)
-                table->keyFree(iter->name);
-            VIR_FREE(iter);
-            iter = next;
-        }
+
+/* Find @name in either array. If @slots is not NULL it is set to
+ * the array the entry lives in. */
+static virHashEntryPtr
+virHashFindEntry(const virHashTable *table,
+                 const void *name,
+                 uint32_t code,
+                 virHashSlotsPtr *slots)
+{
+    virHashEntryPtr entry;
+
+    if ((entry = virHashSlotsFind(table, &table->cur, name, code))) {
+        if (slots)
+            *slots = (virHashSlotsPtr) &table->cur;
+    } else if ((entry = virHashSlotsFind(table, &table->old, name, code))) {
+        if (slots)
+            *slots = (virHashSlotsPtr) &table->old;
     }
 
-    VIR_FREE(table->table);
-    VIR_FREE(table);
+    return entry;
 }
 
 static int
@@ -279,8 +426,8 @@ virHashAddOrUpdateEntry(virHashTablePtr table, const void *name,
                         void *userdata,
                         bool is_update)
 {
-    size_t key, len = 0;
     virHashEntryPtr entry;
+    uint32_t code;
     char *new_name;
 
     if ((table == NULL) || (name == NULL))
@@ -289,37 +436,35 @@ virHashAddOrUpdateEntry(virHashTablePtr table, const void *name,
     if (table->iterating)
         virHashIterationError(-1);
 
-    key = virHashComputeKey(table, name);
+    code = table->keyCode(name, table->seed);
 
     /* Check for duplicate entry */
-    for (entry = table->table[key]; entry; entry = entry->next) {
-        if (table->keyEqual(entry->name, name)) {
-            if (is_update) {
-                if (table->dataFree)
-                    table->dataFree(entry->payload, entry->name);
-                entry->payload = userdata;
-                return 0;
-            } else {
-                return -1;
-            }
+    if ((entry = virHashFindEntry(table, name, code, NULL))) {
+        if (is_update) {
+            if (table->dataFree)
+                table->dataFree(entry->payload, entry->name);
+            entry->payload = userdata;
+            return 0;
+        } else {
+            return -1;
         }
-        len++;
     }
 
-    if (VIR_ALLOC(entry) < 0 || !(new_name = table->keyCopy(name))) {
-        VIR_FREE(entry);
+    virHashMigrate(table, VIR_HASH_MIGRATE_STEP);
+
+    /* If the array cannot be replaced, keep filling it as long as an
+     * empty slot remains to terminate probing. */
+    if (virHashSlotsFull(&table->cur) &&
+        virHashGrow(table) < 0 &&
+        table->cur.used + table->cur.deleted + 2 > table->cur.size)
         return -1;
-    }
 
+    if (!(new_name = table->keyCopy(name)))
+        return -1;
+
+    entry = virHashSlotsClaim(&table->cur, code);
     entry->name = new_name;
     entry->payload = userdata;
-    entry->next = table->table[key];
-    table->table[key] = entry;
-
-    table->nbElems++;
-
-    if (len > MAX_HASH_LEN)
-        virHashGrow(table, MAX_HASH_LEN * table->size);
 
     return 0;
 }
@@ -372,18 +517,14 @@ virHashUpdateEntry(virHashTablePtr table, const void *name,
 void *
 virHashLookup(const virHashTable *table, const void *name)
 {
-    size_t key;
     virHashEntryPtr entry;
 
     if (!table || !name)
         return NULL;
 
-    key = virHashComputeKey(table, name);
-    for (entry = table->table[key]; entry; entry = entry->next) {
-        if (table->keyEqual(entry->name, name))
-            return entry->payload;
-    }
-    return NULL;
+    entry = virHashFindEntry(table, name,
+                             table->keyCode(name, table->seed), NULL);
+    return entry ? entry->payload : NULL;
 }
 
 
@@ -424,14 +565,14 @@ virHashSize(const virHashTable *table)
 {
     if (table == NULL)
         return -1;
-    return table->nbElems;
+    return table->cur.used + table->old.used;
 }
 
 /**
  * virHashTableSize:
  * @table: the hash table
  *
- * Query the size of the hash @table, i.e., number of buckets in the table.
+ * Query the size of the hash @table, i.e., number of slots in the table.
  *
  * Returns the number of keys in the hash table or
  * -1 in case of error
@@ -441,7 +582,7 @@ virHashTableSize(const virHashTable *table)
 {
     if (table == NULL)
         return -1;
-    return table->size;
+    return table->cur.size;
 }
 
 
@@ -460,30 +601,30 @@ int
 virHashRemoveEntry(virHashTablePtr table, const void *name)
 {
     virHashEntryPtr entry;
-    virHashEntryPtr *nextptr;
+    virHashSlotsPtr slots;
 
     if (table == NULL || name == NULL)
         return -1;
 
-    nextptr = table->table + virHashComputeKey(table, name);
-    for (entry = *nextptr; entry; entry = entry->next) {
-        if (table->keyEqual(entry->name, name)) {
-            if (table->iterating && table->current != entry)
-                virHashIterationError(-1);
+    if (!(entry = virHashFindEntry(table, name,
+                                   table->keyCode(name, table->seed),
+                                   &slots)))
+        return -1;
 
-            if (table->dataFree)
-                table->dataFree(entry->payload, entry->name);
-            if (table->keyFree)
-                table->keyFree(entry->name);
-            *nextptr = entry->next;
-            VIR_FREE(entry);
-            table->nbElems--;
-            return 0;
-        }
-        nextptr = &entry->next;
-    }
+    if (table->iterating && table->current != entry)
+        virHashIterationError(-1);
+
+    if (table->dataFree)
+        table->dataFree(entry->payload, entry->name);
+    if (table->keyFree)
+        table->keyFree(entry->name);
+    virHashSlotsRelease(slots, entry);
+
+    /* Slots must not move under a running iteration */
+    if (!table->iterating)
+        virHashMigrate(table, VIR_HASH_MIGRATE_STEP);
 
-    return -1;
+    return 0;
 }
 
 
@@ -502,7 +643,8 @@ virHashRemoveEntry(virHashTablePtr table, const void *name)
 ssize_t
 virHashForEach(virHashTablePtr table, virHashIterator iter, void *data)
 {
-    size_t i, count = 0;
+    size_t i, j, count = 0;
+    virHashSlotsPtr slots[2];
 
     if (table == NULL || iter == NULL)
         return -1;
@@ -510,19 +652,22 @@ virHashForEach(virHashTablePtr table, virHashIterator iter, void *data)
     if (table->iterating)
         virHashIterationError(-1);
 
+    slots[0] = &table->old;
+    slots[1] = &table->cur;
     table->iterating = true;
     table->current = NULL;
-    for (i = 0; i < table->size; i++) {
-        virHashEntryPtr entry = table->table[i];
-        while (entry) {
-            virHashEntryPtr next = entry->next;
+    for (j = 0; j < ARRAY_CARDINALITY(slots); j++) {
+        for (i = 0; i < slots[j]->size; i++) {
+            virHashEntryPtr entry = slots[j]->entries + i;
+
+            if (!VIR_HASH_ENTRY_LIVE(entry))
+                continue;
 
             table->current = entry;
             iter(entry->payload, entry->name, data);
             table->current = NULL;
 
             count++;
-            entry = next;
         }
     }
     table->iterating = false;
@@ -548,7 +693,8 @@ virHashRemoveSet(virHashTablePtr table,
                  virHashSearcher iter,
                  const void *data)
 {
-    size_t i, count = 0;
+    size_t i, j, count = 0;
+    virHashSlotsPtr slots[2];
 
     if (table == NULL || iter == NULL)
         return -1;
@@ -556,29 +702,37 @@ virHashRemoveSet(virHashTablePtr table,
     if (table->iterating)
         virHashIterationError(-1);
 
+    slots[0] = &table->old;
+    slots[1] = &table->cur;
     table->iterating = true;
     table->current = NULL;
-    for (i = 0; i < table->size; i++) {
-        virHashEntryPtr *nextptr = table->table + i;
-
-        while (*nextptr) {
-            virHashEntryPtr entry = *nextptr;
-            if (!iter(entry->payload, entry->name, data)) {
-                nextptr = &entry->next;
-            } else {
-                count++;
-                if (table->dataFree)
-                    table->dataFree(entry->payload, entry->name);
-                if (table->keyFree)
-                    table->keyFree(entry->name);
-                *nextptr = entry->next;
-                VIR_FREE(entry);
-                table->nbElems--;
-            }
+    for (j = 0; j < ARRAY_CARDINALITY(slots); j++) {
+        for (i = 0; i < slots[j]->size; i++) {
+            virHashEntryPtr entry = slots[j]->entries + i;
+
+            if (!VIR_HASH_ENTRY_LIVE(entry) ||
+                !iter(entry->payload, entry->name, data))
+                continue;
+
+            count++;
+            if (table->dataFree)
+                table->dataFree(entry->payload, entry->name);
+            if (table->keyFree)
+                table->keyFree(entry->name);
+            virHashSlotsRelease(slots[j], entry);
         }
     }
     table->iterating = false;
 
+    /* Once emptied, drop the removal markers rather than leaving
+     * them to lengthen probing until the next resize. */
+    if (!table->old.used && !table->cur.used && table->cur.deleted) {
+        virHashMigrate(table, SIZE_MAX);
+        memset(table->cur.entries, 0,
+               sizeof(*table->cur.entries) * table->cur.size);
+        table->cur.deleted = 0;
+    }
+
     return count;
 }
 
@@ -622,10 +776,11 @@ void *virHashSearch(const virHashTable *ctable,
                     virHashSearcher iter,
                     const void *data)
 {
-    size_t i;
+    size_t i, j;
 
     /* Cast away const for internal detection of misuse.  */
     virHashTablePtr table = (virHashTablePtr)ctable;
+    virHashSlotsPtr slots[2];
 
     if (table == NULL || iter == NULL)
         return NULL;
@@ -633,12 +788,16 @@ void *virHashSearch(const virHashTable *ctable,
     if (table->iterating)
         virHashIterationError(NULL);
 
+    slots[0] = &table->old;
+    slots[1] = &table->cur;
     table->iterating = true;
     table->current = NULL;
-    for (i = 0; i < table->size; i++) {
-        virHashEntryPtr entry;
-        for (entry = table->table[i]; entry; entry = entry->next) {
-            if (iter(entry->payload, entry->name, data)) {
+    for (j = 0; j < ARRAY_CARDINALITY(slots); j++) {
+        for (i = 0; i < slots[j]->size; i++) {
+            virHashEntryPtr entry = slots[j]->entries + i;
+
+            if (VIR_HASH_ENTRY_LIVE(entry) &&
+                iter(entry->payload, entry->name, data)) {
                 table->iterating = false;
                 return entry->payload;
             }
@@ -559,13 +559,9 @@ virHostdevPreparePCIDevices(virHostdevManagerPtr hostdev_mgr,
 
     /* Loop 3: Now that all the PCI hostdevs have been detached, we
      * can safely reset them */
-    for (i = 0; i < virPCIDeviceListCount(pcidevs); i++) {
-        virPCIDevicePtr dev = virPCIDeviceListGet(pcidevs, i);
-
-        if (virPCIDeviceReset(dev, hostdev_mgr->activePCIHostdevs,
-                              hostdev_mgr->inactivePCIHostdevs) < 0)
-            goto reattachdevs;
-    }
+    if (virPCIDeviceListReset(pcidevs, hostdev_mgr->activePCIHostdevs,
+                              hostdev_mgr->inactivePCIHostdevs, false) < 0)
+        goto reattachdevs;
 
     /* Loop 4: For SRIOV network devices, Now that we have detached the
      * the network device, set the netdev config */
@@ -699,11 +695,15 @@ virHostdevReattachPCIDevice(virPCIDevicePtr dev, virHostdevManagerPtr mgr)
 
     /* Wait for device cleanup if it is qemu/kvm */
     if (STREQ(virPCIDeviceGetStubDriver(dev), "pci-stub")) {
-        int retries = 100;
-        while (virPCIDeviceWaitForCleanup(dev, "kvm_assigned_device")
-               && retries) {
-            usleep(100*1000);
-            retries--;
+        unsigned int delay = 10;
+        unsigned int waited = 0;
+
+        /* Back off from 10ms up to 100ms, giving up after 10s */
+        while (virPCIDeviceWaitForCleanup(dev, "kvm_assigned_device") &&
+               waited < 10 * 1000) {
+            usleep(delay * 1000);
+            waited += delay;
+            delay = MIN(delay * 2, 100);
         }
     }
 
@@ -786,16 +786,13 @@ virHostdevReAttachPCIDevices(virHostdevManagerPtr hostdev_mgr,
         virHostdevNetConfigRestore(hostdevs[i], hostdev_mgr->stateDir,
                                    oldStateDir);
 
-    for (i = 0; i < virPCIDeviceListCount(pcidevs); i++) {
-        virPCIDevicePtr dev = virPCIDeviceListGet(pcidevs, i);
-
-        if (virPCIDeviceReset(dev, hostdev_mgr->activePCIHostdevs,
-                              hostdev_mgr->inactivePCIHostdevs) < 0) {
-            virErrorPtr err = virGetLastError();
-            VIR_ERROR(_("Failed to reset PCI device: %s"),
-                      err ? err->message : _("unknown error"));
-            virResetError(err);
-        }
+    /* Every device is being handed back, so reset as many as we can */
+    if (virPCIDeviceListReset(pcidevs, hostdev_mgr->activePCIHostdevs,
+                              hostdev_mgr->inactivePCIHostdevs, true) < 0) {
+        virErrorPtr err = virGetLastError();
+        VIR_ERROR(_("Failed to reset PCI devices: %s"),
+                  err ? err->message : _("unknown error"));
+        virResetError(err);
     }
 
     while (virPCIDeviceListCount(pcidevs) > 0) {
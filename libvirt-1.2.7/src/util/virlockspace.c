@@ -28,8 +28,10 @@
 #include "virutil.h"
 #include "virfile.h"
 #include "virhash.h"
+#include "virhashcode.h"
 #include "virthread.h"
 #include "virstring.h"
+#include "virtime.h"
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -41,6 +43,11 @@ VIR_LOG_INIT("util.lockspace");
 
 #define VIR_LOCKSPACE_TABLE_SIZE 10
 
+/* Resources are spread over a fixed number of independently locked
+ * shards, so that clients acquiring unrelated resources in the same
+ * lockspace do not serialize on a single mutex */
+#define VIR_LOCKSPACE_SHARDS 16
+
 typedef struct _virLockSpaceResource virLockSpaceResource;
 typedef virLockSpaceResource *virLockSpaceResourcePtr;
 
@@ -52,16 +59,87 @@ struct _virLockSpaceResource {
     unsigned int flags;
     size_t nOwners;
     pid_t *owners;
+    unsigned long long acquiredAt; /* monotonic, in microseconds */
 };
 
-struct _virLockSpace {
-    char *dir;
+typedef struct _virLockSpaceShard virLockSpaceShard;
+typedef virLockSpaceShard *virLockSpaceShardPtr;
+
+struct _virLockSpaceShard {
     virMutex lock;
 
     virHashTablePtr resources;
+    virLockSpaceStats stats;
+};
+
+struct _virLockSpace {
+    char *dir;
+
+    size_t nshards; /* number of initialized shards */
+    virLockSpaceShard shards[VIR_LOCKSPACE_SHARDS];
 };
 
 
+static unsigned long long virLockSpaceNow(void)
+{
+    unsigned long long now;
+
+    if (virTimeMonotonicMicrosNowRaw(&now) < 0)
+        return 0;
+    return now;
+}
+
+
+static virLockSpaceShardPtr
+virLockSpaceGetShard(virLockSpacePtr lockspace,
+                     const char *resname)
+{
+    uint32_t code = virHashCodeGen(resname, strlen(resname), 0);
+
+    return &lockspace->shards[code % VIR_LOCKSPACE_SHARDS];
+}
+
+
+/*
+ * Lock a shard, accounting the time spent waiting for
+ * the mutex in the shard statistics
+ */
+static void virLockSpaceShardLock(virLockSpaceShardPtr shard)
+{
+    unsigned long long start = virLockSpaceNow();
+    unsigned long long waited;
+
+    virMutexLock(&shard->lock);
+
+    waited = virLockSpaceNow() - start;
+    shard->stats.waitTotal += waited;
+    if (waited > shard->stats.waitMax)
+        shard->stats.waitMax = waited;
+}
+
+
+static void virLockSpaceShardUnlock(virLockSpaceShardPtr shard)
+{
+    virMutexUnlock(&shard->lock);
+}
+
+
+static void
+virLockSpaceShardRecordRelease(virLockSpaceShardPtr shard,
+                               virLockSpaceResourcePtr res,
+                               unsigned long long now)
+{
+    unsigned long long held = 0;
+
+    if (res->acquiredAt && now > res->acquiredAt)
+        held = now - res->acquiredAt;
+
+    shard->stats.holdTotal += held;
+    if (held > shard->stats.holdMax)
+        shard->stats.holdMax = held;
+}
+
+
 static char *virLockSpaceGetResourcePath(virLockSpacePtr lockspace,
                                          const char *resname)
 {
@@ -223,6 +301,7 @@ virLockSpaceResourceNew(virLockSpacePtr lockspace,
         goto error;
 
     res->owners[res->nOwners-1] = owner;
+    res->acquiredAt = virLockSpaceNow();
 
     return res;
 
@@ -239,6 +318,30 @@ static void virLockSpaceResourceDataFree(void *opaque, const void *name ATTRIBUT
 }
 
 
+static int virLockSpaceInitShards(virLockSpacePtr lockspace)
+{
+    while (lockspace->nshards < VIR_LOCKSPACE_SHARDS) {
+        virLockSpaceShardPtr shard = &lockspace->shards[lockspace->nshards];
+
+        if (virMutexInit(&shard->lock) < 0) {
+            virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                           _("Unable to initialize lockspace mutex"));
+            return -1;
+        }
+
+        if (!(shard->resources = virHashCreate(VIR_LOCKSPACE_TABLE_SIZE,
+                                               virLockSpaceResourceDataFree))) {
+            virMutexDestroy(&shard->lock);
+            return -1;
+        }
+
+        lockspace->nshards++;
+    }
+
+    return 0;
+}
+
+
 virLockSpacePtr virLockSpaceNew(const char *directory)
 {
     virLockSpacePtr lockspace;
@@ -248,18 +351,10 @@ virLockSpacePtr virLockSpaceNew(const char *directory)
     if (VIR_ALLOC(lockspace) < 0)
         return NULL;
 
-    if (virMutexInit(&lockspace->lock) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("Unable to initialize lockspace mutex"));
-        VIR_FREE(lockspace);
-        return NULL;
-    }
-
-    if (VIR_STRDUP(lockspace->dir, directory) < 0)
+    if (virLockSpaceInitShards(lockspace) < 0)
         goto error;
 
-    if (!(lockspace->resources = virHashCreate(VIR_LOCKSPACE_TABLE_SIZE,
-                                               virLockSpaceResourceDataFree)))
+    if (VIR_STRDUP(lockspace->dir, directory) < 0)
         goto error;
 
     if (directory) {
@@ -301,15 +396,7 @@ virLockSpacePtr virLockSpaceNewPostExecRestart(virJSONValuePtr object)
     if (VIR_ALLOC(lockspace) < 0)
         return NULL;
 
-    if (virMutexInit(&lockspace->lock) < 0) {
-        virReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                       _("Unable to initialize lockspace mutex"));
-        VIR_FREE(lockspace);
-        return NULL;
-    }
-
-    if (!(lockspace->resources = virHashCreate(VIR_LOCKSPACE_TABLE_SIZE,
-                                               virLockSpaceResourceDataFree)))
+    if (virLockSpaceInitShards(lockspace) < 0)
         goto error;
 
     if (virJSONValueObjectHasKey(object, "directory")) {
@@ -423,7 +510,12 @@ virLockSpacePtr virLockSpaceNewPostExecRestart(virJSONValuePtr object)
             res->owners[j] = (pid_t)owner;
         }
 
-        if (virHashAddEntry(lockspace->resources, res->name, res) < 0) {
+        /* Hold times of locks inherited across exec restart are
+         * measured from the restart */
+        res->acquiredAt = virLockSpaceNow();
+
+        if (virHashAddEntry(virLockSpaceGetShard(lockspace, res->name)->resources,
+                            res->name, res) < 0) {
             virLockSpaceResourceFree(res);
             goto error;
         }
@@ -442,11 +534,13 @@ virJSONValuePtr virLockSpacePreExecRestart(virLockSpacePtr lockspace)
     virJSONValuePtr object = virJSONValueNewObject();
     virJSONValuePtr resources;
     virHashKeyValuePairPtr pairs = NULL, tmp;
+    size_t s;
 
     if (!object)
         return NULL;
 
-    virMutexLock(&lockspace->lock);
+    for (s = 0; s < lockspace->nshards; s++)
+        virMutexLock(&lockspace->shards[s].lock);
 
     if (lockspace->dir &&
         virJSONValueObjectAppendString(object, "directory", lockspace->dir) < 0)
@@ -460,76 +554,84 @@ virJSONValuePtr virLockSpacePreExecRestart(virLockSpacePtr lockspace)
         goto error;
     }
 
-    tmp = pairs = virHashGetItems(lockspace->resources, NULL);
-    while (tmp && tmp->value) {
-        virLockSpaceResourcePtr res = (virLockSpaceResourcePtr)tmp->value;
-        virJSONValuePtr child = virJSONValueNewObject();
-        virJSONValuePtr owners = NULL;
-        size_t i;
+    for (s = 0; s < lockspace->nshards; s++) {
+        tmp = pairs = virHashGetItems(lockspace->shards[s].resources, NULL);
+        while (tmp && tmp->value) {
+            virLockSpaceResourcePtr res = (virLockSpaceResourcePtr)tmp->value;
+            virJSONValuePtr child = virJSONValueNewObject();
+            virJSONValuePtr owners = NULL;
+            size_t i;
 
-        if (!child)
-            goto error;
-
-        if (virJSONValueArrayAppend(resources, child) < 0) {
-            virJSONValueFree(child);
-            goto error;
-        }
-
-        if (virJSONValueObjectAppendString(child, "name", res->name) < 0 ||
-            virJSONValueObjectAppendString(child, "path", res->path) < 0 ||
-            virJSONValueObjectAppendNumberInt(child, "fd", res->fd) < 0 ||
-            virJSONValueObjectAppendBoolean(child, "lockHeld", res->lockHeld) < 0 ||
-            virJSONValueObjectAppendNumberUint(child, "flags", res->flags) < 0)
-            goto error;
+            if (!child)
+                goto error;
 
-        if (virSetInherit(res->fd, true) < 0) {
-            virReportSystemError(errno, "%s",
-                                 _("Cannot disable close-on-exec flag"));
-            goto error;
-        }
+            if (virJSONValueArrayAppend(resources, child) < 0) {
+                virJSONValueFree(child);
+                goto error;
+            }
 
-        if (!(owners = virJSONValueNewArray()))
-            goto error;
+            if (virJSONValueObjectAppendString(child, "name", res->name) < 0 ||
+                virJSONValueObjectAppendString(child, "path", res->path) < 0 ||
+                virJSONValueObjectAppendNumberInt(child, "fd", res->fd) < 0 ||
+                virJSONValueObjectAppendBoolean(child, "lockHeld", res->lockHeld) < 0 ||
+                virJSONValueObjectAppendNumberUint(child, "flags", res->flags) < 0)
+                goto error;
 
-        if (virJSONValueObjectAppend(child, "owners", owners) < 0) {
-            virJSONValueFree(owners);
-            goto error;
-        }
+            if (virSetInherit(res->fd, true) < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("Cannot disable close-on-exec flag"));
+                goto error;
+            }
 
-        for (i = 0; i < res->nOwners; i++) {
-            virJSONValuePtr owner = virJSONValueNewNumberUlong(res->owners[i]);
-            if (!owner)
+            if (!(owners = virJSONValueNewArray()))
                 goto error;
 
-            if (virJSONValueArrayAppend(owners, owner) < 0) {
-                virJSONValueFree(owner);
+            if (virJSONValueObjectAppend(child, "owners", owners) < 0) {
+                virJSONValueFree(owners);
                 goto error;
             }
-        }
 
-        tmp++;
+            for (i = 0; i < res->nOwners; i++) {
+                virJSONValuePtr owner = virJSONValueNewNumberUlong(res->owners[i]);
+                if (!owner)
+                    goto error;
+
+                if (virJSONValueArrayAppend(owners, owner) < 0) {
+                    virJSONValueFree(owner);
+                    goto error;
+                }
+            }
+
+            tmp++;
+        }
+        VIR_FREE(pairs);
     }
-    VIR_FREE(pairs);
 
-    virMutexUnlock(&lockspace->lock);
+    for (s = 0; s < lockspace->nshards; s++)
+        virMutexUnlock(&lockspace->shards[s].lock);
     return object;
 
  error:
     VIR_FREE(pairs);
     virJSONValueFree(object);
-    virMutexUnlock(&lockspace->lock);
+    for (s = 0; s < lockspace->nshards; s++)
+        virMutexUnlock(&lockspace->shards[s].lock);
     return NULL;
 }
 
 
 void virLockSpaceFree(virLockSpacePtr lockspace)
 {
+    size_t i;
+
     if (!lockspace)
         return;
 
-    virHashFree(lockspace->resources);
+    for (i = 0; i < lockspace->nshards; i++) {
+        virHashFree(lockspace->shards[i].resources);
+        virMutexDestroy(&lockspace->shards[i].lock);
+    }
     VIR_FREE(lockspace->dir);
-    virMutexDestroy(&lockspace->lock);
     VIR_FREE(lockspace);
 }
 
@@ -545,12 +647,13 @@ int virLockSpaceCreateResource(virLockSpacePtr lockspace,
 {
     int ret = -1;
     char *respath = NULL;
+    virLockSpaceShardPtr shard = virLockSpaceGetShard(lockspace, resname);
 
     VIR_DEBUG("lockspace=%p resname=%s", lockspace, resname);
 
-    virMutexLock(&lockspace->lock);
+    virLockSpaceShardLock(shard);
 
-    if (virHashLookup(lockspace->resources, resname) != NULL) {
+    if (virHashLookup(shard->resources, resname) != NULL) {
         virReportError(VIR_ERR_RESOURCE_BUSY,
                        _("Lockspace resource '%s' is locked"),
                        resname);
@@ -566,7 +669,7 @@ int virLockSpaceCreateResource(virLockSpacePtr lockspace,
     ret = 0;
 
  cleanup:
-    virMutexUnlock(&lockspace->lock);
+    virLockSpaceShardUnlock(shard);
     VIR_FREE(respath);
     return ret;
 }
@@ -577,12 +680,13 @@ int virLockSpaceDeleteResource(virLockSpacePtr lockspace,
 {
     int ret = -1;
     char *respath = NULL;
+    virLockSpaceShardPtr shard = virLockSpaceGetShard(lockspace, resname);
 
     VIR_DEBUG("lockspace=%p resname=%s", lockspace, resname);
 
-    virMutexLock(&lockspace->lock);
+    virLockSpaceShardLock(shard);
 
-    if (virHashLookup(lockspace->resources, resname) != NULL) {
+    if (virHashLookup(shard->resources, resname) != NULL) {
         virReportError(VIR_ERR_RESOURCE_BUSY,
                        _("Lockspace resource '%s' is locked"),
                        resname);
@@ -603,7 +707,7 @@ int virLockSpaceDeleteResource(virLockSpacePtr lockspace,
     ret = 0;
 
  cleanup:
-    virMutexUnlock(&lockspace->lock);
+    virLockSpaceShardUnlock(shard);
     VIR_FREE(respath);
     return ret;
 }
@@ -616,6 +720,7 @@ int virLockSpaceAcquireResource(virLockSpacePtr lockspace,
 {
     int ret = -1;
     virLockSpaceResourcePtr res;
+    virLockSpaceShardPtr shard;
 
     VIR_DEBUG("lockspace=%p resname=%s flags=%x owner=%lld",
               lockspace, resname, flags, (unsigned long long)owner);
@@ -623,9 +728,10 @@ int virLockSpaceAcquireResource(virLockSpacePtr lockspace,
     virCheckFlags(VIR_LOCK_SPACE_ACQUIRE_SHARED |
                   VIR_LOCK_SPACE_ACQUIRE_AUTOCREATE, -1);
 
-    virMutexLock(&lockspace->lock);
+    shard = virLockSpaceGetShard(lockspace, resname);
+    virLockSpaceShardLock(shard);
 
-    if ((res = virHashLookup(lockspace->resources, resname))) {
+    if ((res = virHashLookup(shard->resources, resname))) {
         if ((res->flags & VIR_LOCK_SPACE_ACQUIRE_SHARED) &&
             (flags & VIR_LOCK_SPACE_ACQUIRE_SHARED)) {
 
@@ -644,16 +750,17 @@ int virLockSpaceAcquireResource(virLockSpacePtr lockspace,
     if (!(res = virLockSpaceResourceNew(lockspace, resname, flags, owner)))
         goto cleanup;
 
-    if (virHashAddEntry(lockspace->resources, resname, res) < 0) {
+    if (virHashAddEntry(shard->resources, resname, res) < 0) {
         virLockSpaceResourceFree(res);
         goto cleanup;
     }
 
  done:
+    shard->stats.acquired++;
     ret = 0;
 
  cleanup:
-    virMutexUnlock(&lockspace->lock);
+    virLockSpaceShardUnlock(shard);
     return ret;
 }
 
@@ -664,14 +771,15 @@ int virLockSpaceReleaseResource(virLockSpacePtr lockspace,
 {
     int ret = -1;
     virLockSpaceResourcePtr res;
+    virLockSpaceShardPtr shard = virLockSpaceGetShard(lockspace, resname);
     size_t i;
 
     VIR_DEBUG("lockspace=%p resname=%s owner=%lld",
               lockspace, resname, (unsigned long long)owner);
 
-    virMutexLock(&lockspace->lock);
+    virLockSpaceShardLock(shard);
 
-    if (!(res = virHashLookup(lockspace->resources, resname))) {
+    if (!(res = virHashLookup(shard->resources, resname))) {
         virReportError(VIR_ERR_RESOURCE_BUSY,
                        _("Lockspace resource '%s' is not locked"),
                        resname);
@@ -692,15 +800,18 @@ int virLockSpaceReleaseResource(virLockSpacePtr lockspace,
     }
 
     VIR_DELETE_ELEMENT(res->owners, i, res->nOwners);
+    shard->stats.released++;
 
-    if ((res->nOwners == 0) &&
-        virHashRemoveEntry(lockspace->resources, resname) < 0)
-        goto cleanup;
+    if (res->nOwners == 0) {
+        virLockSpaceShardRecordRelease(shard, res, virLockSpaceNow());
+        if (virHashRemoveEntry(shard->resources, resname) < 0)
+            goto cleanup;
+    }
 
     ret = 0;
 
  cleanup:
-    virMutexUnlock(&lockspace->lock);
+    virLockSpaceShardUnlock(shard);
     return ret;
 }
 
@@ -708,6 +819,8 @@ int virLockSpaceReleaseResource(virLockSpacePtr lockspace,
 struct virLockSpaceRemoveData {
     pid_t owner;
     size_t count;
+    virLockSpaceShardPtr shard;
+    unsigned long long now;
 };
 
 
@@ -732,6 +845,7 @@ virLockSpaceRemoveResourcesForOwner(const void *payload,
         return 0;
 
     data->count++;
+    data->shard->stats.released++;
 
     VIR_DELETE_ELEMENT(res->owners, i, res->nOwners);
 
@@ -741,6 +855,7 @@ virLockSpaceRemoveResourcesForOwner(const void *payload,
     }
 
     VIR_DEBUG("No more owners, remove it");
+    virLockSpaceShardRecordRelease(data->shard, res, data->now);
     return 1;
 }
 
@@ -748,26 +863,74 @@ virLockSpaceRemoveResourcesForOwner(const void *payload,
 int virLockSpaceReleaseResourcesForOwner(virLockSpacePtr lockspace,
                                          pid_t owner)
 {
-    int ret = 0;
     struct virLockSpaceRemoveData data = {
-        owner, 0
+        owner, 0, NULL, 0
     };
+    size_t i;
 
     VIR_DEBUG("lockspace=%p owner=%lld", lockspace, (unsigned long long)owner);
 
-    virMutexLock(&lockspace->lock);
+    data.now = virLockSpaceNow();
 
-    if (virHashRemoveSet(lockspace->resources,
-                         virLockSpaceRemoveResourcesForOwner,
-                         &data) < 0)
-        goto error;
+    for (i = 0; i < lockspace->nshards; i++) {
+        virLockSpaceShardPtr shard = &lockspace->shards[i];
+        int rc;
 
-    ret = data.count;
+        data.shard = shard;
 
-    virMutexUnlock(&lockspace->lock);
-    return ret;
+        virLockSpaceShardLock(shard);
+        rc = virHashRemoveSet(shard->resources,
+                              virLockSpaceRemoveResourcesForOwner,
+                              &data);
+        virLockSpaceShardUnlock(shard);
 
- error:
-    virMutexUnlock(&lockspace->lock);
-    return -1;
+        if (rc < 0)
+            return -1;
+    }
+
+    return data.count;
+}
+
+
+/**
+ * virLockSpaceGetStats:
+ * @lockspace: the lockspace to query
+ * @stats: filled with the statistics summed over all shards
+ *
+ * Report the number of resources currently held and the
+ * acquire/release counters, lock wait times and resource hold
+ * times accumulated since the lockspace was created. Times
+ * are in microseconds.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virLockSpaceGetStats(virLockSpacePtr lockspace,
+                         virLockSpaceStatsPtr stats)
+{
+    size_t i;
+
+    memset(stats, 0, sizeof(*stats));
+
+    for (i = 0; i < lockspace->nshards; i++) {
+        virLockSpaceShardPtr shard = &lockspace->shards[i];
+        int n;
+
+        virMutexLock(&shard->lock);
+        n = virHashSize(shard->resources);
+        stats->acquired += shard->stats.acquired;
+        stats->released += shard->stats.released;
+        stats->waitTotal += shard->stats.waitTotal;
+        stats->holdTotal += shard->stats.holdTotal;
+        if (shard->stats.waitMax > stats->waitMax)
+            stats->waitMax = shard->stats.waitMax;
+        if (shard->stats.holdMax > stats->holdMax)
+            stats->holdMax = shard->stats.holdMax;
+        virMutexUnlock(&shard->lock);
+
+        if (n < 0)
+            return -1;
+        stats->nresources += n;
+    }
+
+    return 0;
 }
@@ -59,4 +59,20 @@ int virLockSpaceReleaseResource(virLockSpacePtr lockspace,
 int virLockSpaceReleaseResourcesForOwner(virLockSpacePtr lockspace,
                                          pid_t owner);
 
+typedef struct _virLockSpaceStats virLockSpaceStats;
+typedef virLockSpaceStats *virLockSpaceStatsPtr;
+
+struct _virLockSpaceStats {
+    size_t nresources;            /* resources currently locked */
+    unsigned long long acquired;  /* successful acquisitions, per owner */
+    unsigned long long released;  /* releases, per owner */
+    unsigned long long waitTotal; /* time waiting for internal locks, in us */
+    unsigned long long waitMax;
+    unsigned long long holdTotal; /* time resources were locked, in us */
+    unsigned long long holdMax;
+};
+
+int virLockSpaceGetStats(virLockSpacePtr lockspace,
+                         virLockSpaceStatsPtr stats);
+
 #endif /* __VIR_LOCK_SPACE_H__ */
@@ -50,6 +50,8 @@
 #include "virtime.h"
 #include "intprops.h"
 #include "virstring.h"
+#include "viratomic.h"
+#include "c-ctype.h"
 
 /* Journald output is only supported on Linux new enough to expose
  * htole64.  */
@@ -128,6 +130,157 @@ static void virLogOutputToFd(virLogSourcePtr src,
                              void *data);
 
 
+/*
+ * Asynchronous logging
+ *
+ * When enabled, threads don't call the outputs themselves. Each one
+ * queues its formatted messages on a ring of its own, which has a
+ * single producer and a single consumer and therefore needs no lock.
+ * A dedicated writer thread drains all the rings periodically,
+ * restores the order in which the messages were logged and hands them
+ * to the outputs in batches, merging the writes to files.
+ *
+ * When a ring is full, debug and info messages are dropped and
+ * counted, while warnings and errors wait for the writer to make
+ * room. Messages asking for a stack trace are always written by the
+ * calling thread, whose stack it is.
+ */
+#define VIR_LOG_ASYNC_RING_SIZE 1024    /* must be a power of two */
+#define VIR_LOG_ASYNC_BATCH 4096        /* most messages written at once */
+#define VIR_LOG_ASYNC_INTERVAL 100      /* ms between two drains */
+
+verify((VIR_LOG_ASYNC_RING_SIZE & (VIR_LOG_ASYNC_RING_SIZE - 1)) == 0);
+
+typedef struct _virLogRecord virLogRecord;
+typedef virLogRecord *virLogRecordPtr;
+
+struct _virLogRecord {
+    unsigned int seq;                   /* global order of messages */
+    virLogSourcePtr source;
+    virLogPriority priority;
+    const char *filename;
+    int linenr;
+    const char *funcname;
+    char timestamp[VIR_TIME_STRING_BUFLEN];
+    virLogMetadataPtr metadata;
+    unsigned int flags;
+    char *str;                          /* raw message */
+    char *msg;                          /* formatted message */
+};
+
+typedef struct _virLogThread virLogThread;
+typedef virLogThread *virLogThreadPtr;
+
+struct _virLogThread {
+    virLogRecordPtr ring[VIR_LOG_ASYNC_RING_SIZE];
+    volatile int head;                  /* next record to write */
+    volatile int tail;                  /* next free slot */
+    volatile int exited;                /* free once drained */
+    virLogThreadPtr next;
+};
+
+static virThreadLocal virLogThreadKey;
+
+/* Protects the list of threads and the writer state */
+static virMutex virLogAsyncLock;
+static virCond virLogAsyncCond;         /* wakes up the writer */
+static virCond virLogDrainedCond;       /* signalled after each drain */
+static virLogThreadPtr virLogThreads;
+static virThread virLogWriter;
+static bool virLogWriterRunning;
+static bool virLogWriterQuit;
+static pid_t virLogWriterPid;
+
+static volatile int virLogAsync;
+static volatile int virLogSeq;
+static volatile int virLogDropped;
+
+/* Used by the writer thread only */
+static virLogRecordPtr virLogBatch[VIR_LOG_ASYNC_BATCH];
+static int virLogDroppedReported;
+
+
+static void
+virLogThreadRelease(void *opaque)
+{
+    virLogThreadPtr thr = opaque;
+
+    /* The writer may still have records to write */
+    virAtomicIntSet(&thr->exited, 1);
+}
+
+
+/*
+ * Flight recorder
+ *
+ * Every message is also recorded in a ring of the thread logging it,
+ * whatever the filters say, unless LIBVIRT_LOG_RECORDER=0 turns this
+ * off. Recording is cheap enough to be left on: the format string is
+ * kept as a pointer and only the arguments are copied, strings up to
+ * a limit. Formatting happens only when the rings are dumped, which
+ * may be done from a signal handler as it takes no locks and
+ * allocates nothing.
+ */
+#define VIR_LOG_RECORDER_ENTRIES 256    /* must be a power of two */
+#define VIR_LOG_RECORDER_ARGS 8         /* most arguments kept per entry */
+#define VIR_LOG_RECORDER_STRINGS 128    /* room for string arguments */
+
+verify((VIR_LOG_RECORDER_ENTRIES & (VIR_LOG_RECORDER_ENTRIES - 1)) == 0);
+
+typedef union _virLogRecorderArg virLogRecorderArg;
+typedef virLogRecorderArg *virLogRecorderArgPtr;
+union _virLogRecorderArg {
+    long long i;
+    double d;
+    const void *p;
+    size_t s;                           /* offset into the strings */
+};
+
+typedef struct _virLogRecorderEntry virLogRecorderEntry;
+typedef virLogRecorderEntry *virLogRecorderEntryPtr;
+
+struct _virLogRecorderEntry {
+    volatile int seq;                   /* position plus one once complete,
+                                         * zero while being written */
+    unsigned long long when;
+    virLogSourcePtr source;
+    virLogPriority priority;
+    const char *funcname;
+    int linenr;
+    const char *fmt;
+    size_t nargs;
+    bool truncated;                     /* not all arguments were kept */
+    virLogRecorderArg args[VIR_LOG_RECORDER_ARGS];
+    char strings[VIR_LOG_RECORDER_STRINGS];
+};
+
+typedef struct _virLogRecorder virLogRecorder;
+typedef virLogRecorder *virLogRecorderPtr;
+
+struct _virLogRecorder {
+    virLogRecorderEntry entries[VIR_LOG_RECORDER_ENTRIES];
+    volatile int pos;                   /* number of entries recorded */
+    unsigned long long thread;
+    volatile int used;                  /* owned by a running thread */
+    virLogRecorderPtr next;
+};
+
+static virThreadLocal virLogRecorderKey;
+static virMutex virLogRecorderLock;     /* serializes additions only */
+static virLogRecorderPtr virLogRecorders;
+static volatile int virLogRecorderEnabled = 1;
+
+
+static void
+virLogRecorderRelease(void *opaque)
+{
+    virLogRecorderPtr rec = opaque;
+
+    /* Rings are never freed, the next new thread takes this one over */
+    virAtomicIntSet(&rec->used, 0);
+}
+
+
 /*
  * Logs accesses must be serialized though a mutex
  */
@@ -187,6 +340,16 @@ virLogOnceInit(void)
     if (virMutexInit(&virLogMutex) < 0)
         return -1;
 
+    if (virMutexInit(&virLogAsyncLock) < 0 ||
+        virCondInit(&virLogAsyncCond) < 0 ||
+        virCondInit(&virLogDrainedCond) < 0 ||
+        virThreadLocalInit(&virLogThreadKey, virLogThreadRelease) < 0)
+        return -1;
+
+    if (virMutexInit(&virLogRecorderLock) < 0 ||
+        virThreadLocalInit(&virLogRecorderKey, virLogRecorderRelease) < 0)
+        return -1;
+
     virLogLock();
     virLogDefaultPriority = VIR_LOG_DEFAULT;
 
@@ -490,6 +653,968 @@ virLogSourceUpdate(virLogSourcePtr source)
     virLogUnlock();
 }
 
+
+static void
+virLogRecordFree(virLogRecordPtr rec)
+{
+    size_t i;
+
+    if (!rec)
+        return;
+
+    for (i = 0; rec->metadata && rec->metadata[i].key; i++) {
+        char *value = (char *) rec->metadata[i].s;
+        VIR_FREE(value);
+    }
+    VIR_FREE(rec->metadata);
+    VIR_FREE(rec->str);
+    VIR_FREE(rec->msg);
+    VIR_FREE(rec);
+}
+
+
+/* The journald output keeps the metadata key pointers, all of which
+ * are string literals, only the values need copying */
+static int
+virLogMetadataCopy(virLogMetadataPtr *dst,
+                   virLogMetadataPtr src)
+{
+    size_t n = 0;
+    size_t i;
+
+    *dst = NULL;
+    if (!src)
+        return 0;
+
+    while (src[n].key)
+        n++;
+
+    if (VIR_ALLOC_N_QUIET(*dst, n + 1) < 0)
+        return -1;
+
+    for (i = 0; i < n; i++) {
+        char *value = NULL;
+
+        if (VIR_STRDUP_QUIET(value, src[i].s) < 0)
+            return -1;
+        (*dst)[i].key = src[i].key;
+        (*dst)[i].s = value;
+        (*dst)[i].iv = src[i].iv;
+    }
+
+    return 0;
+}
+
+
+/* Write a single record to output @i or to stderr if @i is -1. When
+ * @batch is given, plain file descriptors are written to later on,
+ * once for the whole batch. Must be called with virLogLock held. */
+static void
+virLogEmitOutput(int i,
+                 virLogRecordPtr rec,
+                 virBufferPtr batch)
+{
+    virLogOutputFunc f = i < 0 ? virLogOutputToFd : virLogOutputs[i].f;
+    void *data = i < 0 ? (void *) STDERR_FILENO : virLogOutputs[i].data;
+
+    if (batch && f == virLogOutputToFd &&
+        !(rec->flags & VIR_LOG_STACK_TRACE)) {
+        virBufferAsprintf(batch, "%s: %s", rec->timestamp, rec->msg);
+        return;
+    }
+
+    f(rec->source, rec->priority, rec->filename, rec->linenr,
+      rec->funcname, rec->timestamp, rec->metadata, rec->flags,
+      rec->str, rec->msg, data);
+}
+
+
+static void
+virLogEmitVersion(int i,
+                  const char *timestamp,
+                  virBufferPtr batch)
+{
+    virLogRecord rec = {
+        .source = &virLogSelf,
+        .priority = VIR_LOG_INFO,
+        .filename = __FILE__,
+        .linenr = __LINE__,
+        .funcname = __func__,
+    };
+    const char *rawver;
+
+    if (virLogVersionString(&rawver, &rec.msg) >= 0) {
+        rec.str = (char *) rawver;
+        ignore_value(virStrcpyStatic(rec.timestamp, timestamp));
+        virLogEmitOutput(i, &rec, batch);
+    }
+    VIR_FREE(rec.msg);
+}
+
+
+/*
+ * Push the message to the outputs defined, if none exist then
+ * use stderr. Must be called with virLogLock held. @batch is either
+ * NULL or has one buffer per output plus one for stderr.
+ */
+static void
+virLogEmit(virLogRecordPtr rec,
+           virBufferPtr batch)
+{
+    static bool logVersionStderr = true;
+    size_t i;
+
+    for (i = 0; i < virLogNbOutputs; i++) {
+        if (rec->priority >= virLogOutputs[i].priority) {
+            if (virLogOutputs[i].logVersion) {
+                virLogEmitVersion(i, rec->timestamp, batch ? &batch[i] : NULL);
+                virLogOutputs[i].logVersion = false;
+            }
+            virLogEmitOutput(i, rec, batch ? &batch[i] : NULL);
+        }
+    }
+    if (virLogNbOutputs == 0) {
+        if (logVersionStderr) {
+            virLogEmitVersion(-1, rec->timestamp, batch ? &batch[i] : NULL);
+            logVersionStderr = false;
+        }
+        virLogEmitOutput(-1, rec, batch ? &batch[i] : NULL);
+    }
+}
+
+
+static int
+virLogRecordCompare(const void *a,
+                    const void *b)
+{
+    const virLogRecord *ra = *(virLogRecordPtr const *) a;
+    const virLogRecord *rb = *(virLogRecordPtr const *) b;
+
+    /* Sequence numbers wrap around */
+    return (int) (ra->seq - rb->seq);
+}
+
+
+/* Collect queued records into virLogBatch, freeing the rings of the
+ * threads which are gone. Must be called by the writer only. */
+static size_t
+virLogAsyncCollect(void)
+{
+    virLogThreadPtr *prev = &virLogThreads;
+    virLogThreadPtr thr;
+    size_t nbatch = 0;
+
+    virMutexLock(&virLogAsyncLock);
+
+    while ((thr = *prev)) {
+        /* Check for exit first so that no record can be missed */
+        bool exited = virAtomicIntGet(&thr->exited);
+        int tail = virAtomicIntGet(&thr->tail);
+        int head = thr->head;
+
+        while (head != tail && nbatch < VIR_LOG_ASYNC_BATCH) {
+            virLogBatch[nbatch++] =
+                thr->ring[head & (VIR_LOG_ASYNC_RING_SIZE - 1)];
+            head++;
+        }
+        virAtomicIntSet(&thr->head, head);
+
+        if (exited && head == tail) {
+            *prev = thr->next;
+            VIR_FREE(thr);
+        } else {
+            prev = &thr->next;
+        }
+    }
+
+    virMutexUnlock(&virLogAsyncLock);
+
+    return nbatch;
+}
+
+
+/* Write everything queued so far. Must be called by the writer only. */
+static void
+virLogAsyncDrain(void)
+{
+    virBufferPtr batch = NULL;
+    size_t nbatch;
+    size_t noutputs = 0;
+    size_t i;
+    int dropped;
+
+    while ((nbatch = virLogAsyncCollect()) > 0) {
+        qsort(virLogBatch, nbatch, sizeof(virLogBatch[0]),
+              virLogRecordCompare);
+
+        virLogLock();
+
+        noutputs = virLogNbOutputs + 1;
+        if (VIR_ALLOC_N_QUIET(batch, noutputs) < 0)
+            noutputs = 0;
+
+        for (i = 0; i < nbatch; i++) {
+            virLogEmit(virLogBatch[i], batch);
+            virLogRecordFree(virLogBatch[i]);
+            virLogBatch[i] = NULL;
+        }
+
+        /* Only now the files are written, one write per output */
+        for (i = 0; i < noutputs; i++) {
+            int fd = STDERR_FILENO;
+            char *content;
+
+            if (i < virLogNbOutputs)
+                fd = (intptr_t) virLogOutputs[i].data;
+
+            if (!(content = virBufferContentAndReset(&batch[i])))
+                continue;
+            if (fd >= 0)
+                ignore_value(safewrite(fd, content, strlen(content)));
+            VIR_FREE(content);
+        }
+        VIR_FREE(batch);
+
+        virLogUnlock();
+    }
+
+    dropped = virAtomicIntGet(&virLogDropped);
+    if (dropped != virLogDroppedReported) {
+        virLogRecord rec = {
+            .source = &virLogSelf,
+            .priority = VIR_LOG_WARN,
+            .filename = __FILE__,
+            .linenr = __LINE__,
+            .funcname = __func__,
+        };
+
+        if (virTimeStringNowRaw(rec.timestamp) < 0)
+            rec.timestamp[0] = '\0';
+        if (virAsprintfQuiet(&rec.str, "%d log messages were dropped",
+                             dropped - virLogDroppedReported) >= 0 &&
+            virLogFormatString(&rec.msg, rec.linenr, rec.funcname,
+                               rec.priority, rec.str) >= 0) {
+            virLogLock();
+            virLogEmit(&rec, NULL);
+            virLogUnlock();
+        }
+        VIR_FREE(rec.str);
+        VIR_FREE(rec.msg);
+        virLogDroppedReported = dropped;
+    }
+}
+
+
+static void
+virLogWriterThread(void *opaque ATTRIBUTE_UNUSED)
+{
+    unsigned long long now;
+    bool quit = false;
+
+    while (!quit) {
+        virLogAsyncDrain();
+
+        virMutexLock(&virLogAsyncLock);
+        virCondBroadcast(&virLogDrainedCond);
+        /* Drain once more after being asked to quit */
+        if (!(quit = virLogWriterQuit) &&
+            virTimeMillisNowRaw(&now) == 0)
+            ignore_value(virCondWaitUntil(&virLogAsyncCond, &virLogAsyncLock,
+                                          now + VIR_LOG_ASYNC_INTERVAL));
+        virMutexUnlock(&virLogAsyncLock);
+    }
+
+    virMutexLock(&virLogAsyncLock);
+    virCondBroadcast(&virLogDrainedCond);
+    virMutexUnlock(&virLogAsyncLock);
+}
+
+
+static virLogThreadPtr
+virLogThreadGet(void)
+{
+    virLogThreadPtr thr = virThreadLocalGet(&virLogThreadKey);
+
+    if (thr)
+        return thr;
+
+    if (VIR_ALLOC_QUIET(thr) < 0)
+        return NULL;
+
+    if (virThreadLocalSet(&virLogThreadKey, thr) < 0) {
+        VIR_FREE(thr);
+        return NULL;
+    }
+
+    virMutexLock(&virLogAsyncLock);
+    thr->next = virLogThreads;
+    virLogThreads = thr;
+    virMutexUnlock(&virLogAsyncLock);
+
+    return thr;
+}
+
+
+/* Wait until the writer has made room in the ring of @thr. Returns
+ * false if asynchronous logging was turned off meanwhile. */
+static bool
+virLogThreadWaitRoom(virLogThreadPtr thr)
+{
+    bool ret = true;
+
+    virMutexLock(&virLogAsyncLock);
+    while ((unsigned int) (thr->tail - virAtomicIntGet(&thr->head)) >=
+           VIR_LOG_ASYNC_RING_SIZE) {
+        if (!virLogWriterRunning) {
+            ret = false;
+            break;
+        }
+        virCondSignal(&virLogAsyncCond);
+        if (virCondWait(&virLogDrainedCond, &virLogAsyncLock) < 0) {
+            ret = false;
+            break;
+        }
+    }
+    virMutexUnlock(&virLogAsyncLock);
+
+    return ret;
+}
+
+
+/*
+ * Hand a formatted message to the writer thread, taking over @str and
+ * @msg. Returns 0 if the message was queued or dropped, -1 if the
+ * caller has to write it itself.
+ */
+static int
+virLogAsyncQueue(virLogSourcePtr source,
+                 virLogPriority priority,
+                 const char *filename,
+                 int linenr,
+                 const char *funcname,
+                 const char *timestamp,
+                 virLogMetadataPtr metadata,
+                 unsigned int flags,
+                 char **str,
+                 char **msg)
+{
+    virLogThreadPtr thr;
+    virLogRecordPtr rec;
+    unsigned int used;
+    int tail;
+
+    /* Forked children have no writer thread */
+    if (!virAtomicIntGet(&virLogAsync) ||
+        (flags & VIR_LOG_STACK_TRACE) ||
+        getpid() != virLogWriterPid)
+        return -1;
+
+    if (!(thr = virLogThreadGet()))
+        return -1;
+
+    tail = thr->tail;
+    used = tail - virAtomicIntGet(&thr->head);
+    if (used >= VIR_LOG_ASYNC_RING_SIZE) {
+        if (priority < VIR_LOG_WARN) {
+            virAtomicIntInc(&virLogDropped);
+            return 0;
+        }
+        if (!virLogThreadWaitRoom(thr))
+            return -1;
+    }
+
+    if (VIR_ALLOC_QUIET(rec) < 0)
+        return -1;
+
+    if (virLogMetadataCopy(&rec->metadata, metadata) < 0) {
+        virLogRecordFree(rec);
+        return -1;
+    }
+
+    rec->seq = virAtomicIntInc(&virLogSeq);
+    rec->source = source;
+    rec->priority = priority;
+    rec->filename = filename;
+    rec->linenr = linenr;
+    rec->funcname = funcname;
+    ignore_value(virStrcpyStatic(rec->timestamp, timestamp));
+    rec->flags = flags;
+    rec->str = *str;
+    rec->msg = *msg;
+    *str = *msg = NULL;
+
+    thr->ring[tail & (VIR_LOG_ASYNC_RING_SIZE - 1)] = rec;
+    virAtomicIntSet(&thr->tail, tail + 1);
+
+    /* Signalling without the lock may be missed, but the writer wakes
+     * up on its own soon enough */
+    if (priority >= VIR_LOG_WARN || used >= VIR_LOG_ASYNC_RING_SIZE / 2)
+        virCondSignal(&virLogAsyncCond);
+
+    return 0;
+}
+
+
+/**
+ * virLogSetAsync:
+ * @async: whether messages should be written by a separate thread
+ *
+ * Switch between asynchronous logging, where threads only queue their
+ * messages for a dedicated writer thread, and writing each message
+ * right away from the thread logging it. Turning asynchronous logging
+ * off writes all queued messages first.
+ *
+ * Returns 0 if successful, -1 in case of error.
+ */
+int
+virLogSetAsync(bool async)
+{
+    int ret = -1;
+
+    if (virLogInitialize() < 0)
+        return -1;
+
+    virMutexLock(&virLogAsyncLock);
+
+    if (async == virLogWriterRunning) {
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (async) {
+        virLogWriterQuit = false;
+        virLogWriterPid = getpid();
+        if (virThreadCreate(&virLogWriter, true, virLogWriterThread, NULL) < 0)
+            goto cleanup;
+        virLogWriterRunning = true;
+        virAtomicIntSet(&virLogAsync, 1);
+    } else {
+        virAtomicIntSet(&virLogAsync, 0);
+        virLogWriterQuit = true;
+        virCondSignal(&virLogAsyncCond);
+        virMutexUnlock(&virLogAsyncLock);
+
+        virThreadJoin(&virLogWriter);
+
+        virMutexLock(&virLogAsyncLock);
+        virLogWriterRunning = false;
+        /* Wake up threads waiting for room, they'll write themselves */
+        virCondBroadcast(&virLogDrainedCond);
+        virMutexUnlock(&virLogAsyncLock);
+
+        /* Whatever was queued while the writer was quitting */
+        virLogAsyncDrain();
+        return 0;
+    }
+
+    ret = 0;
+
+ cleanup:
+    virMutexUnlock(&virLogAsyncLock);
+    return ret;
+}
+
+
+/**
+ * virLogGetDropped:
+ *
+ * Returns the number of messages dropped because the writer thread
+ * could not keep up with them.
+ */
+unsigned int
+virLogGetDropped(void)
+{
+    return virAtomicIntGet(&virLogDropped);
+}
+
+
+typedef enum {
+    VIR_LOG_ARG_NONE,                   /* "%%" */
+    VIR_LOG_ARG_INT,
+    VIR_LOG_ARG_LONG,
+    VIR_LOG_ARG_LONG_LONG,
+    VIR_LOG_ARG_SIZE,
+    VIR_LOG_ARG_INTMAX,
+    VIR_LOG_ARG_PTRDIFF,
+    VIR_LOG_ARG_DOUBLE,
+    VIR_LOG_ARG_STRING,
+    VIR_LOG_ARG_POINTER,
+    VIR_LOG_ARG_INVALID,                /* not supported by the recorder */
+} virLogArgType;
+
+
+/*
+ * Parse the conversion specification following a '%' at @fmt. Stores
+ * the type of its argument, how many '*' it has and its precision,
+ * -1 if there is none or -2 if it comes from an argument. Returns the
+ * character following the specification.
+ */
+static const char *
+virLogRecorderParseConversion(const char *fmt,
+                              virLogArgType *type,
+                              size_t *nstars,
+                              int *precision)
+{
+    enum { LEN_NONE, LEN_LONG, LEN_LONG_LONG, LEN_SIZE,
+           LEN_INTMAX, LEN_PTRDIFF, LEN_LONG_DOUBLE } len = LEN_NONE;
+
+    *nstars = 0;
+    *precision = -1;
+
+    while (*fmt && strchr("-+ #0'", *fmt))
+        fmt++;
+
+    if (*fmt == '*') {
+        (*nstars)++;
+        fmt++;
+    } else {
+        while (c_isdigit(*fmt))
+            fmt++;
+    }
+
+    if (*fmt == '.') {
+        fmt++;
+        if (*fmt == '*') {
+            (*nstars)++;
+            *precision = -2;
+            fmt++;
+        } else {
+            *precision = 0;
+            while (c_isdigit(*fmt))
+                *precision = *precision * 10 + (*fmt++ - '0');
+        }
+    }
+
+    switch (*fmt) {
+    case 'h':
+        fmt += fmt[1] == 'h' ? 2 : 1;
+        break;
+    case 'l':
+        if (fmt[1] == 'l') {
+            len = LEN_LONG_LONG;
+            fmt++;
+        } else {
+            len = LEN_LONG;
+        }
+        fmt++;
+        break;
+    case 'q':
+        len = LEN_LONG_LONG;
+        fmt++;
+        break;
+    case 'z':
+        len = LEN_SIZE;
+        fmt++;
+        break;
+    case 'j':
+        len = LEN_INTMAX;
+        fmt++;
+        break;
+    case 't':
+        len = LEN_PTRDIFF;
+        fmt++;
+        break;
+    case 'L':
+        len = LEN_LONG_DOUBLE;
+        fmt++;
+        break;
+    }
+
+    switch (*fmt) {
+    case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+        switch (len) {
+        case LEN_NONE:
+            *type = VIR_LOG_ARG_INT;
+            break;
+        case LEN_LONG:
+            *type = VIR_LOG_ARG_LONG;
+            break;
+        case LEN_LONG_LONG:
+            *type = VIR_LOG_ARG_LONG_LONG;
+            break;
+        case LEN_SIZE:
+            *type = VIR_LOG_ARG_SIZE;
+            break;
+        case LEN_INTMAX:
+            *type = VIR_LOG_ARG_INTMAX;
+            break;
+        case LEN_PTRDIFF:
+            *type = VIR_LOG_ARG_PTRDIFF;
+            break;
+        case LEN_LONG_DOUBLE:
+            *type = VIR_LOG_ARG_INVALID;
+            break;
+        }
+        break;
+    case 'e': case 'E': case 'f': case 'F':
+    case 'g': case 'G': case 'a': case 'A':
+        *type = len == LEN_LONG_DOUBLE ? VIR_LOG_ARG_INVALID : VIR_LOG_ARG_DOUBLE;
+        break;
+    case 's':
+        *type = len == LEN_NONE ? VIR_LOG_ARG_STRING : VIR_LOG_ARG_INVALID;
+        break;
+    case 'p':
+        *type = VIR_LOG_ARG_POINTER;
+        break;
+    case '%':
+        *type = VIR_LOG_ARG_NONE;
+        break;
+    default:
+        /* %n, %m and friends */
+        *type = VIR_LOG_ARG_INVALID;
+        return fmt;
+    }
+
+    return fmt + 1;
+}
+
+
+static virLogRecorderPtr
+virLogRecorderGet(void)
+{
+    virLogRecorderPtr rec = virThreadLocalGet(&virLogRecorderKey);
+
+    if (rec)
+        return rec;
+
+    /* Take over the ring of a thread which has finished */
+    for (rec = virLogRecorders; rec; rec = rec->next) {
+        if (virAtomicIntCompareExchange(&rec->used, 0, 1))
+            break;
+    }
+
+    if (!rec) {
+        if (VIR_ALLOC_QUIET(rec) < 0)
+            return NULL;
+        rec->used = 1;
+
+        virMutexLock(&virLogRecorderLock);
+        rec->next = virLogRecorders;
+        virLogRecorders = rec;
+        virMutexUnlock(&virLogRecorderLock);
+    }
+
+    if (virThreadLocalSet(&virLogRecorderKey, rec) < 0) {
+        virAtomicIntSet(&rec->used, 0);
+        return NULL;
+    }
+
+    rec->thread = virThreadSelfID();
+    virAtomicIntSet(&rec->pos, 0);
+    return rec;
+}
+
+
+static void
+virLogRecorderCapture(virLogSourcePtr source,
+                      virLogPriority priority,
+                      const char *funcname,
+                      int linenr,
+                      const char *fmt,
+                      va_list vargs)
+{
+    virLogRecorderPtr rec;
+    virLogRecorderEntryPtr entry;
+    size_t nstrings = 0;
+    const char *cur = fmt;
+    va_list ap;
+    int pos;
+
+    if (!(rec = virLogRecorderGet()))
+        return;
+
+    pos = rec->pos;
+    entry = &rec->entries[pos & (VIR_LOG_RECORDER_ENTRIES - 1)];
+    virAtomicIntSet(&entry->seq, 0);
+
+    if (virTimeMillisNowRaw(&entry->when) < 0)
+        entry->when = 0;
+    entry->source = source;
+    entry->priority = priority;
+    entry->funcname = funcname;
+    entry->linenr = linenr;
+    entry->fmt = fmt;
+    entry->nargs = 0;
+    entry->truncated = false;
+
+    va_copy(ap, vargs);
+
+    while ((cur = strchr(cur, '%'))) {
+        virLogRecorderArgPtr arg;
+        virLogArgType type;
+        size_t nstars;
+        int precision;
+
+        cur = virLogRecorderParseConversion(cur + 1, &type, &nstars,
+                                            &precision);
+        if (type == VIR_LOG_ARG_NONE)
+            continue;
+
+        if (type == VIR_LOG_ARG_INVALID ||
+            entry->nargs + nstars + 1 > VIR_LOG_RECORDER_ARGS) {
+            entry->truncated = true;
+            break;
+        }
+
+        /* A '*' precision always follows a '*' width */
+        while (nstars--) {
+            entry->args[entry->nargs].i = va_arg(ap, int);
+            if (!nstars && precision == -2)
+                precision = entry->args[entry->nargs].i;
+            entry->nargs++;
+        }
+
+        arg = &entry->args[entry->nargs++];
+        switch (type) {
+        case VIR_LOG_ARG_INT:
+            arg->i = va_arg(ap, int);
+            break;
+        case VIR_LOG_ARG_LONG:
+            arg->i = va_arg(ap, long);
+            break;
+        case VIR_LOG_ARG_LONG_LONG:
+            arg->i = va_arg(ap, long long);
+            break;
+        case VIR_LOG_ARG_SIZE:
+            arg->i = va_arg(ap, ssize_t);
+            break;
+        case VIR_LOG_ARG_INTMAX:
+            arg->i = va_arg(ap, intmax_t);
+            break;
+        case VIR_LOG_ARG_PTRDIFF:
+            arg->i = va_arg(ap, ptrdiff_t);
+            break;
+        case VIR_LOG_ARG_DOUBLE:
+            arg->d = va_arg(ap, double);
+            break;
+        case VIR_LOG_ARG_POINTER:
+            arg->p = va_arg(ap, void *);
+            break;
+        case VIR_LOG_ARG_STRING: {
+            const char *str = va_arg(ap, const char *);
+            size_t room = VIR_LOG_RECORDER_STRINGS - nstrings - 1;
+            size_t len;
+
+            if (!str)
+                str = "(null)";
+
+            /* A precision allows strings without a terminating NUL */
+            if (precision >= 0 && (size_t) precision < room)
+                room = precision;
+            len = strnlen(str, room);
+            memcpy(entry->strings + nstrings, str, len);
+            entry->strings[nstrings + len] = '\0';
+            arg->s = nstrings;
+            nstrings += len + 1;
+
+            if (nstrings >= VIR_LOG_RECORDER_STRINGS) {
+                entry->truncated = true;
+                goto done;
+            }
+            break;
+        }
+        case VIR_LOG_ARG_NONE:
+        case VIR_LOG_ARG_INVALID:
+            break;
+        }
+    }
+
+ done:
+    va_end(ap);
+    virAtomicIntSet(&entry->seq, pos + 1);
+    virAtomicIntSet(&rec->pos, pos + 1);
+}
+
+
+/* Format the message of @entry into @buf of @buflen bytes. Strings
+ * are always taken from the entry, never from the original pointers,
+ * which may well be gone by now. */
+VIR_WARNINGS_NO_PRINTF
+static void
+virLogRecorderFormat(virLogRecorderEntryPtr entry,
+                     char *buf,
+                     size_t buflen)
+{
+    const char *cur = entry->fmt;
+    size_t nargs = 0;
+    size_t off = 0;
+
+    buf[0] = '\0';
+
+    while (*cur && off < buflen - 1) {
+        const char *start = cur;
+        virLogRecorderArgPtr arg;
+        virLogArgType type;
+        size_t nstars;
+        int precision;
+        char spec[64];
+        size_t speclen = 0;
+        int n = 0;
+
+        if (*cur != '%') {
+            buf[off++] = *cur++;
+            buf[off] = '\0';
+            continue;
+        }
+
+        cur = virLogRecorderParseConversion(cur + 1, &type, &nstars,
+                                            &precision);
+        if (type == VIR_LOG_ARG_NONE) {
+            buf[off++] = '%';
+            buf[off] = '\0';
+            continue;
+        }
+
+        if (type == VIR_LOG_ARG_INVALID ||
+            nargs + nstars + 1 > entry->nargs)
+            break;
+
+        /* Rebuild the specification with the '*' values filled in */
+        for (; start < cur && speclen < sizeof(spec) - 12; start++) {
+            if (*start == '*') {
+                speclen += snprintf(spec + speclen, sizeof(spec) - speclen,
+                                    "%d", (int) entry->args[nargs++].i);
+            } else {
+                spec[speclen++] = *start;
+            }
+        }
+        if (start < cur)
+            break;
+        spec[speclen] = '\0';
+
+        arg = &entry->args[nargs++];
+        switch (type) {
+        case VIR_LOG_ARG_INT:
+            n = snprintf(buf + off, buflen - off, spec, (int) arg->i);
+            break;
+        case VIR_LOG_ARG_LONG:
+            n = snprintf(buf + off, buflen - off, spec, (long) arg->i);
+            break;
+        case VIR_LOG_ARG_LONG_LONG:
+            n = snprintf(buf + off, buflen - off, spec, arg->i);
+            break;
+        case VIR_LOG_ARG_SIZE:
+            n = snprintf(buf + off, buflen - off, spec, (ssize_t) arg->i);
+            break;
+        case VIR_LOG_ARG_INTMAX:
+            n = snprintf(buf + off, buflen - off, spec, (intmax_t) arg->i);
+            break;
+        case VIR_LOG_ARG_PTRDIFF:
+            n = snprintf(buf + off, buflen - off, spec, (ptrdiff_t) arg->i);
+            break;
+        case VIR_LOG_ARG_DOUBLE:
+            n = snprintf(buf + off, buflen - off, spec, arg->d);
+            break;
+        case VIR_LOG_ARG_POINTER:
+            n = snprintf(buf + off, buflen - off, spec, arg->p);
+            break;
+        case VIR_LOG_ARG_STRING:
+            if (arg->s >= VIR_LOG_RECORDER_STRINGS)
+                goto done;
+            n = snprintf(buf + off, buflen - off, spec,
+                         entry->strings + arg->s);
+            break;
+        case VIR_LOG_ARG_NONE:
+        case VIR_LOG_ARG_INVALID:
+            break;
+        }
+
+        if (n < 0)
+            break;
+        off = MIN(off + n, buflen - 1);
+    }
+
+ done:
+    if (entry->truncated || *cur)
+        snprintf(buf + off, buflen - off, "...");
+}
+VIR_WARNINGS_RESET
+
+
+static void
+virLogRecorderDumpThread(int fd,
+                         virLogRecorderPtr rec)
+{
+    char line[1024];
+    char msg[768];
+    char timestamp[VIR_TIME_STRING_BUFLEN];
+    virLogRecorderEntry entry;
+    int pos = virAtomicIntGet(&rec->pos);
+    int i;
+
+    snprintf(line, sizeof(line), "Recorded messages of thread %llu:\n",
+             rec->thread);
+    ignore_value(safewrite(fd, line, strlen(line)));
+
+    /* The slot at @pos may be rewritten by its thread meanwhile, and
+     * so may any other once the thread wraps around. Work on a copy
+     * and drop it unless the entry was complete and unchanged from
+     * before the copy until after it. */
+    for (i = MAX(0, pos - VIR_LOG_RECORDER_ENTRIES + 1); i < pos; i++) {
+        virLogRecorderEntryPtr src =
+            &rec->entries[i & (VIR_LOG_RECORDER_ENTRIES - 1)];
+
+        if (virAtomicIntGet(&src->seq) != i + 1)
+            continue;
+        memcpy(&entry, src, sizeof(entry));
+        if (virAtomicIntGet(&src->seq) != i + 1 ||
+            entry.nargs > VIR_LOG_RECORDER_ARGS)
+            continue;
+        entry.strings[VIR_LOG_RECORDER_STRINGS - 1] = '\0';
+
+        if (virTimeStringThenRaw(entry.when, timestamp) < 0)
+            timestamp[0] = '\0';
+        virLogRecorderFormat(&entry, msg, sizeof(msg));
+
+        snprintf(line, sizeof(line), "%s: %llu: %s : %s:%d : %s\n",
+                 timestamp, rec->thread,
+                 virLogPriorityString(entry.priority),
+                 NULLSTR(entry.funcname), entry.linenr, msg);
+        ignore_value(safewrite(fd, line, strlen(line)));
+    }
+}
+
+
+/**
+ * virLogRecorderDump:
+ * @fd: where to write to
+ *
+ * Write the messages recorded by every thread to @fd, oldest first.
+ * This takes no locks and allocates no memory, so that it can be
+ * called from a signal handler.
+ */
+void
+virLogRecorderDump(int fd)
+{
+    virLogRecorderPtr rec;
+
+    for (rec = virLogRecorders; rec; rec = rec->next) {
+        if (virAtomicIntGet(&rec->pos) > 0)
+            virLogRecorderDumpThread(fd, rec);
+    }
+}
+
+
+/**
+ * virLogSetRecorder:
+ * @enabled: whether to record messages
+ *
+ * Turn the flight recorder on or off. Messages already recorded are
+ * kept for virLogRecorderDump.
+ *
+ * Returns 0 if successful, -1 in case of error.
+ */
+int
+virLogSetRecorder(bool enabled)
+{
+    if (virLogInitialize() < 0)
+        return -1;
+
+    virAtomicIntSet(&virLogRecorderEnabled, enabled ? 1 : 0);
+    return 0;
+}
+
+
 /**
  * virLogMessage:
  * @source: where is that message coming from
@@ -546,12 +1671,11 @@ virLogVMessage(virLogSourcePtr source,
                const char *fmt,
                va_list vargs)
 {
-    static bool logVersionStderr = true;
     char *str = NULL;
     char *msg = NULL;
     char timestamp[VIR_TIME_STRING_BUFLEN];
+    virLogRecord rec = { 0 };
     int ret;
-    size_t i;
     int saved_errno = errno;
     unsigned int filterflags = 0;
 
@@ -561,6 +1685,10 @@ virLogVMessage(virLogSourcePtr source,
     if (fmt == NULL)
         return;
 
+    if (virLogRecorderEnabled)
+        virLogRecorderCapture(source, priority, funcname, linenr,
+                              fmt, vargs);
+
     /*
      * 3 intentionally non-thread safe variable reads.
      * Since writes to the variable are serialized on
@@ -589,48 +1717,23 @@ virLogVMessage(virLogSourcePtr source,
     if (virTimeStringNowRaw(timestamp) < 0)
         timestamp[0] = '\0';
 
-    virLogLock();
+    if (virLogAsyncQueue(source, priority, filename, linenr, funcname,
+                         timestamp, metadata, filterflags, &str, &msg) == 0)
+        goto cleanup;
 
-    /*
-     * Push the message to the outputs defined, if none exist then
-     * use stderr.
-     */
-    for (i = 0; i < virLogNbOutputs; i++) {
-        if (priority >= virLogOutputs[i].priority) {
-            if (virLogOutputs[i].logVersion) {
-                const char *rawver;
-                char *ver = NULL;
-                if (virLogVersionString(&rawver, &ver) >= 0)
-                    virLogOutputs[i].f(&virLogSelf, VIR_LOG_INFO,
-                                       __FILE__, __LINE__, __func__,
-                                       timestamp, NULL, 0, rawver, ver,
-                                       virLogOutputs[i].data);
-                VIR_FREE(ver);
-                virLogOutputs[i].logVersion = false;
-            }
-            virLogOutputs[i].f(source, priority,
-                               filename, linenr, funcname,
-                               timestamp, metadata, filterflags,
-                               str, msg, virLogOutputs[i].data);
-        }
-    }
-    if (virLogNbOutputs == 0) {
-        if (logVersionStderr) {
-            const char *rawver;
-            char *ver = NULL;
-            if (virLogVersionString(&rawver, &ver) >= 0)
-                virLogOutputToFd(&virLogSelf, VIR_LOG_INFO,
-                                 __FILE__, __LINE__, __func__,
-                                 timestamp, NULL, 0, rawver, ver,
-                                 (void *) STDERR_FILENO);
-            VIR_FREE(ver);
-            logVersionStderr = false;
-        }
-        virLogOutputToFd(source, priority,
-                         filename, linenr, funcname,
-                         timestamp, metadata, filterflags,
-                         str, msg, (void *) STDERR_FILENO);
-    }
+    rec.source = source;
+    rec.priority = priority;
+    rec.filename = filename;
+    rec.linenr = linenr;
+    rec.funcname = funcname;
+    ignore_value(virStrcpyStatic(rec.timestamp, timestamp));
+    rec.metadata = metadata;
+    rec.flags = filterflags;
+    rec.str = str;
+    rec.msg = msg;
+
+    virLogLock();
+    virLogEmit(&rec, NULL);
     virLogUnlock();
 
  cleanup:
@@ -647,6 +1750,7 @@ virLogStackTraceToFd(int fd)
     int size;
     static bool doneWarning = false;
     const char *msg = "Stack trace not available on this platform\n";
+    virLogRecorderPtr rec;
 
 #define STRIP_DEPTH 3
     size = backtrace(array, ARRAY_CARDINALITY(array));
@@ -658,6 +1762,11 @@ virLogStackTraceToFd(int fd)
         doneWarning = true;
     }
 #undef STRIP_DEPTH
+
+    /* What led the thread here */
+    if (virLogRecorderEnabled &&
+        (rec = virThreadLocalGet(&virLogRecorderKey)))
+        virLogRecorderDumpThread(fd, rec);
 }
 
 static void
@@ -1410,6 +2519,12 @@ virLogSetFromEnv(void)
     debugEnv = virGetEnvAllowSUID("LIBVIRT_LOG_OUTPUTS");
     if (debugEnv && *debugEnv)
         virLogParseOutputs(debugEnv);
+    debugEnv = virGetEnvAllowSUID("LIBVIRT_LOG_ASYNC");
+    if (debugEnv && STREQ(debugEnv, "1"))
+        virLogSetAsync(true);
+    debugEnv = virGetEnvAllowSUID("LIBVIRT_LOG_RECORDER");
+    if (debugEnv && STREQ(debugEnv, "0"))
+        virLogSetRecorder(false);
 }
 
 
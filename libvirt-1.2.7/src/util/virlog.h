@@ -184,6 +184,10 @@ extern int virLogReset(void);
 extern int virLogParseDefaultPriority(const char *priority);
 extern int virLogParseFilters(const char *filters);
 extern int virLogParseOutputs(const char *output);
+extern int virLogSetAsync(bool async);
+extern unsigned int virLogGetDropped(void);
+extern int virLogSetRecorder(bool enabled);
+extern void virLogRecorderDump(int fd);
 extern int virLogPriorityFromSyslog(int priority);
 extern void virLogMessage(virLogSourcePtr source,
                           virLogPriority priority,
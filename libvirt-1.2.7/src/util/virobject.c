@@ -30,6 +30,8 @@
 #include "virlog.h"
 #include "virprobe.h"
 #include "virstring.h"
+#include "virtime.h"
+#include "virutil.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -45,8 +47,31 @@ struct _virClass {
     size_t objectSize;
 
     virObjectDisposeCallback dispose;
+
+    /* Profiling data, only maintained if LIBVIRT_OBJECT_STATS is set */
+    virClassPtr next;
+    int nnew;
+    int ndispose;
+    int nlock;
+    int ncontended;
+    virMutex statsLock;
+    unsigned long long waitTotal;
+    unsigned long long waitMax;
 };
 
+/* Set from the environment at initialization:
+ *
+ *   LIBVIRT_OBJECT_STATS=1        count allocations and lock
+ *                                 contention per class
+ *   LIBVIRT_OBJECT_LOCK=adaptive  use spinning mutexes for
+ *                                 lockable objects
+ */
+static bool virObjectStats;
+static bool virObjectLockAdaptive;
+
+static virMutex virClassListLock = VIR_MUTEX_INITIALIZER;
+static virClassPtr virClassList;
+
 static virClassPtr virObjectClass;
 static virClassPtr virObjectLockableClass;
 
@@ -54,6 +79,16 @@ static void virObjectLockableDispose(void *anyobj);
 
 static int virObjectOnceInit(void)
 {
+    const char *env;
+
+    if ((env = virGetEnvBlockSUID("LIBVIRT_OBJECT_STATS")) &&
+        STRNEQ(env, "") && STRNEQ(env, "0"))
+        virObjectStats = true;
+
+    if ((env = virGetEnvBlockSUID("LIBVIRT_OBJECT_LOCK")) &&
+        STREQ(env, "adaptive"))
+        virObjectLockAdaptive = true;
+
     if (!(virObjectClass = virClassNew(NULL,
                                        "virObject",
                                        sizeof(virObject),
@@ -145,6 +180,18 @@ virClassPtr virClassNew(virClassPtr parent,
     klass->objectSize = objectSize;
     klass->dispose = dispose;
 
+    if (virMutexInit(&klass->statsLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        VIR_FREE(klass->name);
+        goto error;
+    }
+
+    virMutexLock(&virClassListLock);
+    klass->next = virClassList;
+    virClassList = klass;
+    virMutexUnlock(&virClassListLock);
+
     return klass;
 
  error:
@@ -199,6 +246,9 @@ void *virObjectNew(virClassPtr klass)
     obj->klass = klass;
     virAtomicIntSet(&obj->u.s.refs, 1);
 
+    if (virObjectStats)
+        virAtomicIntInc(&klass->nnew);
+
     PROBE(OBJECT_NEW, "obj=%p classname=%s", obj, obj->klass->name);
 
     return obj;
@@ -219,7 +269,9 @@ void *virObjectLockableNew(virClassPtr klass)
     if (!(obj = virObjectNew(klass)))
         return NULL;
 
-    if (virMutexInit(&obj->lock) < 0) {
+    if ((virObjectLockAdaptive ?
+         virMutexInitAdaptive(&obj->lock) :
+         virMutexInit(&obj->lock)) < 0) {
         virReportSystemError(VIR_ERR_INTERNAL_ERROR, "%s",
                              _("Unable to initialize mutex"));
         virObjectUnref(obj);
@@ -260,6 +312,8 @@ bool virObjectUnref(void *anyobj)
     if (lastRef) {
         PROBE(OBJECT_DISPOSE, "obj=%p", obj);
         virClassPtr klass = obj->klass;
+        if (virObjectStats)
+            virAtomicIntInc(&klass->ndispose);
         while (klass) {
             if (klass->dispose)
                 klass->dispose(obj);
@@ -298,6 +352,72 @@ void *virObjectRef(void *anyobj)
 }
 
 
+/**
+ * virObjectRefIfAlive:
+ * @anyobj: any instance of virObjectPtr
+ *
+ * Increment the reference count on @anyobj unless its last
+ * reference is already gone, in which case the object is about
+ * to be disposed of. This lets caches keep pointers to objects
+ * without owning a reference, provided the dispose callback
+ * removes the object from the cache under the same lock that
+ * guards lookups.
+ *
+ * Returns @anyobj, or NULL if it is being disposed of
+ */
+void *virObjectRefIfAlive(void *anyobj)
+{
+    virObjectPtr obj = anyobj;
+    int refs;
+
+    if (!obj)
+        return NULL;
+
+    do {
+        refs = virAtomicIntGet(&obj->u.s.refs);
+        if (refs <= 0)
+            return NULL;
+    } while (!virAtomicIntCompareExchange(&obj->u.s.refs, refs, refs + 1));
+
+    PROBE(OBJECT_REF, "obj=%p", obj);
+    return anyobj;
+}
+
+
+static unsigned long long virObjectNow(void)
+{
+    unsigned long long now;
+
+    if (virTimeMonotonicMicrosNowRaw(&now) < 0)
+        return 0;
+    return now;
+}
+
+
+static void virObjectLockProfiled(virObjectLockablePtr obj)
+{
+    virClassPtr klass = obj->parent.klass;
+    unsigned long long start;
+    unsigned long long waited;
+
+    virAtomicIntInc(&klass->nlock);
+
+    if (virMutexTryLock(&obj->lock) == 0)
+        return;
+
+    start = virObjectNow();
+    virMutexLock(&obj->lock);
+    waited = virObjectNow() - start;
+
+    virAtomicIntInc(&klass->ncontended);
+    virMutexLock(&klass->statsLock);
+    klass->waitTotal += waited;
+    if (waited > klass->waitMax)
+        klass->waitMax = waited;
+    virMutexUnlock(&klass->statsLock);
+}
+
+
 /**
  * virObjectLock:
  * @anyobj: any instance of virObjectLockablePtr
@@ -320,6 +440,11 @@ void virObjectLock(void *anyobj)
         return;
     }
 
+    if (virObjectStats) {
+        virObjectLockProfiled(obj);
+        return;
+    }
+
     virMutexLock(&obj->lock);
 }
 
@@ -405,3 +530,44 @@ void virObjectFreeHashData(void *opaque, const void *name ATTRIBUTE_UNUSED)
 {
     virObjectUnref(opaque);
 }
+
+
+/**
+ * virObjectLogStats:
+ *
+ * Log, for every class which had instances, the number of objects
+ * created and disposed, how often they were locked, how many of
+ * those locks were contended and how long was spent waiting for
+ * them. Does nothing unless the LIBVIRT_OBJECT_STATS environment
+ * variable enabled the collection of statistics.
+ */
+void virObjectLogStats(void)
+{
+    virClassPtr klass;
+
+    if (!virObjectStats)
+        return;
+
+    virMutexLock(&virClassListLock);
+    for (klass = virClassList; klass; klass = klass->next) {
+        unsigned long long waitTotal, waitMax;
+
+        if (!virAtomicIntGet(&klass->nnew))
+            continue;
+
+        virMutexLock(&klass->statsLock);
+        waitTotal = klass->waitTotal;
+        waitMax = klass->waitMax;
+        virMutexUnlock(&klass->statsLock);
+
+        VIR_INFO("Class %s: new=%u dispose=%u lock=%u contended=%u "
+                 "wait total=%lluus max=%lluus",
+                 klass->name,
+                 (unsigned int)virAtomicIntGet(&klass->nnew),
+                 (unsigned int)virAtomicIntGet(&klass->ndispose),
+                 (unsigned int)virAtomicIntGet(&klass->nlock),
+                 (unsigned int)virAtomicIntGet(&klass->ncontended),
+                 waitTotal, waitMax);
+    }
+    virMutexUnlock(&virClassListLock);
+}
@@ -83,6 +83,7 @@ void *virObjectNew(virClassPtr klass)
     ATTRIBUTE_NONNULL(1);
 bool virObjectUnref(void *obj);
 void *virObjectRef(void *obj);
+void *virObjectRefIfAlive(void *obj);
 
 bool virObjectIsClass(void *obj,
                       virClassPtr klass)
@@ -99,5 +100,7 @@ void virObjectLock(void *lockableobj)
 void virObjectUnlock(void *lockableobj)
     ATTRIBUTE_NONNULL(1);
 
+void virObjectLogStats(void);
+
 
 #endif /* __VIR_OBJECT_H */
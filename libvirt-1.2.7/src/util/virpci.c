@@ -42,8 +42,11 @@
 #include "vircommand.h"
 #include "virerror.h"
 #include "virfile.h"
+#include "virhash.h"
 #include "virkmod.h"
 #include "virstring.h"
+#include "virthread.h"
+#include "virtime.h"
 #include "virutil.h"
 
 VIR_LOG_INIT("util.pci");
@@ -87,8 +90,39 @@ struct _virPCIDeviceList {
 
     size_t count;
     virPCIDevicePtr *devs;
+    virHashTablePtr index; /* dev->name -> dev, not owning */
 };
 
+/* One PCI function found in PCI_SYSFS "devices" */
+typedef struct _virPCITopologyEntry virPCITopologyEntry;
+typedef virPCITopologyEntry *virPCITopologyEntryPtr;
+struct _virPCITopologyEntry {
+    unsigned int domain;
+    unsigned int bus;
+    unsigned int slot;
+    unsigned int function;
+
+    /* Filled in lazily by virPCITopologyEntryProbe */
+    bool probed;
+    bool bridge;
+    uint8_t secondary;
+    uint8_t subordinate;
+};
+
+/* Snapshot of the host PCI topology.  Walking sysfs for every bus or
+ * parent check gets expensive on hosts with hundreds of VFs, so the
+ * list of functions and the bus ranges of bridges are read once and
+ * kept until virPCITopologyInvalidate() is called, e.g. on a udev
+ * add/remove event for the pci subsystem.  Since not every host gets
+ * those events to us, each check also compares the part of the cache
+ * it relies on with the device's own sysfs directory and rescans the
+ * whole topology when they disagree.
+ */
+static virMutex virPCITopologyLock;
+static virPCITopologyEntryPtr virPCITopology;
+static size_t virPCITopologyCount;
+static bool virPCITopologyValid;
+
 
 /* For virReportOOMError()  and virReportSystemError() */
 #define VIR_FROM_THIS VIR_FROM_NONE
@@ -112,6 +146,7 @@ struct _virPCIDeviceList {
 #define PCI_HEADER_TYPE_MULTI  0x80
 
 /* PCI30 6.2.1  Device Identification */
+#define PCI_VENDOR_ID           0x00    /* 16 bits */
 #define PCI_CLASS_DEVICE        0x0a    /* Device class */
 
 /* Class Code for bridge; PCI30 D.7  Base Class 06h */
@@ -186,12 +221,32 @@ struct _virPCIDeviceList {
 #define PCI_EXP_TYPE_ROOT_INT_EP 0x9    /* Root Complex Integrated Endpoint */
 #define PCI_EXP_TYPE_ROOT_EC 0xa        /* Root Complex Event Collector */
 
+/* Reset timing.  PCI30 4.3.2 requires RST# to be asserted for at least
+ * 1ms, PCIe20 6.6.1 allows software to wait 100ms after a conventional
+ * reset before issuing configuration requests and PM12 5.6.1 requires
+ * 10ms of recovery after a D3hot transition.  Beyond those minimums we
+ * poll the config space with an exponential backoff rather than sleep
+ * for a fixed worst case period.
+ */
+#define PCI_RESET_BUS_HOLD_MS       2
+#define PCI_RESET_BUS_SETTLE_MS     100
+#define PCI_RESET_PM_SETTLE_MS      10
+#define PCI_RESET_POLL_MIN_MS       1
+#define PCI_RESET_POLL_MAX_MS       50
+#define PCI_RESET_READY_TIMEOUT_MS  1000
+
 static virClassPtr virPCIDeviceListClass;
 
 static void virPCIDeviceListDispose(void *obj);
 
 static int virPCIOnceInit(void)
 {
+    if (virMutexInit(&virPCITopologyLock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize PCI topology mutex"));
+        return -1;
+    }
+
     if (!(virPCIDeviceListClass = virClassNew(virClassForObjectLockable(),
                                               "virPCIDeviceList",
                                               sizeof(virPCIDeviceList),
@@ -429,28 +484,42 @@ virPCIDeviceWrite32(virPCIDevicePtr dev, int cfgfd, unsigned int pos, uint32_t v
     virPCIDeviceWrite(dev, cfgfd, pos, &buf[0], sizeof(buf));
 }
 
-typedef int (*virPCIDeviceIterPredicate)(virPCIDevicePtr, virPCIDevicePtr,
-                                         void *);
+/* Parse a PCI_SYSFS "devices" entry name into @dev's address.
+ * Returns true if @name is a PCI address */
+static bool
+virPCITopologyParseName(const char *name,
+                        virPCITopologyEntryPtr dev)
+{
+    char *tmp;
 
-/* Iterate over available PCI devices calling @predicate
- * to compare each one to @dev.
- * Return -1 on error since we don't want to assume it is
- * safe to reset if there is an error.
- */
+    memset(dev, 0, sizeof(*dev));
+
+    /* expected format: <domain>:<bus>:<slot>.<function> */
+    return /* domain */
+        virStrToLong_ui(name, &tmp, 16, &dev->domain) == 0 && *tmp == ':' &&
+        /* bus */
+        virStrToLong_ui(tmp + 1, &tmp, 16, &dev->bus) == 0 && *tmp == ':' &&
+        /* slot */
+        virStrToLong_ui(tmp + 1, &tmp, 16, &dev->slot) == 0 && *tmp == '.' &&
+        /* function */
+        virStrToLong_ui(tmp + 1, NULL, 16, &dev->function) == 0;
+}
+
+/* Must be called with virPCITopologyLock held */
 static int
-virPCIDeviceIterDevices(virPCIDeviceIterPredicate predicate,
-                        virPCIDevicePtr dev,
-                        virPCIDevicePtr *matched,
-                        void *data)
+virPCITopologyRefresh(void)
 {
     DIR *dir;
     struct dirent *entry;
-    int ret = 0;
+    virPCITopologyEntryPtr devs = NULL;
+    size_t ndevs = 0;
+    int ret = -1;
     int rc;
 
-    *matched = NULL;
+    if (virPCITopologyValid)
+        return 0;
 
-    VIR_DEBUG("%s %s: iterating over " PCI_SYSFS "devices", dev->id, dev->name);
+    VIR_DEBUG("scanning " PCI_SYSFS "devices");
 
     dir = opendir(PCI_SYSFS "devices");
     if (!dir) {
@@ -458,52 +527,364 @@ virPCIDeviceIterDevices(virPCIDeviceIterPredicate predicate,
         return -1;
     }
 
-    while ((ret = virDirRead(dir, &entry, PCI_SYSFS "devices")) > 0) {
-        unsigned int domain, bus, slot, function;
-        virPCIDevicePtr check;
-        char *tmp;
+    while ((rc = virDirRead(dir, &entry, PCI_SYSFS "devices")) > 0) {
+        virPCITopologyEntry dev;
 
         /* Ignore '.' and '..' */
         if (entry->d_name[0] == '.')
             continue;
 
-        /* expected format: <domain>:<bus>:<slot>.<function> */
-        if (/* domain */
-            virStrToLong_ui(entry->d_name, &tmp, 16, &domain) < 0 || *tmp != ':' ||
-            /* bus */
-            virStrToLong_ui(tmp + 1, &tmp, 16, &bus) < 0 || *tmp != ':' ||
-            /* slot */
-            virStrToLong_ui(tmp + 1, &tmp, 16, &slot) < 0 || *tmp != '.' ||
-            /* function */
-            virStrToLong_ui(tmp + 1, NULL, 16, &function) < 0) {
+        if (!virPCITopologyParseName(entry->d_name, &dev)) {
             VIR_WARN("Unusual entry in " PCI_SYSFS "devices: %s", entry->d_name);
             continue;
         }
 
-        check = virPCIDeviceNew(domain, bus, slot, function);
-        if (!check) {
-            ret = -1;
-            break;
-        }
+        if (VIR_APPEND_ELEMENT(devs, ndevs, dev) < 0)
+            goto cleanup;
+    }
+    if (rc < 0)
+        goto cleanup;
 
-        rc = predicate(dev, check, data);
-        if (rc < 0) {
-            /* the predicate returned an error, bail */
-            virPCIDeviceFree(check);
-            ret = -1;
-            break;
-        }
-        else if (rc == 1) {
-            VIR_DEBUG("%s %s: iter matched on %s", dev->id, dev->name, check->name);
-            *matched = check;
-            ret = 1;
+    VIR_FREE(virPCITopology);
+    virPCITopology = devs;
+    virPCITopologyCount = ndevs;
+    virPCITopologyValid = true;
+    devs = NULL;
+    ret = 0;
+
+ cleanup:
+    closedir(dir);
+    VIR_FREE(devs);
+    return ret;
+}
+
+/* Reads whether @entry is a PCI-to-PCI bridge and, if so, the range of
+ * buses behind it.  Must be called with virPCITopologyLock held.
+ */
+static void
+virPCITopologyEntryProbe(virPCITopologyEntryPtr entry)
+{
+    virPCIDevicePtr dev;
+    uint16_t device_class;
+    uint8_t header_type;
+    int fd;
+
+    if (entry->probed)
+        return;
+
+    if (!(dev = virPCIDeviceNew(entry->domain, entry->bus,
+                                entry->slot, entry->function))) {
+        virResetLastError();
+        return;
+    }
+
+    /* Failing to open the config space isn't fatal, the device
+     * just won't be considered as anyone's parent.
+     */
+    if ((fd = virPCIDeviceConfigOpen(dev, false)) < 0)
+        goto cleanup;
+
+    entry->probed = true;
+
+    /* Is it a bridge? */
+    if (virPCIDeviceReadClass(dev, &device_class) < 0) {
+        virResetLastError();
+        goto cleanup;
+    }
+    if (device_class != PCI_CLASS_BRIDGE_PCI)
+        goto cleanup;
+
+    /* Is it a plane? */
+    header_type = virPCIDeviceRead8(dev, fd, PCI_HEADER_TYPE);
+    if ((header_type & PCI_HEADER_TYPE_MASK) != PCI_HEADER_TYPE_BRIDGE)
+        goto cleanup;
+
+    entry->bridge = true;
+    entry->secondary = virPCIDeviceRead8(dev, fd, PCI_SECONDARY_BUS);
+    entry->subordinate = virPCIDeviceRead8(dev, fd, PCI_SUBORDINATE_BUS);
+
+ cleanup:
+    virPCIDeviceConfigClose(dev, fd);
+    virPCIDeviceFree(dev);
+}
+
+/**
+ * virPCITopologyInvalidate:
+ *
+ * Drop the cached view of the host PCI topology, forcing it to be
+ * re-read from sysfs the next time it is needed.  Callers told about
+ * PCI devices being added to or removed from the host should call it;
+ * changes nobody reports are caught by checking the cache against
+ * sysfs before it is relied upon.
+ */
+void
+virPCITopologyInvalidate(void)
+{
+    if (virPCIInitialize() < 0)
+        return;
+
+    virMutexLock(&virPCITopologyLock);
+    virPCITopologyValid = false;
+    virMutexUnlock(&virPCITopologyLock);
+}
+
+/* Returns the sysfs directory holding @dev, i.e. that of the bridge
+ * it sits behind or of its root bus, or NULL on error */
+static char *
+virPCITopologyDeviceDir(virPCIDevicePtr dev)
+{
+    char *link = NULL;
+    char *path = NULL;
+    char *dir = NULL;
+
+    if (virAsprintf(&link, PCI_SYSFS "devices/%s", dev->name) < 0)
+        return NULL;
+
+    if (virFileResolveLink(link, &path) < 0) {
+        VIR_DEBUG("cannot resolve %s: %d", link, errno);
+        goto cleanup;
+    }
+
+    if (!(dir = mdir_name(path)))
+        virReportOOMError();
+
+ cleanup:
+    VIR_FREE(link);
+    VIR_FREE(path);
+    return dir;
+}
+
+static bool
+virPCITopologyContains(const virPCITopologyEntry *dev)
+{
+    size_t i;
+
+    for (i = 0; i < virPCITopologyCount; i++) {
+        if (virPCITopology[i].domain == dev->domain &&
+            virPCITopology[i].bus == dev->bus &&
+            virPCITopology[i].slot == dev->slot &&
+            virPCITopology[i].function == dev->function)
+            return true;
+    }
+    return false;
+}
+
+/* Whether the cached functions on @dev's bus are exactly those sysfs
+ * lists next to @dev.  A function hotplugged or a VF created since the
+ * cache was filled shows up there no matter whether anybody called
+ * virPCITopologyInvalidate.  Must be called with virPCITopologyLock
+ * held. */
+static bool
+virPCITopologyBusIsCurrent(virPCIDevicePtr dev)
+{
+    char *dirpath;
+    DIR *dir = NULL;
+    struct dirent *entry;
+    size_t nsysfs = 0;
+    size_t ncached = 0;
+    size_t i;
+    bool ret = false;
+    int rc;
+
+    if (!(dirpath = virPCITopologyDeviceDir(dev)))
+        goto cleanup;
+
+    if (!(dir = opendir(dirpath)))
+        goto cleanup;
+
+    while ((rc = virDirRead(dir, &entry, dirpath)) > 0) {
+        virPCITopologyEntry check;
+
+        if (!virPCITopologyParseName(entry->d_name, &check) ||
+            check.domain != dev->domain || check.bus != dev->bus)
+            continue;
+
+        if (!virPCITopologyContains(&check))
+            goto cleanup;
+        nsysfs++;
+    }
+    if (rc < 0)
+        goto cleanup;
+
+    for (i = 0; i < virPCITopologyCount; i++) {
+        if (virPCITopology[i].domain == dev->domain &&
+            virPCITopology[i].bus == dev->bus)
+            ncached++;
+    }
+
+    ret = nsysfs == ncached;
+
+ cleanup:
+    if (dir)
+        closedir(dir);
+    VIR_FREE(dirpath);
+    virResetLastError();
+    return ret;
+}
+
+/* Whether @parent, as found in the cache, is the bridge whose sysfs
+ * directory holds @dev (NULL if @dev sits on a root bus).  Must be
+ * called with virPCITopologyLock held. */
+static bool
+virPCITopologyParentIsCurrent(virPCIDevicePtr dev,
+                              const virPCITopologyEntry *parent)
+{
+    char *dirpath;
+    virPCITopologyEntry check;
+    bool ret = false;
+
+    if (!(dirpath = virPCITopologyDeviceDir(dev))) {
+        virResetLastError();
+        return false;
+    }
+
+    if (!virPCITopologyParseName(last_component(dirpath), &check))
+        ret = !parent;
+    else
+        ret = parent &&
+            parent->domain == check.domain &&
+            parent->bus == check.bus &&
+            parent->slot == check.slot &&
+            parent->function == check.function;
+
+    VIR_FREE(dirpath);
+    return ret;
+}
+
+/* Any active devices on the same domain/bus ? */
+static virPCIDevicePtr
+virPCIDeviceBusContainsActiveDevices(virPCIDevicePtr dev,
+                                     virPCIDeviceList *inactiveDevs)
+{
+    virPCIDevicePtr active = NULL;
+    size_t i;
+
+    VIR_DEBUG("%s %s: checking for active devices on the bus",
+              dev->id, dev->name);
+
+    if (virPCIInitialize() < 0)
+        return NULL;
+
+    virMutexLock(&virPCITopologyLock);
+
+    if (virPCITopologyRefresh() < 0)
+        goto cleanup;
+
+    /* Approving a secondary bus reset on stale data could reset a
+     * device in use, so always check the bus against sysfs */
+    if (!virPCITopologyBusIsCurrent(dev)) {
+        VIR_DEBUG("%s %s: bus changed since the PCI topology was cached",
+                  dev->id, dev->name);
+        virPCITopologyValid = false;
+        if (virPCITopologyRefresh() < 0)
+            goto cleanup;
+    }
+
+    for (i = 0; i < virPCITopologyCount; i++) {
+        virPCITopologyEntryPtr check = &virPCITopology[i];
+
+        /* Different domain, different bus, or simply identical device */
+        if (dev->domain != check->domain ||
+            dev->bus != check->bus ||
+            (dev->slot == check->slot &&
+             dev->function == check->function))
+            continue;
+
+        /* same bus, but inactive, i.e. about to be assigned to guest */
+        if (inactiveDevs &&
+            virPCIDeviceListFindByIDs(inactiveDevs, check->domain, check->bus,
+                                      check->slot, check->function))
+            continue;
+
+        active = virPCIDeviceNew(check->domain, check->bus,
+                                 check->slot, check->function);
+        if (active)
+            VIR_DEBUG("%s %s: shares bus with %s",
+                      dev->id, dev->name, active->name);
+        break;
+    }
+
+ cleanup:
+    virMutexUnlock(&virPCITopologyLock);
+    return active;
+}
+
+/* Find the bridge whose secondary bus is @dev's bus or, since SRIOV
+ * allows VFs to be on different buses than their PFs, the most
+ * restrictive bridge whose bus range still contains it.
+ */
+static int
+virPCIDeviceGetParent(virPCIDevicePtr dev, virPCIDevicePtr *parent)
+{
+    virPCITopologyEntryPtr best = NULL;
+    virPCITopologyEntry found;
+    bool rescanned = false;
+    size_t i;
+
+    *parent = NULL;
+
+    if (virPCIInitialize() < 0)
+        return -1;
+
+    virMutexLock(&virPCITopologyLock);
+
+ retry:
+    if (virPCITopologyRefresh() < 0) {
+        virMutexUnlock(&virPCITopologyLock);
+        return -1;
+    }
+
+    best = NULL;
+    for (i = 0; i < virPCITopologyCount; i++) {
+        virPCITopologyEntryPtr check = &virPCITopology[i];
+
+        if (dev->domain != check->domain)
+            continue;
+
+        virPCITopologyEntryProbe(check);
+        if (!check->bridge)
+            continue;
+
+        /* if the secondary bus exactly equals the device's bus, then we found
+         * the direct parent.  No further work is necessary
+         */
+        if (dev->bus == check->secondary) {
+            best = check;
             break;
         }
 
-        virPCIDeviceFree(check);
+        if (dev->bus > check->secondary && dev->bus <= check->subordinate &&
+            (!best || check->secondary > best->secondary))
+            best = check;
     }
-    closedir(dir);
-    return ret;
+
+    /* A bridge added or renumbered behind our back would make us reset
+     * the wrong bus, rescan once if sysfs disagrees with the cache */
+    if (!rescanned && !virPCITopologyParentIsCurrent(dev, best)) {
+        VIR_DEBUG("%s %s: parent changed since the PCI topology was cached",
+                  dev->id, dev->name);
+        virPCITopologyValid = false;
+        rescanned = true;
+        goto retry;
+    }
+
+    if (best)
+        found = *best;
+
+    virMutexUnlock(&virPCITopologyLock);
+
+    if (!best)
+        return 0;
+
+    VIR_DEBUG("%s %s: found parent device %.4x:%.2x:%.2x.%.1x",
+              dev->id, dev->name, found.domain, found.bus,
+              found.slot, found.function);
+
+    if (!(*parent = virPCIDeviceNew(found.domain, found.bus,
+                                    found.slot, found.function)))
+        return -1;
+
+    return 0;
 }
 
 static uint8_t
@@ -652,131 +1033,72 @@ virPCIDeviceDetectPowerManagementReset(virPCIDevicePtr dev, int cfgfd)
     return 0;
 }
 
-/* Any active devices on the same domain/bus ? */
-static int
-virPCIDeviceSharesBusWithActive(virPCIDevicePtr dev, virPCIDevicePtr check, void *data)
-{
-    virPCIDeviceList *inactiveDevs = data;
-
-    /* Different domain, different bus, or simply identical device */
-    if (dev->domain != check->domain ||
-        dev->bus != check->bus ||
-        (dev->slot == check->slot &&
-         dev->function == check->function))
-        return 0;
+typedef bool (*virPCIDeviceReadyPredicate)(virPCIDevicePtr dev, int cfgfd);
 
-    /* same bus, but inactive, i.e. about to be assigned to guest */
-    if (inactiveDevs && virPCIDeviceListFind(inactiveDevs, check))
-        return 0;
+/* A function that went through reset returns all ones for reads
+ * until it is able to complete configuration requests again.
+ */
+static bool
+virPCIDeviceConfigIsReady(virPCIDevicePtr dev, int cfgfd)
+{
+    uint16_t vendor = virPCIDeviceRead16(dev, cfgfd, PCI_VENDOR_ID);
 
-    return 1;
+    return vendor != 0xffff && vendor != 0;
 }
 
-static virPCIDevicePtr
-virPCIDeviceBusContainsActiveDevices(virPCIDevicePtr dev,
-                                     virPCIDeviceList *inactiveDevs)
+static bool
+virPCIDevicePowerStateIsD0(virPCIDevicePtr dev, int cfgfd)
 {
-    virPCIDevicePtr active = NULL;
-    if (virPCIDeviceIterDevices(virPCIDeviceSharesBusWithActive,
-                                dev, &active, inactiveDevs) < 0)
-        return NULL;
-    return active;
+    uint32_t ctl;
+
+    if (!virPCIDeviceConfigIsReady(dev, cfgfd))
+        return false;
+
+    ctl = virPCIDeviceRead32(dev, cfgfd, dev->pci_pm_cap_pos + PCI_PM_CTRL);
+    return (ctl & PCI_PM_CTRL_STATE_MASK) == PCI_PM_CTRL_STATE_D0;
 }
 
-/* Is @check the parent of @dev ? */
+/* Sleep for @settle_ms and then poll @ready with an exponentially
+ * growing interval until it succeeds or PCI_RESET_READY_TIMEOUT_MS
+ * elapses.
+ *
+ * Returns 0 once the device is ready, -1 on timeout.
+ */
 static int
-virPCIDeviceIsParent(virPCIDevicePtr dev, virPCIDevicePtr check, void *data)
+virPCIDeviceWaitReady(virPCIDevicePtr dev,
+                      int cfgfd,
+                      unsigned int settle_ms,
+                      virPCIDeviceReadyPredicate ready)
 {
-    uint16_t device_class;
-    uint8_t header_type, secondary, subordinate;
-    virPCIDevicePtr *best = data;
-    int ret = 0;
-    int fd;
-
-    if (dev->domain != check->domain)
-        return 0;
+    unsigned long long now, deadline;
+    unsigned int delay = PCI_RESET_POLL_MIN_MS;
+    unsigned int polls = 0;
 
-    if ((fd = virPCIDeviceConfigOpen(check, false)) < 0)
-        return 0;
+    if (settle_ms)
+        usleep(settle_ms * 1000);
 
-    /* Is it a bridge? */
-    ret = virPCIDeviceReadClass(check, &device_class);
-    if (ret < 0 || device_class != PCI_CLASS_BRIDGE_PCI)
-        goto cleanup;
-
-    /* Is it a plane? */
-    header_type = virPCIDeviceRead8(check, fd, PCI_HEADER_TYPE);
-    if ((header_type & PCI_HEADER_TYPE_MASK) != PCI_HEADER_TYPE_BRIDGE)
-        goto cleanup;
-
-    secondary   = virPCIDeviceRead8(check, fd, PCI_SECONDARY_BUS);
-    subordinate = virPCIDeviceRead8(check, fd, PCI_SUBORDINATE_BUS);
-
-    VIR_DEBUG("%s %s: found parent device %s", dev->id, dev->name, check->name);
-
-    /* if the secondary bus exactly equals the device's bus, then we found
-     * the direct parent.  No further work is necessary
-     */
-    if (dev->bus == secondary) {
-        ret = 1;
-        goto cleanup;
-    }
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+    deadline = now + PCI_RESET_READY_TIMEOUT_MS;
 
-    /* otherwise, SRIOV allows VFs to be on different buses than their PFs.
-     * In this case, what we need to do is look for the "best" match; i.e.
-     * the most restrictive match that still satisfies all of the conditions.
-     */
-    if (dev->bus > secondary && dev->bus <= subordinate) {
-        if (*best == NULL) {
-            *best = virPCIDeviceNew(check->domain, check->bus, check->slot,
-                                    check->function);
-            if (*best == NULL) {
-                ret = -1;
-                goto cleanup;
-            }
-        } else {
-            /* OK, we had already recorded a previous "best" match for the
-             * parent.  See if the current device is more restrictive than the
-             * best, and if so, make it the new best
-             */
-            int bestfd;
-            uint8_t best_secondary;
-
-            if ((bestfd = virPCIDeviceConfigOpen(*best, false)) < 0)
-                goto cleanup;
-            best_secondary = virPCIDeviceRead8(*best, bestfd, PCI_SECONDARY_BUS);
-            virPCIDeviceConfigClose(*best, bestfd);
-
-            if (secondary > best_secondary) {
-                virPCIDeviceFree(*best);
-                *best = virPCIDeviceNew(check->domain, check->bus, check->slot,
-                                        check->function);
-                if (*best == NULL) {
-                    ret = -1;
-                    goto cleanup;
-                }
-            }
+    while (!ready(dev, cfgfd)) {
+        if (virTimeMillisNow(&now) < 0)
+            return -1;
+        if (now >= deadline) {
+            VIR_DEBUG("%s %s: not ready %ums after reset",
+                      dev->id, dev->name,
+                      settle_ms + PCI_RESET_READY_TIMEOUT_MS);
+            return -1;
         }
-    }
 
- cleanup:
-    virPCIDeviceConfigClose(check, fd);
-    return ret;
-}
-
-static int
-virPCIDeviceGetParent(virPCIDevicePtr dev, virPCIDevicePtr *parent)
-{
-    virPCIDevicePtr best = NULL;
-    int ret;
+        usleep(delay * 1000);
+        polls++;
+        delay = MIN(delay * 2, PCI_RESET_POLL_MAX_MS);
+    }
 
-    *parent = NULL;
-    ret = virPCIDeviceIterDevices(virPCIDeviceIsParent, dev, parent, &best);
-    if (ret == 1)
-        virPCIDeviceFree(best);
-    else if (ret == 0)
-        *parent = best;
-    return ret;
+    VIR_DEBUG("%s %s: ready after %ums settle and %u polls",
+              dev->id, dev->name, settle_ms, polls);
+    return 0;
 }
 
 /* Secondary Bus Reset is our sledgehammer - it resets all
@@ -829,19 +1151,23 @@ virPCIDeviceTrySecondaryBusReset(virPCIDevicePtr dev,
         goto out;
     }
 
-    /* Read the control register, set the reset flag, wait 200ms,
-     * unset the reset flag and wait 200ms.
+    /* Read the control register, set the reset flag, hold it for the
+     * minimum reset time, unset the reset flag and wait for the device
+     * to answer configuration requests again.
      */
     ctl = virPCIDeviceRead16(dev, cfgfd, PCI_BRIDGE_CONTROL);
 
     virPCIDeviceWrite16(parent, parentfd, PCI_BRIDGE_CONTROL,
                         ctl | PCI_BRIDGE_CTL_RESET);
 
-    usleep(200 * 1000); /* sleep 200ms */
+    usleep(PCI_RESET_BUS_HOLD_MS * 1000);
 
     virPCIDeviceWrite16(parent, parentfd, PCI_BRIDGE_CONTROL, ctl);
 
-    usleep(200 * 1000); /* sleep 200ms */
+    if (virPCIDeviceWaitReady(dev, cfgfd, PCI_RESET_BUS_SETTLE_MS,
+                              virPCIDeviceConfigIsReady) < 0)
+        VIR_WARN("%s %s: device did not come back after bus reset",
+                 dev->id, dev->name);
 
     if (virPCIDeviceWrite(dev, cfgfd, 0, config_space, PCI_CONF_LEN) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -886,12 +1212,15 @@ virPCIDeviceTryPowerManagementReset(virPCIDevicePtr dev, int cfgfd)
     virPCIDeviceWrite32(dev, cfgfd, dev->pci_pm_cap_pos + PCI_PM_CTRL,
                         ctl | PCI_PM_CTRL_STATE_D3hot);
 
-    usleep(10 * 1000); /* sleep 10ms */
+    usleep(PCI_RESET_PM_SETTLE_MS * 1000);
 
     virPCIDeviceWrite32(dev, cfgfd, dev->pci_pm_cap_pos + PCI_PM_CTRL,
                         ctl | PCI_PM_CTRL_STATE_D0);
 
-    usleep(10 * 1000); /* sleep 10ms */
+    if (virPCIDeviceWaitReady(dev, cfgfd, PCI_RESET_PM_SETTLE_MS,
+                              virPCIDevicePowerStateIsD0) < 0)
+        VIR_WARN("%s %s: device did not return to D0 after PM reset",
+                 dev->id, dev->name);
 
     if (virPCIDeviceWrite(dev, cfgfd, 0, &config_space[0], PCI_CONF_LEN) < 0) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -919,15 +1248,22 @@ virPCIDeviceInit(virPCIDevicePtr dev, int cfgfd)
     return 0;
 }
 
-int
-virPCIDeviceReset(virPCIDevicePtr dev,
-                  virPCIDeviceList *activeDevs,
-                  virPCIDeviceList *inactiveDevs)
+/* Checks whether @dev needs to be reset by us at all and, if so,
+ * opens its config space into @cfgfd and probes its reset
+ * capabilities.
+ *
+ * Returns 1 if a reset has to be done, 0 if not and -1 on error.
+ */
+static int
+virPCIDeviceResetPrepare(virPCIDevicePtr dev,
+                         virPCIDeviceList *activeDevs,
+                         int *cfgfd)
 {
     char *drvPath = NULL;
     char *drvName = NULL;
     int ret = -1;
-    int fd = -1;
+
+    *cfgfd = -1;
 
     if (activeDevs && virPCIDeviceListFind(activeDevs, dev)) {
         virReportError(VIR_ERR_INTERNAL_ERROR,
@@ -951,10 +1287,10 @@ virPCIDeviceReset(virPCIDevicePtr dev,
     }
     VIR_DEBUG("Resetting device %s", dev->name);
 
-    if ((fd = virPCIDeviceConfigOpen(dev, true)) < 0)
+    if ((*cfgfd = virPCIDeviceConfigOpen(dev, true)) < 0)
         goto cleanup;
 
-    if (virPCIDeviceInit(dev, fd) < 0)
+    if (virPCIDeviceInit(dev, *cfgfd) < 0)
         goto cleanup;
 
     /* KVM will perform FLR when starting and stopping
@@ -965,16 +1301,32 @@ virPCIDeviceReset(virPCIDevicePtr dev,
         goto cleanup;
     }
 
-    /* If the device supports PCI power management reset,
-     * that's the next best thing because it only resets
-     * the function, not the whole device.
-     */
-    if (dev->has_pm_reset)
-        ret = virPCIDeviceTryPowerManagementReset(dev, fd);
+    ret = 1;
+
+ cleanup:
+    VIR_FREE(drvPath);
+    VIR_FREE(drvName);
+    if (ret <= 0 && *cfgfd >= 0) {
+        virPCIDeviceConfigClose(dev, *cfgfd);
+        *cfgfd = -1;
+    }
+    return ret;
+}
+
+/* Last resort once the function level resets have failed or are
+ * not available: reset the whole bus, and report why we could not
+ * reset @dev if even that is not possible.
+ */
+static int
+virPCIDeviceResetFallback(virPCIDevicePtr dev,
+                          int cfgfd,
+                          virPCIDeviceList *inactiveDevs)
+{
+    int ret = -1;
 
     /* Bus reset is not an option with the root bus */
-    if (ret < 0 && dev->bus != 0)
-        ret = virPCIDeviceTrySecondaryBusReset(dev, fd, inactiveDevs);
+    if (dev->bus != 0)
+        ret = virPCIDeviceTrySecondaryBusReset(dev, cfgfd, inactiveDevs);
 
     if (ret < 0) {
         virErrorPtr err = virGetLastError();
@@ -985,14 +1337,185 @@ virPCIDeviceReset(virPCIDevicePtr dev,
                        _("no FLR, PM reset or bus reset available"));
     }
 
- cleanup:
-    VIR_FREE(drvPath);
-    VIR_FREE(drvName);
+    return ret;
+}
+
+int
+virPCIDeviceReset(virPCIDevicePtr dev,
+                  virPCIDeviceList *activeDevs,
+                  virPCIDeviceList *inactiveDevs)
+{
+    int ret = -1;
+    int fd = -1;
+    int rc;
+
+    if ((rc = virPCIDeviceResetPrepare(dev, activeDevs, &fd)) <= 0)
+        return rc;
+
+    /* If the device supports PCI power management reset,
+     * that's the next best thing because it only resets
+     * the function, not the whole device.
+     */
+    if (dev->has_pm_reset)
+        ret = virPCIDeviceTryPowerManagementReset(dev, fd);
+
+    if (ret < 0)
+        ret = virPCIDeviceResetFallback(dev, fd, inactiveDevs);
+
     virPCIDeviceConfigClose(dev, fd);
     return ret;
 }
 
 
+typedef struct _virPCIDeviceResetJob virPCIDeviceResetJob;
+typedef virPCIDeviceResetJob *virPCIDeviceResetJobPtr;
+struct _virPCIDeviceResetJob {
+    virPCIDevicePtr dev;
+    int cfgfd;
+    bool needed;
+    bool threaded;
+    virThread thread;
+    int ret;
+    virErrorPtr err;
+};
+
+static void
+virPCIDeviceResetJobRun(void *opaque)
+{
+    virPCIDeviceResetJobPtr job = opaque;
+
+    job->ret = virPCIDeviceTryPowerManagementReset(job->dev, job->cfgfd);
+    if (job->ret < 0)
+        job->err = virSaveLastError();
+}
+
+static void
+virPCIDeviceListResetFailed(virPCIDevicePtr dev, size_t *nfailed)
+{
+    virErrorPtr err = virGetLastError();
+
+    VIR_ERROR(_("Failed to reset PCI device %s: %s"),
+              dev->name, err ? err->message : _("unknown error"));
+    virResetLastError();
+    (*nfailed)++;
+}
+
+/* virPCIDeviceListReset:
+ * @list: devices to reset
+ * @activeDevs: devices in use by the host or other guests
+ * @inactiveDevs: devices about to be assigned to a guest
+ * @keepGoing: whether to carry on after a device fails to reset
+ *
+ * Reset all devices in @list, equivalent to calling virPCIDeviceReset
+ * on each of them in turn.  Power management resets only affect the
+ * function being reset, so they are issued from one thread per device
+ * and waited for concurrently.  Devices falling back to a secondary bus
+ * reset are then handled one at a time as such a reset affects every
+ * device behind the same bridge.
+ *
+ * Without @keepGoing the first failure stops the reset of the
+ * remaining devices. With it, every device is attempted and each
+ * failure is logged.
+ *
+ * Returns 0 on success, -1 if any device could not be reset.
+ */
+int
+virPCIDeviceListReset(virPCIDeviceListPtr list,
+                      virPCIDeviceListPtr activeDevs,
+                      virPCIDeviceListPtr inactiveDevs,
+                      bool keepGoing)
+{
+    virPCIDeviceResetJobPtr jobs = NULL;
+    size_t njobs = list->count;
+    size_t nfailed = 0;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(jobs, njobs) < 0)
+        return -1;
+
+    for (i = 0; i < njobs; i++) {
+        jobs[i].dev = list->devs[i];
+        jobs[i].cfgfd = -1;
+        jobs[i].ret = -1;
+    }
+
+    for (i = 0; i < njobs; i++) {
+        virPCIDeviceResetJobPtr job = &jobs[i];
+        int rc;
+
+        if ((rc = virPCIDeviceResetPrepare(job->dev, activeDevs,
+                                           &job->cfgfd)) < 0) {
+            if (!keepGoing)
+                goto cleanup;
+            virPCIDeviceListResetFailed(job->dev, &nfailed);
+            continue;
+        }
+        if (rc == 0)
+            continue;
+
+        job->needed = true;
+        if (!job->dev->has_pm_reset)
+            continue;
+
+        if (virThreadCreate(&job->thread, true,
+                            virPCIDeviceResetJobRun, job) < 0) {
+            VIR_DEBUG("%s %s: unable to spawn reset thread, "
+                      "resetting inline", job->dev->id, job->dev->name);
+            virPCIDeviceResetJobRun(job);
+        } else {
+            job->threaded = true;
+        }
+    }
+
+    for (i = 0; i < njobs; i++) {
+        if (jobs[i].threaded) {
+            virThreadJoin(&jobs[i].thread);
+            jobs[i].threaded = false;
+        }
+    }
+
+    for (i = 0; i < njobs; i++) {
+        virPCIDeviceResetJobPtr job = &jobs[i];
+
+        if (!job->needed || job->ret == 0)
+            continue;
+
+        if (job->err)
+            virSetError(job->err);
+        else
+            virResetLastError();
+
+        if (virPCIDeviceResetFallback(job->dev, job->cfgfd,
+                                      inactiveDevs) < 0) {
+            if (!keepGoing)
+                goto cleanup;
+            virPCIDeviceListResetFailed(job->dev, &nfailed);
+        }
+    }
+
+    if (nfailed) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("Failed to reset %zu of %zu PCI devices"),
+                       nfailed, njobs);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+ cleanup:
+    for (i = 0; i < njobs; i++) {
+        if (jobs[i].threaded)
+            virThreadJoin(&jobs[i].thread);
+        if (jobs[i].cfgfd >= 0)
+            virPCIDeviceConfigClose(jobs[i].dev, jobs[i].cfgfd);
+        virFreeError(jobs[i].err);
+    }
+    VIR_FREE(jobs);
+    return ret;
+}
+
+
 static int
 virPCIProbeStubDriver(const char *driver)
 {
@@ -1423,8 +1946,9 @@ virPCIDeviceReattach(virPCIDevicePtr dev,
 int
 virPCIDeviceWaitForCleanup(virPCIDevicePtr dev, const char *matcher)
 {
-    FILE *fp;
-    char line[160];
+    char *buf = NULL;
+    char *line;
+    char *next;
     char *tmp;
     unsigned long long start, end;
     unsigned int domain, bus, slot, function;
@@ -1432,20 +1956,33 @@ virPCIDeviceWaitForCleanup(virPCIDevicePtr dev, const char *matcher)
     int ret;
     size_t match_depth;
 
-    fp = fopen("/proc/iomem", "r");
-    if (!fp) {
-        /* If we failed to open iomem, we just basically ignore the error.  The
+    if (virFileReadAll("/proc/iomem", 1024 * 1024, &buf) < 0) {
+        /* If we failed to read iomem, we just basically ignore the error.  The
          * unbind might succeed anyway, and besides, it's very likely we have
          * no way to report the error
          */
-        VIR_DEBUG("Failed to open /proc/iomem, trying to continue anyway");
+        virResetLastError();
+        VIR_DEBUG("Failed to read /proc/iomem, trying to continue anyway");
+        return 0;
+    }
+
+    /* In the common case nobody holds any region tagged with @matcher,
+     * or the device has no region at all, and there is nothing to parse.
+     */
+    if (!strstr(buf, matcher) || !strstr(buf, dev->name)) {
+        VIR_FREE(buf);
         return 0;
     }
 
     ret = 0;
     in_matching_device = false;
     match_depth = 0;
-    while (fgets(line, sizeof(line), fp) != 0) {
+    for (line = buf; *line; line = next) {
+        if ((next = strchr(line, '\n')))
+            *next++ = '\0';
+        else
+            next = line + strlen(line);
+
         /* the logic here is a bit confusing.  For each line, we look to
          * see if it matches the domain:bus:slot.function we were given.
          * If this line matches the DBSF, then any subsequent lines indented
@@ -1484,7 +2021,7 @@ virPCIDeviceWaitForCleanup(virPCIDevicePtr dev, const char *matcher)
                 /* slot */
                 virStrToLong_ui(tmp + 1, &tmp, 16, &slot) < 0 || *tmp != '.' ||
                 /* function */
-                virStrToLong_ui(tmp + 1, &tmp, 16, &function) < 0 || *tmp != '\n')
+                virStrToLong_ui(tmp + 1, &tmp, 16, &function) < 0 || *tmp != '\0')
                 continue;
 
             if (domain != dev->domain || bus != dev->bus || slot != dev->slot ||
@@ -1495,7 +2032,7 @@ virPCIDeviceWaitForCleanup(virPCIDevicePtr dev, const char *matcher)
         }
     }
 
-    VIR_FORCE_FCLOSE(fp);
+    VIR_FREE(buf);
 
     return ret;
 }
@@ -1770,6 +2307,11 @@ virPCIDeviceListNew(void)
     if (!(list = virObjectLockableNew(virPCIDeviceListClass)))
         return NULL;
 
+    if (!(list->index = virHashCreate(32, NULL))) {
+        virObjectUnref(list);
+        return NULL;
+    }
+
     return list;
 }
 
@@ -1786,6 +2328,7 @@ virPCIDeviceListDispose(void *obj)
 
     list->count = 0;
     VIR_FREE(list->devs);
+    virHashFree(list->index);
 }
 
 int
@@ -1797,7 +2340,13 @@ virPCIDeviceListAdd(virPCIDeviceListPtr list,
                        _("Device %s is already in use"), dev->name);
         return -1;
     }
-    return VIR_APPEND_ELEMENT(list->devs, list->count, dev);
+    if (virHashAddEntry(list->index, dev->name, dev) < 0)
+        return -1;
+    if (VIR_APPEND_ELEMENT(list->devs, list->count, dev) < 0) {
+        virHashSteal(list->index, dev->name);
+        return -1;
+    }
+    return 0;
 }
 
 
@@ -1846,6 +2395,7 @@ virPCIDeviceListStealIndex(virPCIDeviceListPtr list,
 
     ret = list->devs[idx];
     VIR_DELETE_ELEMENT(list->devs, idx, list->count);
+    virHashSteal(list->index, ret->name);
     return ret;
 }
 
@@ -1867,13 +2417,14 @@ virPCIDeviceListDel(virPCIDeviceListPtr list,
 int
 virPCIDeviceListFindIndex(virPCIDeviceListPtr list, virPCIDevicePtr dev)
 {
+    virPCIDevicePtr found;
     size_t i;
 
+    if (!(found = virHashLookup(list->index, dev->name)))
+        return -1;
+
     for (i = 0; i < list->count; i++)
-        if (list->devs[i]->domain   == dev->domain &&
-            list->devs[i]->bus      == dev->bus    &&
-            list->devs[i]->slot     == dev->slot   &&
-            list->devs[i]->function == dev->function)
+        if (list->devs[i] == found)
             return i;
     return -1;
 }
@@ -1886,28 +2437,20 @@ virPCIDeviceListFindByIDs(virPCIDeviceListPtr list,
                           unsigned int slot,
                           unsigned int function)
 {
-    size_t i;
+    char name[PCI_ADDR_LEN];
 
-    for (i = 0; i < list->count; i++) {
-        if (list->devs[i]->domain == domain &&
-            list->devs[i]->bus == bus &&
-            list->devs[i]->slot == slot &&
-            list->devs[i]->function == function)
-            return list->devs[i];
-    }
-    return NULL;
+    if (snprintf(name, sizeof(name), "%.4x:%.2x:%.2x.%.1x",
+                 domain, bus, slot, function) >= sizeof(name))
+        return NULL;
+
+    return virHashLookup(list->index, name);
 }
 
 
 virPCIDevicePtr
 virPCIDeviceListFind(virPCIDeviceListPtr list, virPCIDevicePtr dev)
 {
-    int idx;
-
-    if ((idx = virPCIDeviceListFindIndex(list, dev)) >= 0)
-        return list->devs[idx];
-    else
-        return NULL;
+    return virHashLookup(list->index, dev->name);
 }
 
 
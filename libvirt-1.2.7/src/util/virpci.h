@@ -86,6 +86,10 @@ int virPCIDeviceReattach(virPCIDevicePtr dev,
 int virPCIDeviceReset(virPCIDevicePtr dev,
                       virPCIDeviceListPtr activeDevs,
                       virPCIDeviceListPtr inactiveDevs);
+int virPCIDeviceListReset(virPCIDeviceListPtr list,
+                          virPCIDeviceListPtr activeDevs,
+                          virPCIDeviceListPtr inactiveDevs,
+                          bool keepGoing);
 
 void virPCIDeviceSetManaged(virPCIDevice *dev,
                             bool managed);
@@ -165,6 +169,8 @@ int virPCIDeviceIsAssignable(virPCIDevicePtr dev,
                              int strict_acs_check);
 int virPCIDeviceWaitForCleanup(virPCIDevicePtr dev, const char *matcher);
 
+void virPCITopologyInvalidate(void);
+
 int virPCIGetPhysicalFunction(const char *sysfs_path,
                               virPCIDeviceAddressPtr *phys_fn);
 
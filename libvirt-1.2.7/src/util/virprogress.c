@@ -0,0 +1,288 @@
+/*
+ * virprogress.c: progress tracking for long running I/O operations
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <config.h>
+
+#include "virprogress.h"
+#include "virerror.h"
+#include "virstring.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+/* Throughput is sampled at most this often (in microseconds) and
+ * smoothed with an exponentially weighted moving average, so that a
+ * single stalled write does not make the estimate jump around */
+#define VIR_PROGRESS_SAMPLE_INTERVAL (500 * 1000)
+#define VIR_PROGRESS_RATE_WEIGHT 4
+
+
+static unsigned long long virProgressNow(void)
+{
+    unsigned long long now;
+
+    if (virTimeMonotonicMicrosNowRaw(&now) < 0)
+        return 0;
+    return now;
+}
+
+
+/**
+ * virProgressInit:
+ * @progress: the progress object
+ * @total: number of bytes the operation is expected to process,
+ *         or 0 if unknown
+ *
+ * Reset @progress and start measuring time from now.
+ */
+void virProgressInit(virProgressPtr progress,
+                     unsigned long long total)
+{
+    memset(progress, 0, sizeof(*progress));
+    progress->total = total;
+    progress->start = progress->sampleTime = virProgressNow();
+}
+
+
+/**
+ * virProgressUpdate:
+ * @progress: the progress object
+ * @processed: total number of bytes processed so far
+ *
+ * Record the absolute amount of data processed, refreshing
+ * the throughput estimate if the sampling interval elapsed.
+ */
+void virProgressUpdate(virProgressPtr progress,
+                       unsigned long long processed)
+{
+    unsigned long long now = virProgressNow();
+    unsigned long long delta;
+    unsigned long long rate;
+
+    if (!progress->start)
+        progress->start = progress->sampleTime = now;
+
+    progress->processed = processed;
+
+    if (now < progress->sampleTime + VIR_PROGRESS_SAMPLE_INTERVAL ||
+        processed < progress->sampleBytes)
+        return;
+
+    delta = now - progress->sampleTime;
+    rate = (processed - progress->sampleBytes) * 1000000ull / delta;
+
+    if (progress->rate)
+        progress->rate = (progress->rate * (VIR_PROGRESS_RATE_WEIGHT - 1) +
+                          rate) / VIR_PROGRESS_RATE_WEIGHT;
+    else
+        progress->rate = rate;
+
+    progress->sampleTime = now;
+    progress->sampleBytes = processed;
+}
+
+
+/**
+ * virProgressAdd:
+ * @progress: the progress object
+ * @bytes: number of bytes processed since the last update
+ *
+ * Relative variant of virProgressUpdate.
+ */
+void virProgressAdd(virProgressPtr progress,
+                    unsigned long long bytes)
+{
+    virProgressUpdate(progress, progress->processed + bytes);
+}
+
+
+/**
+ * virProgressAddBlocked:
+ * @progress: the progress object
+ * @input: true if the time was spent waiting for data to process,
+ *         false if waiting for the destination to accept it
+ * @usecs: time blocked, in microseconds
+ *
+ * Account time the operation spent blocked in I/O, which tells
+ * apart a slow source from a slow destination.
+ */
+void virProgressAddBlocked(virProgressPtr progress,
+                           bool input,
+                           unsigned long long usecs)
+{
+    if (input)
+        progress->blockedIn += usecs;
+    else
+        progress->blockedOut += usecs;
+}
+
+
+/**
+ * virProgressGetRate:
+ * @progress: the progress object
+ *
+ * Returns the current throughput in bytes per second. Until the
+ * first sample is taken, this is the average since the start.
+ */
+unsigned long long virProgressGetRate(virProgressPtr progress)
+{
+    unsigned long long now;
+
+    if (progress->rate)
+        return progress->rate;
+
+    now = virProgressNow();
+    if (!progress->start || now <= progress->start)
+        return 0;
+
+    return progress->processed * 1000000ull / (now - progress->start);
+}
+
+
+/**
+ * virProgressGetTimeElapsed:
+ * @progress: the progress object
+ *
+ * Returns the time since the tracking started, in milliseconds.
+ */
+unsigned long long virProgressGetTimeElapsed(virProgressPtr progress)
+{
+    unsigned long long now = virProgressNow();
+
+    if (!progress->start || now <= progress->start)
+        return 0;
+
+    return (now - progress->start) / 1000;
+}
+
+
+/**
+ * virProgressGetTimeRemaining:
+ * @progress: the progress object
+ *
+ * Returns the estimated time needed to process the rest of the
+ * data at the current throughput, in milliseconds, or 0 if the
+ * total size or the throughput is not known.
+ */
+unsigned long long virProgressGetTimeRemaining(virProgressPtr progress)
+{
+    unsigned long long rate = virProgressGetRate(progress);
+
+    if (!rate || progress->processed >= progress->total)
+        return 0;
+
+    return (progress->total - progress->processed) * 1000ull / rate;
+}
+
+
+/**
+ * virProgressAddParams:
+ * @progress: the progress object
+ * @params: array of typed parameters to extend
+ * @nparams: number of parameters in @params
+ * @maxparams: allocated size of @params
+ *
+ * Append the throughput, estimated time remaining and time blocked
+ * on input and output (both in milliseconds) to @params.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int virProgressAddParams(virProgressPtr progress,
+                         virTypedParameterPtr *params,
+                         int *nparams,
+                         int *maxparams)
+{
+    if (virTypedParamsAddULLong(params, nparams, maxparams,
+                                VIR_PROGRESS_PARAM_DATA_BPS,
+                                virProgressGetRate(progress)) < 0)
+        return -1;
+
+    if (progress->total &&
+        virTypedParamsAddULLong(params, nparams, maxparams,
+                                VIR_PROGRESS_PARAM_TIME_ESTIMATE,
+                                virProgressGetTimeRemaining(progress)) < 0)
+        return -1;
+
+    if (virTypedParamsAddULLong(params, nparams, maxparams,
+                                VIR_PROGRESS_PARAM_TIME_BLOCKED_INPUT,
+                                progress->blockedIn / 1000) < 0 ||
+        virTypedParamsAddULLong(params, nparams, maxparams,
+                                VIR_PROGRESS_PARAM_TIME_BLOCKED_OUTPUT,
+                                progress->blockedOut / 1000) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+/**
+ * virProgressFormat:
+ * @progress: the progress object
+ *
+ * Serialize the counters of @progress into a single line of text,
+ * suitable for passing progress from a helper process to libvirtd.
+ *
+ * Returns a newly allocated string or NULL on error.
+ */
+char *virProgressFormat(virProgressPtr progress)
+{
+    char *ret;
+
+    ignore_value(virAsprintf(&ret, "%llu %llu %llu %llu\n",
+                             progress->processed, progress->total,
+                             progress->blockedIn, progress->blockedOut));
+    return ret;
+}
+
+
+/**
+ * virProgressParse:
+ * @str: line produced by virProgressFormat
+ * @progress: the progress object to update
+ *
+ * Update @progress with the counters serialized in @str. The
+ * throughput is measured locally from the successive updates.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int virProgressParse(const char *str,
+                     virProgressPtr progress)
+{
+    unsigned long long processed, total, blockedIn, blockedOut;
+    char *end;
+
+    if (virStrToLong_ull(str, &end, 10, &processed) < 0 ||
+        virStrToLong_ull(end, &end, 10, &total) < 0 ||
+        virStrToLong_ull(end, &end, 10, &blockedIn) < 0 ||
+        virStrToLong_ull(end, &end, 10, &blockedOut) < 0 ||
+        (*end && *end != '\n')) {
+        virReportError(VIR_ERR_INTERNAL_ERROR,
+                       _("malformed progress data '%s'"), str);
+        return -1;
+    }
+
+    virProgressUpdate(progress, processed);
+    progress->total = total;
+    progress->blockedIn = blockedIn;
+    progress->blockedOut = blockedOut;
+
+    return 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * virprogress.h: progress tracking for long running I/O operations
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __VIR_PROGRESS_H__
+# define __VIR_PROGRESS_H__
+
+# include "internal.h"
+
+/* Typed parameter fields reported in addition to the generic
+ * VIR_DOMAIN_JOB_* ones by jobs which track their own I/O */
+# define VIR_PROGRESS_PARAM_DATA_BPS             "data_bps"
+# define VIR_PROGRESS_PARAM_TIME_ESTIMATE        "time_remaining_estimate"
+# define VIR_PROGRESS_PARAM_TIME_BLOCKED_INPUT   "time_blocked_input"
+# define VIR_PROGRESS_PARAM_TIME_BLOCKED_OUTPUT  "time_blocked_output"
+
+typedef struct _virProgress virProgress;
+typedef virProgress *virProgressPtr;
+
+/* All times are in microseconds of the monotonic clock. The
+ * object does no locking of its own, callers must serialize
+ * access to it like they do for the rest of the job state. */
+struct _virProgress {
+    unsigned long long start;       /* when tracking started */
+    unsigned long long total;       /* expected bytes, 0 if unknown */
+    unsigned long long processed;   /* bytes processed so far */
+    unsigned long long blockedIn;   /* time spent waiting for input */
+    unsigned long long blockedOut;  /* time spent waiting for output */
+
+    unsigned long long sampleTime;  /* when @rate was last updated */
+    unsigned long long sampleBytes; /* @processed at @sampleTime */
+    unsigned long long rate;        /* smoothed throughput, bytes/s */
+};
+
+void virProgressInit(virProgressPtr progress,
+                     unsigned long long total);
+
+void virProgressUpdate(virProgressPtr progress,
+                       unsigned long long processed);
+void virProgressAdd(virProgressPtr progress,
+                    unsigned long long bytes);
+void virProgressAddBlocked(virProgressPtr progress,
+                           bool input,
+                           unsigned long long usecs);
+
+unsigned long long virProgressGetRate(virProgressPtr progress);
+unsigned long long virProgressGetTimeElapsed(virProgressPtr progress);
+unsigned long long virProgressGetTimeRemaining(virProgressPtr progress);
+
+int virProgressAddParams(virProgressPtr progress,
+                         virTypedParameterPtr *params,
+                         int *nparams,
+                         int *maxparams);
+
+char *virProgressFormat(virProgressPtr progress);
+int virProgressParse(const char *str,
+                     virProgressPtr progress);
+
+#endif /* __VIR_PROGRESS_H__ */
@@ -38,6 +38,7 @@
 #include "virscsi.h"
 #include "viralloc.h"
 #include "virfile.h"
+#include "virhash.h"
 #include "virutil.h"
 #include "virstring.h"
 #include "virerror.h"
@@ -72,6 +73,7 @@ struct _virSCSIDeviceList {
     virObjectLockable parent;
     size_t count;
     virSCSIDevicePtr *devs;
+    virHashTablePtr index; /* dev->name -> dev, not owning */
 };
 
 static virClassPtr virSCSIDeviceListClass;
@@ -384,6 +386,11 @@ virSCSIDeviceListNew(void)
     if (!(list = virObjectLockableNew(virSCSIDeviceListClass)))
         return NULL;
 
+    if (!(list->index = virHashCreate(32, NULL))) {
+        virObjectUnref(list);
+        return NULL;
+    }
+
     return list;
 }
 
@@ -397,6 +404,7 @@ virSCSIDeviceListDispose(void *obj)
         virSCSIDeviceFree(list->devs[i]);
 
     VIR_FREE(list->devs);
+    virHashFree(list->index);
 }
 
 int
@@ -410,7 +418,13 @@ virSCSIDeviceListAdd(virSCSIDeviceListPtr list,
         return -1;
     }
 
-    return VIR_APPEND_ELEMENT(list->devs, list->count, dev);
+    if (virHashAddEntry(list->index, dev->name, dev) < 0)
+        return -1;
+    if (VIR_APPEND_ELEMENT(list->devs, list->count, dev) < 0) {
+        virHashSteal(list->index, dev->name);
+        return -1;
+    }
+    return 0;
 }
 
 virSCSIDevicePtr
@@ -432,19 +446,19 @@ virSCSIDevicePtr
 virSCSIDeviceListSteal(virSCSIDeviceListPtr list,
                        virSCSIDevicePtr dev)
 {
-    virSCSIDevicePtr ret = NULL;
+    virSCSIDevicePtr ret;
     size_t i;
 
+    if (!(ret = virHashLookup(list->index, dev->name)))
+        return NULL;
+
     for (i = 0; i < list->count; i++) {
-        if (list->devs[i]->adapter == dev->adapter &&
-            list->devs[i]->bus == dev->bus &&
-            list->devs[i]->target == dev->target &&
-            list->devs[i]->unit == dev->unit) {
-            ret = list->devs[i];
+        if (list->devs[i] == ret) {
             VIR_DELETE_ELEMENT(list->devs, i, list->count);
             break;
         }
     }
+    virHashSteal(list->index, ret->name);
 
     return ret;
 }
@@ -477,15 +491,5 @@ virSCSIDevicePtr
 virSCSIDeviceListFind(virSCSIDeviceListPtr list,
                       virSCSIDevicePtr dev)
 {
-    size_t i;
-
-    for (i = 0; i < list->count; i++) {
-        if (list->devs[i]->adapter == dev->adapter &&
-            list->devs[i]->bus == dev->bus &&
-            list->devs[i]->target == dev->target &&
-            list->devs[i]->unit == dev->unit)
-            return list->devs[i];
-    }
-
-    return NULL;
+    return virHashLookup(list->index, dev->name);
 }
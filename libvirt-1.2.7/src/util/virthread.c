@@ -63,6 +63,28 @@ int virMutexInit(virMutexPtr m)
     return 0;
 }
 
+/* A mutex which briefly spins before sleeping when contended,
+ * cheaper than a plain one for short critical sections. Falls
+ * back to a normal mutex where the type is not available. */
+int virMutexInitAdaptive(virMutexPtr m)
+{
+    int ret;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+#ifdef PTHREAD_ADAPTIVE_MUTEX_INITIALIZER_NP
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ADAPTIVE_NP);
+#else
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_NORMAL);
+#endif
+    ret = pthread_mutex_init(&m->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (ret != 0) {
+        errno = ret;
+        return -1;
+    }
+    return 0;
+}
+
 int virMutexInitRecursive(virMutexPtr m)
 {
     int ret;
@@ -88,6 +110,19 @@ void virMutexLock(virMutexPtr m)
     pthread_mutex_lock(&m->lock);
 }
 
+/* Returns 0 if the mutex was acquired, -1 with errno set
+ * to EBUSY if it is held by another thread */
+int virMutexTryLock(virMutexPtr m)
+{
+    int ret;
+
+    if ((ret = pthread_mutex_trylock(&m->lock)) != 0) {
+        errno = ret;
+        return -1;
+    }
+    return 0;
+}
+
 void virMutexUnlock(virMutexPtr m)
 {
     pthread_mutex_unlock(&m->lock);
@@ -124,9 +124,11 @@ int virOnce(virOnceControlPtr once, virOnceFunc init)
 
 int virMutexInit(virMutexPtr m) ATTRIBUTE_RETURN_CHECK;
 int virMutexInitRecursive(virMutexPtr m) ATTRIBUTE_RETURN_CHECK;
+int virMutexInitAdaptive(virMutexPtr m) ATTRIBUTE_RETURN_CHECK;
 void virMutexDestroy(virMutexPtr m);
 
 void virMutexLock(virMutexPtr m);
+int virMutexTryLock(virMutexPtr m) ATTRIBUTE_RETURN_CHECK;
 void virMutexUnlock(virMutexPtr m);
 
 
@@ -27,6 +27,8 @@
 #include "viralloc.h"
 #include "virutil.h"
 #include "virerror.h"
+#include "virhashcode.h"
+#include "virrandom.h"
 #include "virstring.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
@@ -176,23 +178,14 @@ virTypedParameterToString(virTypedParameterPtr param)
     return value;
 }
 
-/* Assign name, type, and the appropriately typed arg to param; in the
- * case of a string, the caller is assumed to have malloc'd a string,
- * or can pass NULL to have this function malloc an empty string.
- * Return 0 on success, -1 after an error message on failure.  */
-int
-virTypedParameterAssign(virTypedParameterPtr param, const char *name,
-                        int type, ...)
+static int
+virTypedParameterAssignArgs(virTypedParameterPtr param, const char *name,
+                            int type, va_list ap, bool copystr)
 {
-    va_list ap;
-    int ret = -1;
-
-    va_start(ap, type);
-
     if (virStrcpyStatic(param->field, name) == NULL) {
         virReportError(VIR_ERR_INTERNAL_ERROR, _("Field name '%s' too long"),
                        name);
-        goto cleanup;
+        return -1;
     }
     param->type = type;
     switch (type)
@@ -216,18 +209,37 @@ virTypedParameterAssign(virTypedParameterPtr param, const char *name,
         param->value.b = !!va_arg(ap, int);
         break;
     case VIR_TYPED_PARAM_STRING:
-        param->value.s = va_arg(ap, char *);
+        if (copystr) {
+            if (VIR_STRDUP(param->value.s, va_arg(ap, const char *)) < 0)
+                return -1;
+        } else {
+            param->value.s = va_arg(ap, char *);
+        }
         if (!param->value.s && VIR_STRDUP(param->value.s, "") < 0)
-            goto cleanup;
+            return -1;
         break;
     default:
         virReportError(VIR_ERR_INTERNAL_ERROR,
                        _("unexpected type %d for field %s"), type, name);
-        goto cleanup;
+        return -1;
     }
 
-    ret = 0;
- cleanup:
+    return 0;
+}
+
+/* Assign name, type, and the appropriately typed arg to param; in the
+ * case of a string, the caller is assumed to have malloc'd a string,
+ * or can pass NULL to have this function malloc an empty string.
+ * Return 0 on success, -1 after an error message on failure.  */
+int
+virTypedParameterAssign(virTypedParameterPtr param, const char *name,
+                        int type, ...)
+{
+    va_list ap;
+    int ret;
+
+    va_start(ap, type);
+    ret = virTypedParameterAssignArgs(param, name, type, ap, false);
     va_end(ap);
     return ret;
 }
@@ -418,6 +430,207 @@ virTypedParamsCopy(virTypedParameterPtr *dst,
 }
 
 
+/* Lists shorter than this are searched linearly */
+#define VIR_TYPED_PARAM_LIST_INDEX_MIN 16
+
+static size_t
+virTypedParamListIndexSlot(virTypedParamListPtr list, const char *name)
+{
+    return virHashCodeGen(name, strlen(name), list->seed) &
+        (list->nindex - 1);
+}
+
+static void
+virTypedParamListIndexInsert(virTypedParamListPtr list, int pos)
+{
+    size_t i = virTypedParamListIndexSlot(list, list->par[pos].field);
+
+    while (list->index[i])
+        i = (i + 1) & (list->nindex - 1);
+    list->index[i] = pos + 1;
+}
+
+/* Bring the index up to date with entries appended since the last
+ * lookup, including any added through the bare par/npar/maxpar
+ * triple. Keeps the index at most half full. Returns false if the
+ * list should be searched linearly instead. */
+static bool
+virTypedParamListIndexSync(virTypedParamListPtr list)
+{
+    if (list->npar <= VIR_TYPED_PARAM_LIST_INDEX_MIN)
+        return false;
+
+    if (list->npar * 2 > list->nindex) {
+        size_t nindex = list->nindex ? list->nindex : 64;
+
+        while (nindex < list->npar * 2)
+            nindex *= 2;
+
+        VIR_FREE(list->index);
+        if (VIR_ALLOC_N_QUIET(list->index, nindex) < 0) {
+            list->nindex = 0;
+            list->nindexed = 0;
+            return false;
+        }
+        if (!list->nindex)
+            list->seed = virRandomBits(32);
+        list->nindex = nindex;
+        list->nindexed = 0;
+    }
+
+    for (; list->nindexed < list->npar; list->nindexed++)
+        virTypedParamListIndexInsert(list, list->nindexed);
+
+    return true;
+}
+
+
+/**
+ * virTypedParamListGet:
+ * @list: list of typed parameters
+ * @name: name of the parameter to find
+ *
+ * Like virTypedParamsGet, but long lists are searched through a hash
+ * index built on first use.
+ *
+ * Returns pointer to the parameter or NULL if it does not exist.
+ */
+virTypedParameterPtr
+virTypedParamListGet(virTypedParamListPtr list,
+                     const char *name)
+{
+    size_t i;
+
+    if (!virTypedParamListIndexSync(list))
+        return virTypedParamsGet(list->par, list->npar, name);
+
+    for (i = virTypedParamListIndexSlot(list, name);
+         list->index[i];
+         i = (i + 1) & (list->nindex - 1)) {
+        virTypedParameterPtr param = list->par + list->index[i] - 1;
+
+        if (STREQ(param->field, name))
+            return param;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * virTypedParamListReserve:
+ * @list: list of typed parameters
+ * @count: number of parameters about to be added
+ *
+ * Make room for exactly @count more parameters so that adding them
+ * does not reallocate the array.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virTypedParamListReserve(virTypedParamListPtr list,
+                         size_t count)
+{
+    size_t max = list->maxpar;
+
+    if (list->npar + count <= max)
+        return 0;
+
+    if (list->npar + count > INT_MAX) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (VIR_EXPAND_N(list->par, max, list->npar + count - max) < 0)
+        return -1;
+
+    list->maxpar = max;
+    return 0;
+}
+
+
+/**
+ * virTypedParamListAdd:
+ * @list: list of typed parameters
+ * @name: name of the new parameter
+ * @type: type of the new parameter
+ * @...: value of the new parameter
+ *
+ * Append a parameter to @list. The value is passed as with
+ * virTypedParameterAssign, except that strings are copied, as done by
+ * virTypedParamsAddString. Duplicate names are rejected.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virTypedParamListAdd(virTypedParamListPtr list,
+                     const char *name,
+                     int type,
+                     ...)
+{
+    va_list ap;
+    size_t max = list->maxpar;
+    int ret;
+
+    if (virTypedParamListGet(list, name)) {
+        virReportError(VIR_ERR_INVALID_ARG,
+                       _("Parameter '%s' is already set"), name);
+        return -1;
+    }
+
+    if (VIR_RESIZE_N(list->par, max, list->npar, 1) < 0)
+        return -1;
+    list->maxpar = max;
+
+    va_start(ap, type);
+    ret = virTypedParameterAssignArgs(list->par + list->npar,
+                                      name, type, ap, true);
+    va_end(ap);
+    if (ret < 0)
+        return -1;
+
+    list->npar++;
+    return 0;
+}
+
+
+/**
+ * virTypedParamListSteal:
+ * @list: list of typed parameters
+ * @par: where to store the array of parameters
+ * @npar: where to store the number of parameters
+ *
+ * Transfer the parameters to the caller, leaving @list empty.
+ */
+void
+virTypedParamListSteal(virTypedParamListPtr list,
+                       virTypedParameterPtr *par,
+                       int *npar)
+{
+    *par = list->par;
+    *npar = list->npar;
+    list->par = NULL;
+    list->npar = 0;
+    list->maxpar = 0;
+    virTypedParamListClear(list);
+}
+
+
+/**
+ * virTypedParamListClear:
+ * @list: list of typed parameters
+ *
+ * Free the parameters of @list along with its index.
+ */
+void
+virTypedParamListClear(virTypedParamListPtr list)
+{
+    virTypedParamsFree(list->par, list->npar);
+    VIR_FREE(list->index);
+    memset(list, 0, sizeof(*list));
+}
+
+
 /* The following APIs are public and their signature may never change. */
 
 /**
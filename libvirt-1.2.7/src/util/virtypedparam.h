@@ -56,6 +56,45 @@ int virTypedParamsCopy(virTypedParameterPtr *dst,
 
 char *virTypedParameterToString(virTypedParameterPtr param);
 
+/*
+ * A growable list of typed parameters. The par, npar and maxpar
+ * members may be handed to the virTypedParamsAdd* APIs directly;
+ * entries added that way are picked up on the next lookup.
+ */
+typedef struct _virTypedParamList virTypedParamList;
+typedef virTypedParamList *virTypedParamListPtr;
+struct _virTypedParamList {
+    virTypedParameterPtr par;
+    int npar;
+    int maxpar;
+
+    /* Open addressing table of positions in par plus one, keyed by
+     * field name; zero marks an empty slot */
+    size_t *index;
+    size_t nindex;
+    int nindexed;
+    uint32_t seed;
+};
+
+virTypedParameterPtr virTypedParamListGet(virTypedParamListPtr list,
+                                          const char *name);
+
+int virTypedParamListReserve(virTypedParamListPtr list,
+                             size_t count)
+    ATTRIBUTE_RETURN_CHECK;
+
+int virTypedParamListAdd(virTypedParamListPtr list,
+                         const char *name,
+                         int type,
+                         /* TYPE arg */ ...)
+    ATTRIBUTE_RETURN_CHECK;
+
+void virTypedParamListSteal(virTypedParamListPtr list,
+                            virTypedParameterPtr *par,
+                            int *npar);
+
+void virTypedParamListClear(virTypedParamListPtr list);
+
 VIR_ENUM_DECL(virTypedParameter)
 
 # define VIR_TYPED_PARAMS_DEBUG(params, nparams)                            \
@@ -39,6 +39,7 @@
 #include "virutil.h"
 #include "virerror.h"
 #include "virfile.h"
+#include "virhash.h"
 #include "virstring.h"
 
 #define USB_SYSFS "/sys/bus/usb"
@@ -66,6 +67,7 @@ struct _virUSBDeviceList {
     virObjectLockable parent;
     size_t count;
     virUSBDevicePtr *devs;
+    virHashTablePtr index; /* dev->name -> dev, not owning */
 };
 
 typedef enum {
@@ -446,6 +448,11 @@ virUSBDeviceListNew(void)
     if (!(list = virObjectLockableNew(virUSBDeviceListClass)))
         return NULL;
 
+    if (!(list->index = virHashCreate(32, NULL))) {
+        virObjectUnref(list);
+        return NULL;
+    }
+
     return list;
 }
 
@@ -459,6 +466,7 @@ virUSBDeviceListDispose(void *obj)
         virUSBDeviceFree(list->devs[i]);
 
     VIR_FREE(list->devs);
+    virHashFree(list->index);
 }
 
 int
@@ -471,7 +479,13 @@ virUSBDeviceListAdd(virUSBDeviceListPtr list,
                        dev->name);
         return -1;
     }
-    return VIR_APPEND_ELEMENT(list->devs, list->count, dev);
+    if (virHashAddEntry(list->index, dev->name, dev) < 0)
+        return -1;
+    if (VIR_APPEND_ELEMENT(list->devs, list->count, dev) < 0) {
+        virHashSteal(list->index, dev->name);
+        return -1;
+    }
+    return 0;
 }
 
 virUSBDevicePtr
@@ -495,17 +509,20 @@ virUSBDevicePtr
 virUSBDeviceListSteal(virUSBDeviceListPtr list,
                       virUSBDevicePtr dev)
 {
-    virUSBDevicePtr ret = NULL;
+    virUSBDevicePtr ret;
     size_t i;
 
+    if (!(ret = virHashLookup(list->index, dev->name)))
+        return NULL;
+
     for (i = 0; i < list->count; i++) {
-        if (list->devs[i]->bus == dev->bus &&
-            list->devs[i]->dev == dev->dev) {
-            ret = list->devs[i];
+        if (list->devs[i] == ret) {
             VIR_DELETE_ELEMENT(list->devs, i, list->count);
             break;
         }
     }
+    virHashSteal(list->index, ret->name);
+
     return ret;
 }
 
@@ -521,13 +538,5 @@ virUSBDevicePtr
 virUSBDeviceListFind(virUSBDeviceListPtr list,
                      virUSBDevicePtr dev)
 {
-    size_t i;
-
-    for (i = 0; i < list->count; i++) {
-        if (list->devs[i]->bus == dev->bus &&
-            list->devs[i]->dev == dev->dev)
-            return list->devs[i];
-    }
-
-    return NULL;
+    return virHashLookup(list->index, dev->name);
 }
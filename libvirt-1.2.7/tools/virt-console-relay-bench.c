@@ -0,0 +1,446 @@
+/*
+ * virt-console-relay-bench.c: measure console relay throughput
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Pushes data from one pty pair to another the way the LXC controller
+ * relays a container console to its host side, and prints the
+ * throughput of each way of moving it: through a 1 KiB buffer as the
+ * controller used to, through a 64 KiB one as it does now, and with
+ * splice() through a pipe where the kernel supports it on ptys.  A
+ * writer thread plays the container and a reader thread the client
+ * attached to the host side.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+
+#include "internal.h"
+#include "virerror.h"
+#include "viralloc.h"
+#include "virfile.h"
+#include "virstring.h"
+#include "virthread.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define RELAY_CHUNK (64 * 1024)
+
+typedef enum {
+    RELAY_MODE_COPY_SMALL,
+    RELAY_MODE_COPY_LARGE,
+    RELAY_MODE_SPLICE,
+
+    RELAY_MODE_LAST
+} relayMode;
+
+static const char *relayModeNames[RELAY_MODE_LAST] = {
+    "copy-1k", "copy-64k", "splice",
+};
+
+typedef struct {
+    int fd;
+    unsigned long long len;
+    int err;
+} relayEnd;
+
+static void
+show_help(FILE *out, const char *argv0)
+{
+    fprintf(out,
+            "\n"
+            "syntax: %s [OPTIONS]\n"
+            "\n"
+            " Options:\n"
+            "   -h, --help          Display command line help\n"
+            "   -s, --size=MIB      MiB relayed in each mode (64)\n"
+            "   -m, --mode=MODE     Only run copy-1k, copy-64k or splice\n"
+            "\n",
+            argv0);
+}
+
+static const struct option argOptions[] = {
+    { "help", 0, NULL, 'h', },
+    { "size", 1, NULL, 's', },
+    { "mode", 1, NULL, 'm', },
+    { NULL, 0, NULL, '\0', }
+};
+
+static int
+open_pty(int *master, int *slave)
+{
+    struct termios tio;
+    char *name;
+
+    *slave = -1;
+    if ((*master = posix_openpt(O_RDWR | O_NOCTTY)) < 0 ||
+        grantpt(*master) < 0 ||
+        unlockpt(*master) < 0 ||
+        !(name = ptsname(*master)) ||
+        (*slave = open(name, O_RDWR | O_NOCTTY)) < 0 ||
+        tcgetattr(*slave, &tio) < 0)
+        goto error;
+
+    cfmakeraw(&tio);
+    if (tcsetattr(*slave, TCSANOW, &tio) < 0)
+        goto error;
+
+    return 0;
+
+ error:
+    perror("pty");
+    VIR_FORCE_CLOSE(*master);
+    VIR_FORCE_CLOSE(*slave);
+    return -1;
+}
+
+/* The container writing to its console */
+static void
+produce(void *opaque)
+{
+    relayEnd *end = opaque;
+    char buf[RELAY_CHUNK];
+    unsigned long long done = 0;
+
+    memset(buf, 'x', sizeof(buf));
+    while (done < end->len) {
+        size_t want = MIN(sizeof(buf), end->len - done);
+        ssize_t got = write(end->fd, buf, want);
+
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            end->err = errno;
+            return;
+        }
+        done += got;
+    }
+}
+
+/* The client attached to the host side of the console */
+static void
+consume(void *opaque)
+{
+    relayEnd *end = opaque;
+    char buf[RELAY_CHUNK];
+    unsigned long long done = 0;
+
+    while (done < end->len) {
+        ssize_t got = read(end->fd, buf, sizeof(buf));
+
+        if (got <= 0) {
+            if (got < 0 && errno == EINTR)
+                continue;
+            end->err = got < 0 ? errno : EPIPE;
+            return;
+        }
+        done += got;
+    }
+}
+
+static int
+wait_fd(int fd, short events)
+{
+    struct pollfd pfd = { .fd = fd, .events = events };
+
+    while (poll(&pfd, 1, -1) < 0) {
+        if (errno != EINTR)
+            return -1;
+    }
+    return 0;
+}
+
+/* Moves @len bytes from @in to @out through a buffer of @size bytes,
+ * waiting for each end to become ready as an event loop would */
+static int
+relay_copy(int in, int out, unsigned long long len, size_t size)
+{
+    char *buf = NULL;
+    unsigned long long done = 0;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(buf, size) < 0)
+        return -1;
+
+    while (done < len) {
+        ssize_t got, put = 0;
+
+        if (wait_fd(in, POLLIN) < 0)
+            goto cleanup;
+        if ((got = read(in, buf, size)) < 0) {
+            if (errno == EAGAIN || errno == EINTR)
+                continue;
+            goto cleanup;
+        }
+
+        while (put < got) {
+            ssize_t n = write(out, buf + put, got - put);
+
+            if (n < 0) {
+                if (errno == EAGAIN) {
+                    if (wait_fd(out, POLLOUT) < 0)
+                        goto cleanup;
+                    continue;
+                }
+                if (errno == EINTR)
+                    continue;
+                goto cleanup;
+            }
+            put += n;
+        }
+        done += got;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FREE(buf);
+    return ret;
+}
+
+/* Same, but through a pipe with splice().  Returns -2 if the kernel
+ * cannot splice to or from a pty */
+static int
+relay_splice(int in, int out, unsigned long long len)
+{
+    int pipefd[2] = { -1, -1 };
+    unsigned long long done = 0;
+    int ret = -1;
+
+    if (pipe2(pipefd, O_NONBLOCK) < 0)
+        return -1;
+
+    while (done < len) {
+        ssize_t got, put = 0;
+
+        if (wait_fd(in, POLLIN) < 0)
+            goto cleanup;
+        got = splice(in, NULL, pipefd[1], NULL, RELAY_CHUNK,
+                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (got < 0) {
+            if (errno == EAGAIN || errno == EINTR)
+                continue;
+            if (errno == EINVAL)
+                ret = -2;
+            goto cleanup;
+        }
+
+        while (put < got) {
+            ssize_t n = splice(pipefd[0], NULL, out, NULL, got - put,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+            if (n < 0) {
+                if (errno == EAGAIN) {
+                    if (wait_fd(out, POLLOUT) < 0)
+                        goto cleanup;
+                    continue;
+                }
+                if (errno == EINTR)
+                    continue;
+                if (errno == EINVAL)
+                    ret = -2;
+                goto cleanup;
+            }
+            put += n;
+        }
+        done += got;
+    }
+
+    ret = 0;
+ cleanup:
+    VIR_FORCE_CLOSE(pipefd[0]);
+    VIR_FORCE_CLOSE(pipefd[1]);
+    return ret;
+}
+
+/* Returns the time taken in microseconds, -1 on error or -2 if the
+ * mode is not supported */
+static long long
+run_mode(relayMode mode, unsigned long long len)
+{
+    int contMaster = -1, contSlave = -1;
+    int hostMaster = -1, hostSlave = -1;
+    relayEnd writer = { .len = len };
+    relayEnd reader = { .len = len };
+    virThread producer, consumer;
+    bool haveProducer = false, haveConsumer = false;
+    unsigned long long start, end;
+    long long ret = -1;
+    int rc;
+
+    if (open_pty(&contMaster, &contSlave) < 0 ||
+        open_pty(&hostMaster, &hostSlave) < 0)
+        goto cleanup;
+
+    if (virSetNonBlock(contMaster) < 0 ||
+        virSetNonBlock(hostMaster) < 0) {
+        perror("O_NONBLOCK");
+        goto cleanup;
+    }
+
+    writer.fd = contSlave;
+    reader.fd = hostSlave;
+
+    if (virTimeMonotonicMicrosNowRaw(&start) < 0)
+        goto cleanup;
+
+    if (virThreadCreate(&consumer, true, consume, &reader) < 0)
+        goto cleanup;
+    haveConsumer = true;
+    if (virThreadCreate(&producer, true, produce, &writer) < 0)
+        goto cleanup;
+    haveProducer = true;
+
+    switch (mode) {
+    case RELAY_MODE_COPY_SMALL:
+        rc = relay_copy(contMaster, hostMaster, len, 1024);
+        break;
+    case RELAY_MODE_COPY_LARGE:
+        rc = relay_copy(contMaster, hostMaster, len, RELAY_CHUNK);
+        break;
+    case RELAY_MODE_SPLICE:
+    default:
+        rc = relay_splice(contMaster, hostMaster, len);
+        break;
+    }
+
+    if (rc < 0) {
+        if (rc == -2)
+            ret = -2;
+        else
+            perror(relayModeNames[mode]);
+        goto cleanup;
+    }
+
+    virThreadJoin(&producer);
+    haveProducer = false;
+    virThreadJoin(&consumer);
+    haveConsumer = false;
+
+    if (virTimeMonotonicMicrosNowRaw(&end) < 0)
+        goto cleanup;
+
+    if (writer.err || reader.err) {
+        char ebuf[1024];
+
+        fprintf(stderr, "%s: %s\n", relayModeNames[mode],
+                virStrerror(writer.err ? writer.err : reader.err,
+                            ebuf, sizeof(ebuf)));
+        goto cleanup;
+    }
+
+    ret = end - start;
+
+ cleanup:
+    /* Closing the masters hangs up the slaves, which gets the threads
+     * out of a blocked read or write if the relay gave up early */
+    VIR_FORCE_CLOSE(contMaster);
+    VIR_FORCE_CLOSE(hostMaster);
+    if (haveProducer)
+        virThreadJoin(&producer);
+    if (haveConsumer)
+        virThreadJoin(&consumer);
+    VIR_FORCE_CLOSE(contSlave);
+    VIR_FORCE_CLOSE(hostSlave);
+    return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+    unsigned int size = 64;
+    unsigned long long len;
+    int only = -1;
+    int ret = EXIT_FAILURE;
+    int c;
+    size_t i;
+
+    while ((c = getopt_long(argc, argv, "hs:m:", argOptions, NULL)) != -1) {
+        switch (c) {
+        case 'h':
+            show_help(stdout, argv[0]);
+            return EXIT_SUCCESS;
+
+        case 's':
+            if (virStrToLong_ui(optarg, NULL, 10, &size) < 0 || !size) {
+                fprintf(stderr, "%s: invalid size '%s'\n", argv[0], optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'm':
+            for (i = 0; i < RELAY_MODE_LAST; i++) {
+                if (STREQ(optarg, relayModeNames[i]))
+                    break;
+            }
+            if (i == RELAY_MODE_LAST) {
+                fprintf(stderr, "%s: unknown mode '%s'\n", argv[0], optarg);
+                return EXIT_FAILURE;
+            }
+            only = i;
+            break;
+
+        case '?':
+        default:
+            show_help(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc) {
+        show_help(stderr, argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (virInitialize() < 0) {
+        fprintf(stderr, "%s: failed to initialize libvirt\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    len = (unsigned long long) size * 1024 * 1024;
+
+    printf("%-10s %12s %12s\n", "mode", "ms", "MiB/s");
+    for (i = 0; i < RELAY_MODE_LAST; i++) {
+        long long us;
+
+        if (only >= 0 && i != (size_t) only)
+            continue;
+
+        if ((us = run_mode(i, len)) == -2) {
+            printf("%-10s %12s %12s\n", relayModeNames[i],
+                   "-", "unsupported");
+            continue;
+        }
+        if (us < 0)
+            goto cleanup;
+
+        printf("%-10s %12lld %12.1f\n", relayModeNames[i], us / 1000,
+               us ? (double) size * 1e6 / us : 0.0);
+    }
+
+    ret = EXIT_SUCCESS;
+
+ cleanup:
+    return ret;
+}
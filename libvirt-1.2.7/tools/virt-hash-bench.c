@@ -0,0 +1,263 @@
+/*
+ * virt-hash-bench.c: time the basic operations of virHashTable
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Fills a string keyed table from a small initial size, the way the
+ * drivers' object lists grow, then looks every key up, looks up as
+ * many keys that are not there, walks the table with virHashForEach
+ * and removes every entry again.  Prints the average cost of each
+ * operation for tables of 1K, 10K, 100K and 1M entries, or of the
+ * sizes given on the command line.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "internal.h"
+#include "virerror.h"
+#include "viralloc.h"
+#include "virhash.h"
+#include "virstring.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+static const unsigned int defaultSizes[] = { 1000, 10000, 100000, 1000000 };
+
+static void
+show_help(FILE *out, const char *argv0)
+{
+    fprintf(out,
+            "\n"
+            "syntax: %s [OPTIONS] [ENTRIES...]\n"
+            "\n"
+            " Options:\n"
+            "   -h, --help          Display command line help\n"
+            "   -r, --rounds=N      Repeat each size N times (1)\n"
+            "\n",
+            argv0);
+}
+
+static const struct option argOptions[] = {
+    { "help", 0, NULL, 'h', },
+    { "rounds", 1, NULL, 'r', },
+    { NULL, 0, NULL, '\0', }
+};
+
+static void
+report_error(const char *what)
+{
+    virErrorPtr err = virGetLastError();
+
+    fprintf(stderr, "%s: %s\n", what,
+            err && err->message ? err->message : "unknown error");
+}
+
+static void
+count_entry(void *payload ATTRIBUTE_UNUSED,
+            const void *name ATTRIBUTE_UNUSED,
+            void *data)
+{
+    size_t *count = data;
+
+    (*count)++;
+}
+
+/* Average nanoseconds per operation */
+static double
+per_op(unsigned long long start, unsigned long long end, unsigned int n)
+{
+    return (double) (end - start) * 1000 / n;
+}
+
+static int
+run_size(unsigned int n)
+{
+    virHashTablePtr table = NULL;
+    char **keys = NULL;
+    char **missing = NULL;
+    unsigned long long t0, t1, t2, t3, t4, t5;
+    size_t count = 0;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(keys, n) < 0 ||
+        VIR_ALLOC_N(missing, n) < 0)
+        goto error;
+
+    for (i = 0; i < n; i++) {
+        if (virAsprintf(&keys[i], "domain-%08zu", i) < 0 ||
+            virAsprintf(&missing[i], "absent-%08zu", i) < 0)
+            goto error;
+    }
+
+    if (!(table = virHashCreate(32, NULL)))
+        goto error;
+
+    if (virTimeMonotonicMicrosNowRaw(&t0) < 0)
+        goto cleanup;
+
+    for (i = 0; i < n; i++) {
+        if (virHashAddEntry(table, keys[i], keys[i]) < 0)
+            goto error;
+    }
+
+    if (virTimeMonotonicMicrosNowRaw(&t1) < 0)
+        goto cleanup;
+
+    for (i = 0; i < n; i++) {
+        if (virHashLookup(table, keys[i]) != keys[i]) {
+            fprintf(stderr, "lookup of '%s' failed\n", keys[i]);
+            goto cleanup;
+        }
+    }
+
+    if (virTimeMonotonicMicrosNowRaw(&t2) < 0)
+        goto cleanup;
+
+    for (i = 0; i < n; i++) {
+        if (virHashLookup(table, missing[i])) {
+            fprintf(stderr, "lookup of '%s' succeeded\n", missing[i]);
+            goto cleanup;
+        }
+    }
+
+    if (virTimeMonotonicMicrosNowRaw(&t3) < 0)
+        goto cleanup;
+
+    if (virHashForEach(table, count_entry, &count) < 0)
+        goto error;
+
+    if (virTimeMonotonicMicrosNowRaw(&t4) < 0)
+        goto cleanup;
+
+    if (count != n) {
+        fprintf(stderr, "iterated over %zu of %u entries\n", count, n);
+        goto cleanup;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (virHashRemoveEntry(table, keys[i]) < 0)
+            goto error;
+    }
+
+    if (virTimeMonotonicMicrosNowRaw(&t5) < 0)
+        goto cleanup;
+
+    if (virHashSize(table) != 0) {
+        fprintf(stderr, "%zd entries left after removal\n",
+                virHashSize(table));
+        goto cleanup;
+    }
+
+    printf("%-10u %10.1f %10.1f %10.1f %10.1f %10.1f\n", n,
+           per_op(t0, t1, n), per_op(t1, t2, n), per_op(t2, t3, n),
+           per_op(t3, t4, n), per_op(t4, t5, n));
+
+    ret = 0;
+
+ cleanup:
+    virHashFree(table);
+    for (i = 0; keys && i < n; i++)
+        VIR_FREE(keys[i]);
+    for (i = 0; missing && i < n; i++)
+        VIR_FREE(missing[i]);
+    VIR_FREE(keys);
+    VIR_FREE(missing);
+    return ret;
+
+ error:
+    report_error("hash");
+    goto cleanup;
+}
+
+int
+main(int argc, char **argv)
+{
+    unsigned int *sizes = NULL;
+    size_t nsizes;
+    unsigned int rounds = 1;
+    unsigned int r;
+    int ret = EXIT_FAILURE;
+    int c;
+    size_t i;
+
+    while ((c = getopt_long(argc, argv, "hr:", argOptions, NULL)) != -1) {
+        switch (c) {
+        case 'h':
+            show_help(stdout, argv[0]);
+            return EXIT_SUCCESS;
+
+        case 'r':
+            if (virStrToLong_ui(optarg, NULL, 10, &rounds) < 0 || !rounds) {
+                fprintf(stderr, "%s: invalid number of rounds '%s'\n",
+                        argv[0], optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case '?':
+        default:
+            show_help(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (virInitialize() < 0) {
+        fprintf(stderr, "%s: failed to initialize libvirt\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    nsizes = optind < argc ? (size_t) (argc - optind)
+                           : ARRAY_CARDINALITY(defaultSizes);
+    if (VIR_ALLOC_N(sizes, nsizes) < 0) {
+        report_error("allocation");
+        goto cleanup;
+    }
+
+    for (i = 0; i < nsizes; i++) {
+        if (optind == argc) {
+            sizes[i] = defaultSizes[i];
+        } else if (virStrToLong_ui(argv[optind + i], NULL, 10,
+                                   &sizes[i]) < 0 || !sizes[i]) {
+            fprintf(stderr, "%s: invalid number of entries '%s'\n",
+                    argv[0], argv[optind + i]);
+            goto cleanup;
+        }
+    }
+
+    printf("%-10s %10s %10s %10s %10s %10s\n", "entries",
+           "insert", "lookup", "miss", "iterate", "remove");
+    printf("%-10s %10s %10s %10s %10s %10s\n", "",
+           "ns/op", "ns/op", "ns/op", "ns/entry", "ns/op");
+    for (i = 0; i < nsizes; i++) {
+        for (r = 0; r < rounds; r++) {
+            if (run_size(sizes[i]) < 0)
+                goto cleanup;
+        }
+    }
+
+    ret = EXIT_SUCCESS;
+
+ cleanup:
+    VIR_FREE(sizes);
+    return ret;
+}
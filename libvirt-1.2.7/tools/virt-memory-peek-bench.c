@@ -0,0 +1,221 @@
+/*
+ * virt-memory-peek-bench.c: measure the latency of virDomainMemoryPeek
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Peeks the same range of a running domain's memory over and over,
+ * the way introspection tools poll small structures, and prints the
+ * latency distribution of the calls.  Run it once against a daemon
+ * reading the range back through a temporary file and once against
+ * one streaming it through a FIFO to compare the two.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "internal.h"
+#include "virerror.h"
+#include "viralloc.h"
+#include "virstring.h"
+#include "virtime.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+/* The most virDomainMemoryPeek hands out in one call */
+#define PEEK_MAX_SIZE (64 * 1024)
+
+static void
+show_help(FILE *out, const char *argv0)
+{
+    fprintf(out,
+            "\n"
+            "syntax: %s [OPTIONS] DOMAIN\n"
+            "\n"
+            " Options:\n"
+            "   -h, --help            Display command line help\n"
+            "   -c, --connect=URI     Hypervisor connection URI\n"
+            "   -n, --iterations=N    Number of peeks (1000)\n"
+            "   -s, --size=BYTES      Bytes read by each peek (1024)\n"
+            "   -a, --address=ADDR    Start of the range (0)\n"
+            "   -p, --physical        ADDR is a physical address\n"
+            "\n",
+            argv0);
+}
+
+static const struct option argOptions[] = {
+    { "help", 0, NULL, 'h', },
+    { "connect", 1, NULL, 'c', },
+    { "iterations", 1, NULL, 'n', },
+    { "size", 1, NULL, 's', },
+    { "address", 1, NULL, 'a', },
+    { "physical", 0, NULL, 'p', },
+    { NULL, 0, NULL, '\0', }
+};
+
+static void
+report_error(const char *what)
+{
+    virErrorPtr err = virGetLastError();
+
+    fprintf(stderr, "%s: %s\n", what,
+            err && err->message ? err->message : "unknown error");
+}
+
+static int
+compare_ull(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+int
+main(int argc, char **argv)
+{
+    virConnectPtr conn = NULL;
+    virDomainPtr dom = NULL;
+    const char *uri = NULL;
+    unsigned long long *lat = NULL;
+    unsigned long long start, end;
+    unsigned long long total = 0;
+    unsigned long long addr = 0;
+    unsigned int iterations = 1000;
+    unsigned int size = 1024;
+    unsigned int flags = VIR_MEMORY_VIRTUAL;
+    unsigned int i;
+    char *buf = NULL;
+    int ret = EXIT_FAILURE;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "hc:n:s:a:p",
+                            argOptions, NULL)) != -1) {
+        switch (c) {
+        case 'h':
+            show_help(stdout, argv[0]);
+            return EXIT_SUCCESS;
+
+        case 'c':
+            uri = optarg;
+            break;
+
+        case 'n':
+            if (virStrToLong_ui(optarg, NULL, 10, &iterations) < 0 ||
+                !iterations) {
+                fprintf(stderr, "%s: invalid number of iterations '%s'\n",
+                        argv[0], optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 's':
+            if (virStrToLong_ui(optarg, NULL, 10, &size) < 0 ||
+                !size || size > PEEK_MAX_SIZE) {
+                fprintf(stderr, "%s: size '%s' must be between 1 and %d\n",
+                        argv[0], optarg, PEEK_MAX_SIZE);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'a':
+            if (virStrToLong_ull(optarg, NULL, 0, &addr) < 0) {
+                fprintf(stderr, "%s: invalid address '%s'\n",
+                        argv[0], optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'p':
+            flags = VIR_MEMORY_PHYSICAL;
+            break;
+
+        case '?':
+        default:
+            show_help(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc - 1) {
+        show_help(stderr, argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (virInitialize() < 0) {
+        fprintf(stderr, "%s: failed to initialize libvirt\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (VIR_ALLOC_N(lat, iterations) < 0 ||
+        VIR_ALLOC_N(buf, size) < 0) {
+        report_error("allocation");
+        goto cleanup;
+    }
+
+    if (!(conn = virConnectOpen(uri))) {
+        report_error("connect");
+        goto cleanup;
+    }
+
+    if (!(dom = virDomainLookupByName(conn, argv[optind]))) {
+        report_error(argv[optind]);
+        goto cleanup;
+    }
+
+    for (i = 0; i < iterations; i++) {
+        if (virTimeMonotonicMicrosNowRaw(&start) < 0)
+            goto cleanup;
+
+        if (virDomainMemoryPeek(dom, addr, size, buf, flags) < 0) {
+            report_error("peek");
+            goto cleanup;
+        }
+
+        if (virTimeMonotonicMicrosNowRaw(&end) < 0)
+            goto cleanup;
+
+        lat[i] = end - start;
+        total += lat[i];
+    }
+
+    qsort(lat, iterations, sizeof(*lat), compare_ull);
+
+    printf("%u peeks of %u bytes at 0x%llx\n", iterations, size, addr);
+    printf("%-8s %12s\n", "", "us");
+    printf("%-8s %12llu\n", "min", lat[0]);
+    printf("%-8s %12llu\n", "avg", total / iterations);
+    printf("%-8s %12llu\n", "p50", lat[iterations / 2]);
+    printf("%-8s %12llu\n", "p99", lat[(iterations - 1) * 99 / 100]);
+    printf("%-8s %12llu\n", "max", lat[iterations - 1]);
+    printf("%.0f peeks/s, %.2f MiB/s\n",
+           total ? iterations * 1e6 / total : 0.0,
+           total ? (double) iterations * size / total * 1e6 / 1048576 : 0.0);
+
+    ret = EXIT_SUCCESS;
+
+ cleanup:
+    if (dom)
+        virDomainFree(dom);
+    if (conn)
+        virConnectClose(conn);
+    VIR_FREE(lat);
+    VIR_FREE(buf);
+    return ret;
+}
@@ -0,0 +1,205 @@
+/*
+ * virt-pci-reset-bench.c: time PCI device resets, serial vs parallel
+ *
+ * Copyright (C) 2014 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ * Resets the given devices the way virHostdevPreparePCIDevices used
+ * to, one virPCIDeviceReset after the other, and the way it does now,
+ * through virPCIDeviceListReset, and prints how long each took.  The
+ * devices must not be in use by the host, e.g. be bound to pci-stub;
+ * running it on a device driving the host's disk or network is a
+ * good way to lose either.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "internal.h"
+#include "virerror.h"
+#include "virpci.h"
+#include "virstring.h"
+#include "virtime.h"
+
+static void
+show_help(FILE *out, const char *argv0)
+{
+    fprintf(out,
+            "\n"
+            "syntax: %s [OPTIONS] DOMAIN:BUS:SLOT.FUNCTION...\n"
+            "\n"
+            " Options:\n"
+            "   -h, --help        Display command line help\n"
+            "   -r, --rounds=N    Reset the devices N times each way (1)\n"
+            "\n",
+            argv0);
+}
+
+static const struct option argOptions[] = {
+    { "help", 0, NULL, 'h', },
+    { "rounds", 1, NULL, 'r', },
+    { NULL, 0, NULL, '\0', }
+};
+
+static void
+report_error(const char *what)
+{
+    virErrorPtr err = virGetLastError();
+
+    fprintf(stderr, "%s: %s\n", what,
+            err && err->message ? err->message : "unknown error");
+}
+
+/* Returns the duration in milliseconds, or -1 on error */
+static long long
+reset_serial(virPCIDeviceListPtr devs,
+             virPCIDeviceListPtr active,
+             virPCIDeviceListPtr inactive)
+{
+    unsigned long long start, end;
+    size_t i;
+
+    if (virTimeMillisNow(&start) < 0)
+        return -1;
+
+    for (i = 0; i < virPCIDeviceListCount(devs); i++) {
+        if (virPCIDeviceReset(virPCIDeviceListGet(devs, i),
+                              active, inactive) < 0) {
+            report_error("serial reset");
+            return -1;
+        }
+    }
+
+    if (virTimeMillisNow(&end) < 0)
+        return -1;
+    return end - start;
+}
+
+static long long
+reset_parallel(virPCIDeviceListPtr devs,
+               virPCIDeviceListPtr active,
+               virPCIDeviceListPtr inactive)
+{
+    unsigned long long start, end;
+
+    if (virTimeMillisNow(&start) < 0)
+        return -1;
+
+    if (virPCIDeviceListReset(devs, active, inactive, false) < 0) {
+        report_error("parallel reset");
+        return -1;
+    }
+
+    if (virTimeMillisNow(&end) < 0)
+        return -1;
+    return end - start;
+}
+
+int
+main(int argc, char **argv)
+{
+    virPCIDeviceListPtr devs = NULL;
+    virPCIDeviceListPtr active = NULL;
+    virPCIDeviceListPtr inactive = NULL;
+    unsigned int rounds = 1;
+    unsigned int r;
+    int ret = EXIT_FAILURE;
+    int c;
+    int i;
+
+    while ((c = getopt_long(argc, argv, "hr:", argOptions, NULL)) != -1) {
+        switch (c) {
+        case 'h':
+            show_help(stdout, argv[0]);
+            return EXIT_SUCCESS;
+
+        case 'r':
+            if (virStrToLong_ui(optarg, NULL, 10, &rounds) < 0 || !rounds) {
+                fprintf(stderr, "%s: invalid number of rounds '%s'\n",
+                        argv[0], optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case '?':
+        default:
+            show_help(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind == argc) {
+        show_help(stderr, argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (virInitialize() < 0) {
+        fprintf(stderr, "%s: failed to initialize libvirt\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!(devs = virPCIDeviceListNew()) ||
+        !(active = virPCIDeviceListNew()) ||
+        !(inactive = virPCIDeviceListNew())) {
+        report_error("device list");
+        goto cleanup;
+    }
+
+    for (i = optind; i < argc; i++) {
+        virPCIDeviceAddress addr;
+        virPCIDevicePtr dev;
+
+        if (virPCIDeviceAddressParse(argv[i], &addr) < 0) {
+            fprintf(stderr, "%s: invalid PCI address '%s'\n",
+                    argv[0], argv[i]);
+            goto cleanup;
+        }
+
+        if (!(dev = virPCIDeviceNew(addr.domain, addr.bus,
+                                    addr.slot, addr.function))) {
+            report_error(argv[i]);
+            goto cleanup;
+        }
+
+        if (virPCIDeviceListAdd(devs, dev) < 0) {
+            report_error(argv[i]);
+            virPCIDeviceFree(dev);
+            goto cleanup;
+        }
+    }
+
+    printf("%-8s %12s %12s\n", "round", "serial ms", "parallel ms");
+    for (r = 0; r < rounds; r++) {
+        long long serial, parallel;
+
+        if ((serial = reset_serial(devs, active, inactive)) < 0 ||
+            (parallel = reset_parallel(devs, active, inactive)) < 0)
+            goto cleanup;
+
+        printf("%-8u %12lld %12lld\n", r + 1, serial, parallel);
+    }
+
+    ret = EXIT_SUCCESS;
+
+ cleanup:
+    virObjectUnref(devs);
+    virObjectUnref(active);
+    virObjectUnref(inactive);
+    return ret;
+}